@@ -0,0 +1,184 @@
+/* cobs.c
+ * PPP over Any Transport -- COBS framing with CRC32C
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace.h"
+#include "cobs.h"
+#include "crc32c.h"
+#include "memory.h"
+#include "util.h"
+
+enum {
+	COBS_DELIM = 0x00,
+	/* Code of a full block, it isn't followed by an implicit zero */
+	COBS_CODE_MAX = 0xff,
+};
+
+struct cobs_enc {
+	unsigned char *ce_code;
+	unsigned char *ce_p;
+	unsigned int   ce_code_val;
+};
+
+int pppoat_cobs_init(struct pppoat_cobs *cb, size_t mru)
+{
+	memset(cb, 0, sizeof(*cb));
+	cb->cb_size = mru + PPPOAT_COBS_CRC_LEN;
+	cb->cb_buf  = pppoat_alloc(cb->cb_size);
+
+	return cb->cb_buf == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+void pppoat_cobs_fini(struct pppoat_cobs *cb)
+{
+	pppoat_free(cb->cb_buf);
+}
+
+static uint32_t cobs_get32le(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+static int cobs_frame_end(struct pppoat_cobs    *cb,
+			  pppoat_cobs_deliver_t  deliver,
+			  void                  *userdata)
+{
+	size_t len  = cb->cb_len;
+	bool   bad  = cb->cb_left != 0;
+	bool   skip = cb->cb_skip;
+
+	cb->cb_len  = 0;
+	cb->cb_code = 0;
+	cb->cb_left = 0;
+	cb->cb_skip = false;
+	/* Back-to-back delimiters are idle line, not frames */
+	if (skip || (len == 0 && !bad))
+		return 0;
+	if (bad || len <= PPPOAT_COBS_CRC_LEN ||
+	    pppoat_crc32c(0, cb->cb_buf, len - PPPOAT_COBS_CRC_LEN) !=
+	    cobs_get32le(cb->cb_buf + len - PPPOAT_COBS_CRC_LEN)) {
+		++cb->cb_bad_crc;
+		return 0;
+	}
+	++cb->cb_frames;
+	return deliver(userdata, cb->cb_buf, len - PPPOAT_COBS_CRC_LEN);
+}
+
+static bool cobs_append(struct pppoat_cobs  *cb,
+			const unsigned char *p,
+			size_t               len)
+{
+	if (cb->cb_size - cb->cb_len < len) {
+		++cb->cb_too_long;
+		cb->cb_skip = true;
+		return false;
+	}
+	memcpy(cb->cb_buf + cb->cb_len, p, len);
+	cb->cb_len += len;
+	return true;
+}
+
+int pppoat_cobs_decode(struct pppoat_cobs    *cb,
+		       const unsigned char   *buf,
+		       size_t                 len,
+		       pppoat_cobs_deliver_t  deliver,
+		       void                  *userdata)
+{
+	static const unsigned char zero = 0;
+	const unsigned char       *end  = buf + len;
+	const unsigned char       *delim;
+	size_t                     n;
+	int                        rc   = 0;
+
+	while (rc == 0 && buf < end) {
+		if (cb->cb_skip) {
+			delim = memchr(buf, COBS_DELIM, end - buf);
+			buf   = delim ?: end;
+			if (delim == NULL)
+				break;
+		}
+		if (*buf == COBS_DELIM) {
+			++buf;
+			rc = cobs_frame_end(cb, deliver, userdata);
+		} else if (cb->cb_left == 0) {
+			/* A short block is followed by a zero unless last */
+			if (cb->cb_code != 0 && cb->cb_code != COBS_CODE_MAX &&
+			    !cobs_append(cb, &zero, 1))
+				continue;
+			cb->cb_code = *buf++;
+			cb->cb_left = cb->cb_code - 1;
+		} else {
+			/* Block data is copied at once up to a delimiter */
+			n = pppoat_min(cb->cb_left, (size_t)(end - buf));
+			delim = memchr(buf, COBS_DELIM, n);
+			n = delim == NULL ? n : (size_t)(delim - buf);
+			if (!cobs_append(cb, buf, n))
+				continue;
+			buf         += n;
+			cb->cb_left -= n;
+		}
+	}
+	return rc;
+}
+
+static void cobs_put(struct cobs_enc *ce, const unsigned char *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		if (p[i] != COBS_DELIM) {
+			*ce->ce_p++ = p[i];
+			++ce->ce_code_val;
+		}
+		if (p[i] == COBS_DELIM || ce->ce_code_val == COBS_CODE_MAX) {
+			*ce->ce_code    = ce->ce_code_val;
+			ce->ce_code     = ce->ce_p++;
+			ce->ce_code_val = 1;
+		}
+	}
+}
+
+size_t pppoat_cobs_encode(const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *out)
+{
+	struct cobs_enc ce  = {
+		.ce_code     = out,
+		.ce_p        = out + 1,
+		.ce_code_val = 1,
+	};
+	unsigned char   crc[PPPOAT_COBS_CRC_LEN];
+	uint32_t        v;
+
+	v = pppoat_crc32c(0, frame, len);
+	crc[0] = v & 0xff;
+	crc[1] = (v >> 8) & 0xff;
+	crc[2] = (v >> 16) & 0xff;
+	crc[3] = v >> 24;
+	cobs_put(&ce, frame, len);
+	cobs_put(&ce, crc, sizeof(crc));
+	*ce.ce_code = ce.ce_code_val;
+	*ce.ce_p++  = COBS_DELIM;
+
+	return (size_t)(ce.ce_p - out);
+}
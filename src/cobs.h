@@ -0,0 +1,78 @@
+/* cobs.h
+ * PPP over Any Transport -- COBS framing with CRC32C
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_COBS_H__
+#define __PPPOAT_COBS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Consistent Overhead Byte Stuffing: a frame is split into blocks of up
+ * to 254 non-zero bytes, each led by a code byte, so zero only appears
+ * as the frame delimiter. Overhead is one byte per 254 bytes at most.
+ * Every frame ends with CRC32C of its data, little endian.
+ */
+
+#define PPPOAT_COBS_CRC_LEN 4
+/* Encoded frame: data with CRC, a code byte per block and the delimiter */
+#define PPPOAT_COBS_ENC_MAX(len) \
+	((len) + PPPOAT_COBS_CRC_LEN + ((len) + PPPOAT_COBS_CRC_LEN) / 254 + 2)
+
+typedef int (*pppoat_cobs_deliver_t)(void          *userdata,
+				     unsigned char *frame,
+				     size_t         len);
+
+struct pppoat_cobs {
+	unsigned char *cb_buf;
+	size_t         cb_len;
+	size_t         cb_size;
+	/* Code of the current block, 0 before the first one */
+	unsigned int   cb_code;
+	/* Data bytes left in the current block */
+	unsigned int   cb_left;
+	/* The frame is too long, skip it till the next delimiter */
+	bool           cb_skip;
+	/* Counters */
+	unsigned long  cb_frames;
+	unsigned long  cb_bad_crc;
+	unsigned long  cb_too_long;
+};
+
+int pppoat_cobs_init(struct pppoat_cobs *cb, size_t mru);
+void pppoat_cobs_fini(struct pppoat_cobs *cb);
+
+/*
+ * Decodes a chunk of the stream, frames may span chunks. Every complete
+ * frame with valid CRC is passed to deliver without the CRC.
+ */
+int pppoat_cobs_decode(struct pppoat_cobs    *cb,
+		       const unsigned char   *buf,
+		       size_t                 len,
+		       pppoat_cobs_deliver_t  deliver,
+		       void                  *userdata);
+/*
+ * Encodes a frame to out which must hold PPPOAT_COBS_ENC_MAX(len) bytes.
+ * Returns length of the encoded frame including the delimiter.
+ */
+size_t pppoat_cobs_encode(const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *out);
+
+#endif /* __PPPOAT_COBS_H__ */
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>	/* strtoul */
 #include <string.h>	/* strcmp */
 #include <unistd.h>	/* getopt */
 #ifdef HAVE_GETOPT_LONG
@@ -27,7 +28,7 @@
 #include "conf.h"
 #include "memory.h"
 
-#define CONF_KEYS_MAX 10
+#define CONF_KEYS_MAX 64
 
 int pppoat_conf_init(struct pppoat_conf *conf)
 {
@@ -68,7 +69,7 @@ int pppoat_conf_insert(struct pppoat_conf *conf, const char *key,
 int pppoat_conf_update(struct pppoat_conf *conf, const char *key,
 		       const char *obj)
 {
-	/* TODO implement replace */
+	pppoat_conf_remove(conf, key);
 	return pppoat_conf_insert(conf, key, obj);
 }
 
@@ -77,7 +78,8 @@ void pppoat_conf_remove(struct pppoat_conf *conf, const char *key)
 	int i;
 
 	for (i = 0; i < CONF_KEYS_MAX; ++i)
-		if (strcmp(key, conf->cfg_keys[i]) == 0) {
+		if (conf->cfg_keys[i] != NULL &&
+		    strcmp(key, conf->cfg_keys[i]) == 0) {
 			pppoat_free(conf->cfg_keys[i]);
 			pppoat_free(conf->cfg_vals[i]);
 			conf->cfg_keys[i] = NULL;
@@ -96,6 +98,27 @@ const char *pppoat_conf_get(const struct pppoat_conf *conf, const char *key)
 	return i < CONF_KEYS_MAX ? conf->cfg_vals[i] : NULL;
 }
 
+unsigned long pppoat_conf_get_ulong(const struct pppoat_conf *conf,
+				    const char               *key,
+				    unsigned long             def)
+{
+	const char    *obj = pppoat_conf_get(conf, key);
+	char          *end;
+	unsigned long  val;
+
+	if (obj == NULL)
+		return def;
+
+	errno = 0;
+	val = strtoul(obj, &end, 0);
+	if (errno != 0 || end == obj || *end != '\0') {
+		pppoat_error("conf", "Invalid number %s=%s, using %lu",
+			     key, obj, def);
+		val = def;
+	}
+	return val;
+}
+
 bool pppoat_conf_obj_is_true(const char *obj)
 {
 	return obj != NULL && (strcmp(obj, "true") == 0 ||
@@ -42,6 +42,9 @@ int pppoat_conf_update(struct pppoat_conf *conf, const char *key,
 		       const char *obj);
 void pppoat_conf_remove(struct pppoat_conf *conf, const char *key);
 const char *pppoat_conf_get(const struct pppoat_conf *conf, const char *key);
+unsigned long pppoat_conf_get_ulong(const struct pppoat_conf *conf,
+				    const char               *key,
+				    unsigned long             def);
 bool pppoat_conf_obj_is_true(const char *obj);
 
 /* interface for reading cfg file (ini) */
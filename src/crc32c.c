@@ -0,0 +1,133 @@
+/* crc32c.c
+ * PPP over Any Transport -- CRC32C (Castagnoli)
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "trace.h"
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78U
+
+typedef uint32_t (*crc32c_func_t)(uint32_t             crc,
+				  const unsigned char *p,
+				  size_t               len);
+
+static uint32_t crc32c_tbl[256];
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len-- > 0)
+		crc = (crc >> 8) ^ crc32c_tbl[(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t crc64 = crc;
+	uint64_t v;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&v, p, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = crc64;
+	while (len-- > 0)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+static bool crc32c_hw_present(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__)
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&v, p, 8);
+		crc = __crc32cd(crc, v);
+	}
+	while (len-- > 0)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+
+static bool crc32c_hw_present(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+#define crc32c_hw crc32c_sw
+
+static bool crc32c_hw_present(void)
+{
+	return false;
+}
+
+#endif
+
+static crc32c_func_t crc32c_select(void)
+{
+	unsigned int b;
+	unsigned int i;
+	uint32_t     v;
+
+	if (crc32c_hw_present())
+		return &crc32c_hw;
+	for (b = 0; b < 256; ++b) {
+		v = b;
+		for (i = 0; i < 8; ++i)
+			v = v & 1 ? (v >> 1) ^ CRC32C_POLY : v >> 1;
+		crc32c_tbl[b] = v;
+	}
+	return &crc32c_sw;
+}
+
+uint32_t pppoat_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	static crc32c_func_t func;
+	crc32c_func_t        f;
+
+	/* Every caller selects the same function, a race is harmless */
+	f = __atomic_load_n(&func, __ATOMIC_ACQUIRE);
+	if (f == NULL) {
+		f = crc32c_select();
+		__atomic_store_n(&func, f, __ATOMIC_RELEASE);
+	}
+	return ~f(~crc, buf, len);
+}
@@ -0,0 +1,34 @@
+/* crc32c.h
+ * PPP over Any Transport -- CRC32C (Castagnoli)
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_CRC32C_H__
+#define __PPPOAT_CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C as iSCSI and ext4 use it. The CRC instructions of SSE4.2 or
+ * ARMv8 compute it when the CPU has them, a table otherwise.
+ */
+
+/* Returns CRC32C of buf, pass the previous result as crc to continue. */
+uint32_t pppoat_crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif /* __PPPOAT_CRC32C_H__ */
@@ -0,0 +1,114 @@
+/* ether.c
+ * PPP over Any Transport -- Tunnel frames of Ethernet transports
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "ether.h"
+#include "log.h"
+
+int pppoat_ether_mac_parse(const char *str, unsigned char *mac)
+{
+	unsigned int b[ETH_ALEN];
+	int          i;
+	char         c;
+
+	if (sscanf(str, "%x:%x:%x:%x:%x:%x%c", &b[0], &b[1], &b[2], &b[3],
+		   &b[4], &b[5], &c) != ETH_ALEN)
+		return P_ERR(-EINVAL);
+	for (i = 0; i < ETH_ALEN; ++i) {
+		if (b[i] > 0xff)
+			return P_ERR(-EINVAL);
+		mac[i] = b[i];
+	}
+	return 0;
+}
+
+/* Packet and AF_XDP sockets don't take device ioctls, a datagram does. */
+int pppoat_ether_dev_query(const char    *dev,
+			   int           *ifindex,
+			   unsigned char *mac,
+			   unsigned int  *mtu)
+{
+	struct ifreq ifr;
+	int          sock;
+	int          rc;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return P_ERR(-errno);
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, dev);
+	rc = ioctl(sock, SIOCGIFINDEX, &ifr);
+	if (rc == 0) {
+		*ifindex = ifr.ifr_ifindex;
+		rc = ioctl(sock, SIOCGIFHWADDR, &ifr);
+	}
+	if (rc == 0) {
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+		rc = ioctl(sock, SIOCGIFMTU, &ifr);
+	}
+	if (rc == 0) {
+		*mtu = ifr.ifr_mtu;
+	} else {
+		pppoat_error("ether", "Can't query %s, errno=%d", dev, errno);
+		rc = P_ERR(-errno);
+	}
+	(void)close(sock);
+	return rc;
+}
+
+void pppoat_ether_hdr_put(unsigned char       *frame,
+			  const unsigned char *dst,
+			  const unsigned char *src,
+			  uint16_t             type,
+			  unsigned int         queue,
+			  size_t               len)
+{
+	memcpy(frame, dst, ETH_ALEN);
+	memcpy(frame + ETH_ALEN, src, ETH_ALEN);
+	frame[2 * ETH_ALEN]     = type >> 8;
+	frame[2 * ETH_ALEN + 1] = type & 0xff;
+	frame[ETH_HLEN]     = len >> 8;
+	frame[ETH_HLEN + 1] = len & 0xff;
+	frame[ETH_HLEN + 2] = queue;
+	frame[ETH_HLEN + 3] = 0;
+}
+
+ssize_t pppoat_ether_hdr_get(const unsigned char *frame,
+			     size_t               flen,
+			     unsigned int        *queue)
+{
+	size_t len;
+
+	if (flen < ETH_HLEN + PPPOAT_ETHER_HDR_LEN)
+		return -1;
+	len = (size_t)frame[ETH_HLEN] << 8 | frame[ETH_HLEN + 1];
+	if (len == 0 || len > flen - ETH_HLEN - PPPOAT_ETHER_HDR_LEN)
+		return -1;
+	*queue = frame[ETH_HLEN + 2];
+	return len;
+}
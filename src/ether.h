@@ -0,0 +1,61 @@
+/* ether.h
+ * PPP over Any Transport -- Tunnel frames of Ethernet transports
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_ETHER_H__
+#define __PPPOAT_ETHER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The eth and xdp modules send the same frames: Ethernet header with
+ * their own EtherType, then [16-bit length][queue][0] and a chunk of the
+ * interface stream. Short frames are padded on the wire, the length tells
+ * where the chunk ends.
+ */
+
+/* IEEE 802 local experimental EtherType */
+#define PPPOAT_ETHER_TYPE_DEFAULT 0x88b5
+#define PPPOAT_ETHER_HDR_LEN      4
+
+/* Parses MAC address in the xx:xx:xx:xx:xx:xx form. */
+int pppoat_ether_mac_parse(const char *str, unsigned char *mac);
+/* Finds index, MAC address and MTU of a network device. */
+int pppoat_ether_dev_query(const char    *dev,
+			   int           *ifindex,
+			   unsigned char *mac,
+			   unsigned int  *mtu);
+
+/* Fills headers in front of a chunk of len bytes. */
+void pppoat_ether_hdr_put(unsigned char       *frame,
+			  const unsigned char *dst,
+			  const unsigned char *src,
+			  uint16_t             type,
+			  unsigned int         queue,
+			  size_t               len);
+/*
+ * Returns length of the chunk in a frame of flen bytes and its queue, or
+ * -1 if the frame is malformed.
+ */
+ssize_t pppoat_ether_hdr_get(const unsigned char *frame,
+			     size_t               flen,
+			     unsigned int        *queue);
+
+#endif /* __PPPOAT_ETHER_H__ */
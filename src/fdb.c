@@ -0,0 +1,182 @@
+/* fdb.c
+ * PPP over Any Transport -- MAC learning table
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>	/* getpid */
+
+#include "trace.h"
+#include "fdb.h"
+#include "memory.h"
+#include "util.h"
+
+#define FDB_KEY_USED (1ULL << 63)
+#define FDB_SIZE_MIN 64
+
+static uint64_t fdb_key(const unsigned char *mac)
+{
+	return FDB_KEY_USED | (uint64_t)mac[0] << 40 | (uint64_t)mac[1] << 32 |
+	       (uint64_t)mac[2] << 24 | (uint64_t)mac[3] << 16 |
+	       (uint64_t)mac[4] << 8 | mac[5];
+}
+
+static size_t fdb_home(const struct pppoat_fdb *fdb, uint64_t key)
+{
+	/* Fibonacci hashing, high bits are the best mixed */
+	key = (key ^ fdb->fdb_seed) * 0x9e3779b97f4a7c15ULL;
+	return (size_t)(key >> 32) & fdb->fdb_mask;
+}
+
+static bool fdb_is_alive(const struct pppoat_fdb       *fdb,
+			 const struct pppoat_fdb_entry *fe,
+			 uint64_t                       now)
+{
+	return fdb->fdb_ageing == 0 || now - fe->fe_seen < fdb->fdb_ageing;
+}
+
+/* Returns slot of the key or the free slot where it would be inserted. */
+static size_t fdb_find(const struct pppoat_fdb *fdb, uint64_t key)
+{
+	size_t i = fdb_home(fdb, key);
+
+	while (fdb->fdb_entries[i].fe_key != 0 &&
+	       fdb->fdb_entries[i].fe_key != key)
+		i = (i + 1) & fdb->fdb_mask;
+	return i;
+}
+
+int pppoat_fdb_init(struct pppoat_fdb *fdb, size_t max, uint64_t ageing)
+{
+	size_t size = FDB_SIZE_MIN;
+
+	memset(fdb, 0, sizeof(*fdb));
+	while (size < max * 2)
+		size *= 2;
+	fdb->fdb_entries = pppoat_calloc(size, sizeof(*fdb->fdb_entries));
+	if (fdb->fdb_entries == NULL)
+		return P_ERR(-ENOMEM);
+
+	fdb->fdb_mask   = size - 1;
+	fdb->fdb_max    = max;
+	fdb->fdb_ageing = ageing;
+	/* Remote stations must not be able to build long probe chains */
+	fdb->fdb_seed   = pppoat_util_time_us() ^ (uint64_t)getpid() << 32;
+
+	return 0;
+}
+
+void pppoat_fdb_fini(struct pppoat_fdb *fdb)
+{
+	pppoat_free(fdb->fdb_entries);
+}
+
+/* Removes entry i and moves entries of its probe chain back. */
+static void fdb_delete(struct pppoat_fdb *fdb, size_t i)
+{
+	struct pppoat_fdb_entry *entries = fdb->fdb_entries;
+	size_t                   hole    = i;
+	size_t                   home;
+
+	for (i = (i + 1) & fdb->fdb_mask; entries[i].fe_key != 0;
+	     i = (i + 1) & fdb->fdb_mask) {
+		home = fdb_home(fdb, entries[i].fe_key);
+		/* The entry may move unless its home is between hole and i */
+		if (((i - home) & fdb->fdb_mask) >=
+		    ((i - hole) & fdb->fdb_mask)) {
+			entries[hole] = entries[i];
+			hole = i;
+		}
+	}
+	entries[hole].fe_key = 0;
+	--fdb->fdb_nr;
+}
+
+void pppoat_fdb_learn(struct pppoat_fdb   *fdb,
+		      const unsigned char *mac,
+		      void                *port,
+		      uint64_t             now)
+{
+	static const unsigned char  zero[6];
+	struct pppoat_fdb_entry    *fe;
+	uint64_t                    key = fdb_key(mac);
+
+	/* Group and all-zeroes addresses never appear as a source */
+	if ((mac[0] & 0x01) != 0 || memcmp(mac, zero, sizeof(zero)) == 0)
+		return;
+
+	fe = &fdb->fdb_entries[fdb_find(fdb, key)];
+	if (fe->fe_key == key) {
+		if (fe->fe_port != port && fdb_is_alive(fdb, fe, now))
+			++fdb->fdb_moved;
+	} else if (fdb->fdb_nr < fdb->fdb_max) {
+		fe->fe_key = key;
+		++fdb->fdb_nr;
+		++fdb->fdb_learned;
+	} else {
+		/* Frames to the station are flooded */
+		++fdb->fdb_full;
+		return;
+	}
+	fe->fe_port = port;
+	fe->fe_seen = now;
+}
+
+bool pppoat_fdb_lookup(const struct pppoat_fdb *fdb,
+		       const unsigned char     *mac,
+		       uint64_t                 now,
+		       void                   **port)
+{
+	uint64_t                       key = fdb_key(mac);
+	const struct pppoat_fdb_entry *fe;
+
+	fe = &fdb->fdb_entries[fdb_find(fdb, key)];
+	if (fe->fe_key != key || !fdb_is_alive(fdb, fe, now))
+		return false;
+	*port = fe->fe_port;
+	return true;
+}
+
+void pppoat_fdb_port_del(struct pppoat_fdb *fdb, void *port)
+{
+	size_t i = 0;
+
+	/* Deletion moves later entries into slot i, so it's checked again */
+	while (i <= fdb->fdb_mask && fdb->fdb_nr > 0) {
+		if (fdb->fdb_entries[i].fe_key != 0 &&
+		    fdb->fdb_entries[i].fe_port == port)
+			fdb_delete(fdb, i);
+		else
+			++i;
+	}
+}
+
+void pppoat_fdb_expire(struct pppoat_fdb *fdb, uint64_t now)
+{
+	size_t i = 0;
+
+	while (i <= fdb->fdb_mask && fdb->fdb_nr > 0) {
+		if (fdb->fdb_entries[i].fe_key != 0 &&
+		    !fdb_is_alive(fdb, &fdb->fdb_entries[i], now)) {
+			fdb_delete(fdb, i);
+			++fdb->fdb_aged;
+		} else {
+			++i;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+/* fdb.h
+ * PPP over Any Transport -- MAC learning table
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_FDB_H__
+#define __PPPOAT_FDB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Forwarding database of a learning switch: maps MAC addresses to ports.
+ * Entries live in a single array with open addressing and linear probing,
+ * so a lookup touches one or two cache lines. The array is kept at most
+ * half full. Entries which weren't refreshed for fdb_ageing usec are
+ * ignored by lookups and removed by pppoat_fdb_expire().
+ */
+
+struct pppoat_fdb_entry {
+	/* MAC address with FDB_KEY_USED bit, 0 for free slots */
+	uint64_t  fe_key;
+	uint64_t  fe_seen;
+	void     *fe_port;
+};
+
+struct pppoat_fdb {
+	struct pppoat_fdb_entry *fdb_entries;
+	size_t                   fdb_mask;
+	size_t                   fdb_nr;
+	size_t                   fdb_max;
+	uint64_t                 fdb_ageing;
+	uint64_t                 fdb_seed;
+	/* Counters */
+	unsigned long            fdb_learned;
+	unsigned long            fdb_moved;
+	unsigned long            fdb_aged;
+	unsigned long            fdb_full;
+};
+
+int pppoat_fdb_init(struct pppoat_fdb *fdb, size_t max, uint64_t ageing);
+void pppoat_fdb_fini(struct pppoat_fdb *fdb);
+
+/* Binds a unicast MAC address to the port, port may be NULL. */
+void pppoat_fdb_learn(struct pppoat_fdb   *fdb,
+		      const unsigned char *mac,
+		      void                *port,
+		      uint64_t             now);
+/* Returns false if the address is unknown or aged out. */
+bool pppoat_fdb_lookup(const struct pppoat_fdb *fdb,
+		       const unsigned char     *mac,
+		       uint64_t                 now,
+		       void                   **port);
+/* Forgets all addresses behind the port. */
+void pppoat_fdb_port_del(struct pppoat_fdb *fdb, void *port);
+void pppoat_fdb_expire(struct pppoat_fdb *fdb, uint64_t now);
+
+#endif /* __PPPOAT_FDB_H__ */
@@ -0,0 +1,453 @@
+/* filter.c
+ * PPP over Any Transport -- Packet filter compiler
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>	/* strtoul */
+#include <string.h>
+#include <unistd.h>	/* syscall */
+#include <arpa/inet.h>	/* inet_pton */
+#include <netinet/in.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "filter.h"
+#include "log.h"
+#include "memory.h"
+#include "util.h"
+
+/* Return values of the program: bytes of the packet to keep */
+#define FILTER_PASS 0xffffffffU
+#define FILTER_DROP 0
+
+enum {
+	FILTER_IP4 = 1 << 0,
+	FILTER_IP6 = 1 << 1,
+	/* Jumps to the next rule inside of a rule */
+	FILTER_FIX_MAX = 32,
+	/* Registers: packet loads return to R0, they need skb in R6 */
+	FILTER_R0 = BPF_REG_0,
+	FILTER_R1 = BPF_REG_1,
+	FILTER_SKB = BPF_REG_6,
+	/* IPv4 header length */
+	FILTER_IHL = BPF_REG_7,
+};
+
+struct filter_addr {
+	int           fa_family;
+	unsigned char fa_addr[16];
+	unsigned int  fa_len;
+};
+
+struct filter_rule {
+	bool               fr_pass;
+	/* Families the rule can match */
+	unsigned int       fr_family;
+	/* No terms, the rule matches any frame */
+	bool               fr_all;
+	int                fr_proto;
+	bool               fr_icmp;
+	int                fr_port;
+	int                fr_sport;
+	int                fr_dport;
+	bool               fr_mcast;
+	bool               fr_bcast;
+	struct filter_addr fr_src;
+	struct filter_addr fr_dst;
+};
+
+struct filter_ctx {
+	struct bpf_insn *fc_insns;
+	unsigned int     fc_len;
+	/* Offset of IP header */
+	unsigned int     fc_base;
+	bool             fc_ether;
+	/* Instructions which jump to the next rule */
+	unsigned int     fc_fix[FILTER_FIX_MAX];
+	unsigned int     fc_fix_nr;
+	int              fc_rc;
+};
+
+static void filter_emit(struct filter_ctx *ctx, uint8_t code, uint8_t dst,
+			uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn insn = {
+		.code    = code,
+		.dst_reg = dst,
+		.src_reg = src,
+		.off     = off,
+		.imm     = imm,
+	};
+
+	if (ctx->fc_len == BPF_MAXINSNS) {
+		ctx->fc_rc = P_ERR(-E2BIG);
+		return;
+	}
+	ctx->fc_insns[ctx->fc_len++] = insn;
+}
+
+/* Loads size bytes at off of the packet (plus FILTER_IHL if ind) to R0 */
+static void filter_load(struct filter_ctx *ctx, uint8_t size,
+			unsigned int off, bool ind)
+{
+	filter_emit(ctx, BPF_LD | size | (ind ? BPF_IND : BPF_ABS), 0,
+		    ind ? FILTER_IHL : 0, 0, off);
+}
+
+static void filter_and(struct filter_ctx *ctx, uint32_t k)
+{
+	filter_emit(ctx, BPF_ALU | BPF_AND | BPF_K, FILTER_R0, 0, 0, k);
+}
+
+/* Jumps to the next rule if R0 matches k with the 32-bit op. */
+static void filter_fail_if(struct filter_ctx *ctx, uint8_t op, uint32_t k)
+{
+	if (ctx->fc_fix_nr == FILTER_FIX_MAX) {
+		ctx->fc_rc = P_ERR(-E2BIG);
+		return;
+	}
+	ctx->fc_fix[ctx->fc_fix_nr++] = ctx->fc_len;
+	filter_emit(ctx, BPF_JMP32 | op | BPF_K, FILTER_R0, 0, 0, k);
+}
+
+/* Continues if R0 is k, jumps to the next rule otherwise. */
+static void filter_eq(struct filter_ctx *ctx, uint32_t k)
+{
+	filter_fail_if(ctx, BPF_JNE, k);
+}
+
+/* Skips n instructions if R0 is k. */
+static void filter_skip_eq(struct filter_ctx *ctx, uint32_t k, int16_t n)
+{
+	filter_emit(ctx, BPF_JMP32 | BPF_JEQ | BPF_K, FILTER_R0, 0, n, k);
+}
+
+static void filter_ret(struct filter_ctx *ctx, uint32_t k)
+{
+	filter_emit(ctx, BPF_ALU | BPF_MOV | BPF_K, FILTER_R0, 0, 0, k);
+	filter_emit(ctx, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+/* Resolves jumps to the next rule, which starts at the current position */
+static void filter_fix(struct filter_ctx *ctx)
+{
+	unsigned int idx;
+	unsigned int i;
+
+	for (i = 0; i < ctx->fc_fix_nr && ctx->fc_rc == 0; ++i) {
+		idx = ctx->fc_fix[i];
+		ctx->fc_insns[idx].off = ctx->fc_len - idx - 1;
+	}
+	ctx->fc_fix_nr = 0;
+}
+
+static void filter_addr_emit(struct filter_ctx        *ctx,
+			     const struct filter_addr *fa,
+			     unsigned int              off)
+{
+	unsigned int words = fa->fa_family == AF_INET ? 1 : 4;
+	unsigned int bits;
+	uint32_t     mask;
+	uint32_t     val;
+	unsigned int i;
+
+	for (i = 0; i < words && fa->fa_len > i * 32; ++i) {
+		bits = pppoat_min(fa->fa_len - i * 32, 32);
+		mask = bits == 32 ? 0xffffffff : ~(0xffffffffU >> bits);
+		val  = (uint32_t)fa->fa_addr[i * 4] << 24 |
+		       (uint32_t)fa->fa_addr[i * 4 + 1] << 16 |
+		       (uint32_t)fa->fa_addr[i * 4 + 2] << 8 |
+		       fa->fa_addr[i * 4 + 3];
+		filter_load(ctx, BPF_W, ctx->fc_base + off + i * 4, false);
+		if (mask != 0xffffffff)
+			filter_and(ctx, mask);
+		filter_eq(ctx, val & mask);
+	}
+}
+
+/* Loads a 16-bit word at off of the transport header to R0. */
+static void filter_l4_load(struct filter_ctx *ctx, bool v6, unsigned int off)
+{
+	if (v6)
+		filter_load(ctx, BPF_H, ctx->fc_base + 40 + off, false);
+	else
+		filter_load(ctx, BPF_H, ctx->fc_base + off, true);
+}
+
+static void filter_rule_emit(struct filter_ctx        *ctx,
+			     const struct filter_rule *fr,
+			     unsigned int              family)
+{
+	unsigned int base  = ctx->fc_base;
+	bool         v6    = family == FILTER_IP6;
+	bool         ports = fr->fr_port >= 0 || fr->fr_sport >= 0 ||
+			     fr->fr_dport >= 0;
+	unsigned int proto_off = base + (v6 ? 6 : 9);
+	unsigned int dst_off   = v6 ? 24 : 16;
+	unsigned int src_off   = v6 ? 8 : 12;
+
+	if (family != 0 && ctx->fc_ether) {
+		filter_load(ctx, BPF_H, 12, false);
+		filter_eq(ctx, v6 ? 0x86dd : 0x0800);
+	} else if (family != 0) {
+		filter_load(ctx, BPF_B, 0, false);
+		filter_and(ctx, 0xf0);
+		filter_eq(ctx, v6 ? 0x60 : 0x40);
+	}
+	if (fr->fr_proto >= 0 || fr->fr_icmp) {
+		filter_load(ctx, BPF_B, proto_off, false);
+		filter_eq(ctx, fr->fr_icmp ? (v6 ? IPPROTO_ICMPV6 :
+						   IPPROTO_ICMP) :
+					     (uint32_t)fr->fr_proto);
+	} else if (ports) {
+		filter_load(ctx, BPF_B, proto_off, false);
+		filter_skip_eq(ctx, IPPROTO_TCP, 1);
+		filter_eq(ctx, IPPROTO_UDP);
+	}
+	if (fr->fr_mcast && v6) {
+		filter_load(ctx, BPF_B, base + dst_off, false);
+		filter_eq(ctx, 0xff);
+	} else if (fr->fr_mcast) {
+		filter_load(ctx, BPF_W, base + dst_off, false);
+		filter_and(ctx, 0xf0000000);
+		filter_eq(ctx, 0xe0000000);
+	}
+	if (fr->fr_bcast) {
+		filter_load(ctx, BPF_W, base + dst_off, false);
+		filter_eq(ctx, 0xffffffff);
+	}
+	if (fr->fr_src.fa_family != 0)
+		filter_addr_emit(ctx, &fr->fr_src, src_off);
+	if (fr->fr_dst.fa_family != 0)
+		filter_addr_emit(ctx, &fr->fr_dst, dst_off);
+	if (ports && !v6) {
+		/* Only the first fragment has ports */
+		filter_load(ctx, BPF_H, base + 6, false);
+		filter_fail_if(ctx, BPF_JSET, 0x1fff);
+		filter_load(ctx, BPF_B, base, false);
+		filter_and(ctx, 0x0f);
+		filter_emit(ctx, BPF_ALU | BPF_LSH | BPF_K, FILTER_R0, 0, 0, 2);
+		filter_emit(ctx, BPF_ALU64 | BPF_MOV | BPF_X, FILTER_IHL,
+			    FILTER_R0, 0, 0);
+	}
+	if (fr->fr_sport >= 0) {
+		filter_l4_load(ctx, v6, 0);
+		filter_eq(ctx, fr->fr_sport);
+	}
+	if (fr->fr_dport >= 0) {
+		filter_l4_load(ctx, v6, 2);
+		filter_eq(ctx, fr->fr_dport);
+	}
+	if (fr->fr_port >= 0) {
+		filter_l4_load(ctx, v6, 0);
+		filter_skip_eq(ctx, fr->fr_port, 2);
+		filter_l4_load(ctx, v6, 2);
+		filter_eq(ctx, fr->fr_port);
+	}
+	filter_ret(ctx, fr->fr_pass ? FILTER_PASS : FILTER_DROP);
+	filter_fix(ctx);
+}
+
+static int filter_num(const char *str, unsigned long max)
+{
+	unsigned long val;
+	char         *end;
+
+	if (str == NULL)
+		return -1;
+	val = strtoul(str, &end, 0);
+	return end == str || *end != '\0' || val > max ? -1 : (int)val;
+}
+
+static int filter_addr_parse(struct filter_addr *fa, char *str)
+{
+	char *len = strchr(str, '/');
+	int   max;
+	int   rc;
+
+	if (len != NULL)
+		*len++ = '\0';
+	fa->fa_family = strchr(str, ':') == NULL ? AF_INET : AF_INET6;
+	max = fa->fa_family == AF_INET ? 32 : 128;
+	rc  = inet_pton(fa->fa_family, str, fa->fa_addr);
+	fa->fa_len = len == NULL ? max : filter_num(len, max);
+
+	return rc == 1 && (int)fa->fa_len >= 0 ? 0 : -EINVAL;
+}
+
+static int filter_rule_parse(struct filter_rule *fr, char *str)
+{
+	char *save = NULL;
+	char *tok;
+	char *arg;
+	int  *port;
+	int   rc = 0;
+
+	memset(fr, 0, sizeof(*fr));
+	fr->fr_family = FILTER_IP4 | FILTER_IP6;
+	fr->fr_proto  = -1;
+	fr->fr_port   = -1;
+	fr->fr_sport  = -1;
+	fr->fr_dport  = -1;
+
+	tok = strtok_r(str, " \t", &save);
+	if (tok == NULL || (strcmp(tok, "pass") != 0 &&
+			    strcmp(tok, "drop") != 0))
+		return -EINVAL;
+	fr->fr_pass = strcmp(tok, "pass") == 0;
+	fr->fr_all  = true;
+
+	while (rc == 0 && (tok = strtok_r(NULL, " \t", &save)) != NULL) {
+		if (strcmp(tok, "all") == 0)
+			continue;
+		fr->fr_all = false;
+		port = NULL;
+		if (strcmp(tok, "ip4") == 0 || strcmp(tok, "ip") == 0) {
+			fr->fr_family &= FILTER_IP4;
+		} else if (strcmp(tok, "ip6") == 0) {
+			fr->fr_family &= FILTER_IP6;
+		} else if (strcmp(tok, "tcp") == 0) {
+			fr->fr_proto = IPPROTO_TCP;
+		} else if (strcmp(tok, "udp") == 0) {
+			fr->fr_proto = IPPROTO_UDP;
+		} else if (strcmp(tok, "icmp") == 0) {
+			fr->fr_icmp = true;
+		} else if (strcmp(tok, "multicast") == 0) {
+			fr->fr_mcast = true;
+		} else if (strcmp(tok, "broadcast") == 0) {
+			fr->fr_bcast   = true;
+			fr->fr_family &= FILTER_IP4;
+		} else if (strcmp(tok, "proto") == 0) {
+			fr->fr_proto = filter_num(strtok_r(NULL, " \t", &save),
+						  0xff);
+			rc = fr->fr_proto < 0 ? -EINVAL : 0;
+		} else if (strcmp(tok, "port") == 0) {
+			port = &fr->fr_port;
+		} else if (strcmp(tok, "sport") == 0) {
+			port = &fr->fr_sport;
+		} else if (strcmp(tok, "dport") == 0) {
+			port = &fr->fr_dport;
+		} else if (strcmp(tok, "src") == 0 || strcmp(tok, "dst") == 0) {
+			arg = strtok_r(NULL, " \t", &save);
+			rc  = arg == NULL ? -EINVAL :
+			      filter_addr_parse(tok[0] == 's' ? &fr->fr_src :
+							       &fr->fr_dst, arg);
+			if (rc == 0)
+				fr->fr_family &= tok[0] == 's' ?
+				    (fr->fr_src.fa_family == AF_INET ?
+				     FILTER_IP4 : FILTER_IP6) :
+				    (fr->fr_dst.fa_family == AF_INET ?
+				     FILTER_IP4 : FILTER_IP6);
+		} else {
+			rc = -EINVAL;
+		}
+		if (port != NULL) {
+			*port = filter_num(strtok_r(NULL, " \t", &save),
+					   0xffff);
+			rc = *port < 0 ? -EINVAL : 0;
+		}
+	}
+	if (rc == 0 && (fr->fr_proto >= 0 || fr->fr_icmp) &&
+	    (fr->fr_port >= 0 || fr->fr_sport >= 0 || fr->fr_dport >= 0) &&
+	    fr->fr_proto != IPPROTO_TCP && fr->fr_proto != IPPROTO_UDP)
+		rc = -EINVAL;
+	/* E.g. "ip6 broadcast" */
+	if (rc == 0 && fr->fr_family == 0)
+		rc = -EINVAL;
+	return rc;
+}
+
+int pppoat_filter_compile(struct pppoat_filter *filter,
+			  const char           *rules,
+			  bool                  ether)
+{
+	struct filter_ctx  ctx = {};
+	struct filter_rule fr  = {};
+	char              *str;
+	char              *cur = NULL;
+	char              *rule;
+	unsigned int       nr  = 0;
+	int                rc  = 0;
+
+	str = pppoat_strdup(rules);
+	ctx.fc_insns = pppoat_calloc(BPF_MAXINSNS, sizeof(*ctx.fc_insns));
+	ctx.fc_base  = ether ? 14 : 0;
+	ctx.fc_ether = ether;
+	if (str == NULL || ctx.fc_insns == NULL)
+		rc = P_ERR(-ENOMEM);
+	if (rc == 0)
+		filter_emit(&ctx, BPF_ALU64 | BPF_MOV | BPF_X, FILTER_SKB,
+			    FILTER_R1, 0, 0);
+
+	for (cur = str; rc == 0 && !fr.fr_all && cur != NULL; ++nr) {
+		rule = strsep(&cur, ";,");
+		if (strspn(rule, " \t") == strlen(rule))
+			continue;
+		rc = filter_rule_parse(&fr, rule);
+		if (rc != 0) {
+			pppoat_error("filter", "Invalid rule #%u", nr + 1);
+			break;
+		}
+		if (fr.fr_all) {
+			filter_rule_emit(&ctx, &fr, 0);
+		} else {
+			if (fr.fr_family & FILTER_IP4)
+				filter_rule_emit(&ctx, &fr, FILTER_IP4);
+			if (fr.fr_family & FILTER_IP6)
+				filter_rule_emit(&ctx, &fr, FILTER_IP6);
+		}
+		rc = ctx.fc_rc;
+	}
+	/* The verifier rejects unreachable code */
+	if (rc == 0 && cur != NULL)
+		pppoat_error("filter", "Rules after #%u are never reached", nr);
+	if (rc == 0 && !fr.fr_all) {
+		filter_ret(&ctx, FILTER_PASS);
+		rc = ctx.fc_rc;
+	}
+
+	pppoat_free(str);
+	if (rc != 0) {
+		pppoat_free(ctx.fc_insns);
+		return rc;
+	}
+	filter->pf_insns = ctx.fc_insns;
+	filter->pf_len   = ctx.fc_len;
+
+	return 0;
+}
+
+int pppoat_filter_load(const struct pppoat_filter *filter, int *fd)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns     = (uintptr_t)filter->pf_insns;
+	attr.insn_cnt  = filter->pf_len;
+	attr.license   = (uintptr_t)"GPL";
+
+	*fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+
+	return *fd < 0 ? P_ERR(-errno) : 0;
+}
+
+void pppoat_filter_fini(struct pppoat_filter *filter)
+{
+	pppoat_free(filter->pf_insns);
+}
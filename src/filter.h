@@ -0,0 +1,59 @@
+/* filter.h
+ * PPP over Any Transport -- Packet filter compiler
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_FILTER_H__
+#define __PPPOAT_FILTER_H__
+
+#include <stdbool.h>
+#include <linux/bpf.h>
+
+/*
+ * Compiles rules to a BPF socket filter program which the kernel runs
+ * before a packet is copied to user space.
+ *
+ * Rules are separated with ';' or ',' and checked in order, the first
+ * matching rule decides. Packets which match no rule pass. A rule is an
+ * action followed by terms which all must match:
+ *
+ *   pass|drop  all | ip4 | ip6 | tcp | udp | icmp | proto N |
+ *              port N | sport N | dport N | src ADDR[/LEN] |
+ *              dst ADDR[/LEN] | multicast | broadcast
+ *
+ * Example: "drop multicast; pass tcp port 22; drop ip6". Port terms
+ * without a protocol match both TCP and UDP. IPv6 extension headers are
+ * not followed.
+ */
+
+struct pppoat_filter {
+	struct bpf_insn *pf_insns;
+	unsigned int     pf_len;
+};
+
+/*
+ * Packets start with IP header or with Ethernet header if ether is set.
+ * Returns -EINVAL if rules can't be parsed.
+ */
+int pppoat_filter_compile(struct pppoat_filter *filter,
+			  const char           *rules,
+			  bool                  ether);
+/* Loads the program to the kernel, needs CAP_BPF or CAP_SYS_ADMIN. */
+int pppoat_filter_load(const struct pppoat_filter *filter, int *fd);
+void pppoat_filter_fini(struct pppoat_filter *filter);
+
+#endif /* __PPPOAT_FILTER_H__ */
@@ -0,0 +1,340 @@
+/* gso.c
+ * PPP over Any Transport -- Segmentation offload helpers
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "trace.h"
+#include "gso.h"
+#include "memory.h"
+#include "util.h"
+
+enum {
+	GSO_TCP_FIN = 0x01,
+	GSO_TCP_PSH = 0x08,
+	GSO_TCP_ACK = 0x10,
+	GSO_TCP_CWR = 0x80,
+};
+
+static uint16_t gso_get16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void gso_put16(unsigned char *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val & 0xff;
+}
+
+static uint32_t gso_get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8  | p[3];
+}
+
+static void gso_put32(unsigned char *p, uint32_t val)
+{
+	gso_put16(p, val >> 16);
+	gso_put16(p + 2, val & 0xffff);
+}
+
+/* One's complement sum of big-endian words, not folded. */
+static uint64_t gso_sum(const unsigned char *p, size_t len, uint64_t sum)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += gso_get16(p + i);
+	if (len % 2 != 0)
+		sum += (uint16_t)(p[len - 1] << 8);
+	return sum;
+}
+
+static uint16_t gso_fold(uint64_t sum)
+{
+	while (sum >> 16 != 0)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)sum;
+}
+
+/* Sum of the pseudo-header which TCP and UDP checksums cover. */
+static uint64_t gso_pseudo(const unsigned char *ip, uint8_t proto,
+			   size_t l4len)
+{
+	bool v6 = ip[0] >> 4 == 6;
+
+	return gso_sum(ip + (v6 ? 8 : 12), v6 ? 32 : 8, proto + l4len);
+}
+
+static void gso_ip4_csum(unsigned char *ip)
+{
+	size_t ihl = (ip[0] & 0x0f) * 4;
+
+	gso_put16(ip + 10, 0);
+	gso_put16(ip + 10, ~gso_fold(gso_sum(ip, ihl, 0)));
+}
+
+int pppoat_gso_csum(const struct virtio_net_hdr *hdr,
+		    unsigned char               *pkt,
+		    size_t                       len)
+{
+	size_t   start = hdr->csum_start;
+	size_t   off   = hdr->csum_offset;
+	uint16_t csum;
+
+	if (start + off + 2 > len)
+		return P_ERR(-EINVAL);
+
+	/* The field holds the pseudo-header sum already */
+	csum = ~gso_fold(gso_sum(pkt + start, len - start, 0));
+	/* Zero means "no checksum" for UDP */
+	if (csum == 0 && off == 6)
+		csum = 0xffff;
+	gso_put16(pkt + start + off, csum);
+
+	return 0;
+}
+
+ssize_t pppoat_gso_segment(const struct virtio_net_hdr *hdr,
+			   const unsigned char         *pkt,
+			   size_t                       len,
+			   unsigned char               *out,
+			   size_t                       size)
+{
+	unsigned int   type  = hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+	size_t         l4off = hdr->csum_start;
+	size_t         mss   = hdr->gso_size;
+	bool           v6    = len > 0 && pkt[0] >> 4 == 6;
+	bool           tcp   = type != VIRTIO_NET_HDR_GSO_UDP_L4;
+	unsigned char *seg;
+	unsigned char *l4;
+	uint32_t       seq;
+	uint16_t       id;
+	uint16_t       csum;
+	size_t         hlen;
+	size_t         plen;
+	size_t         off;
+	size_t         pos = 0;
+	size_t         cso;
+	unsigned int   i;
+
+	if (type != VIRTIO_NET_HDR_GSO_TCPV4 &&
+	    type != VIRTIO_NET_HDR_GSO_TCPV6 &&
+	    type != VIRTIO_NET_HDR_GSO_UDP_L4)
+		return P_ERR(-EPROTONOSUPPORT);
+	if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) == 0 || mss == 0 ||
+	    l4off < (v6 ? 40 : 20) || l4off + 20 > len ||
+	    (!v6 && (pkt[0] >> 4 != 4 || (size_t)(pkt[0] & 0x0f) * 4 > l4off)))
+		return P_ERR(-EINVAL);
+
+	hlen = l4off + (tcp ? (size_t)(pkt[l4off + 12] >> 4) * 4 : 8);
+	if (hlen > len || (tcp && hlen < l4off + 20))
+		return P_ERR(-EINVAL);
+	cso = tcp ? 16 : 6;
+	seq = gso_get32(pkt + l4off + 4);
+	id  = gso_get16(pkt + 4);
+
+	for (off = hlen, i = 0; off < len; off += plen, ++i) {
+		plen = pppoat_min(mss, len - off);
+		if (pos + hlen + plen > size)
+			return P_ERR(-E2BIG);
+		seg = out + pos;
+		l4  = seg + l4off;
+		memcpy(seg, pkt, hlen);
+		memcpy(seg + hlen, pkt + off, plen);
+		pos += hlen + plen;
+
+		if (v6) {
+			gso_put16(seg + 4, hlen + plen - 40);
+		} else {
+			gso_put16(seg + 2, hlen + plen);
+			gso_put16(seg + 4, id + i);
+			gso_ip4_csum(seg);
+		}
+		if (tcp) {
+			gso_put32(l4 + 4, seq + (uint32_t)(off - hlen));
+			if (off + plen < len)
+				l4[13] &= ~(GSO_TCP_FIN | GSO_TCP_PSH);
+			if (i > 0)
+				l4[13] &= ~GSO_TCP_CWR;
+		} else {
+			gso_put16(l4 + 4, hlen + plen - l4off);
+		}
+		gso_put16(l4 + cso, 0);
+		csum = ~gso_fold(gso_pseudo(seg, tcp ? IPPROTO_TCP : IPPROTO_UDP,
+					    hlen + plen - l4off) +
+				 gso_sum(l4, hlen + plen - l4off, 0));
+		if (csum == 0 && !tcp)
+			csum = 0xffff;
+		gso_put16(l4 + cso, csum);
+	}
+	return pos;
+}
+
+int pppoat_gro_init(struct pppoat_gro *gro, size_t size)
+{
+	memset(gro, 0, sizeof(*gro));
+	gro->gr_buf  = pppoat_alloc(size);
+	gro->gr_size = size;
+
+	return gro->gr_buf == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+void pppoat_gro_fini(struct pppoat_gro *gro)
+{
+	pppoat_free(gro->gr_buf);
+}
+
+/*
+ * Returns length of IP and TCP headers of a segment which may be merged
+ * or 0: no IP options or fragments, only ACK and PSH flags, some payload
+ * and a valid checksum since the merged packet gets a new one.
+ */
+static size_t gro_tcp_hlen(const unsigned char *pkt, size_t len,
+			   size_t *l3len)
+{
+	const unsigned char *tcp;
+	size_t               hlen;
+
+	if (len >= 20 && pkt[0] == 0x45) {
+		if (pkt[9] != IPPROTO_TCP || gso_get16(pkt + 2) != len ||
+		    (gso_get16(pkt + 6) & 0x3fff) != 0 ||
+		    gso_fold(gso_sum(pkt, 20, 0)) != 0xffff)
+			return 0;
+		*l3len = 20;
+	} else if (len >= 40 && pkt[0] >> 4 == 6) {
+		if (pkt[6] != IPPROTO_TCP || gso_get16(pkt + 4) + 40 != len)
+			return 0;
+		*l3len = 40;
+	} else {
+		return 0;
+	}
+	if (len < *l3len + 20)
+		return 0;
+	tcp  = pkt + *l3len;
+	hlen = *l3len + (size_t)(tcp[12] >> 4) * 4;
+	if (hlen < *l3len + 20 || hlen >= len ||
+	    (tcp[13] & ~(GSO_TCP_ACK | GSO_TCP_PSH)) != 0 ||
+	    (tcp[13] & GSO_TCP_ACK) == 0)
+		return 0;
+	if (gso_fold(gso_pseudo(pkt, IPPROTO_TCP, len - *l3len) +
+		     gso_sum(tcp, len - *l3len, 0)) != 0xffff)
+		return 0;
+	return hlen;
+}
+
+/* Headers must match except lengths, IDs, checksums and PSH. */
+static bool gro_hdr_match(const unsigned char *a, const unsigned char *b,
+			  size_t l3len, size_t hlen)
+{
+	const unsigned char *ta = a + l3len;
+	const unsigned char *tb = b + l3len;
+
+	if (l3len == 20) {
+		if (memcmp(a, b, 2) != 0 || a[6] != b[6] ||
+		    memcmp(a + 8, b + 8, 2) != 0 ||
+		    memcmp(a + 12, b + 12, 8) != 0)
+			return false;
+	} else if (memcmp(a, b, 4) != 0 || memcmp(a + 6, b + 6, 34) != 0) {
+		return false;
+	}
+	return memcmp(ta, tb, 4) == 0 && memcmp(ta + 8, tb + 8, 5) == 0 &&
+	       memcmp(ta + 14, tb + 14, 2) == 0 &&
+	       memcmp(ta + 20, tb + 20, hlen - l3len - 20) == 0;
+}
+
+bool pppoat_gro_add(struct pppoat_gro   *gro,
+		    const unsigned char *pkt,
+		    size_t               len)
+{
+	unsigned char *tcp;
+	size_t         l3len = 0;
+	size_t         hlen;
+	size_t         plen;
+
+	hlen = gro_tcp_hlen(pkt, len, &l3len);
+	plen = len - hlen;
+
+	if (gro->gr_len == 0) {
+		if (len > gro->gr_size)
+			len = gro->gr_size;
+		memcpy(gro->gr_buf, pkt, len);
+		gro->gr_len    = len;
+		gro->gr_segs   = 1;
+		gro->gr_l3len  = l3len;
+		gro->gr_hlen   = hlen;
+		gro->gr_mss    = hlen == 0 ? 0 : plen;
+		gro->gr_closed = hlen == 0 || (pkt[l3len + 13] & GSO_TCP_PSH);
+		if (hlen != 0)
+			gro->gr_seq_next = gso_get32(pkt + l3len + 4) + plen;
+		return true;
+	}
+	if (gro->gr_closed || hlen == 0 || l3len != gro->gr_l3len ||
+	    hlen != gro->gr_hlen || plen > gro->gr_mss ||
+	    gro->gr_len + plen > gro->gr_size ||
+	    gro->gr_len + plen - (l3len == 40 ? 40 : 0) > 0xffff ||
+	    gso_get32(pkt + l3len + 4) != gro->gr_seq_next ||
+	    !gro_hdr_match(gro->gr_buf, pkt, l3len, hlen))
+		return false;
+
+	memcpy(gro->gr_buf + gro->gr_len, pkt + hlen, plen);
+	gro->gr_len      += plen;
+	gro->gr_seq_next += plen;
+	++gro->gr_segs;
+	++gro->gr_merged;
+	if (plen < gro->gr_mss || (pkt[l3len + 13] & GSO_TCP_PSH)) {
+		tcp = gro->gr_buf + l3len;
+		tcp[13] |= pkt[l3len + 13] & GSO_TCP_PSH;
+		gro->gr_closed = true;
+	}
+	return true;
+}
+
+size_t pppoat_gro_flush(struct pppoat_gro *gro, struct virtio_net_hdr *hdr)
+{
+	unsigned char *buf   = gro->gr_buf;
+	size_t         l3len = gro->gr_l3len;
+	size_t         len   = gro->gr_len;
+
+	memset(hdr, 0, sizeof(*hdr));
+	if (gro->gr_segs > 1) {
+		if (l3len == 20) {
+			gso_put16(buf + 2, len);
+			gso_ip4_csum(buf);
+		} else {
+			gso_put16(buf + 4, len - 40);
+		}
+		/* The kernel completes the checksum or segments the packet */
+		gso_put16(buf + l3len + 16,
+			  gso_fold(gso_pseudo(buf, IPPROTO_TCP, len - l3len)));
+		hdr->flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		hdr->gso_type    = l3len == 20 ? VIRTIO_NET_HDR_GSO_TCPV4 :
+						 VIRTIO_NET_HDR_GSO_TCPV6;
+		hdr->hdr_len     = gro->gr_hlen;
+		hdr->gso_size    = gro->gr_mss;
+		hdr->csum_start  = l3len;
+		hdr->csum_offset = 16;
+		++gro->gr_flushed;
+	}
+	gro->gr_len = 0;
+
+	return len;
+}
@@ -0,0 +1,99 @@
+/* gso.h
+ * PPP over Any Transport -- Segmentation offload helpers
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_GSO_H__
+#define __PPPOAT_GSO_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/virtio_net.h>
+
+/*
+ * Packets exchanged with a TUN device opened with IFF_VNET_HDR are
+ * prefixed with struct virtio_net_hdr. The kernel hands over TCP/UDP
+ * super-packets (GSO) of up to 64KiB with a partial checksum, and
+ * accepts such super-packets back (GRO). Peers exchange ordinary IP
+ * packets, these helpers convert between the two forms.
+ *
+ * Fields of the header are in host byte order.
+ */
+
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+#define VIRTIO_NET_HDR_GSO_UDP_L4 5
+#endif
+
+/* Completes the partial checksum described by a NEEDS_CSUM header. */
+int pppoat_gso_csum(const struct virtio_net_hdr *hdr,
+		    unsigned char               *pkt,
+		    size_t                       len);
+
+/*
+ * Splits a GSO packet into IP packets of at most hdr->gso_size payload
+ * bytes each and stores them back to back into out. Checksums of the
+ * segments are complete. Returns the number of bytes stored.
+ */
+ssize_t pppoat_gso_segment(const struct virtio_net_hdr *hdr,
+			   const unsigned char         *pkt,
+			   size_t                       len,
+			   unsigned char               *out,
+			   size_t                       size);
+
+/*
+ * Coalesces consecutive segments of a TCP flow into a super-packet.
+ * Packets which can't be merged close the current super-packet.
+ */
+struct pppoat_gro {
+	/* Super-packet, gr_len is 0 when there is none */
+	unsigned char *gr_buf;
+	size_t         gr_size;
+	size_t         gr_len;
+	/* IP and TCP header lengths */
+	size_t         gr_l3len;
+	size_t         gr_hlen;
+	size_t         gr_mss;
+	uint32_t       gr_seq_next;
+	unsigned int   gr_segs;
+	/* Last segment was short or had PSH, nothing can follow */
+	bool           gr_closed;
+	/* Statistics */
+	unsigned long  gr_merged;
+	unsigned long  gr_flushed;
+};
+
+int pppoat_gro_init(struct pppoat_gro *gro, size_t size);
+void pppoat_gro_fini(struct pppoat_gro *gro);
+
+/*
+ * Appends an IP packet to the super-packet. Returns false if the packet
+ * doesn't belong to it, the caller must flush the super-packet and add
+ * the packet again.
+ */
+bool pppoat_gro_add(struct pppoat_gro   *gro,
+		    const unsigned char *pkt,
+		    size_t               len);
+
+/*
+ * Finalises the super-packet, fills hdr and returns its length. gr_buf
+ * is valid until the next pppoat_gro_add().
+ */
+size_t pppoat_gro_flush(struct pppoat_gro *gro, struct virtio_net_hdr *hdr);
+
+#endif /* __PPPOAT_GSO_H__ */
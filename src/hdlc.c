@@ -0,0 +1,166 @@
+/* hdlc.c
+ * PPP over Any Transport -- Asynchronous HDLC framing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace.h"
+#include "hdlc.h"
+#include "memory.h"
+
+enum {
+	HDLC_FLAG     = 0x7e,
+	HDLC_ESC      = 0x7d,
+	HDLC_ESC_MASK = 0x20,
+	HDLC_FCS_INIT = 0xffff,
+	/* FCS over a frame together with its FCS */
+	HDLC_FCS_GOOD = 0xf0b8,
+	/* Shorter frames are discarded, RFC 1662 4.3 */
+	HDLC_FRAME_MIN = 4,
+};
+
+static uint16_t hdlc_fcs_tbl[256];
+
+static void hdlc_fcs_tbl_init(void)
+{
+	unsigned int b;
+	unsigned int i;
+	uint16_t     v;
+
+	/* The table is the same for every caller, a race is harmless */
+	if (hdlc_fcs_tbl[1] != 0)
+		return;
+	for (b = 0; b < 256; ++b) {
+		v = (uint16_t)b;
+		for (i = 0; i < 8; ++i)
+			v = v & 1 ? (v >> 1) ^ 0x8408 : v >> 1;
+		hdlc_fcs_tbl[b] = v;
+	}
+}
+
+static uint16_t hdlc_fcs(uint16_t fcs, const unsigned char *p, size_t len)
+{
+	while (len-- > 0)
+		fcs = (fcs >> 8) ^ hdlc_fcs_tbl[(fcs ^ *p++) & 0xff];
+	return fcs;
+}
+
+int pppoat_hdlc_init(struct pppoat_hdlc *hd, size_t mru)
+{
+	hdlc_fcs_tbl_init();
+	memset(hd, 0, sizeof(*hd));
+	/* Address, control and protocol fields may precede MRU of data */
+	hd->hd_size = mru + 4 + 2;
+	hd->hd_buf  = pppoat_alloc(hd->hd_size);
+
+	return hd->hd_buf == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+void pppoat_hdlc_fini(struct pppoat_hdlc *hd)
+{
+	pppoat_free(hd->hd_buf);
+}
+
+static int hdlc_frame_end(struct pppoat_hdlc    *hd,
+			  pppoat_hdlc_deliver_t  deliver,
+			  void                  *userdata)
+{
+	size_t len  = hd->hd_len;
+	bool   skip = hd->hd_skip || hd->hd_esc;
+
+	/* Escape followed by flag aborts the frame */
+	hd->hd_len  = 0;
+	hd->hd_esc  = false;
+	hd->hd_skip = false;
+	if (skip || len == 0)
+		return 0;
+	if (len < HDLC_FRAME_MIN ||
+	    hdlc_fcs(HDLC_FCS_INIT, hd->hd_buf, len) != HDLC_FCS_GOOD) {
+		++hd->hd_bad_fcs;
+		return 0;
+	}
+	++hd->hd_frames;
+	return deliver(userdata, hd->hd_buf, len - 2);
+}
+
+int pppoat_hdlc_decode(struct pppoat_hdlc    *hd,
+		       const unsigned char   *buf,
+		       size_t                 len,
+		       pppoat_hdlc_deliver_t  deliver,
+		       void                  *userdata)
+{
+	const unsigned char *end = buf + len;
+	const unsigned char *flag;
+	unsigned char        c;
+	int                  rc  = 0;
+
+	while (rc == 0 && buf < end) {
+		if (hd->hd_skip) {
+			flag = memchr(buf, HDLC_FLAG, end - buf);
+			buf  = flag ?: end;
+			if (flag == NULL)
+				break;
+		}
+		c = *buf++;
+		if (c == HDLC_FLAG) {
+			rc = hdlc_frame_end(hd, deliver, userdata);
+		} else if (c == HDLC_ESC) {
+			hd->hd_esc = true;
+		} else if (hd->hd_len == hd->hd_size) {
+			++hd->hd_too_long;
+			hd->hd_skip = true;
+		} else {
+			hd->hd_buf[hd->hd_len++] = hd->hd_esc ?
+						   c ^ HDLC_ESC_MASK : c;
+			hd->hd_esc = false;
+		}
+	}
+	return rc;
+}
+
+static unsigned char *hdlc_put(unsigned char *out, unsigned char c)
+{
+	if (c < 0x20 || c == HDLC_FLAG || c == HDLC_ESC) {
+		*out++ = HDLC_ESC;
+		c ^= HDLC_ESC_MASK;
+	}
+	*out++ = c;
+	return out;
+}
+
+size_t pppoat_hdlc_encode(const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *out)
+{
+	unsigned char *p   = out;
+	uint16_t       fcs;
+	size_t         i;
+
+	hdlc_fcs_tbl_init();
+	fcs  = ~hdlc_fcs(HDLC_FCS_INIT, frame, len);
+	*p++ = HDLC_FLAG;
+	for (i = 0; i < len; ++i)
+		p = hdlc_put(p, frame[i]);
+	p = hdlc_put(p, fcs & 0xff);
+	p = hdlc_put(p, fcs >> 8);
+	*p++ = HDLC_FLAG;
+
+	return (size_t)(p - out);
+}
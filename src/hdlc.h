@@ -0,0 +1,75 @@
+/* hdlc.h
+ * PPP over Any Transport -- Asynchronous HDLC framing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_HDLC_H__
+#define __PPPOAT_HDLC_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * PPP in HDLC-like framing (RFC 1662) as pppd speaks it on a tty: frames
+ * are delimited with flag bytes, flags, escapes and control characters
+ * inside a frame are escaped and every frame ends with FCS-16.
+ */
+
+/* Largest MRU pppd accepts */
+#define PPPOAT_HDLC_MRU_MAX 16384
+/* Encoded frame: flags, FCS and every byte escaped in the worst case */
+#define PPPOAT_HDLC_ENC_MAX(len) (2 * ((len) + 2) + 2)
+
+typedef int (*pppoat_hdlc_deliver_t)(void          *userdata,
+				     unsigned char *frame,
+				     size_t         len);
+
+struct pppoat_hdlc {
+	unsigned char *hd_buf;
+	size_t         hd_len;
+	size_t         hd_size;
+	bool           hd_esc;
+	/* The frame is too long, skip it till the next flag */
+	bool           hd_skip;
+	/* Counters */
+	unsigned long  hd_frames;
+	unsigned long  hd_bad_fcs;
+	unsigned long  hd_too_long;
+};
+
+int pppoat_hdlc_init(struct pppoat_hdlc *hd, size_t mru);
+void pppoat_hdlc_fini(struct pppoat_hdlc *hd);
+
+/*
+ * Decodes a chunk of the stream, frames may span chunks. Every complete
+ * frame with valid FCS is passed to deliver without the FCS.
+ */
+int pppoat_hdlc_decode(struct pppoat_hdlc    *hd,
+		       const unsigned char   *buf,
+		       size_t                 len,
+		       pppoat_hdlc_deliver_t  deliver,
+		       void                  *userdata);
+/*
+ * Encodes a frame to out which must hold PPPOAT_HDLC_ENC_MAX(len) bytes.
+ * All control characters are escaped, so any ACCM is satisfied.
+ * Returns length of the encoded frame.
+ */
+size_t pppoat_hdlc_encode(const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *out);
+
+#endif /* __PPPOAT_HDLC_H__ */
@@ -0,0 +1,203 @@
+/* http.c
+ * PPP over Any Transport -- Minimal HTTP/1.1 helpers
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "trace.h"
+#include "http.h"
+#include "util.h"
+
+enum {
+	HTTP_CHUNK_SIZE,
+	/* Chunk extensions up to the end of the size line */
+	HTTP_CHUNK_EXT,
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_DATA_CR,
+	HTTP_CHUNK_DATA_LF,
+	HTTP_CHUNK_TRAILER,
+};
+
+size_t pppoat_http_head_len(const char *buf, size_t len)
+{
+	const char *end = memmem(buf, len, "\r\n\r\n", 4);
+
+	return end == NULL ? 0 : (size_t)(end - buf) + 4;
+}
+
+int pppoat_http_status(const char *head, size_t len)
+{
+	unsigned int code;
+
+	if (len < 12 || strncmp(head, "HTTP/1.", 7) != 0 ||
+	    sscanf(head + 8, " %3u", &code) != 1)
+		return -1;
+	return code;
+}
+
+bool pppoat_http_header(const char *head,
+			size_t      len,
+			const char *name,
+			char       *val,
+			size_t      size)
+{
+	const char *end  = head + len;
+	const char *line = head;
+	const char *eol;
+	size_t      nlen = strlen(name);
+	size_t      vlen;
+
+	/* The first line is the request or status line */
+	while ((eol = memchr(line, '\n', end - line)) != NULL) {
+		line = eol + 1;
+		if ((size_t)(end - line) <= nlen ||
+		    strncasecmp(line, name, nlen) != 0 || line[nlen] != ':')
+			continue;
+		line += nlen + 1;
+		eol   = memchr(line, '\n', end - line);
+		while (line < eol && (*line == ' ' || *line == '\t'))
+			++line;
+		while (eol > line && isspace((unsigned char)eol[-1]))
+			--eol;
+		vlen = eol - line;
+		if (vlen >= size)
+			return false;
+		memcpy(val, line, vlen);
+		val[vlen] = '\0';
+		return true;
+	}
+	return false;
+}
+
+bool pppoat_http_has_token(const char *val, const char *token)
+{
+	size_t len = strlen(token);
+
+	while (*val != '\0') {
+		val += strspn(val, " \t,");
+		if (strncasecmp(val, token, len) == 0 &&
+		    strchr(" \t,", val[len]) != NULL)
+			return true;
+		val += strcspn(val, ",");
+	}
+	return false;
+}
+
+void pppoat_http_chunk_hdr(char *buf, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	PPPOAT_ASSERT(len <= PPPOAT_HTTP_CHUNK_MAX);
+
+	/* Leading zeros keep the header size fixed */
+	buf[0] = hex[len >> 12 & 0xf];
+	buf[1] = hex[len >> 8 & 0xf];
+	buf[2] = hex[len >> 4 & 0xf];
+	buf[3] = hex[len & 0xf];
+	buf[4] = '\r';
+	buf[5] = '\n';
+}
+
+void pppoat_http_chunked_init(struct pppoat_http_chunked *hc)
+{
+	memset(hc, 0, sizeof(*hc));
+	hc->hc_state = HTTP_CHUNK_SIZE;
+}
+
+static int http_hex(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* Handles one byte of the chunk framing. */
+static int http_chunked_byte(struct pppoat_http_chunked *hc, unsigned char c)
+{
+	int digit;
+
+	switch (hc->hc_state) {
+	case HTTP_CHUNK_SIZE:
+		digit = http_hex(c);
+		if (digit >= 0 && hc->hc_left >> 56 == 0) {
+			hc->hc_left   = hc->hc_left << 4 | digit;
+			hc->hc_digits = true;
+			return 0;
+		}
+		if (!hc->hc_digits || digit >= 0)
+			return P_ERR(-EPROTO);
+		hc->hc_state = HTTP_CHUNK_EXT;
+		/* fallthrough */
+	case HTTP_CHUNK_EXT:
+		if (c != '\n')
+			return 0;
+		hc->hc_digits = false;
+		hc->hc_line   = 0;
+		hc->hc_state  = hc->hc_left == 0 ? HTTP_CHUNK_TRAILER :
+						   HTTP_CHUNK_DATA;
+		return 0;
+	case HTTP_CHUNK_DATA_CR:
+		hc->hc_state = HTTP_CHUNK_DATA_LF;
+		return c == '\r' ? 0 : P_ERR(-EPROTO);
+	case HTTP_CHUNK_DATA_LF:
+		hc->hc_state = HTTP_CHUNK_SIZE;
+		return c == '\n' ? 0 : P_ERR(-EPROTO);
+	case HTTP_CHUNK_TRAILER:
+		if (c == '\n' && hc->hc_line == 0)
+			hc->hc_done = true;
+		else if (c == '\n')
+			hc->hc_line = 0;
+		else if (c != '\r')
+			++hc->hc_line;
+		return 0;
+	}
+	return P_ERR(-EPROTO);
+}
+
+int pppoat_http_chunked_decode(struct pppoat_http_chunked *hc,
+			       unsigned char              *buf,
+			       size_t                      len,
+			       size_t                     *used,
+			       pppoat_http_deliver_t       deliver,
+			       void                       *userdata)
+{
+	size_t off = 0;
+	size_t n;
+	int    rc  = 0;
+
+	while (rc == 0 && off < len && !hc->hc_done) {
+		if (hc->hc_state != HTTP_CHUNK_DATA) {
+			rc = http_chunked_byte(hc, buf[off++]);
+			continue;
+		}
+		n = pppoat_min(hc->hc_left, (uint64_t)(len - off));
+		rc = deliver(userdata, buf + off, n);
+		off         += n;
+		hc->hc_left -= n;
+		if (hc->hc_left == 0)
+			hc->hc_state = HTTP_CHUNK_DATA_CR;
+	}
+	*used = off;
+	return rc;
+}
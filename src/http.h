@@ -0,0 +1,84 @@
+/* http.h
+ * PPP over Any Transport -- Minimal HTTP/1.1 helpers
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_HTTP_H__
+#define __PPPOAT_HTTP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Just enough HTTP/1.1 to pass through proxies: message heads are parsed
+ * in the receive buffer, bodies come with chunked transfer coding.
+ */
+
+/* Longest head accepted */
+#define PPPOAT_HTTP_HEAD_MAX 8192
+/* Chunk header of a fixed width, the size fits 4 hex digits */
+#define PPPOAT_HTTP_CHUNK_HDR_LEN 6
+#define PPPOAT_HTTP_CHUNK_MAX     0xffff
+
+/* Returns length of the head with its empty line, 0 if incomplete. */
+size_t pppoat_http_head_len(const char *buf, size_t len);
+/* Returns status code of a response head or -1. */
+int pppoat_http_status(const char *head, size_t len);
+/*
+ * Copies value of the header to val. Returns false if the head doesn't
+ * have it or val is too small.
+ */
+bool pppoat_http_header(const char *head,
+			size_t      len,
+			const char *name,
+			char       *val,
+			size_t      size);
+/* Whether a comma separated header value has the token. */
+bool pppoat_http_has_token(const char *val, const char *token);
+
+/* Writes the header of a chunk of len bytes, see CHUNK_HDR_LEN. */
+void pppoat_http_chunk_hdr(char *buf, size_t len);
+
+typedef int (*pppoat_http_deliver_t)(void          *userdata,
+				     unsigned char *data,
+				     size_t         len);
+
+struct pppoat_http_chunked {
+	int      hc_state;
+	uint64_t hc_left;
+	bool     hc_digits;
+	/* Characters in the current trailer line */
+	size_t   hc_line;
+	/* The last chunk and the trailer are received */
+	bool     hc_done;
+};
+
+void pppoat_http_chunked_init(struct pppoat_http_chunked *hc);
+/*
+ * Passes chunk data of the body to deliver. Stops after the end of the
+ * body and sets hc_done, *used is the number of bytes of the body.
+ * Returns -EPROTO on a malformed body or the error of deliver.
+ */
+int pppoat_http_chunked_decode(struct pppoat_http_chunked *hc,
+			       unsigned char              *buf,
+			       size_t                      len,
+			       size_t                     *used,
+			       pppoat_http_deliver_t       deliver,
+			       void                       *userdata);
+
+#endif /* __PPPOAT_HTTP_H__ */
@@ -0,0 +1,498 @@
+/* hub.c
+ * PPP over Any Transport -- Multi-client hub
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>	/* memcmp */
+#include <unistd.h>	/* getpid */
+#include <netinet/in.h>
+
+#include "trace.h"
+#include "hub.h"
+#include "log.h"
+#include "memory.h"
+#include "util.h"
+
+#define HUB_BUCKETS_MIN 64
+
+/* Ethernet header, frames shorter than the minimum are padded */
+#define HUB_ETH_HLEN     14
+#define HUB_VLAN_HLEN    4
+#define HUB_ETH_DATA_MAX 1500
+#define HUB_FRAME_MIN    60
+
+static uint32_t hub_fnv1a(uint32_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len-- > 0)
+		hash = (hash ^ *p++) * 16777619U;
+	return hash;
+}
+
+static uint32_t hub_hash(const struct pppoat_hub     *hub,
+			 const struct sockaddr_storage *ss)
+{
+	const struct sockaddr_in  *sin  = (const struct sockaddr_in *)ss;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+	uint32_t                   hash = 2166136261U ^ hub->hub_seed;
+
+	if (ss->ss_family == AF_INET) {
+		hash = hub_fnv1a(hash, &sin->sin_addr, sizeof(sin->sin_addr));
+		hash = hub_fnv1a(hash, &sin->sin_port, sizeof(sin->sin_port));
+	} else {
+		hash = hub_fnv1a(hash, &sin6->sin6_addr,
+				 sizeof(sin6->sin6_addr));
+		hash = hub_fnv1a(hash, &sin6->sin6_port,
+				 sizeof(sin6->sin6_port));
+	}
+	return hash;
+}
+
+static bool hub_addr_eq(const struct sockaddr_storage *ss1,
+			const struct sockaddr_storage *ss2)
+{
+	const struct sockaddr_in  *a4 = (const struct sockaddr_in *)ss1;
+	const struct sockaddr_in  *b4 = (const struct sockaddr_in *)ss2;
+	const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)ss1;
+	const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)ss2;
+
+	if (ss1->ss_family != ss2->ss_family)
+		return false;
+	if (ss1->ss_family == AF_INET)
+		return a4->sin_port == b4->sin_port &&
+		       a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	return a6->sin6_port == b6->sin6_port &&
+	       memcmp(&a6->sin6_addr, &b6->sin6_addr,
+		      sizeof(a6->sin6_addr)) == 0;
+}
+
+static struct pppoat_hub_sess **hub_bucket(struct pppoat_hub *hub,
+					   uint32_t           hash)
+{
+	return &hub->hub_buckets[hash & (hub->hub_buckets_nr - 1)];
+}
+
+int pppoat_hub_init(struct pppoat_hub *hub,
+		    size_t             max,
+		    uint64_t           timeout,
+		    unsigned int       plen4,
+		    unsigned int       plen6)
+{
+	memset(hub, 0, sizeof(*hub));
+	hub->hub_buckets_nr = HUB_BUCKETS_MIN;
+	hub->hub_buckets    = pppoat_calloc(hub->hub_buckets_nr,
+					    sizeof(*hub->hub_buckets));
+	if (hub->hub_buckets == NULL)
+		return P_ERR(-ENOMEM);
+
+	hub->hub_max     = max;
+	hub->hub_timeout = timeout;
+	hub->hub_plen4   = pppoat_min(plen4, 32);
+	hub->hub_plen6   = pppoat_min(plen6, 128);
+	/* Clients must not be able to predict bucket of an address */
+	hub->hub_seed    = (uint32_t)pppoat_util_time_us() ^
+			   ((uint32_t)getpid() << 16);
+	hub->hub_expire_next = timeout == 0 ? PPPOAT_TIME_NEVER :
+			       pppoat_util_time_us() + timeout;
+	pppoat_lpm_init(&hub->hub_routes4);
+	pppoat_lpm_init(&hub->hub_routes6);
+
+	return 0;
+}
+
+static struct pppoat_lpm *hub_routes(struct pppoat_hub *hub, int family)
+{
+	return family == AF_INET ? &hub->hub_routes4 : &hub->hub_routes6;
+}
+
+static void hub_route_del(struct pppoat_hub      *hub,
+			  struct pppoat_hub_sess *sess,
+			  unsigned int            idx)
+{
+	struct pppoat_hub_route *route = &sess->hs_routes[idx];
+
+	(void)pppoat_lpm_delete(hub_routes(hub, route->hr_family),
+				route->hr_key, route->hr_len);
+	--sess->hs_routes_nr;
+	memmove(route, route + 1, (sess->hs_routes_nr - idx) * sizeof(*route));
+}
+
+static void hub_sess_free(struct pppoat_hub *hub, struct pppoat_hub_sess *sess)
+{
+	while (sess->hs_routes_nr > 0)
+		hub_route_del(hub, sess, sess->hs_routes_nr - 1);
+	if (hub->hub_switch)
+		pppoat_fdb_port_del(&hub->hub_fdb, sess);
+	pppoat_free(sess);
+	--hub->hub_nr;
+}
+
+void pppoat_hub_fini(struct pppoat_hub *hub)
+{
+	struct pppoat_hub_sess *sess;
+	size_t                  i;
+
+	for (i = 0; i < hub->hub_buckets_nr; ++i) {
+		while ((sess = hub->hub_buckets[i]) != NULL) {
+			hub->hub_buckets[i] = sess->hs_next;
+			hub_sess_free(hub, sess);
+		}
+	}
+	PPPOAT_ASSERT(hub->hub_nr == 0);
+	pppoat_lpm_fini(&hub->hub_routes4);
+	pppoat_lpm_fini(&hub->hub_routes6);
+	if (hub->hub_switch)
+		pppoat_fdb_fini(&hub->hub_fdb);
+	pppoat_free(hub->hub_buckets);
+}
+
+int pppoat_hub_switch_init(struct pppoat_hub *hub,
+			   size_t             max,
+			   uint64_t           ageing)
+{
+	int rc;
+
+	rc = pppoat_fdb_init(&hub->hub_fdb, max, ageing);
+	hub->hub_switch = rc == 0;
+	if (rc == 0 && ageing != 0)
+		hub->hub_expire_next = pppoat_min(hub->hub_expire_next,
+				pppoat_util_time_us() + ageing);
+	return rc;
+}
+
+/* Doubles number of buckets, the table stays usable on failure. */
+static void hub_grow(struct pppoat_hub *hub)
+{
+	struct pppoat_hub_sess **old    = hub->hub_buckets;
+	size_t                   old_nr = hub->hub_buckets_nr;
+	struct pppoat_hub_sess  *sess;
+	struct pppoat_hub_sess **bucket;
+	size_t                   i;
+
+	hub->hub_buckets = pppoat_calloc(old_nr * 2, sizeof(*old));
+	if (hub->hub_buckets == NULL) {
+		hub->hub_buckets = old;
+		return;
+	}
+	hub->hub_buckets_nr = old_nr * 2;
+	for (i = 0; i < old_nr; ++i) {
+		while ((sess = old[i]) != NULL) {
+			old[i]        = sess->hs_next;
+			bucket        = hub_bucket(hub, sess->hs_hash);
+			sess->hs_next = *bucket;
+			*bucket       = sess;
+		}
+	}
+	pppoat_free(old);
+}
+
+struct pppoat_hub_sess *pppoat_hub_sess_get(struct pppoat_hub     *hub,
+					    const struct sockaddr *addr,
+					    socklen_t              addrlen,
+					    uint64_t               now)
+{
+	struct sockaddr_storage  ss;
+	struct pppoat_hub_sess  *sess;
+	struct pppoat_hub_sess **bucket;
+	uint32_t                 hash;
+
+	if ((addr->sa_family != AF_INET && addr->sa_family != AF_INET6) ||
+	    addrlen > sizeof(ss))
+		return NULL;
+
+	memset(&ss, 0, sizeof(ss));
+	memcpy(&ss, addr, addrlen);
+	hash   = hub_hash(hub, &ss);
+	bucket = hub_bucket(hub, hash);
+	for (sess = *bucket; sess != NULL; sess = sess->hs_next) {
+		if (sess->hs_hash == hash && hub_addr_eq(&sess->hs_addr, &ss)) {
+			sess->hs_last = now;
+			return sess;
+		}
+	}
+
+	if (hub->hub_nr >= hub->hub_max) {
+		++hub->hub_rejected;
+		return NULL;
+	}
+	sess = pppoat_calloc(1, sizeof(*sess));
+	if (sess == NULL)
+		return NULL;
+	sess->hs_addr    = ss;
+	sess->hs_addrlen = addrlen;
+	sess->hs_hash    = hash;
+	sess->hs_last    = now;
+	sess->hs_next    = *bucket;
+	*bucket          = sess;
+	++hub->hub_nr;
+	if (hub->hub_nr > hub->hub_buckets_nr)
+		hub_grow(hub);
+
+	return sess;
+}
+
+/*
+ * Extracts source or destination address of an IP packet.
+ * Returns address family or 0 if the packet is malformed.
+ */
+static int hub_pkt_addr(const unsigned char *pkt,
+			size_t               len,
+			bool                 src,
+			uint8_t             *key)
+{
+	if (len >= 20 && pkt[0] >> 4 == 4) {
+		memcpy(key, pkt + (src ? 12 : 16), 4);
+		return AF_INET;
+	}
+	if (len >= 40 && pkt[0] >> 4 == 6) {
+		memcpy(key, pkt + (src ? 8 : 24), 16);
+		return AF_INET6;
+	}
+	return 0;
+}
+
+static bool hub_sess_is_live(const struct pppoat_hub      *hub,
+			     const struct pppoat_hub_sess *sess,
+			     uint64_t                      now)
+{
+	return hub->hub_timeout == 0 || now - sess->hs_last < hub->hub_timeout;
+}
+
+int pppoat_hub_learn(struct pppoat_hub      *hub,
+		     struct pppoat_hub_sess *sess,
+		     const unsigned char    *pkt,
+		     size_t                  len)
+{
+	struct pppoat_hub_route *route;
+	struct pppoat_hub_sess  *owner;
+	struct pppoat_lpm       *lpm;
+	uint8_t                  key[PPPOAT_LPM_KEY_BITS / 8] = {};
+	unsigned int             plen;
+	unsigned int             i;
+	int                      family;
+	int                      rc;
+
+	family = hub_pkt_addr(pkt, len, true, key);
+	if (family == 0)
+		return 0;
+	plen = family == AF_INET ? hub->hub_plen4 : hub->hub_plen6;
+	for (i = plen; i < PPPOAT_LPM_KEY_BITS; ++i)
+		key[i / 8] &= ~(0x80 >> (i % 8));
+
+	for (i = 0; i < sess->hs_routes_nr; ++i) {
+		route = &sess->hs_routes[i];
+		if (route->hr_family == family && route->hr_len == plen &&
+		    memcmp(route->hr_key, key, sizeof(key)) == 0)
+			return 0;
+	}
+
+	/*
+	 * Client moved to another transport address. A live session keeps its
+	 * prefix, otherwise anyone could take it over with a spoofed inner
+	 * source. The prefix moves when the old session expires.
+	 */
+	lpm   = hub_routes(hub, family);
+	owner = pppoat_lpm_lookup(lpm, key, plen);
+	if (owner != NULL && owner != sess &&
+	    hub_sess_is_live(hub, owner, sess->hs_last)) {
+		++hub->hub_refused;
+		return -EACCES;
+	}
+	owner = pppoat_lpm_delete(lpm, key, plen);
+	for (i = 0; owner != NULL && i < owner->hs_routes_nr; ++i) {
+		route = &owner->hs_routes[i];
+		if (route->hr_family == family && route->hr_len == plen &&
+		    memcmp(route->hr_key, key, sizeof(key)) == 0) {
+			--owner->hs_routes_nr;
+			memmove(route, route + 1,
+				(owner->hs_routes_nr - i) * sizeof(*route));
+			break;
+		}
+	}
+	if (sess->hs_routes_nr == PPPOAT_HUB_ROUTES_MAX)
+		hub_route_del(hub, sess, 0);
+
+	rc = pppoat_lpm_insert(lpm, key, plen, sess);
+	if (rc == 0) {
+		route = &sess->hs_routes[sess->hs_routes_nr++];
+		route->hr_family = family;
+		route->hr_len    = plen;
+		memcpy(route->hr_key, key, sizeof(key));
+	}
+	return rc;
+}
+
+struct pppoat_hub_sess *pppoat_hub_route(struct pppoat_hub   *hub,
+					 const unsigned char *pkt,
+					 size_t               len)
+{
+	struct pppoat_hub_sess *sess = NULL;
+	uint8_t                 key[PPPOAT_LPM_KEY_BITS / 8];
+	int                     family;
+
+	family = hub_pkt_addr(pkt, len, false, key);
+	if (family != 0)
+		sess = pppoat_lpm_lookup(hub_routes(hub, family), key,
+					 family == AF_INET ? 32 : 128);
+	if (sess == NULL)
+		++hub->hub_unrouted;
+
+	return sess;
+}
+
+enum pppoat_hub_fwd pppoat_hub_switch(struct pppoat_hub       *hub,
+				      struct pppoat_hub_sess  *from,
+				      const unsigned char     *frame,
+				      size_t                   len,
+				      uint64_t                 now,
+				      struct pppoat_hub_sess **to)
+{
+	void *port;
+
+	PPPOAT_ASSERT(hub->hub_switch);
+
+	if (len < HUB_ETH_HLEN)
+		return PPPOAT_HUB_FWD_NONE;
+	pppoat_fdb_learn(&hub->hub_fdb, frame + 6, from, now);
+	if ((frame[0] & 0x01) != 0 ||
+	    !pppoat_fdb_lookup(&hub->hub_fdb, frame, now, &port)) {
+		++hub->hub_flooded;
+		return PPPOAT_HUB_FWD_FLOOD;
+	}
+	if (port == from)
+		return PPPOAT_HUB_FWD_NONE;
+	*to = port;
+	return port == NULL ? PPPOAT_HUB_FWD_IF : PPPOAT_HUB_FWD_SESS;
+}
+
+struct pppoat_hub_sess *pppoat_hub_sess_next(struct pppoat_hub      *hub,
+					     struct pppoat_hub_sess *sess)
+{
+	size_t i = 0;
+
+	if (sess != NULL && sess->hs_next != NULL)
+		return sess->hs_next;
+	if (sess != NULL)
+		i = (sess->hs_hash & (hub->hub_buckets_nr - 1)) + 1;
+	for (; i < hub->hub_buckets_nr; ++i)
+		if (hub->hub_buckets[i] != NULL)
+			return hub->hub_buckets[i];
+	return NULL;
+}
+
+void pppoat_hub_expire(struct pppoat_hub *hub, uint64_t now)
+{
+	struct pppoat_hub_sess **pp;
+	struct pppoat_hub_sess  *sess;
+	size_t                   i;
+
+	if (now < hub->hub_expire_next)
+		return;
+
+	for (i = 0; hub->hub_timeout != 0 && i < hub->hub_buckets_nr; ++i) {
+		pp = &hub->hub_buckets[i];
+		while ((sess = *pp) != NULL) {
+			if (now - sess->hs_last < hub->hub_timeout) {
+				pp = &sess->hs_next;
+				continue;
+			}
+			*pp = sess->hs_next;
+			hub_sess_free(hub, sess);
+			++hub->hub_expired;
+		}
+	}
+	/* Session lives between timeout and 1.25 * timeout */
+	hub->hub_expire_next = hub->hub_timeout == 0 ? PPPOAT_TIME_NEVER :
+			       now + pppoat_max(hub->hub_timeout / 4, 1);
+	if (hub->hub_switch && hub->hub_fdb.fdb_ageing != 0) {
+		pppoat_fdb_expire(&hub->hub_fdb, now);
+		hub->hub_expire_next = pppoat_min(hub->hub_expire_next,
+			now + pppoat_max(hub->hub_fdb.fdb_ageing / 4, 1));
+	}
+}
+
+uint64_t pppoat_hub_deadline(const struct pppoat_hub *hub)
+{
+	return hub->hub_expire_next;
+}
+
+ssize_t pppoat_hub_pkt_len(const unsigned char *buf, size_t len)
+{
+	size_t pkt_len;
+
+	if (len == 0)
+		return 0;
+	switch (buf[0] >> 4) {
+	case 4:
+		if (len < 4)
+			return 0;
+		pkt_len = (size_t)buf[2] << 8 | buf[3];
+		return pkt_len < 20 ? -1 : (ssize_t)pkt_len;
+	case 6:
+		if (len < 6)
+			return 0;
+		pkt_len = (size_t)buf[4] << 8 | buf[5];
+		return (ssize_t)pkt_len + 40;
+	default:
+		return -1;
+	}
+}
+
+ssize_t pppoat_hub_frame_len(const unsigned char *buf, size_t len)
+{
+	size_t       hlen = HUB_ETH_HLEN;
+	unsigned int type;
+	ssize_t      flen;
+
+	if (len < hlen)
+		return 0;
+	type = (unsigned int)buf[12] << 8 | buf[13];
+	/* 802.1Q and 802.1ad tags, the type follows them */
+	while (type == 0x8100 || type == 0x88a8) {
+		hlen += HUB_VLAN_HLEN;
+		if (hlen > HUB_ETH_HLEN + 2 * HUB_VLAN_HLEN)
+			return -1;
+		if (len < hlen)
+			return 0;
+		type = (unsigned int)buf[hlen - 2] << 8 | buf[hlen - 1];
+	}
+	switch (type) {
+	case 0x0800:
+	case 0x86dd:
+		flen = pppoat_hub_pkt_len(buf + hlen, len - hlen);
+		if (flen <= 0)
+			return flen;
+		flen += hlen;
+		break;
+	case 0x0806:
+		flen = hlen + 28;
+		break;
+	default:
+		/* 802.3 frames have length of the payload instead of type */
+		if (type > HUB_ETH_DATA_MAX)
+			return -1;
+		flen = hlen + type;
+		break;
+	}
+	/* Padding is zeroes, a frame starts with non-zero destination */
+	while ((size_t)flen < HUB_FRAME_MIN + hlen - HUB_ETH_HLEN &&
+	       (size_t)flen < len && buf[flen] == 0)
+		++flen;
+	return flen;
+}
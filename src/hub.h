@@ -0,0 +1,161 @@
+/* hub.h
+ * PPP over Any Transport -- Multi-client hub
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_HUB_H__
+#define __PPPOAT_HUB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "fdb.h"
+#include "lpm.h"
+
+/*
+ * Hub serves many clients over one socket and one interface. Sessions are
+ * found by the client's transport address for inbound traffic. Routes to
+ * sessions are learned from inner source addresses of inbound packets,
+ * outbound packets are routed by inner destination with longest prefix
+ * match. Idle sessions expire together with their routes.
+ *
+ * In switch mode the hub carries Ethernet frames instead and acts as a
+ * learning switch between the interface and the clients: source MAC
+ * addresses are bound to the session or to the interface they came from,
+ * frames are forwarded to the single port behind the destination. Only
+ * group and unknown destinations are flooded.
+ */
+
+#define PPPOAT_HUB_ROUTES_MAX 4
+
+struct pppoat_hub_route {
+	int          hr_family;
+	uint8_t      hr_key[PPPOAT_LPM_KEY_BITS / 8];
+	unsigned int hr_len;
+};
+
+struct pppoat_hub_sess {
+	struct sockaddr_storage  hs_addr;
+	socklen_t                hs_addrlen;
+	uint32_t                 hs_hash;
+	uint64_t                 hs_last;
+	struct pppoat_hub_sess  *hs_next;
+	struct pppoat_hub_route  hs_routes[PPPOAT_HUB_ROUTES_MAX];
+	unsigned int             hs_routes_nr;
+	unsigned long            hs_rx;
+	unsigned long            hs_tx;
+};
+
+struct pppoat_hub {
+	struct pppoat_hub_sess **hub_buckets;
+	size_t                   hub_buckets_nr;
+	size_t                   hub_nr;
+	size_t                   hub_max;
+	uint32_t                 hub_seed;
+	uint64_t                 hub_timeout;
+	uint64_t                 hub_expire_next;
+	/* Learned routes are prefixes of this length */
+	unsigned int             hub_plen4;
+	unsigned int             hub_plen6;
+	struct pppoat_lpm        hub_routes4;
+	struct pppoat_lpm        hub_routes6;
+	bool                     hub_switch;
+	struct pppoat_fdb        hub_fdb;
+	/* Counters */
+	unsigned long            hub_rejected;
+	unsigned long            hub_expired;
+	unsigned long            hub_unrouted;
+	/* Inner sources owned by another live session */
+	unsigned long            hub_refused;
+	unsigned long            hub_flooded;
+};
+
+enum pppoat_hub_fwd {
+	/* Destination is behind the port the frame came from */
+	PPPOAT_HUB_FWD_NONE,
+	PPPOAT_HUB_FWD_IF,
+	PPPOAT_HUB_FWD_SESS,
+	/* The interface and all sessions except the source */
+	PPPOAT_HUB_FWD_FLOOD,
+};
+
+int pppoat_hub_init(struct pppoat_hub *hub,
+		    size_t             max,
+		    uint64_t           timeout,
+		    unsigned int       plen4,
+		    unsigned int       plen6);
+void pppoat_hub_fini(struct pppoat_hub *hub);
+/* Turns on switch mode, up to max MAC addresses are remembered. */
+int pppoat_hub_switch_init(struct pppoat_hub *hub,
+			   size_t             max,
+			   uint64_t           ageing);
+
+/*
+ * Returns session of the client, creates one if it doesn't exist.
+ * Returns NULL when the table is full.
+ */
+struct pppoat_hub_sess *pppoat_hub_sess_get(struct pppoat_hub     *hub,
+					    const struct sockaddr *addr,
+					    socklen_t              addrlen,
+					    uint64_t               now);
+/*
+ * Routes the inner source of an inbound packet to the session. Returns
+ * -EACCES when the source belongs to another live session, the packet
+ * must be dropped then.
+ */
+int pppoat_hub_learn(struct pppoat_hub      *hub,
+		     struct pppoat_hub_sess *sess,
+		     const unsigned char    *pkt,
+		     size_t                  len);
+/* Returns session for the inner destination of a packet or NULL. */
+struct pppoat_hub_sess *pppoat_hub_route(struct pppoat_hub   *hub,
+					 const unsigned char *pkt,
+					 size_t               len);
+
+/*
+ * Learns the source of a frame and decides where it goes. from is NULL
+ * for frames read from the interface. *to is set for PPPOAT_HUB_FWD_SESS.
+ */
+enum pppoat_hub_fwd pppoat_hub_switch(struct pppoat_hub       *hub,
+				      struct pppoat_hub_sess  *from,
+				      const unsigned char     *frame,
+				      size_t                   len,
+				      uint64_t                 now,
+				      struct pppoat_hub_sess **to);
+/* Iterates over sessions, starts with NULL and ends with NULL. */
+struct pppoat_hub_sess *pppoat_hub_sess_next(struct pppoat_hub      *hub,
+					     struct pppoat_hub_sess *sess);
+
+/* Removes sessions which were idle for longer than the timeout. */
+void pppoat_hub_expire(struct pppoat_hub *hub, uint64_t now);
+uint64_t pppoat_hub_deadline(const struct pppoat_hub *hub);
+
+/*
+ * Returns length of the IP packet at the start of buf, 0 if buf doesn't
+ * hold a whole header or -1 if it isn't an IP packet.
+ */
+ssize_t pppoat_hub_pkt_len(const unsigned char *buf, size_t len);
+/*
+ * Same for Ethernet frames. IP, ARP and 802.3 frames are recognised, with
+ * up to two VLAN tags. Returns -1 for other types, their end is unknown.
+ */
+ssize_t pppoat_hub_frame_len(const unsigned char *buf, size_t len);
+
+#endif /* __PPPOAT_HUB_H__ */
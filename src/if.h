@@ -35,6 +35,19 @@ struct pppoat_if_module {
 	void      (*im_fini)(void *userdata);
 	int       (*im_run)(int rd, int wr, void *userdata);
 	int       (*im_stop)(void *userdata);
+	/* Optional, called by transport when path MTU changes */
+	int       (*im_mtu_set)(void *userdata, unsigned int mtu);
+	/*
+	 * Optional, number of queues. Every queue gets its own im_run() call
+	 * and its own transport instance.
+	 */
+	unsigned  (*im_queues)(void *userdata);
 };
 
+/*
+ * Sets MTU of the running interface. Transport passes the largest packet
+ * it can carry without fragmentation of the underlay.
+ */
+int pppoat_if_mtu_set(unsigned int mtu);
+
 #endif /* __PPPOAT_IF_H__ */
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
@@ -29,16 +30,43 @@
 
 #include "trace.h"
 #include "conf.h"
+#include "hdlc.h"
 #include "if_pppd.h"
 #include "if.h"
 #include "log.h"
 #include "memory.h"
+#include "record.h"
 #include "util.h"
 
+/*
+ * pppd speaks asynchronous HDLC on its stdin/stdout. By default the
+ * framing is stripped locally: only raw PPP frames in checked records
+ * (see record.h) go to the transport and the peer frames them again for
+ * its pppd. With ppp.hdlc=1 the HDLC stream is passed verbatim, both
+ * sides must agree.
+ */
+#define PPPD_BUF_SIZE 4096
+
 struct pppd_ctx {
-	const char *pc_pppd;
-	const char *pc_ip;
-	pid_t       pc_pid;
+	const char        *pc_pppd;
+	const char        *pc_ip;
+	pid_t              pc_pid;
+	bool               pc_hdlc;
+	/* Transport side */
+	int                pc_rd;
+	int                pc_wr;
+	/* pppd's stdin and stdout */
+	int                pc_in;
+	int                pc_out;
+	int                pc_stop[2];
+	pthread_t          pc_thread;
+	struct pppoat_hdlc   pc_dec;
+	struct pppoat_record pc_rec;
+	unsigned char       *pc_buf;
+	unsigned char       *pc_enc;
+	unsigned char       *pc_frame;
+	/* Counters */
+	unsigned long        pc_dropped;
 };
 
 static const char *pppd_paths[] = {
@@ -66,18 +94,51 @@ static const char *pppd_find(void)
 	return i < ARRAY_SIZE(pppd_paths) ? pppd_paths[i] : NULL;
 }
 
+static void pppd_bufs_free(struct pppd_ctx *ctx)
+{
+	pppoat_hdlc_fini(&ctx->pc_dec);
+	pppoat_record_fini(&ctx->pc_rec);
+	pppoat_free(ctx->pc_buf);
+	pppoat_free(ctx->pc_enc);
+	pppoat_free(ctx->pc_frame);
+}
+
+static int pppd_bufs_alloc(struct pppd_ctx *ctx)
+{
+	int rc;
+
+	rc = pppoat_hdlc_init(&ctx->pc_dec, PPPOAT_HDLC_MRU_MAX);
+	rc = rc ?: pppoat_record_init(&ctx->pc_rec, ctx->pc_dec.hd_size);
+	if (rc != 0) {
+		pppoat_hdlc_fini(&ctx->pc_dec);
+		return rc;
+	}
+	ctx->pc_buf   = pppoat_alloc(PPPD_BUF_SIZE);
+	ctx->pc_enc   = pppoat_alloc(PPPOAT_HDLC_ENC_MAX(ctx->pc_dec.hd_size));
+	ctx->pc_frame = pppoat_alloc(PPPOAT_RECORD_LEN(ctx->pc_dec.hd_size));
+	if (ctx->pc_buf == NULL || ctx->pc_enc == NULL ||
+	    ctx->pc_frame == NULL) {
+		pppd_bufs_free(ctx);
+		return P_ERR(-ENOMEM);
+	}
+	return 0;
+}
+
 static int if_module_pppd_init(struct pppoat_conf *conf, void **userdata)
 {
 	struct pppd_ctx *ctx;
 	const char      *obj;
 	int              rc;
 
-	ctx = pppoat_alloc(sizeof(*ctx));
+	ctx = pppoat_calloc(1, sizeof(*ctx));
 	rc  = ctx == NULL ? P_ERR(-ENOMEM) : 0;
 	if (rc == 0) {
 		ctx->pc_ip   = NULL;
 		ctx->pc_pppd = pppd_find();
+		ctx->pc_hdlc = pppoat_conf_obj_is_true(
+					pppoat_conf_get(conf, "ppp.hdlc"));
 		rc = ctx->pc_pppd == NULL ? P_ERR(-ENOENT) : 0;
+		rc = rc ?: ctx->pc_hdlc ? 0 : pppd_bufs_alloc(ctx);
 		if (rc != 0)
 			pppoat_free(ctx);
 	}
@@ -94,7 +155,108 @@ static int if_module_pppd_init(struct pppoat_conf *conf, void **userdata)
 
 static void if_module_pppd_fini(void *userdata)
 {
-	pppoat_free(userdata);
+	struct pppd_ctx *ctx = userdata;
+
+	if (!ctx->pc_hdlc) {
+		pppoat_debug("pppd", "HDLC: frames=%lu bad_fcs=%lu "
+			     "too_long=%lu, dropped=%lu malformed=%lu",
+			     ctx->pc_dec.hd_frames, ctx->pc_dec.hd_bad_fcs,
+			     ctx->pc_dec.hd_too_long, ctx->pc_dropped,
+			     ctx->pc_rec.re_bad);
+		pppd_bufs_free(ctx);
+	}
+	pppoat_free(ctx);
+}
+
+/* A frame which doesn't fit is dropped, PPP copes with loss like a line. */
+static int pppd_frame_write(struct pppd_ctx *ctx,
+			    int              fd,
+			    unsigned char   *buf,
+			    size_t           len)
+{
+	int rc;
+
+	rc = pppoat_util_write_frame(fd, buf, len);
+	if (rc == -EAGAIN) {
+		++ctx->pc_dropped;
+		rc = 0;
+	}
+	return rc;
+}
+
+/* Sends a frame decoded from pppd's output to the transport. */
+static int pppd_frame_deliver(void *userdata, unsigned char *frame, size_t len)
+{
+	struct pppd_ctx *ctx = userdata;
+
+	memcpy(ctx->pc_frame + PPPOAT_RECORD_HDR, frame, len);
+
+	return pppd_frame_write(ctx, ctx->pc_wr, ctx->pc_frame,
+				pppoat_record_seal(ctx->pc_frame, len));
+}
+
+static int pppd_output_read(struct pppd_ctx *ctx)
+{
+	ssize_t len;
+
+	len = read(ctx->pc_out, ctx->pc_buf, PPPD_BUF_SIZE);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : P_ERR(-errno);
+	if (len == 0)
+		return -EPIPE;
+
+	return pppoat_hdlc_decode(&ctx->pc_dec, ctx->pc_buf, len,
+				  &pppd_frame_deliver, ctx);
+}
+
+/* Frames a packet from the transport for pppd. */
+static int pppd_input_frame(void *userdata, unsigned char *frame, size_t len)
+{
+	struct pppd_ctx *ctx = userdata;
+	size_t           elen;
+
+	elen = pppoat_hdlc_encode(frame, len, ctx->pc_enc);
+	return pppd_frame_write(ctx, ctx->pc_in, ctx->pc_enc, elen);
+}
+
+static int pppd_input_write(struct pppd_ctx *ctx)
+{
+	return pppoat_record_read(&ctx->pc_rec, ctx->pc_rd,
+				  &pppd_input_frame, ctx);
+}
+
+static void *pppd_thread(void *userdata)
+{
+	struct pppd_ctx *ctx  = userdata;
+	int              stop = ctx->pc_stop[0];
+	fd_set           rfds;
+	int              max;
+	int              rc   = 0;
+
+	max = pppoat_max(pppoat_max(ctx->pc_rd, ctx->pc_out), stop);
+	while (rc == 0) {
+		FD_ZERO(&rfds);
+		FD_SET(ctx->pc_rd, &rfds);
+		FD_SET(ctx->pc_out, &rfds);
+		FD_SET(stop, &rfds);
+		rc = pppoat_util_select(max, &rfds, NULL);
+		PPPOAT_ASSERT(rc >= 0);
+		rc = 0;
+
+		if (FD_ISSET(stop, &rfds))
+			break;
+		if (FD_ISSET(ctx->pc_out, &rfds))
+			rc = pppd_output_read(ctx);
+		if (rc == 0 && FD_ISSET(ctx->pc_rd, &rfds))
+			rc = pppd_input_write(ctx);
+	}
+	if (rc != 0 && rc != -EPIPE)
+		pppoat_error("pppd", "Framing failed, rc=%d", rc);
+	/* Let the transport see that the interface is gone */
+	close(ctx->pc_wr);
+	ctx->pc_wr = -1;
+
+	return NULL;
 }
 
 static int if_module_pppd_run(int rd, int wr, void *userdata)
@@ -102,12 +264,32 @@ static int if_module_pppd_run(int rd, int wr, void *userdata)
 	struct pppd_ctx *ctx  = userdata;
 	const char      *pppd = ctx->pc_pppd;
 	const char      *ip   = ctx->pc_ip;
+	int              in[2];
+	int              out[2];
 	pid_t            pid;
 	int              rc;
 
+	if (!ctx->pc_hdlc) {
+		rc = pipe(in);
+		PPPOAT_ASSERT(rc == 0);
+		rc = pipe(out);
+		PPPOAT_ASSERT(rc == 0);
+		rc = pipe(ctx->pc_stop);
+		PPPOAT_ASSERT(rc == 0);
+	}
 	pid = fork();
 	PPPOAT_ASSERT(pid >= 0);
 	if (pid == 0) {
+		if (!ctx->pc_hdlc) {
+			close(rd);
+			close(wr);
+			close(in[1]);
+			close(out[0]);
+			close(ctx->pc_stop[0]);
+			close(ctx->pc_stop[1]);
+			rd = in[0];
+			wr = out[1];
+		}
 		rc = dup2(rd, 0);
 		PPPOAT_ASSERT(rc >= 0);
 		rc = dup2(wr, 1);
@@ -123,6 +305,23 @@ static int if_module_pppd_run(int rd, int wr, void *userdata)
 		exit(1);
 	}
 	ctx->pc_pid = pid;
+	if (ctx->pc_hdlc)
+		return 0;
+
+	close(in[0]);
+	close(out[1]);
+	ctx->pc_in  = in[1];
+	ctx->pc_out = out[0];
+	ctx->pc_rd  = dup(rd);
+	ctx->pc_wr  = dup(wr);
+	PPPOAT_ASSERT(ctx->pc_rd != -1);
+	PPPOAT_ASSERT(ctx->pc_wr != -1);
+	/* A stalled side costs frames instead of blocking the other one */
+	rc = pppoat_util_fd_nonblock_set(ctx->pc_in, true);
+	rc = rc ?: pppoat_util_fd_nonblock_set(ctx->pc_wr, true);
+	PPPOAT_ASSERT(rc == 0);
+	rc = pthread_create(&ctx->pc_thread, NULL, &pppd_thread, ctx);
+	PPPOAT_ASSERT(rc == 0);
 
 	return 0;
 }
@@ -139,6 +338,18 @@ static int if_module_pppd_stop(void *userdata)
 		pid = waitpid(ctx->pc_pid, NULL, 0);
 	} while (pid < 0 && errno == EINTR);
 	PPPOAT_ASSERT(pid > 0);
+	if (ctx->pc_hdlc)
+		return 0;
+
+	rc = write(ctx->pc_stop[1], "", 1);
+	PPPOAT_ASSERT(rc == 1);
+	rc = pthread_join(ctx->pc_thread, NULL);
+	PPPOAT_ASSERT(rc == 0);
+	close(ctx->pc_stop[0]);
+	close(ctx->pc_stop[1]);
+	close(ctx->pc_in);
+	close(ctx->pc_out);
+	close(ctx->pc_rd);
 
 	return 0;
 }
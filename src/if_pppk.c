@@ -0,0 +1,373 @@
+/* if_pppk.c
+ * PPP over Any Transport -- Kernel PPP network interface module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>	/* htons */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/if_pppox.h>
+#include <linux/if_tun.h>
+#include <linux/ppp-ioctl.h>
+
+#include "trace.h"
+#include "conf.h"
+#include "if_pppk.h"
+#include "if.h"
+#include "log.h"
+#include "memory.h"
+#include "record.h"
+#include "util.h"
+
+/*
+ * The kernel PPP generic layer has no channel which user space can feed
+ * directly, so the module borrows PPPoE: a private TAP device carries a
+ * single PPPoE session and the PPPoE channel is connected to a new PPP
+ * unit through /dev/ppp. The kernel adds and strips PPP protocol field,
+ * pppoat only swaps the 20 bytes of Ethernet and PPPoE headers for a
+ * checked record (see record.h) on the transport side. There is no pppd
+ * and no LCP/IPCP, the unit passes IPv4 and IPv6 as soon as it is
+ * configured, e.g.:
+ *
+ *   ip addr add 10.0.0.1 peer 10.0.0.2 dev ppp0 && ip link set ppp0 up
+ */
+
+#define PPPK_ETH_HLEN  14
+#define PPPK_PPPOE_LEN (PPPK_ETH_HLEN + sizeof(struct pppoe_hdr))
+#define PPPK_SID       1
+#define PPPK_MTU       1500
+#define PPPK_BUF_SIZE  4096
+
+static const char *pppk_tun_path = "/dev/net/tun";
+static const char *pppk_ppp_path = "/dev/ppp";
+
+/* Locally administered address of the imaginary PPPoE server */
+static const unsigned char pppk_peer_mac[ETH_ALEN] = {
+	0x02, 0x00, 0x5e, 0x00, 0x00, 0x01,
+};
+
+struct pppk_ctx {
+	char           pk_tap_name[IFNAMSIZ];
+	unsigned char  pk_tap_mac[ETH_ALEN];
+	int            pk_tap;
+	int            pk_sock;
+	int            pk_chan;
+	int            pk_unit;
+	int            pk_unit_nr;
+	/* Transport side */
+	int            pk_rd;
+	int            pk_wr;
+	int            pk_stop[2];
+	pthread_t      pk_thread;
+	unsigned char       *pk_buf;
+	struct pppoat_record pk_rec;
+	/* Counters */
+	unsigned long        pk_dropped;
+	unsigned long        pk_ignored;
+};
+
+static int pppk_tap_open(struct pppk_ctx *ctx)
+{
+	struct ifreq ifr;
+	int          sock;
+	int          rc;
+
+	ctx->pk_tap = open(pppk_tun_path, O_RDWR);
+	if (ctx->pk_tap < 0)
+		return P_ERR(-errno);
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strcpy(ifr.ifr_name, "pppk%d");
+	rc = ioctl(ctx->pk_tap, TUNSETIFF, &ifr);
+	if (rc < 0)
+		return P_ERR(-errno);
+	strcpy(ctx->pk_tap_name, ifr.ifr_name);
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return P_ERR(-errno);
+	/* Room for the PPPoE header, so the unit gets the usual MTU */
+	ifr.ifr_mtu = PPPK_MTU + sizeof(struct pppoe_hdr) + 2;
+	rc = ioctl(sock, SIOCSIFMTU, &ifr);
+	if (rc < 0)
+		pppoat_info("pppk", "Can't set MTU of %s, errno=%d",
+			    ctx->pk_tap_name, errno);
+	rc = ioctl(sock, SIOCGIFHWADDR, &ifr);
+	if (rc == 0) {
+		memcpy(ctx->pk_tap_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+		rc = ioctl(sock, SIOCGIFFLAGS, &ifr);
+	}
+	if (rc == 0) {
+		/* PPPoE needs a running device, nothing else uses it */
+		ifr.ifr_flags |= IFF_UP | IFF_NOARP;
+		rc = ioctl(sock, SIOCSIFFLAGS, &ifr);
+	}
+	rc = rc < 0 ? P_ERR(-errno) : 0;
+	close(sock);
+
+	return rc;
+}
+
+/* Connects PPPoE session on the TAP device to a new PPP unit. */
+static int pppk_unit_create(struct pppk_ctx *ctx)
+{
+	struct sockaddr_pppox   sp;
+	struct sockaddr_storage ss;
+	int                     chan_nr;
+	int                     rc;
+
+	ctx->pk_sock = socket(AF_PPPOX, SOCK_STREAM, PX_PROTO_OE);
+	if (ctx->pk_sock < 0)
+		return P_ERR(-errno);
+	memset(&sp, 0, sizeof(sp));
+	sp.sa_family   = AF_PPPOX;
+	sp.sa_protocol = PX_PROTO_OE;
+	sp.sa_addr.pppoe.sid = htons(PPPK_SID);
+	memcpy(sp.sa_addr.pppoe.remote, pppk_peer_mac, ETH_ALEN);
+	strcpy(sp.sa_addr.pppoe.dev, ctx->pk_tap_name);
+	/* sockaddr_pppox is packed, connect() gets an aligned copy */
+	memcpy(&ss, &sp, sizeof(sp));
+	rc = connect(ctx->pk_sock, (struct sockaddr *)&ss, sizeof(sp));
+	rc = rc ?: ioctl(ctx->pk_sock, PPPIOCGCHAN, &chan_nr);
+	if (rc < 0)
+		return P_ERR(-errno);
+
+	ctx->pk_chan = open(pppk_ppp_path, O_RDWR);
+	ctx->pk_unit = open(pppk_ppp_path, O_RDWR);
+	if (ctx->pk_chan < 0 || ctx->pk_unit < 0)
+		return P_ERR(-errno);
+	ctx->pk_unit_nr = -1;
+	rc = ioctl(ctx->pk_chan, PPPIOCATTCHAN, &chan_nr);
+	rc = rc ?: ioctl(ctx->pk_unit, PPPIOCNEWUNIT, &ctx->pk_unit_nr);
+	rc = rc ?: ioctl(ctx->pk_chan, PPPIOCCONNECT, &ctx->pk_unit_nr);
+
+	return rc < 0 ? P_ERR(-errno) : 0;
+}
+
+static void pppk_close(struct pppk_ctx *ctx)
+{
+	/* Closing the unit destroys pppN */
+	if (ctx->pk_unit >= 0)
+		close(ctx->pk_unit);
+	if (ctx->pk_chan >= 0)
+		close(ctx->pk_chan);
+	if (ctx->pk_sock >= 0)
+		close(ctx->pk_sock);
+	if (ctx->pk_tap >= 0)
+		close(ctx->pk_tap);
+	pppoat_free(ctx->pk_buf);
+	pppoat_record_fini(&ctx->pk_rec);
+}
+
+static int if_module_pppk_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppk_ctx *ctx;
+	int              rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->pk_tap  = -1;
+	ctx->pk_sock = -1;
+	ctx->pk_chan = -1;
+	ctx->pk_unit = -1;
+	/* Room for CRC of the record after the frame */
+	ctx->pk_buf  = pppoat_alloc(PPPK_BUF_SIZE + PPPOAT_RECORD_CRC);
+	rc = ctx->pk_buf == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: pppoat_record_init(&ctx->pk_rec,
+				      PPPK_BUF_SIZE - PPPK_PPPOE_LEN);
+	rc = rc ?: pppk_tap_open(ctx);
+	rc = rc ?: pppk_unit_create(ctx);
+	if (rc != 0) {
+		pppoat_error("pppk", "Kernel PPP is unavailable, needs "
+			     "ppp_generic, pppoe and tun modules");
+		pppk_close(ctx);
+		pppoat_free(ctx);
+		return rc;
+	}
+	pppoat_info("pppk", "Interface ppp%d over %s", ctx->pk_unit_nr,
+		    ctx->pk_tap_name);
+	*userdata = ctx;
+
+	return 0;
+}
+
+static void if_module_pppk_fini(void *userdata)
+{
+	struct pppk_ctx *ctx = userdata;
+
+	pppoat_debug("pppk", "dropped=%lu ignored=%lu malformed=%lu",
+		     ctx->pk_dropped, ctx->pk_ignored, ctx->pk_rec.re_bad);
+	pppk_close(ctx);
+	pppoat_free(ctx);
+}
+
+/* Passes PPP frame of our PPPoE session to the transport. */
+static int pppk_frame_read(struct pppk_ctx *ctx)
+{
+	unsigned char    *buf = ctx->pk_buf;
+	struct pppoe_hdr *ph  = (struct pppoe_hdr *)(buf + PPPK_ETH_HLEN);
+	size_t            plen;
+	ssize_t           len;
+	int               rc;
+
+	len = read(ctx->pk_tap, buf, PPPK_BUF_SIZE);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : P_ERR(-errno);
+	/* IPv6 autoconfiguration and alike may talk on the device too */
+	plen = len < (ssize_t)PPPK_PPPOE_LEN ? 0 : ntohs(ph->length);
+	if (len < (ssize_t)PPPK_PPPOE_LEN ||
+	    (buf[12] << 8 | buf[13]) != ETH_P_PPP_SES ||
+	    ph->code != 0 || ph->sid != htons(PPPK_SID) || plen == 0 ||
+	    plen > len - PPPK_PPPOE_LEN) {
+		++ctx->pk_ignored;
+		return 0;
+	}
+	/* Header of the record replaces the tail of PPPoE header */
+	rc = pppoat_util_write_frame(ctx->pk_wr,
+			buf + PPPK_PPPOE_LEN - PPPOAT_RECORD_HDR,
+			pppoat_record_seal(buf + PPPK_PPPOE_LEN -
+					   PPPOAT_RECORD_HDR, plen));
+	if (rc == -EAGAIN) {
+		++ctx->pk_dropped;
+		rc = 0;
+	}
+	return rc;
+}
+
+static int pppk_frame_write(void *userdata, unsigned char *frame, size_t len)
+{
+	struct pppk_ctx  *ctx = userdata;
+	unsigned char     hdr[PPPK_PPPOE_LEN];
+	struct pppoe_hdr *ph  = (struct pppoe_hdr *)(hdr + PPPK_ETH_HLEN);
+	struct iovec      iov[2];
+	ssize_t           wlen;
+
+	memcpy(hdr, ctx->pk_tap_mac, ETH_ALEN);
+	memcpy(hdr + ETH_ALEN, pppk_peer_mac, ETH_ALEN);
+	hdr[12]    = ETH_P_PPP_SES >> 8;
+	hdr[13]    = ETH_P_PPP_SES & 0xff;
+	ph->ver    = 1;
+	ph->type   = 1;
+	ph->code   = 0;
+	ph->sid    = htons(PPPK_SID);
+	ph->length = htons(len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len  = sizeof(hdr);
+	iov[1].iov_base = frame;
+	iov[1].iov_len  = len;
+
+	wlen = writev(ctx->pk_tap, iov, 2);
+	if (wlen < 0 && errno != EINTR && errno != EAGAIN && errno != EIO)
+		return P_ERR(-errno);
+	if (wlen < 0)
+		++ctx->pk_dropped;
+	return 0;
+}
+
+/* Splits the stream from the transport into frames. */
+static int pppk_transport_read(struct pppk_ctx *ctx)
+{
+	return pppoat_record_read(&ctx->pk_rec, ctx->pk_rd,
+				  &pppk_frame_write, ctx);
+}
+
+static void *pppk_thread(void *userdata)
+{
+	struct pppk_ctx *ctx  = userdata;
+	int              stop = ctx->pk_stop[0];
+	fd_set           rfds;
+	int              max;
+	int              rc   = 0;
+
+	max = pppoat_max(pppoat_max(ctx->pk_rd, ctx->pk_tap), stop);
+	while (rc == 0) {
+		FD_ZERO(&rfds);
+		FD_SET(ctx->pk_rd, &rfds);
+		FD_SET(ctx->pk_tap, &rfds);
+		FD_SET(stop, &rfds);
+		rc = pppoat_util_select(max, &rfds, NULL);
+		PPPOAT_ASSERT(rc >= 0);
+		rc = 0;
+
+		if (FD_ISSET(stop, &rfds))
+			break;
+		if (FD_ISSET(ctx->pk_tap, &rfds))
+			rc = pppk_frame_read(ctx);
+		if (rc == 0 && FD_ISSET(ctx->pk_rd, &rfds))
+			rc = pppk_transport_read(ctx);
+	}
+	if (rc != 0 && rc != -EPIPE)
+		pppoat_error("pppk", "Worker failed, rc=%d", rc);
+	/* Let the transport see that the interface is gone */
+	close(ctx->pk_wr);
+	ctx->pk_wr = -1;
+
+	return NULL;
+}
+
+static int if_module_pppk_run(int rd, int wr, void *userdata)
+{
+	struct pppk_ctx *ctx = userdata;
+	int              rc;
+
+	rc = pipe(ctx->pk_stop);
+	PPPOAT_ASSERT(rc == 0);
+	ctx->pk_rd = dup(rd);
+	ctx->pk_wr = dup(wr);
+	PPPOAT_ASSERT(ctx->pk_rd != -1);
+	PPPOAT_ASSERT(ctx->pk_wr != -1);
+	/* A stalled transport costs frames instead of blocking the kernel */
+	rc = pppoat_util_fd_nonblock_set(ctx->pk_wr, true);
+	PPPOAT_ASSERT(rc == 0);
+	rc = pthread_create(&ctx->pk_thread, NULL, &pppk_thread, ctx);
+	PPPOAT_ASSERT(rc == 0);
+
+	return 0;
+}
+
+static int if_module_pppk_stop(void *userdata)
+{
+	struct pppk_ctx *ctx = userdata;
+	int              rc;
+
+	rc = write(ctx->pk_stop[1], "", 1);
+	PPPOAT_ASSERT(rc == 1);
+	rc = pthread_join(ctx->pk_thread, NULL);
+	PPPOAT_ASSERT(rc == 0);
+	close(ctx->pk_stop[0]);
+	close(ctx->pk_stop[1]);
+	close(ctx->pk_rd);
+
+	return 0;
+}
+
+const struct pppoat_if_module pppoat_if_module_pppk = {
+	.im_name  = "pppk",
+	.im_descr = "Kernel PPP unit without pppd",
+	.im_init  = &if_module_pppk_init,
+	.im_fini  = &if_module_pppk_fini,
+	.im_run   = &if_module_pppk_run,
+	.im_stop  = &if_module_pppk_stop,
+};
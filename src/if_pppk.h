@@ -0,0 +1,27 @@
+/* if_pppk.h
+ * PPP over Any Transport -- Kernel PPP network interface module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_IF_PPPK_H__
+#define __PPPOAT_IF_PPPK_H__
+
+#include "if.h"
+
+extern const struct pppoat_if_module pppoat_if_module_pppk;
+
+#endif /* __PPPOAT_IF_PPPK_H__ */
@@ -24,63 +24,246 @@
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <netinet/in.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
 
 #include "trace.h"
 #include "conf.h"
+#include "filter.h"
+#include "gso.h"
+#include "hub.h"
 #include "if_tun.h"
 #include "if.h"
 #include "log.h"
 #include "memory.h"
+#include "neigh.h"
 #include "util.h"
 
+#define TUN_BUF_SIZE 65536
+/* Room for IPv6 jumbo-sized GSO packet and the rest of a stream chunk */
+#define TUN_RX_SIZE (2 * TUN_BUF_SIZE)
+#define TUN_VNET_LEN sizeof(struct virtio_net_hdr)
+
+#define TAP_ETH_HLEN 14
+#define TAP_BCAST_UNLIMITED ULONG_MAX
+
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#define TUN_F_USO6 0x40
+#endif
+#define TUN_QUEUES_MAX 16
+
 typedef enum {
 	PPPOAT_IF_TUN,
 	PPPOAT_IF_TAP,
 } tun_type_t;
 
+struct tun_ctx;
+
+/*
+ * With IFF_MULTI_QUEUE the device has a file descriptor per queue and
+ * the kernel spreads flows among them. Every queue is served by its own
+ * worker and connected to its own transport instance.
+ */
+struct tun_queue {
+	struct tun_ctx    *tq_ctx;
+	int                tq_fd;
+	int                tq_rd;
+	int                tq_wr;
+	pthread_t          tq_thread;
+	/* Packet read from the device, with virtio-net header if enabled */
+	unsigned char     *tq_buf;
+	/* Segments of a GSO packet */
+	unsigned char     *tq_seg;
+	/* Part of tq_buf or tq_seg the transport hasn't accepted yet */
+	unsigned char     *tq_out;
+	size_t             tq_out_len;
+	/*
+	 * The transport is a byte stream, packets for the device are split
+	 * by IP length.
+	 */
+	unsigned char     *tq_rx;
+	size_t             tq_rx_len;
+	/* Part of a packet was lost, looking for the next one */
+	bool               tq_lost;
+	struct pppoat_gro  tq_gro;
+	unsigned long      tq_mss_clamped;
+	unsigned long      tq_gso_split;
+	unsigned long      tq_dropped;
+	/* Token bucket for broadcast frames, 1000000 per frame */
+	uint64_t           tq_bcast_tokens;
+	uint64_t           tq_bcast_last;
+	unsigned long      tq_bcast_dropped;
+};
+
 struct tun_ctx {
-	tun_type_t tc_type;
-	int        tc_fd;
-	int        tc_rd;
-	int        tc_wr;
-	char       tc_name[8];
-	pthread_t  tc_thread;
-	sem_t      tc_stop;
+	tun_type_t          tc_type;
+	char                tc_name[IFNAMSIZ];
+	struct tun_queue    tc_queues[TUN_QUEUES_MAX];
+	unsigned int        tc_queues_nr;
+	unsigned int        tc_running;
+	/* Becomes readable when workers must stop */
+	int                 tc_stop[2];
+	/* MSS of outgoing TCP SYNs is clamped to fit into tc_mtu */
+	bool                tc_mss_clamp;
+	/* Set by the transport while queues run, see tun_mtu() */
+	unsigned int        tc_mtu;
+	/* Packets carry struct virtio_net_hdr, GSO/GRO is used */
+	bool                tc_offload;
+	/* TAP: bindings of the remote side answer local ARP/ND requests */
+	bool                tc_neigh_proxy;
+	struct pppoat_neigh tc_neigh;
+	/* TAP: broadcast and multicast frames per second */
+	unsigned long       tc_bcast_rate;
 };
 
 static const char *tun_path = "/dev/net/tun";
 
+/*
+ * The filter is attached to the device, so the kernel drops unwanted
+ * packets before they are copied to us.
+ */
+static int tun_filter_attach(struct tun_ctx *ctx, const char *rules)
+{
+	struct pppoat_filter filter;
+	int                  fd;
+	int                  rc;
+
+	rc = pppoat_filter_compile(&filter, rules,
+				   ctx->tc_type == PPPOAT_IF_TAP);
+	rc = rc ?: pppoat_filter_load(&filter, &fd);
+	if (rc != 0)
+		return rc;
+	/*
+	 * TUNATTACHFILTER works for TAP only, eBPF filter is a property of
+	 * the device and is shared by all queues. The device holds its own
+	 * reference to the program.
+	 */
+	rc = ioctl(ctx->tc_queues[0].tq_fd, TUNSETFILTEREBPF, &fd);
+	rc = rc < 0 ? P_ERR(-errno) : 0;
+	if (rc == 0)
+		pppoat_debug("tun/tap", "Attached filter of %u instructions",
+			     filter.pf_len);
+	close(fd);
+	pppoat_filter_fini(&filter);
+
+	return rc;
+}
+
 static int if_module_tun_init_common(struct pppoat_conf  *conf,
 				     void               **userdata,
 				     tun_type_t           type)
 {
-	struct tun_ctx *ctx;
-	struct ifreq    ifr;
-	int             rc;
+	struct tun_ctx   *ctx;
+	struct tun_queue *q;
+	struct ifreq      ifr;
+	const char       *opt;
+	unsigned long     nr;
+	unsigned int      offload;
+	unsigned int      i;
+	int               sock;
+	int               rc;
 
-	ctx = pppoat_alloc(sizeof(*ctx));
-	PPPOAT_ASSERT(ctx != NULL);
+	nr = pppoat_conf_get_ulong(conf, "tun.queues", 1);
+	PPPOAT_ASSERT_INFO(nr >= 1 && nr <= TUN_QUEUES_MAX,
+			   "tun.queues must be 1..%d", TUN_QUEUES_MAX);
 
-	rc = sem_init(&ctx->tc_stop, 0, 0);
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	PPPOAT_ASSERT(ctx != NULL);
+	rc = pipe(ctx->tc_stop);
 	PPPOAT_ASSERT(rc == 0);
-	ctx->tc_type = type;
+	ctx->tc_type      = type;
+	ctx->tc_queues_nr = nr;
+	/*
+	 * Packets from the transport are delimited by IP length, so offloads
+	 * are supported for TUN only.
+	 */
+	opt = pppoat_conf_get(conf, "tun.offload");
+	ctx->tc_offload = type == PPPOAT_IF_TUN &&
+			  (opt == NULL || pppoat_conf_obj_is_true(opt));
 
-	ctx->tc_fd = open(tun_path, O_RDWR);
-	PPPOAT_ASSERT(ctx->tc_fd >= 0);
+	/* Every queue is attached with the name the kernel gave to the first */
 	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = type == PPPOAT_IF_TUN ? IFF_TUN : IFF_TAP;
-	rc = ioctl(ctx->tc_fd, TUNSETIFF, (void *)&ifr);
-	PPPOAT_ASSERT(rc >= 0);
+	ifr.ifr_flags = (type == PPPOAT_IF_TUN ? IFF_TUN : IFF_TAP) | IFF_NO_PI;
+	if (ctx->tc_offload)
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	if (nr > 1)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	for (i = 0; i < nr; ++i) {
+		q = &ctx->tc_queues[i];
+		q->tq_ctx = ctx;
+		q->tq_buf = pppoat_alloc(TUN_VNET_LEN + TUN_BUF_SIZE);
+		q->tq_rx  = pppoat_alloc(TUN_RX_SIZE);
+		PPPOAT_ASSERT(q->tq_buf != NULL && q->tq_rx != NULL);
+		if (ctx->tc_offload) {
+			q->tq_seg = pppoat_alloc(TUN_RX_SIZE);
+			PPPOAT_ASSERT(q->tq_seg != NULL);
+			rc = pppoat_gro_init(&q->tq_gro, TUN_RX_SIZE);
+			PPPOAT_ASSERT(rc == 0);
+		}
+		q->tq_fd = open(tun_path, O_RDWR);
+		PPPOAT_ASSERT(q->tq_fd >= 0);
+		rc = ioctl(q->tq_fd, TUNSETIFF, (void *)&ifr);
+		PPPOAT_ASSERT_INFO(rc >= 0, "queue=%u errno=%d", i, errno);
+	}
 	PPPOAT_ASSERT(strlen(ifr.ifr_name) < sizeof(ctx->tc_name));
 	strcpy(ctx->tc_name, ifr.ifr_name);
 
-	pppoat_debug("tun/tap", "Created interface %s", ctx->tc_name);
+	/* Offloads are a property of the device, USO needs Linux 6.2 */
+	offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN |
+		  TUN_F_USO4 | TUN_F_USO6;
+	if (ctx->tc_offload) {
+		rc = ioctl(ctx->tc_queues[0].tq_fd, TUNSETOFFLOAD, offload);
+		if (rc < 0 && errno == EINVAL) {
+			offload &= ~(TUN_F_USO4 | TUN_F_USO6);
+			rc = ioctl(ctx->tc_queues[0].tq_fd, TUNSETOFFLOAD,
+				   offload);
+		}
+		if (rc < 0)
+			pppoat_error("tun/tap", "TUNSETOFFLOAD failed, "
+				     "errno=%d", errno);
+		else
+			pppoat_debug("tun/tap", "Offloads 0x%x enabled",
+				     offload);
+	}
+
+	opt = pppoat_conf_get(conf, "tap.neigh_proxy");
+	ctx->tc_neigh_proxy = type == PPPOAT_IF_TAP &&
+			      (opt == NULL || pppoat_conf_obj_is_true(opt));
+	if (ctx->tc_neigh_proxy) {
+		rc = pppoat_neigh_init(&ctx->tc_neigh,
+			pppoat_conf_get_ulong(conf, "tap.neigh_max", 256),
+			pppoat_conf_get_ulong(conf, "tap.neigh_timeout", 300) *
+			1000000);
+		PPPOAT_ASSERT(rc == 0);
+	}
+	ctx->tc_bcast_rate = pppoat_conf_get_ulong(conf, "tap.bcast_rate",
+						   TAP_BCAST_UNLIMITED);
+	for (i = 0; i < nr; ++i)
+		ctx->tc_queues[i].tq_bcast_tokens = 1000000;
+
+	opt = pppoat_conf_get(conf, "tun.filter");
+	if (opt != NULL) {
+		rc = tun_filter_attach(ctx, opt);
+		PPPOAT_ASSERT_INFO(rc == 0, "tun.filter: rc=%d", rc);
+	}
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	rc   = sock < 0 ? -1 : ioctl(sock, SIOCGIFMTU, &ifr);
+	ctx->tc_mtu = rc == 0 ? ifr.ifr_mtu : 0;
+	if (sock >= 0)
+		close(sock);
+	opt = pppoat_conf_get(conf, "tun.mss_clamp");
+	ctx->tc_mss_clamp = type == PPPOAT_IF_TUN &&
+			    (opt == NULL || pppoat_conf_obj_is_true(opt));
+
+	pppoat_debug("tun/tap", "Created interface %s with %u queue(s)",
+		     ctx->tc_name, ctx->tc_queues_nr);
 	*userdata = ctx;
 
 	return 0;
@@ -99,83 +282,522 @@ static int if_module_tap_init(struct pppoat_conf *conf, void **userdata)
 
 static void if_module_tun_fini(void *userdata)
 {
-	struct tun_ctx *ctx = userdata;
+	struct tun_ctx   *ctx     = userdata;
+	struct tun_queue *q;
+	unsigned long     clamped = 0;
+	unsigned int      i;
 
-	sem_destroy(&ctx->tc_stop);
-	close(ctx->tc_fd);
+	for (i = 0; i < ctx->tc_queues_nr; ++i) {
+		q = &ctx->tc_queues[i];
+		clamped += q->tq_mss_clamped;
+		pppoat_debug("tun/tap", "Queue %u: split %lu GSO packets, "
+			     "merged %lu segments, dropped %lu, broadcasts "
+			     "dropped %lu", i, q->tq_gso_split,
+			     q->tq_gro.gr_merged, q->tq_dropped,
+			     q->tq_bcast_dropped);
+		close(q->tq_fd);
+		if (ctx->tc_offload)
+			pppoat_gro_fini(&q->tq_gro);
+		pppoat_free(q->tq_seg);
+		pppoat_free(q->tq_rx);
+		pppoat_free(q->tq_buf);
+	}
+	if (clamped > 0)
+		pppoat_debug("tun/tap", "Clamped MSS of %lu TCP SYNs", clamped);
+	if (ctx->tc_neigh_proxy) {
+		pppoat_debug("tun/tap", "Learnt %lu bindings, answered %lu "
+			     "ARP/ND requests", ctx->tc_neigh.nb_learned,
+			     ctx->tc_neigh.nb_answered);
+		pppoat_neigh_fini(&ctx->tc_neigh);
+	}
+	close(ctx->tc_stop[0]);
+	close(ctx->tc_stop[1]);
 	pppoat_free(ctx);
 }
 
-static void *tun_thread(void *userdata)
+static unsigned int if_module_tun_queues(void *userdata)
 {
 	struct tun_ctx *ctx = userdata;
-	fd_set          rfds;
-	int             max;
-	int             rc;
 
-	while (sem_trywait(&ctx->tc_stop) != 0) {
+	return ctx->tc_queues_nr;
+}
+
+/* Updates Internet checksum for a 16-bit word change (RFC 1624). */
+static uint16_t tun_csum_update(uint16_t csum, uint16_t old, uint16_t new)
+{
+	uint32_t sum = (uint16_t)~csum + (uint16_t)~old + new;
+
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+
+static uint16_t tun_get16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void tun_put16(unsigned char *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val & 0xff;
+}
+
+/*
+ * Lowers MSS option of a TCP SYN in an IP packet so the peer never sends
+ * segments which don't fit into the MTU. Returns true if the packet was
+ * modified.
+ */
+static bool tun_mss_clamp(unsigned char *pkt, size_t len, unsigned int mtu)
+{
+	unsigned char *tcp;
+	unsigned char *opt;
+	size_t         tcp_len;
+	size_t         hlen;
+	size_t         i;
+	uint16_t       mss;
+	uint16_t       old;
+	uint16_t       new;
+
+	if (len >= 20 && pkt[0] >> 4 == 4) {
+		hlen = (pkt[0] & 0x0f) * 4;
+		/* Only the first fragment has the TCP header */
+		if (pkt[9] != IPPROTO_TCP || hlen < 20 ||
+		    (tun_get16(pkt + 6) & 0x1fff) != 0)
+			return false;
+		mss = mtu - 40;
+	} else if (len >= 40 && pkt[0] >> 4 == 6) {
+		/* Extension headers are not handled */
+		hlen = 40;
+		if (pkt[6] != IPPROTO_TCP)
+			return false;
+		mss = mtu - 60;
+	} else {
+		return false;
+	}
+	if (len < hlen + 20)
+		return false;
+	tcp     = pkt + hlen;
+	tcp_len = (tcp[12] >> 4) * 4;
+	/* SYN flag */
+	if ((tcp[13] & 0x02) == 0 || tcp_len < 20 || len < hlen + tcp_len)
+		return false;
+
+	for (i = 20; i < tcp_len;) {
+		opt = tcp + i;
+		if (opt[0] == 0)	/* End of options */
+			break;
+		if (opt[0] == 1) {	/* NOP */
+			++i;
+			continue;
+		}
+		if (i + 1 >= tcp_len || opt[1] < 2 || i + opt[1] > tcp_len)
+			break;
+		if (opt[0] == 2 && opt[1] == 4) {
+			old = tun_get16(opt + 2);
+			if (old <= mss)
+				return false;
+			new = mss;
+			tun_put16(opt + 2, new);
+			/* Checksum is a sum of words at even offsets */
+			if (i % 2 != 0) {
+				old = (uint16_t)(old << 8 | old >> 8);
+				new = (uint16_t)(new << 8 | new >> 8);
+			}
+			tun_put16(tcp + 16, tun_csum_update(tun_get16(tcp + 16),
+							    old, new));
+			return true;
+		}
+		i += opt[1];
+	}
+	return false;
+}
+
+static void tun_dev_write(struct tun_queue            *q,
+			  const struct virtio_net_hdr *hdr,
+			  unsigned char               *pkt,
+			  size_t                       len)
+{
+	struct iovec iov[2];
+	ssize_t      rc;
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len  = TUN_VNET_LEN;
+	iov[1].iov_base = pkt;
+	iov[1].iov_len  = len;
+	do {
+		rc = q->tq_ctx->tc_offload ? writev(q->tq_fd, iov, 2) :
+					     write(q->tq_fd, pkt, len);
+	} while (rc < 0 && errno == EINTR);
+	/* The kernel rejects malformed packets, drop them */
+	if (rc < 0)
+		++q->tq_dropped;
+}
+
+/*
+ * The transport may block writing to us, so we must not block writing
+ * to it. The device isn't read until the pending data is flushed.
+ */
+static int tun_out_flush(struct tun_queue *q)
+{
+	ssize_t len;
+
+	while (q->tq_out_len > 0) {
+		len = write(q->tq_wr, q->tq_out, q->tq_out_len);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			return errno == EAGAIN ? 0 : P_ERR(-errno);
+		q->tq_out     += len;
+		q->tq_out_len -= len;
+	}
+	return 0;
+}
+
+static bool tap_bcast_allow(struct tun_queue *q, uint64_t now)
+{
+	unsigned long rate  = q->tq_ctx->tc_bcast_rate;
+	uint64_t      burst = (uint64_t)pppoat_max(rate, 1) * 1000000;
+
+	if (rate == TAP_BCAST_UNLIMITED)
+		return true;
+	q->tq_bcast_tokens += (now - q->tq_bcast_last) * rate;
+	q->tq_bcast_tokens  = pppoat_min(q->tq_bcast_tokens, burst);
+	q->tq_bcast_last    = now;
+	if (rate > 0 && q->tq_bcast_tokens >= 1000000) {
+		q->tq_bcast_tokens -= 1000000;
+		return true;
+	}
+	++q->tq_bcast_dropped;
+	return false;
+}
+
+/*
+ * Decides whether a frame from the device crosses the link. ARP and ND
+ * requests for known remote addresses are answered locally. Broadcast
+ * and multicast frames are rate limited except for ARP/ND which are
+ * needed to resolve addresses.
+ */
+static bool tap_frame_forward(struct tun_queue    *q,
+			      const unsigned char *frame,
+			      size_t               len)
+{
+	struct tun_ctx        *ctx = q->tq_ctx;
+	struct virtio_net_hdr  hdr = {};
+	unsigned char          reply[128];
+	uint64_t               now = pppoat_util_time_us();
+	size_t                 rlen;
+
+	if (ctx->tc_neigh_proxy) {
+		rlen = pppoat_neigh_proxy(&ctx->tc_neigh, frame, len, reply,
+					  sizeof(reply), now);
+		if (rlen > 0) {
+			tun_dev_write(q, &hdr, reply, rlen);
+			return false;
+		}
+	}
+	if (len < TAP_ETH_HLEN || (frame[0] & 0x01) == 0 ||
+	    pppoat_neigh_is_nd(frame, len))
+		return true;
+	return tap_bcast_allow(q, now);
+}
+
+/* MTU may be changed by im_mtu_set() from the transport's thread. */
+static unsigned int tun_mtu(struct tun_ctx *ctx)
+{
+	return __atomic_load_n(&ctx->tc_mtu, __ATOMIC_RELAXED);
+}
+
+/*
+ * Passes a packet from the device to the transport. GSO packets are split
+ * into segments of the size the kernel chose for them.
+ */
+static int tun_pkt_read(struct tun_queue *q)
+{
+	struct tun_ctx        *ctx = q->tq_ctx;
+	struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)q->tq_buf;
+	unsigned char         *pkt = q->tq_buf;
+	unsigned int           mtu;
+	ssize_t                len;
+	ssize_t                seg_len;
+	int                    rc;
+
+	len = read(q->tq_fd, q->tq_buf, TUN_VNET_LEN + TUN_BUF_SIZE);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : P_ERR(-errno);
+	if (ctx->tc_offload) {
+		if (len < (ssize_t)TUN_VNET_LEN)
+			return P_ERR(-EINVAL);
+		pkt += TUN_VNET_LEN;
+		len -= TUN_VNET_LEN;
+	}
+	if (ctx->tc_type == PPPOAT_IF_TAP && !tap_frame_forward(q, pkt, len))
+		return 0;
+
+	if (ctx->tc_offload && hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+		seg_len = pppoat_gso_segment(hdr, pkt, len, q->tq_seg,
+					     TUN_RX_SIZE);
+		if (seg_len < 0) {
+			++q->tq_dropped;
+			return 0;
+		}
+		++q->tq_gso_split;
+		pkt = q->tq_seg;
+		len = seg_len;
+	} else if (ctx->tc_offload &&
+		   (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) != 0) {
+		rc = pppoat_gso_csum(hdr, pkt, len);
+		if (rc != 0) {
+			++q->tq_dropped;
+			return 0;
+		}
+	}
+	/*
+	 * Checksum must be complete before the incremental update. SYNs are
+	 * never GSO packets, so looking at the first segment is enough.
+	 */
+	mtu = tun_mtu(ctx);
+	if (ctx->tc_mss_clamp && mtu > 60 && tun_mss_clamp(pkt, len, mtu))
+		++q->tq_mss_clamped;
+
+	q->tq_out     = pkt;
+	q->tq_out_len = len;
+
+	return tun_out_flush(q);
+}
+
+/*
+ * Returns length of the IP packet at the start of the stream, 0 if more
+ * data is needed or -1 if there is no packet header. The transport
+ * doesn't preserve packet boundaries, so when a datagram is lost the
+ * stream is scanned for the next header. IPv4 header checksum protects
+ * from taking garbage for a header. IPv6 has no checksum, a candidate
+ * must look like a common packet which fits into the MTU, otherwise the
+ * queue could wait for up to 64KiB of data which never comes.
+ */
+static ssize_t tun_pkt_len(struct tun_queue    *q,
+			   const unsigned char *buf,
+			   size_t               len)
+{
+	ssize_t  plen = pppoat_hub_pkt_len(buf, len);
+	size_t   hlen;
+	uint32_t sum = 0;
+	size_t   i;
+
+	if (plen <= 0)
+		return plen;
+	if (buf[0] >> 4 == 6) {
+		if (!q->tq_lost)
+			return plen;
+		if (len < 8)
+			return 0;
+		return plen <= pppoat_max(tun_mtu(q->tq_ctx), 1280) &&
+		       buf[7] != 0 && (buf[6] == IPPROTO_TCP ||
+				       buf[6] == IPPROTO_UDP ||
+				       buf[6] == IPPROTO_ICMPV6) ? plen : -1;
+	}
+	hlen = (buf[0] & 0x0f) * 4;
+	if (hlen < 20 || (size_t)plen < hlen)
+		return -1;
+	if (len < hlen)
+		return 0;
+	for (i = 0; i < hlen; i += 2)
+		sum += tun_get16(buf + i);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum == 0xffff ? plen : -1;
+}
+
+/*
+ * Passes packets from the transport to the device. Consecutive segments
+ * of a TCP flow are written as one GRO packet when offloads are enabled.
+ */
+static int tun_pkt_write(struct tun_queue *q)
+{
+	struct virtio_net_hdr  hdr = {};
+	struct pppoat_gro     *gro = &q->tq_gro;
+	unsigned char         *pkt;
+	size_t                 off = 0;
+	ssize_t                len;
+
+	len = read(q->tq_rd, q->tq_rx + q->tq_rx_len,
+		   TUN_RX_SIZE - q->tq_rx_len);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : P_ERR(-errno);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	q->tq_rx_len += len;
+
+	while (true) {
+		pkt = q->tq_rx + off;
+		len = q->tq_ctx->tc_type == PPPOAT_IF_TAP ?
+		      pppoat_hub_frame_len(pkt, q->tq_rx_len - off) :
+		      tun_pkt_len(q, pkt, q->tq_rx_len - off);
+		if (len < 0) {
+			if (!q->tq_lost)
+				++q->tq_dropped;
+			q->tq_lost = true;
+			++off;
+			continue;
+		}
+		if (len == 0 || (size_t)len > q->tq_rx_len - off)
+			break;
+		q->tq_lost = false;
+		off += len;
+		if (q->tq_ctx->tc_neigh_proxy)
+			pppoat_neigh_learn(&q->tq_ctx->tc_neigh, pkt, len,
+					   pppoat_util_time_us());
+		if (!q->tq_ctx->tc_offload) {
+			tun_dev_write(q, &hdr, pkt, len);
+			continue;
+		}
+		if (!pppoat_gro_add(gro, pkt, len)) {
+			tun_dev_write(q, &hdr, gro->gr_buf,
+				      pppoat_gro_flush(gro, &hdr));
+			(void)pppoat_gro_add(gro, pkt, len);
+		}
+	}
+	/* Don't hold packets back waiting for more segments */
+	if (q->tq_ctx->tc_offload && gro->gr_len > 0)
+		tun_dev_write(q, &hdr, gro->gr_buf, pppoat_gro_flush(gro, &hdr));
+
+	q->tq_rx_len -= off;
+	memmove(q->tq_rx, q->tq_rx + off, q->tq_rx_len);
+
+	return 0;
+}
+
+static void *tun_thread(void *userdata)
+{
+	struct tun_queue *q    = userdata;
+	int               stop = q->tq_ctx->tc_stop[0];
+	fd_set            rfds;
+	fd_set            wfds;
+	int               max;
+	int               rc;
+
+	rc = pppoat_util_fd_nonblock_set(q->tq_wr, true);
+	PPPOAT_ASSERT(rc == 0);
+
+	while (true) {
 		FD_ZERO(&rfds);
-		FD_SET(ctx->tc_rd, &rfds);
-		FD_SET(ctx->tc_fd, &rfds);
-		max = pppoat_max(ctx->tc_rd, ctx->tc_fd);
-		rc  = pppoat_util_select(max, &rfds, NULL);
+		FD_ZERO(&wfds);
+		FD_SET(q->tq_rd, &rfds);
+		if (q->tq_out_len > 0)
+			FD_SET(q->tq_wr, &wfds);
+		else
+			FD_SET(q->tq_fd, &rfds);
+		FD_SET(stop, &rfds);
+		max = pppoat_max(pppoat_max(q->tq_rd, q->tq_fd), stop);
+		max = pppoat_max(max, q->tq_wr);
+		rc  = pppoat_util_select(max, &rfds, &wfds);
 		PPPOAT_ASSERT(rc >= 0);
 
-		if (FD_ISSET(ctx->tc_rd, &rfds)) {
-			rc = pppoat_util_write_fd(ctx->tc_fd, ctx->tc_rd);
+		if (FD_ISSET(stop, &rfds))
+			break;
+		if (FD_ISSET(q->tq_wr, &wfds)) {
+			rc = tun_out_flush(q);
+			PPPOAT_ASSERT(rc == 0);
+		}
+		if (FD_ISSET(q->tq_rd, &rfds)) {
+			rc = tun_pkt_write(q);
 			PPPOAT_ASSERT(rc == 0);
 		}
-		if (FD_ISSET(ctx->tc_fd, &rfds)) {
-			rc = pppoat_util_write_fd(ctx->tc_wr, ctx->tc_fd);
+		if (FD_ISSET(q->tq_fd, &rfds)) {
+			rc = tun_pkt_read(q);
 			PPPOAT_ASSERT(rc == 0);
 		}
 	}
 	return NULL;
 }
 
+/* Called once per queue, starts worker of the next queue. */
 static int if_module_tun_run(int rd, int wr, void *userdata)
 {
-	struct tun_ctx *ctx = userdata;
-	int             rc;
+	struct tun_ctx   *ctx = userdata;
+	struct tun_queue *q;
+	int               rc;
 
-	ctx->tc_rd = dup(rd);
-	ctx->tc_wr = dup(wr);
-	PPPOAT_ASSERT(ctx->tc_rd != -1);
-	PPPOAT_ASSERT(ctx->tc_wr != -1);
-	rc = pthread_create(&ctx->tc_thread, NULL, &tun_thread, userdata);
+	PPPOAT_ASSERT(ctx->tc_running < ctx->tc_queues_nr);
+	q = &ctx->tc_queues[ctx->tc_running];
+	q->tq_rd = dup(rd);
+	q->tq_wr = dup(wr);
+	PPPOAT_ASSERT(q->tq_rd != -1);
+	PPPOAT_ASSERT(q->tq_wr != -1);
+	rc = pthread_create(&q->tq_thread, NULL, &tun_thread, q);
 	PPPOAT_ASSERT(rc == 0);
+	++ctx->tc_running;
 
 	return 0;
 }
 
 static int if_module_tun_stop(void *userdata)
 {
-	struct tun_ctx *ctx = userdata;
-	int             rc;
+	struct tun_ctx   *ctx = userdata;
+	struct tun_queue *q;
+	unsigned int      i;
+	int               rc;
 
-	sem_post(&ctx->tc_stop);
-	rc = pthread_join(ctx->tc_thread, NULL);
-	PPPOAT_ASSERT(rc == 0);
-	close(ctx->tc_rd);
-	close(ctx->tc_wr);
+	/* The pipe stays readable, so every worker sees it */
+	rc = write(ctx->tc_stop[1], "", 1);
+	PPPOAT_ASSERT(rc == 1);
+	for (i = 0; i < ctx->tc_running; ++i) {
+		q  = &ctx->tc_queues[i];
+		rc = pthread_join(q->tq_thread, NULL);
+		PPPOAT_ASSERT(rc == 0);
+		close(q->tq_rd);
+		close(q->tq_wr);
+	}
+	ctx->tc_running = 0;
 
 	return 0;
 }
 
+static int if_module_tun_mtu_set(void *userdata, unsigned int mtu)
+{
+	struct tun_ctx *ctx = userdata;
+	struct ifreq    ifr;
+	int             sock;
+	int             rc;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, ctx->tc_name);
+	ifr.ifr_mtu = mtu;
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	rc   = sock < 0 ? P_ERR(-errno) : 0;
+	if (rc == 0) {
+		rc = ioctl(sock, SIOCSIFMTU, &ifr);
+		rc = rc < 0 ? P_ERR(-errno) : 0;
+		close(sock);
+	}
+	if (rc == 0) {
+		__atomic_store_n(&ctx->tc_mtu, mtu, __ATOMIC_RELAXED);
+		pppoat_info("tun/tap", "MTU of %s set to %u", ctx->tc_name,
+			    mtu);
+	}
+	return rc;
+}
+
 const struct pppoat_if_module pppoat_if_module_tun = {
-	.im_name  = "tun",
-	.im_descr = "Using TUN/TAP driver",
-	.im_init  = &if_module_tun_init,
-	.im_fini  = &if_module_tun_fini,
-	.im_run   = &if_module_tun_run,
-	.im_stop  = &if_module_tun_stop,
+	.im_name    = "tun",
+	.im_descr   = "Using TUN/TAP driver",
+	.im_init    = &if_module_tun_init,
+	.im_fini    = &if_module_tun_fini,
+	.im_run     = &if_module_tun_run,
+	.im_stop    = &if_module_tun_stop,
+	.im_mtu_set = &if_module_tun_mtu_set,
+	.im_queues  = &if_module_tun_queues,
 };
 
 const struct pppoat_if_module pppoat_if_module_tap = {
-	.im_name  = "tap",
-	.im_descr = "Using TUN/TAP driver",
-	.im_init  = &if_module_tap_init,
-	.im_fini  = &if_module_tun_fini,
-	.im_run   = &if_module_tun_run,
-	.im_stop  = &if_module_tun_stop,
+	.im_name    = "tap",
+	.im_descr   = "Using TUN/TAP driver",
+	.im_init    = &if_module_tap_init,
+	.im_fini    = &if_module_tun_fini,
+	.im_run     = &if_module_tun_run,
+	.im_stop    = &if_module_tun_stop,
+	.im_mtu_set = &if_module_tun_mtu_set,
+	.im_queues  = &if_module_tun_queues,
 };
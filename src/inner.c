@@ -0,0 +1,120 @@
+/* inner.c
+ * PPP over Any Transport -- Transport run inside another transport
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "conf.h"
+#include "inner.h"
+#include "pppoat.h"
+#include "util.h"
+
+static void *inner_thread(void *userdata)
+{
+	struct pppoat_inner *in = userdata;
+
+	in->in_rc = in->in_module->m_run(in->in_tx[0], in->in_rx[1], 0,
+					 in->in_data);
+	/* EOF tells the outer one, in_tx[0] stays open so writes don't fail */
+	(void)close(in->in_rx[1]);
+	in->in_rx[1] = -1;
+
+	return NULL;
+}
+
+int pppoat_inner_init(struct pppoat_inner        *in,
+		      const struct pppoat_module *module,
+		      struct pppoat_conf         *conf)
+{
+	const char *packets = pppoat_conf_get(conf, "if.packets");
+	bool        restore = pppoat_conf_obj_is_true(packets);
+	int         rc;
+
+	in->in_module  = module;
+	in->in_inited  = false;
+	in->in_started = false;
+	in->in_tx[0]   = in->in_tx[1] = -1;
+	in->in_rx[0]   = in->in_rx[1] = -1;
+	in->in_rc      = 0;
+
+	/*
+	 * The stream of the outer transport isn't the interface stream, the
+	 * inner one must not look for packet boundaries in it.
+	 */
+	rc = pppoat_conf_update(conf, "if.packets", "0");
+	rc = rc ?: module->m_init(conf, &in->in_data);
+	in->in_inited = rc == 0;
+	if (restore)
+		(void)pppoat_conf_update(conf, "if.packets", "1");
+	return rc;
+}
+
+void pppoat_inner_fini(struct pppoat_inner *in)
+{
+	int *fds[] = { &in->in_tx[0], &in->in_tx[1], &in->in_rx[0],
+		       &in->in_rx[1] };
+	int  i;
+
+	pppoat_inner_stop(in);
+	for (i = 0; i < ARRAY_SIZE(fds); ++i)
+		if (*fds[i] >= 0)
+			(void)close(*fds[i]);
+	if (in->in_inited)
+		in->in_module->m_fini(in->in_data);
+	in->in_inited = false;
+}
+
+int pppoat_inner_start(struct pppoat_inner *in)
+{
+	int rc;
+
+	rc = pipe(in->in_tx) != 0 ? P_ERR(-errno) : 0;
+	if (rc == 0 && pipe(in->in_rx) != 0)
+		rc = P_ERR(-errno);
+	rc = rc ?: pppoat_util_fd_nonblock_set(in->in_tx[1], true);
+	rc = rc ?: pppoat_util_fd_nonblock_set(in->in_rx[0], true);
+	rc = rc ?: -pthread_create(&in->in_thread, NULL, &inner_thread, in);
+	in->in_started = rc == 0;
+	return rc;
+}
+
+int pppoat_inner_join(struct pppoat_inner *in)
+{
+	if (in->in_started)
+		(void)pthread_join(in->in_thread, NULL);
+	in->in_started = false;
+	return in->in_rc;
+}
+
+/* The output is drained meanwhile, so the inner one doesn't block on it. */
+void pppoat_inner_stop(struct pppoat_inner *in)
+{
+	char buf[4096];
+
+	if (in->in_tx[1] >= 0)
+		(void)close(in->in_tx[1]);
+	in->in_tx[1] = -1;
+	if (!in->in_started)
+		return;
+	(void)pppoat_util_fd_nonblock_set(in->in_rx[0], false);
+	while (read(in->in_rx[0], buf, sizeof(buf)) > 0)
+		;
+	(void)pppoat_inner_join(in);
+}
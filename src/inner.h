@@ -0,0 +1,58 @@
+/* inner.h
+ * PPP over Any Transport -- Transport run inside another transport
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_INNER_H__
+#define __PPPOAT_INNER_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct pppoat_conf;
+struct pppoat_module;
+
+/*
+ * Transport run by another transport. Its run function works in a
+ * thread behind a pair of pipes, the way main() runs the top one. The
+ * outer transport writes to in_tx[1] and reads from in_rx[0], both are
+ * non-blocking. EOF on in_rx[0] means the inner transport has finished.
+ */
+struct pppoat_inner {
+	const struct pppoat_module *in_module;
+	void                       *in_data;
+	bool                        in_inited;
+	bool                        in_started;
+	int                         in_tx[2];
+	int                         in_rx[2];
+	pthread_t                   in_thread;
+	/* Result of the run function */
+	int                         in_rc;
+};
+
+int pppoat_inner_init(struct pppoat_inner        *in,
+		      const struct pppoat_module *module,
+		      struct pppoat_conf         *conf);
+void pppoat_inner_fini(struct pppoat_inner *in);
+
+int pppoat_inner_start(struct pppoat_inner *in);
+/* Waits for the thread after EOF on in_rx[0], returns its result. */
+int pppoat_inner_join(struct pppoat_inner *in);
+/* Closes the input of the inner transport and waits until it returns. */
+void pppoat_inner_stop(struct pppoat_inner *in);
+
+#endif /* __PPPOAT_INNER_H__ */
@@ -0,0 +1,223 @@
+/* lpm.c
+ * PPP over Any Transport -- Longest prefix match
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>	/* memcpy */
+
+#include "trace.h"
+#include "lpm.h"
+#include "memory.h"
+#include "util.h"
+
+static unsigned int lpm_bit(const uint8_t *key, unsigned int i)
+{
+	return (key[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/* Length of the common prefix of two keys, at most max bits. */
+static unsigned int lpm_common(const uint8_t *k1,
+			       const uint8_t *k2,
+			       unsigned int   max)
+{
+	unsigned int i = 0;
+	uint8_t      diff;
+
+	while (i < max && k1[i / 8] == k2[i / 8])
+		i += 8;
+	if (i < max) {
+		diff = k1[i / 8] ^ k2[i / 8];
+		while ((diff & 0x80) == 0) {
+			diff <<= 1;
+			++i;
+		}
+	}
+	return pppoat_min(i, max);
+}
+
+static struct pppoat_lpm_node *lpm_node_new(struct pppoat_lpm *lpm,
+					    const uint8_t     *key,
+					    unsigned int       len,
+					    void              *value)
+{
+	struct pppoat_lpm_node *node;
+	unsigned int            i;
+
+	node = pppoat_calloc(1, sizeof(*node));
+	if (node == NULL)
+		return NULL;
+
+	/* Bits beyond the prefix are kept zero */
+	memcpy(node->ln_key, key, (len + 7) / 8);
+	if (len % 8 != 0)
+		node->ln_key[len / 8] &= (uint8_t)(0xff << (8 - len % 8));
+	for (i = (len + 7) / 8; i < sizeof(node->ln_key); ++i)
+		node->ln_key[i] = 0;
+	node->ln_len   = len;
+	node->ln_value = value;
+	++lpm->lpm_nodes;
+
+	return node;
+}
+
+static void lpm_node_free(struct pppoat_lpm *lpm, struct pppoat_lpm_node *node)
+{
+	pppoat_free(node);
+	--lpm->lpm_nodes;
+}
+
+static void lpm_subtree_free(struct pppoat_lpm      *lpm,
+			     struct pppoat_lpm_node *node)
+{
+	if (node != NULL) {
+		lpm_subtree_free(lpm, node->ln_child[0]);
+		lpm_subtree_free(lpm, node->ln_child[1]);
+		lpm_node_free(lpm, node);
+	}
+}
+
+void pppoat_lpm_init(struct pppoat_lpm *lpm)
+{
+	lpm->lpm_root     = NULL;
+	lpm->lpm_nodes    = 0;
+	lpm->lpm_prefixes = 0;
+}
+
+void pppoat_lpm_fini(struct pppoat_lpm *lpm)
+{
+	lpm_subtree_free(lpm, lpm->lpm_root);
+	PPPOAT_ASSERT(lpm->lpm_nodes == 0);
+}
+
+int pppoat_lpm_insert(struct pppoat_lpm *lpm,
+		      const uint8_t     *key,
+		      unsigned int       len,
+		      void              *value)
+{
+	struct pppoat_lpm_node **pp = &lpm->lpm_root;
+	struct pppoat_lpm_node  *node;
+	struct pppoat_lpm_node  *leaf;
+	struct pppoat_lpm_node  *glue;
+	unsigned int             common;
+
+	PPPOAT_ASSERT(len <= PPPOAT_LPM_KEY_BITS && value != NULL);
+
+	while (*pp != NULL) {
+		node   = *pp;
+		common = lpm_common(node->ln_key, key,
+				    pppoat_min(node->ln_len, len));
+		if (common == node->ln_len && node->ln_len == len) {
+			if (node->ln_value == NULL)
+				++lpm->lpm_prefixes;
+			node->ln_value = value;
+			return 0;
+		}
+		if (common == node->ln_len) {
+			pp = &node->ln_child[lpm_bit(key, node->ln_len)];
+			continue;
+		}
+		leaf = lpm_node_new(lpm, key, len, value);
+		if (leaf == NULL)
+			return P_ERR(-ENOMEM);
+		if (common == len) {
+			/* New prefix covers the node */
+			leaf->ln_child[lpm_bit(node->ln_key, len)] = node;
+			*pp = leaf;
+		} else {
+			glue = lpm_node_new(lpm, key, common, NULL);
+			if (glue == NULL) {
+				lpm_node_free(lpm, leaf);
+				return P_ERR(-ENOMEM);
+			}
+			glue->ln_child[lpm_bit(key, common)] = leaf;
+			glue->ln_child[lpm_bit(node->ln_key, common)] = node;
+			*pp = glue;
+		}
+		++lpm->lpm_prefixes;
+		return 0;
+	}
+	*pp = lpm_node_new(lpm, key, len, value);
+	if (*pp == NULL)
+		return P_ERR(-ENOMEM);
+	++lpm->lpm_prefixes;
+
+	return 0;
+}
+
+/* Replaces a node without value which has less than two children. */
+static void lpm_compact(struct pppoat_lpm       *lpm,
+			struct pppoat_lpm_node **pp)
+{
+	struct pppoat_lpm_node *node = *pp;
+
+	if (node->ln_value != NULL ||
+	    (node->ln_child[0] != NULL && node->ln_child[1] != NULL))
+		return;
+	*pp = node->ln_child[0] ?: node->ln_child[1];
+	lpm_node_free(lpm, node);
+}
+
+void *pppoat_lpm_delete(struct pppoat_lpm *lpm,
+			const uint8_t     *key,
+			unsigned int       len)
+{
+	struct pppoat_lpm_node **pp     = &lpm->lpm_root;
+	struct pppoat_lpm_node **parent = NULL;
+	struct pppoat_lpm_node  *node;
+	void                    *value;
+
+	while (*pp != NULL) {
+		node = *pp;
+		if (node->ln_len > len ||
+		    lpm_common(node->ln_key, key, node->ln_len) < node->ln_len)
+			return NULL;
+		if (node->ln_len == len)
+			break;
+		parent = pp;
+		pp     = &node->ln_child[lpm_bit(key, node->ln_len)];
+	}
+	if (*pp == NULL || (*pp)->ln_value == NULL)
+		return NULL;
+
+	value = (*pp)->ln_value;
+	(*pp)->ln_value = NULL;
+	--lpm->lpm_prefixes;
+	lpm_compact(lpm, pp);
+	/* Parent may have become a join node with a single child */
+	if (parent != NULL)
+		lpm_compact(lpm, parent);
+
+	return value;
+}
+
+void *pppoat_lpm_lookup(const struct pppoat_lpm *lpm,
+			const uint8_t           *key,
+			unsigned int             len)
+{
+	const struct pppoat_lpm_node *node = lpm->lpm_root;
+	void                         *best = NULL;
+
+	while (node != NULL && node->ln_len <= len &&
+	       lpm_common(node->ln_key, key, node->ln_len) == node->ln_len) {
+		best = node->ln_value ?: best;
+		if (node->ln_len == len)
+			break;
+		node = node->ln_child[lpm_bit(key, node->ln_len)];
+	}
+	return best;
+}
@@ -0,0 +1,64 @@
+/* lpm.h
+ * PPP over Any Transport -- Longest prefix match
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_LPM_H__
+#define __PPPOAT_LPM_H__
+
+#include <stdint.h>
+
+/*
+ * Path-compressed binary trie for longest prefix match on keys of up to
+ * 128 bits. Every node stores the full key of its prefix, so a lookup
+ * makes one comparison per branching point rather than per bit.
+ */
+
+#define PPPOAT_LPM_KEY_BITS 128
+
+struct pppoat_lpm_node {
+	uint8_t                 ln_key[PPPOAT_LPM_KEY_BITS / 8];
+	unsigned int            ln_len;
+	/* NULL for nodes which only join two subtrees */
+	void                   *ln_value;
+	struct pppoat_lpm_node *ln_child[2];
+};
+
+struct pppoat_lpm {
+	struct pppoat_lpm_node *lpm_root;
+	unsigned long           lpm_nodes;
+	unsigned long           lpm_prefixes;
+};
+
+void pppoat_lpm_init(struct pppoat_lpm *lpm);
+void pppoat_lpm_fini(struct pppoat_lpm *lpm);
+
+/* Adds prefix key/len or replaces value of the existing one. */
+int pppoat_lpm_insert(struct pppoat_lpm *lpm,
+		      const uint8_t     *key,
+		      unsigned int       len,
+		      void              *value);
+/* Returns value of the removed prefix or NULL if it doesn't exist. */
+void *pppoat_lpm_delete(struct pppoat_lpm *lpm,
+			const uint8_t     *key,
+			unsigned int       len);
+/* Returns value of the longest prefix of key or NULL. */
+void *pppoat_lpm_lookup(const struct pppoat_lpm *lpm,
+			const uint8_t           *key,
+			unsigned int             len);
+
+#endif /* __PPPOAT_LPM_H__ */
@@ -0,0 +1,734 @@
+/* bond.c
+ * PPP over Any Transport -- Bonding of several transports
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/bond.h"
+#include "conf.h"
+#include "crc32c.h"
+#include "inner.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "probe.h"
+#include "reorder.h"
+#include "util.h"
+
+/*
+ * Runs the transports of bond.modules at once, each as an inner
+ * transport in its own thread. Both ends list the
+ * same members in the same order, member N talks to member N.
+ *
+ * Every chunk from the interface becomes a record with a sequence number
+ * and goes to the primary member. Pings on every member measure RTT and
+ * loss. The primary is the first listed member which is up and isn't
+ * lossy, unless a later one is faster by more than bond.rtt_slack. When
+ * the primary leaves a ping unanswered for longer than its RTO, records
+ * are duplicated to the next best member until the reply comes or the
+ * primary is down. So data keeps flowing within one RTT of a failure
+ * and the switch follows after PPPOAT_PROBE_DOWN_PINGS intervals.
+ *
+ * Members carry byte streams, they may split, merge or lose records.
+ * The receiver finds records by magic and length, drops ones failing
+ * CRC32C and restores order with the reorder buffer, which also drops
+ * duplicates.
+ */
+
+#define BOND_MEMBERS_MAX 4
+#define BOND_MAGIC       0xb04d
+
+#define BOND_FRAME_DEFAULT 1400
+#define BOND_FRAME_MAX     16384
+#define BOND_RX_SIZE       65536
+
+#define BOND_PROBE_INTERVAL_DEFAULT  100
+#define BOND_RTT_SLACK_DEFAULT       5
+/* Loss which moves a member behind the others, parts per million */
+#define BOND_LOSS_MAX_DEFAULT        50000
+#define BOND_REORDER_WINDOW_DEFAULT  256
+#define BOND_REORDER_TIMEOUT_DEFAULT 50000
+
+enum {
+	BOND_MSG_DATA = 0,
+	/* Payload is opaque send time, echoed in struct bond_pong */
+	BOND_MSG_PING = 1,
+	BOND_MSG_PONG = 2,
+};
+
+/*
+ * Record header, multibyte fields are in network byte order. bh_crc is
+ * CRC32C of the header with zero bh_crc and the payload.
+ */
+struct bond_hdr {
+	uint16_t bh_magic;
+	uint8_t  bh_type;
+	uint8_t  bh_pad;
+	uint16_t bh_len;
+	/* Per-member sequence number of data, gives loss of the member */
+	uint16_t bh_member_seq;
+	uint32_t bh_seq;
+	uint32_t bh_crc;
+};
+
+#define BOND_HDR_LEN sizeof(struct bond_hdr)
+
+/* Receive counters are for data which arrived over the ping's member */
+struct bond_pong {
+	uint64_t bp_ts;
+	uint32_t bp_rx;
+	uint32_t bp_expected;
+};
+
+struct bond_member {
+	struct pppoat_inner         bm_inner;
+	/* The member's run function returned */
+	bool                        bm_dead;
+	struct pppoat_probe         bm_probe;
+	struct pppoat_probe_rx      bm_probe_rx;
+	uint64_t                    bm_ping_time;
+	uint64_t                    bm_rx_time;
+	/* Tail of a record the pipe didn't take */
+	unsigned char              *bm_pend;
+	size_t                      bm_pend_off;
+	size_t                      bm_pend_len;
+	unsigned char              *bm_rx;
+	size_t                      bm_rx_len;
+	/* Counters */
+	unsigned long               bm_tx;
+	unsigned long               bm_dups;
+	unsigned long               bm_bad;
+};
+
+struct pppoat_bond_ctx {
+	struct bond_member     bc_members[BOND_MEMBERS_MAX];
+	unsigned int           bc_members_nr;
+	struct bond_member    *bc_primary;
+	struct bond_member    *bc_backup;
+	size_t                 bc_frame;
+	uint64_t               bc_rtt_slack;
+	uint32_t               bc_loss_max;
+	uint32_t               bc_tx_seq;
+	struct pppoat_reorder  bc_reorder;
+	bool                   bc_reorder_inited;
+	unsigned char         *bc_buf;
+	int                    bc_wr;
+	/* Counters */
+	unsigned long          bc_switches;
+	unsigned long          bc_dropped;
+};
+
+static int bond_deliver(void *userdata, unsigned char *buf, size_t len)
+{
+	struct pppoat_bond_ctx *ctx = userdata;
+
+	return pppoat_util_write(ctx->bc_wr, buf, len);
+}
+
+static const char *bond_member_name(const struct bond_member *m)
+{
+	return m->bm_inner.in_module->m_name;
+}
+
+/*
+ * Pongs queue behind data in stream transports, so data received
+ * recently also proves the member is alive. The peer stops sending data
+ * over a member it finds down, then this end follows.
+ */
+static bool bond_member_up(const struct bond_member *m, uint64_t now)
+{
+	const struct pppoat_probe *pr = &m->bm_probe;
+
+	return !m->bm_dead &&
+	       (!pr->pr_down || now - m->bm_rx_time <=
+				PPPOAT_PROBE_DOWN_PINGS * pr->pr_interval);
+}
+
+/* Members with acceptable loss come first, then untested and lossy ones */
+static int bond_member_class(const struct pppoat_bond_ctx *ctx,
+			     const struct bond_member     *m)
+{
+	if (!m->bm_probe.pr_has_rtt)
+		return 1;
+	return m->bm_probe.pr_loss_ppm <= ctx->bc_loss_max ? 0 : 2;
+}
+
+/* Whether c is better than best, which is listed before c. */
+static bool bond_member_better(const struct pppoat_bond_ctx *ctx,
+			       const struct bond_member     *c,
+			       const struct bond_member     *best)
+{
+	int cc = bond_member_class(ctx, c);
+	int bc = bond_member_class(ctx, best);
+
+	if (cc != bc)
+		return cc < bc;
+	if (cc == 2)
+		return c->bm_probe.pr_loss_ppm < best->bm_probe.pr_loss_ppm;
+	return cc == 0 && c->bm_probe.pr_srtt + ctx->bc_rtt_slack <
+			  best->bm_probe.pr_srtt;
+}
+
+/* With any set, members which are down but still run qualify too. */
+static struct bond_member *bond_member_best(struct pppoat_bond_ctx *ctx,
+					    struct bond_member     *skip,
+					    bool                    any,
+					    uint64_t                now)
+{
+	struct bond_member *best = NULL;
+	struct bond_member *m;
+	unsigned int        i;
+
+	for (i = 0; i < ctx->bc_members_nr; ++i) {
+		m = &ctx->bc_members[i];
+		if (m == skip || m->bm_dead ||
+		    (!any && !bond_member_up(m, now)))
+			continue;
+		if (best == NULL || bond_member_better(ctx, m, best))
+			best = m;
+	}
+	return best;
+}
+
+/* When no member is up, data goes to the best one which still runs. */
+static void bond_rank(struct pppoat_bond_ctx *ctx)
+{
+	uint64_t            now     = pppoat_util_time_us();
+	struct bond_member *primary = bond_member_best(ctx, NULL, false, now);
+	bool                up      = primary != NULL;
+
+	primary = primary ?: bond_member_best(ctx, NULL, true, now);
+	if (primary != ctx->bc_primary && primary != NULL) {
+		pppoat_info("bond", "Primary is %s (%s), rtt=%llu usec "
+			    "loss=%u.%02u%%", bond_member_name(primary),
+			    up ? "up" : "down",
+			    (unsigned long long)primary->bm_probe.pr_srtt,
+			    primary->bm_probe.pr_loss_ppm / 10000,
+			    primary->bm_probe.pr_loss_ppm % 10000 / 100);
+		ctx->bc_switches += ctx->bc_primary != NULL;
+	}
+	ctx->bc_primary = primary;
+	ctx->bc_backup  = primary == NULL ? NULL :
+			  bond_member_best(ctx, primary, !up, now);
+}
+
+/* The last ping is unanswered for longer than the retransmission timeout */
+static bool bond_member_suspect(const struct bond_member *m, uint64_t now)
+{
+	const struct pppoat_probe *pr = &m->bm_probe;
+	uint64_t                   rto;
+
+	rto = pr->pr_has_rtt ? pr->pr_srtt + 4 * pr->pr_rttvar :
+			       pr->pr_interval;
+	return m->bm_ping_time > pr->pr_last_pong &&
+	       now - m->bm_ping_time > rto;
+}
+
+static void bond_hdr_fill(struct bond_hdr     *hdr,
+			  unsigned int         type,
+			  const unsigned char *payload,
+			  size_t               len,
+			  uint16_t             member_seq,
+			  uint32_t             seq)
+{
+	uint32_t crc;
+
+	hdr->bh_magic      = htons(BOND_MAGIC);
+	hdr->bh_type       = type;
+	hdr->bh_pad        = 0;
+	hdr->bh_len        = htons(len);
+	hdr->bh_member_seq = htons(member_seq);
+	hdr->bh_seq        = htonl(seq);
+	hdr->bh_crc        = 0;
+	crc = pppoat_crc32c(0, hdr, BOND_HDR_LEN);
+	hdr->bh_crc        = htonl(pppoat_crc32c(crc, payload, len));
+}
+
+/*
+ * Writes a record to the member's pipe. With keep set, a record the pipe
+ * doesn't take is kept and sent when the pipe drains. Otherwise it's
+ * dropped and -EAGAIN is returned.
+ */
+static int bond_member_send(struct bond_member    *m,
+			    const struct bond_hdr *hdr,
+			    const unsigned char   *payload,
+			    size_t                 len,
+			    bool                   keep)
+{
+	struct iovec iov[2];
+	size_t       total = BOND_HDR_LEN + len;
+	ssize_t      n;
+
+	if (m->bm_pend_len > 0)
+		return -EAGAIN;
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len  = BOND_HDR_LEN;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len  = len;
+	n = writev(m->bm_inner.in_tx[1], iov, ARRAY_SIZE(iov));
+	if (n < 0 && errno != EAGAIN && errno != EINTR)
+		return P_ERR(-errno);
+	if (n < 0 && !keep)
+		return -EAGAIN;
+	n = pppoat_max(n, 0);
+	if ((size_t)n == total)
+		return 0;
+
+	/* Pipe writes up to PIPE_BUF are atomic, bigger ones may be split */
+	if ((size_t)n < BOND_HDR_LEN) {
+		memcpy(m->bm_pend, (const unsigned char *)hdr + n,
+		       BOND_HDR_LEN - n);
+		memcpy(m->bm_pend + BOND_HDR_LEN - n, payload, len);
+	} else {
+		memcpy(m->bm_pend, payload + n - BOND_HDR_LEN, total - n);
+	}
+	m->bm_pend_off = 0;
+	m->bm_pend_len = total - n;
+	return 0;
+}
+
+static int bond_member_flush(struct bond_member *m)
+{
+	ssize_t n;
+
+	n = write(m->bm_inner.in_tx[1], m->bm_pend + m->bm_pend_off,
+		  m->bm_pend_len);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	m->bm_pend_off += n;
+	m->bm_pend_len -= n;
+	return 0;
+}
+
+static void bond_ping_send(struct bond_member *m, uint64_t now)
+{
+	struct bond_hdr hdr;
+
+	bond_hdr_fill(&hdr, BOND_MSG_PING, (unsigned char *)&now, sizeof(now),
+		      0, 0);
+	/* A ping which doesn't fit is lost, the member looks worse then */
+	if (bond_member_send(m, &hdr, (unsigned char *)&now, sizeof(now),
+			     false) == 0)
+		m->bm_ping_time = now;
+}
+
+static void bond_pong_send(struct bond_member *m, const unsigned char *ts)
+{
+	struct bond_pong pong;
+	struct bond_hdr  hdr;
+
+	memcpy(&pong.bp_ts, ts, sizeof(pong.bp_ts));
+	pong.bp_rx       = htonl(m->bm_probe_rx.prx_nr);
+	pong.bp_expected = htonl(m->bm_probe_rx.prx_expected);
+	bond_hdr_fill(&hdr, BOND_MSG_PONG, (unsigned char *)&pong,
+		      sizeof(pong), 0, 0);
+	(void)bond_member_send(m, &hdr, (unsigned char *)&pong, sizeof(pong),
+			       false);
+}
+
+static int bond_record_process(struct pppoat_bond_ctx *ctx,
+			       struct bond_member     *m,
+			       const struct bond_hdr  *hdr,
+			       unsigned char          *payload,
+			       size_t                  len)
+{
+	struct bond_pong pong;
+
+	switch (hdr->bh_type) {
+	case BOND_MSG_DATA:
+		m->bm_rx_time = pppoat_util_time_us();
+		pppoat_probe_rx(&m->bm_probe_rx, ntohs(hdr->bh_member_seq));
+		return pppoat_reorder_put(&ctx->bc_reorder, ntohl(hdr->bh_seq),
+					  payload, len, pppoat_util_time_us());
+	case BOND_MSG_PING:
+		if (len == sizeof(pong.bp_ts))
+			bond_pong_send(m, payload);
+		break;
+	case BOND_MSG_PONG:
+		if (len != sizeof(pong))
+			break;
+		memcpy(&pong, payload, sizeof(pong));
+		pppoat_probe_pong(&m->bm_probe, pong.bp_ts, ntohl(pong.bp_rx),
+				  ntohl(pong.bp_expected),
+				  pppoat_util_time_us());
+		bond_rank(ctx);
+		break;
+	default:
+		++m->bm_bad;
+	}
+	return 0;
+}
+
+/* Finds records in the member's stream, skips garbage after a loss. */
+static int bond_member_parse(struct pppoat_bond_ctx *ctx,
+			     struct bond_member     *m)
+{
+	unsigned char   *buf = m->bm_rx;
+	struct bond_hdr  hdr;
+	uint32_t         crc;
+	size_t           off = 0;
+	size_t           len;
+	bool             ok;
+	int              rc  = 0;
+
+	while (rc == 0 && m->bm_rx_len - off >= BOND_HDR_LEN) {
+		memcpy(&hdr, buf + off, sizeof(hdr));
+		len = ntohs(hdr.bh_len);
+		ok  = ntohs(hdr.bh_magic) == BOND_MAGIC &&
+		      len <= BOND_FRAME_MAX;
+		if (ok && m->bm_rx_len - off < BOND_HDR_LEN + len)
+			break;
+		if (ok) {
+			crc = ntohl(hdr.bh_crc);
+			hdr.bh_crc = 0;
+			ok = crc == pppoat_crc32c(pppoat_crc32c(0, &hdr,
+						  BOND_HDR_LEN), buf + off +
+						  BOND_HDR_LEN, len);
+		}
+		if (!ok) {
+			++m->bm_bad;
+			++off;
+			continue;
+		}
+		rc = bond_record_process(ctx, m, &hdr,
+					 buf + off + BOND_HDR_LEN, len);
+		off += BOND_HDR_LEN + len;
+	}
+	m->bm_rx_len -= off;
+	memmove(buf, buf + off, m->bm_rx_len);
+	return rc;
+}
+
+static int bond_member_recv(struct pppoat_bond_ctx *ctx,
+			    struct bond_member     *m)
+{
+	ssize_t len;
+
+	len = read(m->bm_inner.in_rx[0], m->bm_rx + m->bm_rx_len,
+		   BOND_RX_SIZE - m->bm_rx_len);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (len == 0) {
+		m->bm_dead = true;
+		pppoat_error("bond", "Member %s stopped, rc=%d",
+			     bond_member_name(m),
+			     pppoat_inner_join(&m->bm_inner));
+		bond_rank(ctx);
+		return 0;
+	}
+	m->bm_rx_len += len;
+	return bond_member_parse(ctx, m);
+}
+
+/* Reads a chunk from the interface and sends it as a data record. */
+static int bond_tx(struct pppoat_bond_ctx *ctx, int rd, uint64_t now)
+{
+	struct bond_member *primary = ctx->bc_primary;
+	struct bond_member *backup  = ctx->bc_backup;
+	unsigned char      *buf     = ctx->bc_buf;
+	struct bond_hdr     hdr;
+	ssize_t             len;
+	uint32_t            seq;
+	int                 rc;
+
+	len = read(rd, buf, ctx->bc_frame);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (primary == NULL) {
+		++ctx->bc_dropped;
+		return 0;
+	}
+
+	seq = ctx->bc_tx_seq++;
+	bond_hdr_fill(&hdr, BOND_MSG_DATA, buf, len,
+		      primary->bm_probe.pr_tx_seq++, seq);
+	rc = bond_member_send(primary, &hdr, buf, len, true);
+	++primary->bm_tx;
+	if (rc == 0 && backup != NULL && bond_member_suspect(primary, now)) {
+		bond_hdr_fill(&hdr, BOND_MSG_DATA, buf, len,
+			      backup->bm_probe.pr_tx_seq++, seq);
+		if (bond_member_send(backup, &hdr, buf, len, false) == 0)
+			++backup->bm_dups;
+	}
+	return rc;
+}
+
+static uint64_t bond_deadline(struct pppoat_bond_ctx *ctx)
+{
+	uint64_t     deadline = pppoat_reorder_deadline(&ctx->bc_reorder);
+	unsigned int i;
+
+	for (i = 0; i < ctx->bc_members_nr; ++i)
+		if (!ctx->bc_members[i].bm_dead)
+			deadline = pppoat_min(deadline, pppoat_probe_deadline(
+					&ctx->bc_members[i].bm_probe));
+	return deadline;
+}
+
+static int bond_timers_run(struct pppoat_bond_ctx *ctx, uint64_t now)
+{
+	struct bond_member *m;
+	unsigned int        i;
+
+	for (i = 0; i < ctx->bc_members_nr; ++i) {
+		m = &ctx->bc_members[i];
+		if (!m->bm_dead && pppoat_probe_ping_due(&m->bm_probe, now))
+			bond_ping_send(m, now);
+	}
+	bond_rank(ctx);
+	return pppoat_reorder_expire(&ctx->bc_reorder, now);
+}
+
+static void bond_member_fini(struct bond_member *m)
+{
+	pppoat_inner_fini(&m->bm_inner);
+	pppoat_free(m->bm_pend);
+	pppoat_free(m->bm_rx);
+}
+
+static void bond_ctx_fini(struct pppoat_bond_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->bc_members_nr; ++i)
+		bond_member_fini(&ctx->bc_members[i]);
+	if (ctx->bc_reorder_inited)
+		pppoat_reorder_fini(&ctx->bc_reorder);
+	pppoat_free(ctx->bc_buf);
+	pppoat_free(ctx);
+}
+
+static int bond_member_init(struct pppoat_bond_ctx *ctx,
+			    struct pppoat_conf     *conf,
+			    const char             *name,
+			    uint64_t                interval)
+{
+	const struct pppoat_module *module = pppoat_module_find(name);
+	struct bond_member         *m;
+	int                         rc;
+
+	if (module == NULL || module == &pppoat_module_bond) {
+		pppoat_error("bond", "Can't use '%s' as a member", name);
+		return P_ERR(-EINVAL);
+	}
+	if (ctx->bc_members_nr == BOND_MEMBERS_MAX) {
+		pppoat_error("bond", "At most %d members are supported",
+			     BOND_MEMBERS_MAX);
+		return P_ERR(-E2BIG);
+	}
+	m = &ctx->bc_members[ctx->bc_members_nr++];
+	rc = pppoat_inner_init(&m->bm_inner, module, conf);
+	m->bm_pend = pppoat_alloc(BOND_HDR_LEN + BOND_FRAME_MAX);
+	m->bm_rx   = pppoat_alloc(BOND_RX_SIZE);
+	pppoat_probe_init(&m->bm_probe, interval, pppoat_util_time_us());
+	pppoat_probe_rx_init(&m->bm_probe_rx);
+	if (rc == 0 && (m->bm_pend == NULL || m->bm_rx == NULL))
+		rc = P_ERR(-ENOMEM);
+	return rc;
+}
+
+static int module_bond_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_bond_ctx *ctx;
+	const char             *list;
+	char                   *names = NULL;
+	char                   *name;
+	char                   *save;
+	uint64_t                interval;
+	unsigned long           window;
+	unsigned long           timeout;
+	int                     rc = 0;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->bc_frame     = pppoat_conf_get_ulong(conf, "bond.frame",
+						  BOND_FRAME_DEFAULT);
+	ctx->bc_frame     = pppoat_min(pppoat_max(ctx->bc_frame, 64),
+				       BOND_FRAME_MAX);
+	ctx->bc_rtt_slack = pppoat_conf_get_ulong(conf, "bond.rtt_slack",
+				BOND_RTT_SLACK_DEFAULT) * 1000;
+	ctx->bc_loss_max  = pppoat_conf_get_ulong(conf, "bond.loss_max",
+				BOND_LOSS_MAX_DEFAULT / 10000) * 10000;
+	interval = pppoat_conf_get_ulong(conf, "bond.probe_interval",
+				BOND_PROBE_INTERVAL_DEFAULT) * 1000;
+	interval = pppoat_max(interval, 1000);
+	window   = pppoat_conf_get_ulong(conf, "bond.reorder_window",
+					 BOND_REORDER_WINDOW_DEFAULT);
+	timeout  = pppoat_conf_get_ulong(conf, "bond.reorder_timeout",
+					 BOND_REORDER_TIMEOUT_DEFAULT);
+
+	ctx->bc_buf = pppoat_alloc(BOND_FRAME_MAX);
+	rc = ctx->bc_buf == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: pppoat_reorder_init(&ctx->bc_reorder, pppoat_max(window, 1),
+				       timeout, &bond_deliver, ctx);
+	ctx->bc_reorder_inited = rc == 0;
+
+	list = pppoat_conf_get(conf, "bond.modules");
+	if (rc == 0 && list == NULL) {
+		pppoat_error("bond", "bond.modules is required, e.g. "
+			     "bond.modules=udp,tcp");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0) {
+		names = pppoat_strdup(list);
+		rc = names == NULL ? P_ERR(-ENOMEM) : 0;
+	}
+	for (name = rc == 0 ? strtok_r(names, ",", &save) : NULL;
+	     rc == 0 && name != NULL; name = strtok_r(NULL, ",", &save))
+		rc = bond_member_init(ctx, conf, name, interval);
+	pppoat_free(names);
+	if (rc == 0 && ctx->bc_members_nr == 0)
+		rc = P_ERR(-EINVAL);
+
+	if (rc == 0) {
+		pppoat_debug("bond", "%u members, frame=%zu probe=%llu msec",
+			     ctx->bc_members_nr, ctx->bc_frame,
+			     (unsigned long long)interval / 1000);
+		*userdata = ctx;
+	} else {
+		bond_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_bond_fini(void *userdata)
+{
+	struct pppoat_bond_ctx *ctx = userdata;
+	struct pppoat_reorder  *ro  = &ctx->bc_reorder;
+	uint64_t                now = pppoat_util_time_us();
+	struct pppoat_probe    *pr;
+	struct bond_member     *m;
+	unsigned int            i;
+
+	for (i = 0; i < ctx->bc_members_nr; ++i) {
+		m  = &ctx->bc_members[i];
+		pr = &m->bm_probe;
+		pppoat_debug("bond", "Member %s: %s rtt=%llu usec "
+			     "loss=%u.%02u%% tx=%lu dups=%lu rx=%u bad=%lu",
+			     bond_member_name(m),
+			     bond_member_up(m, now) ? "up" : "down",
+			     (unsigned long long)pr->pr_srtt,
+			     pr->pr_loss_ppm / 10000,
+			     pr->pr_loss_ppm % 10000 / 100, m->bm_tx,
+			     m->bm_dups, m->bm_probe_rx.prx_nr, m->bm_bad);
+	}
+	pppoat_debug("bond", "switches=%lu dropped=%lu reordered=%lu "
+		     "duplicates=%lu lost=%lu", ctx->bc_switches,
+		     ctx->bc_dropped, ro->ro_reordered, ro->ro_dropped,
+		     ro->ro_lost);
+	bond_ctx_fini(ctx);
+}
+
+static int module_bond_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_bond_ctx *ctx = userdata;
+	struct bond_member     *m;
+	fd_set                  rfds;
+	fd_set                  wfds;
+	uint64_t                now;
+	uint64_t                deadline;
+	unsigned int            i;
+	unsigned int            alive;
+	int                     max;
+	int                     rc;
+
+	ctx->bc_wr = wr;
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	for (i = 0; rc == 0 && i < ctx->bc_members_nr; ++i)
+		rc = pppoat_inner_start(&ctx->bc_members[i].bm_inner);
+
+	while (rc == 0) {
+		now = pppoat_util_time_us();
+		rc  = bond_timers_run(ctx, now);
+		if (rc != 0)
+			break;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		max   = rd;
+		alive = 0;
+		/* The interface waits while the primary's pipe is full */
+		if (ctx->bc_primary == NULL ||
+		    ctx->bc_primary->bm_pend_len == 0)
+			FD_SET(rd, &rfds);
+		for (i = 0; i < ctx->bc_members_nr; ++i) {
+			m = &ctx->bc_members[i];
+			if (m->bm_dead)
+				continue;
+			++alive;
+			FD_SET(m->bm_inner.in_rx[0], &rfds);
+			max = pppoat_max(max, m->bm_inner.in_rx[0]);
+			if (m->bm_pend_len > 0) {
+				FD_SET(m->bm_inner.in_tx[1], &wfds);
+				max = pppoat_max(max, m->bm_inner.in_tx[1]);
+			}
+		}
+		if (alive == 0) {
+			rc = P_ERR(-ENOTCONN);
+			break;
+		}
+		deadline = bond_deadline(ctx);
+		rc = pppoat_util_select_timed(max, &rfds, &wfds,
+				deadline == PPPOAT_TIME_NEVER ?
+				PPPOAT_TIME_NEVER :
+				deadline - pppoat_min(deadline, now));
+		if (rc <= 0) {
+			rc = rc < 0 ? rc : 0;
+			continue;
+		}
+		rc = 0;
+
+		for (i = 0; rc == 0 && i < ctx->bc_members_nr; ++i) {
+			m = &ctx->bc_members[i];
+			if (!m->bm_dead &&
+			    FD_ISSET(m->bm_inner.in_rx[0], &rfds))
+				rc = bond_member_recv(ctx, m);
+			if (rc == 0 && !m->bm_dead && m->bm_pend_len > 0 &&
+			    FD_ISSET(m->bm_inner.in_tx[1], &wfds))
+				rc = bond_member_flush(m);
+		}
+		if (rc == 0 && FD_ISSET(rd, &rfds) &&
+		    (ctx->bc_primary == NULL ||
+		     ctx->bc_primary->bm_pend_len == 0))
+			rc = bond_tx(ctx, rd, pppoat_util_time_us());
+	}
+	for (i = 0; i < ctx->bc_members_nr; ++i)
+		pppoat_inner_stop(&ctx->bc_members[i].bm_inner);
+
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_bond = {
+	.m_name  = "bond",
+	.m_descr = "Bonding of several transports with failover",
+	.m_init  = &module_bond_init,
+	.m_fini  = &module_bond_fini,
+	.m_run   = &module_bond_run,
+};
@@ -0,0 +1,468 @@
+/* eth.c
+ * PPP over Any Transport -- Raw Ethernet transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/eth.h"
+#include "conf.h"
+#include "ether.h"
+#include "if.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "util.h"
+
+/*
+ * Tunnel frames go straight to an Ethernet segment under their own
+ * EtherType, there is no IP stack on the way. A frame carries a chunk of
+ * the interface stream after a header of 16-bit length (short frames are
+ * padded on the wire) and the queue index, a BPF filter passes a queue's
+ * frames only to its socket.
+ *
+ * The socket has memory-mapped TPACKET_V3 rings. The kernel fills RX
+ * blocks with many frames and hands over a whole block, so a burst costs
+ * one wakeup. Packets from the interface are read right into TX ring
+ * slots and a batch is sent with one send().
+ *
+ * The peer's address is eth.peer, otherwise frames are broadcast until
+ * the first frame from the peer reveals it.
+ */
+
+
+#define ETH_RX_BLOCK_SIZE     (1 << 18)
+#define ETH_RX_BLOCKS_DEFAULT 16
+/* Partially filled RX block is handed over after this many msec */
+#define ETH_RX_TIMEOUT_DEFAULT 1
+#define ETH_TX_FRAMES_DEFAULT  256
+#define ETH_TX_BLOCK_FRAMES    16
+/* Frames from the interface sent with one send() */
+#define ETH_TX_BATCH           32
+/* Full TX ring is kicked again after this many usec */
+#define ETH_TX_RETRY           1000
+
+/* TX frame data follows the aligned tpacket3_hdr */
+#define ETH_TX_DATA_OFF (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+struct pppoat_eth_ctx {
+	int                  ec_sock;
+	int                  ec_ifindex;
+	char                 ec_dev[IFNAMSIZ];
+	uint16_t             ec_type;
+	unsigned int         ec_queue;
+	unsigned int         ec_mtu;
+	unsigned char        ec_mac[ETH_ALEN];
+	unsigned char        ec_peer[ETH_ALEN];
+	bool                 ec_peer_fixed;
+	unsigned char       *ec_map;
+	size_t               ec_map_size;
+	struct tpacket_req3  ec_rx_req;
+	struct tpacket_req3  ec_tx_req;
+	unsigned int         ec_rx_block;
+	unsigned int         ec_tx_frame;
+	/* TX frames filled since the last send() */
+	unsigned int         ec_tx_pending;
+	/* Counters */
+	unsigned long        ec_rx_blocks;
+	unsigned long        ec_rx_frames;
+	unsigned long        ec_tx_frames_sent;
+	unsigned long        ec_tx_sends;
+	unsigned long        ec_bad;
+};
+
+/* Passes only frames of our queue, the kernel drops the rest. */
+static int eth_filter_attach(struct pppoat_eth_ctx *ctx)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ETH_HLEN + 2),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ctx->ec_queue, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len    = ARRAY_SIZE(code),
+		.filter = code,
+	};
+	int rc;
+
+	rc = setsockopt(ctx->ec_sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+			sizeof(prog));
+	return rc != 0 ? P_ERR(-errno) : 0;
+}
+
+static int eth_rings_setup(struct pppoat_eth_ctx *ctx,
+			   struct pppoat_conf    *conf)
+{
+	struct tpacket_req3 *rx = &ctx->ec_rx_req;
+	struct tpacket_req3 *tx = &ctx->ec_tx_req;
+	unsigned int         frame_size = 2048;
+	int                  version    = TPACKET_V3;
+	int                  rc;
+
+	while (frame_size < ETH_TX_DATA_OFF + ETH_HLEN + ctx->ec_mtu)
+		frame_size *= 2;
+
+	memset(rx, 0, sizeof(*rx));
+	rx->tp_block_size     = ETH_RX_BLOCK_SIZE;
+	rx->tp_block_nr       = pppoat_max(pppoat_conf_get_ulong(conf,
+				"eth.rx_blocks", ETH_RX_BLOCKS_DEFAULT), 2);
+	rx->tp_frame_size     = frame_size;
+	rx->tp_frame_nr       = rx->tp_block_size / frame_size *
+				rx->tp_block_nr;
+	rx->tp_retire_blk_tov = pppoat_conf_get_ulong(conf, "eth.rx_timeout",
+						      ETH_RX_TIMEOUT_DEFAULT);
+
+	memset(tx, 0, sizeof(*tx));
+	tx->tp_frame_size = frame_size;
+	tx->tp_block_size = pppoat_max(frame_size * ETH_TX_BLOCK_FRAMES,
+				       (unsigned int)getpagesize());
+	tx->tp_frame_nr   = pppoat_max(pppoat_conf_get_ulong(conf,
+				"eth.tx_frames", ETH_TX_FRAMES_DEFAULT),
+				ETH_TX_BATCH);
+	tx->tp_block_nr   = (tx->tp_frame_nr * frame_size +
+			     tx->tp_block_size - 1) / tx->tp_block_size;
+	tx->tp_frame_nr   = tx->tp_block_nr * tx->tp_block_size / frame_size;
+
+	rc = setsockopt(ctx->ec_sock, SOL_PACKET, PACKET_VERSION, &version,
+			sizeof(version));
+	if (rc == 0)
+		rc = setsockopt(ctx->ec_sock, SOL_PACKET, PACKET_RX_RING, rx,
+				sizeof(*rx));
+	if (rc == 0)
+		rc = setsockopt(ctx->ec_sock, SOL_PACKET, PACKET_TX_RING, tx,
+				sizeof(*tx));
+	if (rc != 0) {
+		pppoat_error("eth", "Can't set up TPACKET_V3 rings, errno=%d",
+			     errno);
+		return P_ERR(-errno);
+	}
+
+	/* RX ring is followed by TX ring in one mapping */
+	ctx->ec_map_size = (size_t)rx->tp_block_size * rx->tp_block_nr +
+			   (size_t)tx->tp_block_size * tx->tp_block_nr;
+	ctx->ec_map = mmap(NULL, ctx->ec_map_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, ctx->ec_sock, 0);
+	if (ctx->ec_map == MAP_FAILED) {
+		ctx->ec_map = NULL;
+		return P_ERR(-errno);
+	}
+	return 0;
+}
+
+static int eth_sock_setup(struct pppoat_eth_ctx *ctx,
+			  struct pppoat_conf    *conf)
+{
+	struct sockaddr_ll addr;
+	int                one = 1;
+	int                rc;
+
+	ctx->ec_sock = socket(AF_PACKET, SOCK_RAW, htons(ctx->ec_type));
+	if (ctx->ec_sock < 0)
+		return P_ERR(-errno);
+	rc = pppoat_ether_dev_query(ctx->ec_dev, &ctx->ec_ifindex, ctx->ec_mac,
+				    &ctx->ec_mtu);
+	rc = rc ?: eth_filter_attach(ctx);
+	rc = rc ?: eth_rings_setup(ctx, conf);
+	if (rc == 0) {
+		/* Linux 4.20+, the socket doesn't see own frames anyway */
+		(void)setsockopt(ctx->ec_sock, SOL_PACKET,
+				 PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+		/* Frames go to the device queue, bypassing qdiscs */
+		(void)setsockopt(ctx->ec_sock, SOL_PACKET, PACKET_QDISC_BYPASS,
+				 &one, sizeof(one));
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family   = AF_PACKET;
+		addr.sll_protocol = htons(ctx->ec_type);
+		addr.sll_ifindex  = ctx->ec_ifindex;
+		rc = bind(ctx->ec_sock, (struct sockaddr *)&addr,
+			  sizeof(addr));
+		rc = rc != 0 ? P_ERR(-errno) : 0;
+	}
+	return rc ?: pppoat_util_fd_nonblock_set(ctx->ec_sock, true);
+}
+
+static void eth_ctx_fini(struct pppoat_eth_ctx *ctx)
+{
+	if (ctx->ec_map != NULL)
+		(void)munmap(ctx->ec_map, ctx->ec_map_size);
+	if (ctx->ec_sock >= 0)
+		(void)close(ctx->ec_sock);
+	pppoat_free(ctx);
+}
+
+static int module_eth_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_eth_ctx *ctx;
+	const char            *dev;
+	const char            *peer;
+	int                    rc = 0;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->ec_sock  = -1;
+	ctx->ec_type  = pppoat_conf_get_ulong(conf, "eth.type",
+					      PPPOAT_ETHER_TYPE_DEFAULT);
+	ctx->ec_queue = pppoat_conf_get_ulong(conf, "queue", 0);
+	memset(ctx->ec_peer, 0xff, ETH_ALEN);
+
+	dev  = pppoat_conf_get(conf, "eth.dev");
+	peer = pppoat_conf_get(conf, "eth.peer");
+	if (dev == NULL || strlen(dev) >= IFNAMSIZ) {
+		pppoat_error("eth", "Needs eth.dev");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0 && peer != NULL) {
+		rc = pppoat_ether_mac_parse(peer, ctx->ec_peer);
+		ctx->ec_peer_fixed = true;
+	}
+	if (rc == 0) {
+		strcpy(ctx->ec_dev, dev);
+		rc = eth_sock_setup(ctx, conf);
+	}
+	if (rc == 0) {
+		pppoat_debug("eth", "%s type 0x%04x queue %u mtu %u rx %ux%u "
+			     "tx %u frames", ctx->ec_dev, ctx->ec_type,
+			     ctx->ec_queue, ctx->ec_mtu,
+			     ctx->ec_rx_req.tp_block_nr,
+			     ctx->ec_rx_req.tp_block_size,
+			     ctx->ec_tx_req.tp_frame_nr);
+		*userdata = ctx;
+	} else {
+		eth_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_eth_fini(void *userdata)
+{
+	struct pppoat_eth_ctx *ctx = userdata;
+
+	pppoat_debug("eth", "rx blocks=%lu frames=%lu, tx frames=%lu "
+		     "sends=%lu, bad=%lu", ctx->ec_rx_blocks,
+		     ctx->ec_rx_frames, ctx->ec_tx_frames_sent,
+		     ctx->ec_tx_sends, ctx->ec_bad);
+	eth_ctx_fini(ctx);
+}
+
+static struct tpacket_block_desc *eth_rx_block(struct pppoat_eth_ctx *ctx,
+					       unsigned int           i)
+{
+	return (struct tpacket_block_desc *)(ctx->ec_map +
+		(size_t)i * ctx->ec_rx_req.tp_block_size);
+}
+
+static struct tpacket3_hdr *eth_tx_frame(struct pppoat_eth_ctx *ctx,
+					 unsigned int           i)
+{
+	size_t rx_size = (size_t)ctx->ec_rx_req.tp_block_size *
+			 ctx->ec_rx_req.tp_block_nr;
+
+	/* Frames don't cross blocks, block size is a multiple of them */
+	return (struct tpacket3_hdr *)(ctx->ec_map + rx_size +
+		(size_t)i * ctx->ec_tx_req.tp_frame_size);
+}
+
+static int eth_rx_frame(struct pppoat_eth_ctx *ctx,
+			struct tpacket3_hdr   *hdr,
+			int                    wr)
+{
+	unsigned char *frame = (unsigned char *)hdr + hdr->tp_mac;
+	unsigned int   queue;
+	ssize_t        len;
+
+	/* The filter has checked the queue */
+	len = pppoat_ether_hdr_get(frame, hdr->tp_snaplen, &queue);
+	if (len < 0) {
+		++ctx->ec_bad;
+		return 0;
+	}
+	if (!ctx->ec_peer_fixed) {
+		/* Source of the frame is ETH_ALEN bytes after destination */
+		memcpy(ctx->ec_peer, frame + ETH_ALEN, ETH_ALEN);
+	}
+	++ctx->ec_rx_frames;
+	return pppoat_util_write(wr, frame + ETH_HLEN + PPPOAT_ETHER_HDR_LEN,
+				 len);
+}
+
+/* Passes every block the kernel has retired to the interface. */
+static int eth_rx(struct pppoat_eth_ctx *ctx, int wr)
+{
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr       *hdr;
+	unsigned int               i;
+	int                        rc = 0;
+
+	while (rc == 0) {
+		block = eth_rx_block(ctx, ctx->ec_rx_block);
+		if ((__atomic_load_n(&block->hdr.bh1.block_status,
+				     __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+			break;
+		hdr = (struct tpacket3_hdr *)((unsigned char *)block +
+			block->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; rc == 0 && i < block->hdr.bh1.num_pkts; ++i) {
+			rc  = eth_rx_frame(ctx, hdr, wr);
+			hdr = (struct tpacket3_hdr *)((unsigned char *)hdr +
+						      hdr->tp_next_offset);
+		}
+		__atomic_store_n(&block->hdr.bh1.block_status,
+				 TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		ctx->ec_rx_block = (ctx->ec_rx_block + 1) %
+				   ctx->ec_rx_req.tp_block_nr;
+		++ctx->ec_rx_blocks;
+	}
+	return rc;
+}
+
+static bool eth_tx_frame_free(struct pppoat_eth_ctx *ctx)
+{
+	struct tpacket3_hdr *hdr = eth_tx_frame(ctx, ctx->ec_tx_frame);
+	uint32_t             status;
+
+	status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	if (status == TP_STATUS_WRONG_FORMAT) {
+		/* The kernel rejected the frame, reuse the slot */
+		++ctx->ec_bad;
+		status = TP_STATUS_AVAILABLE;
+	}
+	return status == TP_STATUS_AVAILABLE;
+}
+
+static void eth_tx_send(struct pppoat_eth_ctx *ctx)
+{
+	ssize_t rc;
+
+	/* Frames the kernel couldn't queue stay requested till next send */
+	rc = send(ctx->ec_sock, NULL, 0, MSG_DONTWAIT);
+	if (rc < 0 && errno != EAGAIN && errno != ENOBUFS)
+		pppoat_debug("eth", "send errno=%d", errno);
+	ctx->ec_tx_frames_sent += ctx->ec_tx_pending;
+	ctx->ec_tx_pending = 0;
+	++ctx->ec_tx_sends;
+}
+
+/*
+ * Reads packets from the interface into free TX slots while the pipe has
+ * any, then sends the whole batch.
+ */
+static int eth_tx(struct pppoat_eth_ctx *ctx, int rd)
+{
+	struct tpacket3_hdr *hdr;
+	unsigned char       *frame;
+	size_t               max;
+	ssize_t              len;
+	int                  rc = 0;
+
+	/* The pipe is a stream, a longer packet continues in the next frame */
+	max = pppoat_min(ctx->ec_tx_req.tp_frame_size - ETH_TX_DATA_OFF -
+			 ETH_HLEN, ctx->ec_mtu) - PPPOAT_ETHER_HDR_LEN;
+	while (rc == 0 && ctx->ec_tx_pending < ETH_TX_BATCH &&
+	       eth_tx_frame_free(ctx)) {
+		hdr   = eth_tx_frame(ctx, ctx->ec_tx_frame);
+		frame = (unsigned char *)hdr + ETH_TX_DATA_OFF;
+		len   = read(rd, frame + ETH_HLEN + PPPOAT_ETHER_HDR_LEN, max);
+		if (len == 0)
+			rc = P_ERR(-EPIPE);
+		else if (len < 0)
+			rc = errno == EAGAIN || errno == EINTR ? 1 :
+			     P_ERR(-errno);
+		if (rc != 0)
+			break;
+
+		pppoat_ether_hdr_put(frame, ctx->ec_peer, ctx->ec_mac,
+				     ctx->ec_type, ctx->ec_queue, len);
+
+		hdr->tp_len         = ETH_HLEN + PPPOAT_ETHER_HDR_LEN + len;
+		hdr->tp_next_offset = 0;
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+				 __ATOMIC_RELEASE);
+		ctx->ec_tx_frame = (ctx->ec_tx_frame + 1) %
+				   ctx->ec_tx_req.tp_frame_nr;
+		++ctx->ec_tx_pending;
+	}
+	if (ctx->ec_tx_pending > 0)
+		eth_tx_send(ctx);
+
+	return rc == 1 ? 0 : rc;
+}
+
+static int module_eth_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_eth_ctx *ctx = userdata;
+	fd_set                 rfds;
+	fd_set                 wfds;
+	uint64_t               timeout;
+	bool                   tx_full;
+	int                    rc;
+
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	/* Packets which fit a frame are never split */
+	if (rc == 0 && ctx->ec_queue == 0)
+		(void)pppoat_if_mtu_set(ctx->ec_mtu - PPPOAT_ETHER_HDR_LEN);
+
+	while (rc == 0) {
+		/*
+		 * Interface waits while the kernel drains a full TX ring. The
+		 * ring is kicked and polled in case the device refused frames.
+		 */
+		tx_full = !eth_tx_frame_free(ctx);
+		if (tx_full)
+			eth_tx_send(ctx);
+		timeout = tx_full ? ETH_TX_RETRY : PPPOAT_TIME_NEVER;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(ctx->ec_sock, &rfds);
+		if (tx_full)
+			FD_SET(ctx->ec_sock, &wfds);
+		else
+			FD_SET(rd, &rfds);
+		rc = pppoat_util_select_timed(pppoat_max(rd, ctx->ec_sock),
+					      &rfds, &wfds, timeout);
+		if (rc <= 0)
+			continue;
+		rc = 0;
+
+		if (FD_ISSET(ctx->ec_sock, &rfds))
+			rc = eth_rx(ctx, wr);
+		if (rc == 0 && !tx_full && FD_ISSET(rd, &rfds))
+			rc = eth_tx(ctx, rd);
+	}
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_eth = {
+	.m_name  = "eth",
+	.m_descr = "PPP over raw Ethernet (AF_PACKET)",
+	.m_init  = &module_eth_init,
+	.m_fini  = &module_eth_fini,
+	.m_run   = &module_eth_run,
+};
@@ -0,0 +1,490 @@
+/* netem.c
+ * PPP over Any Transport -- Network emulator in front of a transport
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/netem.h"
+#include "conf.h"
+#include "inner.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "util.h"
+
+/*
+ * Impairs what this end sends, as tc-netem does on egress, and passes it
+ * to the inner transport netem.module. Received data passes untouched,
+ * the peer runs its own netem for the other direction. Decisions come
+ * from a PRNG seeded with netem.seed, so a run with the same seed and
+ * traffic makes the same decisions. The unit is a read from the
+ * interface, which is a packet unless the interface falls behind.
+ *
+ * Every packet gets a departure time: the rate limit serialises packets
+ * one after another, then delay with jitter from the chosen distribution
+ * is added. A packet picked for reordering skips the delay. Packets wait
+ * in a heap ordered by departure time, so jitter reorders them too.
+ */
+
+#define NETEM_FRAME_MAX     65536
+#define NETEM_LIMIT_DEFAULT 1000
+
+typedef enum {
+	NETEM_DIST_UNIFORM,
+	NETEM_DIST_NORMAL,
+	NETEM_DIST_PARETO,
+} netem_dist_t;
+
+/* Shape of the pareto distribution, the tail is heavy but has a mean */
+#define NETEM_PARETO_ALPHA 3.0
+
+struct netem_pkt {
+	uint64_t      np_time;
+	/* Keeps packets with equal time in order */
+	uint64_t      np_seq;
+	size_t        np_len;
+	unsigned char np_data[];
+};
+
+struct pppoat_netem_ctx {
+	struct pppoat_inner  nc_inner;
+	uint64_t             nc_seed;
+	uint64_t             nc_rand;
+	uint64_t             nc_delay;
+	uint64_t             nc_jitter;
+	netem_dist_t         nc_dist;
+	/* Probabilities are scaled to [0, 1] */
+	double               nc_loss;
+	double               nc_loss_p;
+	double               nc_loss_r;
+	double               nc_loss_bad;
+	bool                 nc_bad;
+	double               nc_reorder;
+	double               nc_duplicate;
+	/* Bits per second, 0 is unlimited */
+	uint64_t             nc_rate;
+	uint64_t             nc_busy_until;
+	struct netem_pkt   **nc_heap;
+	size_t               nc_heap_nr;
+	size_t               nc_limit;
+	uint64_t             nc_seq;
+	/* Packet being written to the inner transport */
+	struct netem_pkt    *nc_cur;
+	size_t               nc_cur_off;
+	unsigned char       *nc_buf;
+	/* Counters */
+	unsigned long        nc_packets;
+	unsigned long        nc_lost;
+	unsigned long        nc_dups;
+	unsigned long        nc_reordered;
+	unsigned long        nc_overflows;
+};
+
+/* xorshift64* */
+static uint64_t netem_rand(struct pppoat_netem_ctx *ctx)
+{
+	ctx->nc_rand ^= ctx->nc_rand >> 12;
+	ctx->nc_rand ^= ctx->nc_rand << 25;
+	ctx->nc_rand ^= ctx->nc_rand >> 27;
+	return ctx->nc_rand * 0x2545f4914f6cdd1dULL;
+}
+
+/* Uniform in (0, 1) */
+static double netem_uniform(struct pppoat_netem_ctx *ctx)
+{
+	return ((netem_rand(ctx) >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+static bool netem_chance(struct pppoat_netem_ctx *ctx, double p)
+{
+	return p > 0 && netem_uniform(ctx) < p;
+}
+
+static uint64_t netem_delay(struct pppoat_netem_ctx *ctx)
+{
+	double d = ctx->nc_delay;
+	double j = ctx->nc_jitter;
+	double u;
+	double x;
+
+	if (j == 0)
+		return ctx->nc_delay;
+	switch (ctx->nc_dist) {
+	case NETEM_DIST_NORMAL:
+		/* Box-Muller */
+		u = netem_uniform(ctx);
+		x = d + j * sqrt(-2 * log(u)) *
+			cos(2 * M_PI * netem_uniform(ctx));
+		break;
+	case NETEM_DIST_PARETO:
+		/* Scaled so the mean stays at the delay */
+		x = j * (NETEM_PARETO_ALPHA - 1) / NETEM_PARETO_ALPHA /
+		    pow(netem_uniform(ctx), 1 / NETEM_PARETO_ALPHA);
+		x = d - j + x;
+		break;
+	default:
+		x = d + j * (2 * netem_uniform(ctx) - 1);
+	}
+	return x > 0 ? (uint64_t)x : 0;
+}
+
+/* Gilbert-Elliott model, it's plain random loss while loss_p is 0. */
+static bool netem_lost(struct pppoat_netem_ctx *ctx)
+{
+	if (ctx->nc_bad && netem_chance(ctx, ctx->nc_loss_r))
+		ctx->nc_bad = false;
+	else if (!ctx->nc_bad && netem_chance(ctx, ctx->nc_loss_p))
+		ctx->nc_bad = true;
+	return netem_chance(ctx, ctx->nc_bad ? ctx->nc_loss_bad :
+					       ctx->nc_loss);
+}
+
+static bool netem_pkt_before(const struct netem_pkt *a,
+			     const struct netem_pkt *b)
+{
+	return a->np_time < b->np_time ||
+	       (a->np_time == b->np_time && a->np_seq < b->np_seq);
+}
+
+static void netem_heap_push(struct pppoat_netem_ctx *ctx,
+			    struct netem_pkt        *pkt)
+{
+	struct netem_pkt **heap = ctx->nc_heap;
+	size_t             i    = ctx->nc_heap_nr++;
+
+	for (; i > 0 && netem_pkt_before(pkt, heap[(i - 1) / 2]);
+	     i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = pkt;
+}
+
+static struct netem_pkt *netem_heap_pop(struct pppoat_netem_ctx *ctx)
+{
+	struct netem_pkt **heap = ctx->nc_heap;
+	struct netem_pkt  *top  = heap[0];
+	struct netem_pkt  *last = heap[--ctx->nc_heap_nr];
+	size_t             nr   = ctx->nc_heap_nr;
+	size_t             i    = 0;
+	size_t             c;
+
+	while ((c = 2 * i + 1) < nr) {
+		if (c + 1 < nr && netem_pkt_before(heap[c + 1], heap[c]))
+			++c;
+		if (!netem_pkt_before(heap[c], last))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	if (nr > 0)
+		heap[i] = last;
+	return top;
+}
+
+static void netem_enqueue(struct pppoat_netem_ctx *ctx,
+			  const unsigned char     *buf,
+			  size_t                   len,
+			  uint64_t                 time)
+{
+	struct netem_pkt *pkt;
+
+	if (ctx->nc_heap_nr == ctx->nc_limit) {
+		++ctx->nc_overflows;
+		return;
+	}
+	pkt = pppoat_alloc(sizeof(*pkt) + len);
+	if (pkt == NULL) {
+		++ctx->nc_overflows;
+		return;
+	}
+	pkt->np_time = time;
+	pkt->np_seq  = ctx->nc_seq++;
+	pkt->np_len  = len;
+	memcpy(pkt->np_data, buf, len);
+	netem_heap_push(ctx, pkt);
+}
+
+/* Reads a packet from the interface and schedules it. */
+static int netem_tx(struct pppoat_netem_ctx *ctx, int rd, uint64_t now)
+{
+	uint64_t time;
+	ssize_t  len;
+	int      copies;
+
+	len = read(rd, ctx->nc_buf, NETEM_FRAME_MAX);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	++ctx->nc_packets;
+
+	if (netem_lost(ctx)) {
+		++ctx->nc_lost;
+		return 0;
+	}
+	copies = netem_chance(ctx, ctx->nc_duplicate) ? 2 : 1;
+	ctx->nc_dups += copies - 1;
+	while (copies-- > 0) {
+		time = now;
+		if (ctx->nc_rate > 0) {
+			time = pppoat_max(time, ctx->nc_busy_until) +
+			       (uint64_t)len * 8 * 1000000 / ctx->nc_rate;
+			ctx->nc_busy_until = time;
+		}
+		if (netem_chance(ctx, ctx->nc_reorder))
+			++ctx->nc_reordered;
+		else
+			time += netem_delay(ctx);
+		netem_enqueue(ctx, ctx->nc_buf, len, time);
+	}
+	return 0;
+}
+
+/* Writes due packets to the inner transport while its pipe takes them. */
+static int netem_flush(struct pppoat_netem_ctx *ctx, uint64_t now)
+{
+	struct netem_pkt *pkt;
+	ssize_t           n;
+
+	while (true) {
+		if (ctx->nc_cur == NULL && ctx->nc_heap_nr > 0 &&
+		    ctx->nc_heap[0]->np_time <= now) {
+			ctx->nc_cur     = netem_heap_pop(ctx);
+			ctx->nc_cur_off = 0;
+		}
+		pkt = ctx->nc_cur;
+		if (pkt == NULL)
+			break;
+		n = write(ctx->nc_inner.in_tx[1],
+			  pkt->np_data + ctx->nc_cur_off,
+			  pkt->np_len - ctx->nc_cur_off);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 :
+							       P_ERR(-errno);
+		ctx->nc_cur_off += n;
+		if (ctx->nc_cur_off < pkt->np_len)
+			break;
+		pppoat_free(pkt);
+		ctx->nc_cur = NULL;
+	}
+	return 0;
+}
+
+/* Passes received data to the interface, EOF means the inner one ended. */
+static int netem_rx(struct pppoat_netem_ctx *ctx, int wr)
+{
+	ssize_t len;
+	int     rc;
+
+	len = read(ctx->nc_inner.in_rx[0], ctx->nc_buf, NETEM_FRAME_MAX);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (len == 0) {
+		rc = pppoat_inner_join(&ctx->nc_inner);
+		pppoat_error("netem", "Inner transport stopped, rc=%d", rc);
+		return rc ?: -EPIPE;
+	}
+	return pppoat_util_write(wr, ctx->nc_buf, len);
+}
+
+/* Percentage option as a probability. */
+static int netem_conf_prob(struct pppoat_conf *conf,
+			   const char         *key,
+			   double              def,
+			   double             *prob)
+{
+	const char *val = pppoat_conf_get(conf, key);
+	char       *end;
+	double      p;
+
+	*prob = def;
+	if (val == NULL)
+		return 0;
+	p = strtod(val, &end);
+	if (*end != '\0' || !(p >= 0 && p <= 100)) {
+		pppoat_error("netem", "%s must be a percentage", key);
+		return P_ERR(-EINVAL);
+	}
+	*prob = p / 100;
+	return 0;
+}
+
+static void netem_ctx_fini(struct pppoat_netem_ctx *ctx)
+{
+	pppoat_inner_fini(&ctx->nc_inner);
+	while (ctx->nc_heap != NULL && ctx->nc_heap_nr > 0)
+		pppoat_free(netem_heap_pop(ctx));
+	pppoat_free(ctx->nc_cur);
+	pppoat_free(ctx->nc_heap);
+	pppoat_free(ctx->nc_buf);
+	pppoat_free(ctx);
+}
+
+static int module_netem_init(struct pppoat_conf *conf, void **userdata)
+{
+	const struct pppoat_module *inner;
+	struct pppoat_netem_ctx    *ctx;
+	const char                 *name;
+	const char                 *dist;
+	int                         rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->nc_inner.in_tx[0] = ctx->nc_inner.in_tx[1] = -1;
+	ctx->nc_inner.in_rx[0] = ctx->nc_inner.in_rx[1] = -1;
+
+	ctx->nc_delay  = pppoat_conf_get_ulong(conf, "netem.delay", 0);
+	ctx->nc_jitter = pppoat_conf_get_ulong(conf, "netem.jitter", 0);
+	ctx->nc_rate   = pppoat_conf_get_ulong(conf, "netem.rate", 0);
+	ctx->nc_limit  = pppoat_max(pppoat_conf_get_ulong(conf, "netem.limit",
+					NETEM_LIMIT_DEFAULT), 1);
+	rc = netem_conf_prob(conf, "netem.loss", 0, &ctx->nc_loss);
+	rc = rc ?: netem_conf_prob(conf, "netem.loss_p", 0, &ctx->nc_loss_p);
+	rc = rc ?: netem_conf_prob(conf, "netem.loss_r", 1, &ctx->nc_loss_r);
+	rc = rc ?: netem_conf_prob(conf, "netem.loss_bad", 1,
+				   &ctx->nc_loss_bad);
+	rc = rc ?: netem_conf_prob(conf, "netem.reorder", 0,
+				   &ctx->nc_reorder);
+	rc = rc ?: netem_conf_prob(conf, "netem.duplicate", 0,
+				   &ctx->nc_duplicate);
+
+	dist = pppoat_conf_get(conf, "netem.dist") ?: "uniform";
+	if (strcmp(dist, "normal") == 0)
+		ctx->nc_dist = NETEM_DIST_NORMAL;
+	else if (strcmp(dist, "pareto") == 0)
+		ctx->nc_dist = NETEM_DIST_PARETO;
+	else if (strcmp(dist, "uniform") != 0)
+		rc = rc ?: P_ERR(-EINVAL);
+
+	/* Without a seed a random one is logged, so the run can be repeated */
+	ctx->nc_seed = pppoat_conf_get_ulong(conf, "netem.seed", 0);
+	if (pppoat_conf_get(conf, "netem.seed") == NULL &&
+	    getrandom(&ctx->nc_seed, sizeof(ctx->nc_seed), 0) !=
+	    sizeof(ctx->nc_seed))
+		ctx->nc_seed = pppoat_util_time_us();
+	/* splitmix64 step, xorshift needs a state which isn't zero */
+	ctx->nc_rand = ctx->nc_seed + 0x9e3779b97f4a7c15ULL;
+	ctx->nc_rand = (ctx->nc_rand ^ (ctx->nc_rand >> 30)) *
+		       0xbf58476d1ce4e5b9ULL;
+	ctx->nc_rand = (ctx->nc_rand ^ (ctx->nc_rand >> 27)) *
+		       0x94d049bb133111ebULL;
+	ctx->nc_rand = (ctx->nc_rand ^ (ctx->nc_rand >> 31)) ?: 1;
+
+	ctx->nc_heap = pppoat_alloc(ctx->nc_limit * sizeof(*ctx->nc_heap));
+	ctx->nc_buf  = pppoat_alloc(NETEM_FRAME_MAX);
+	if (rc == 0 && (ctx->nc_heap == NULL || ctx->nc_buf == NULL))
+		rc = P_ERR(-ENOMEM);
+
+	name  = pppoat_conf_get(conf, "netem.module");
+	inner = name == NULL ? NULL : pppoat_module_find(name);
+	if (rc == 0 && (inner == NULL || inner == &pppoat_module_netem)) {
+		pppoat_error("netem", "netem.module must name the transport "
+			     "to run behind the emulator");
+		rc = P_ERR(-EINVAL);
+	}
+	rc = rc ?: pppoat_inner_init(&ctx->nc_inner, inner, conf);
+
+	if (rc == 0) {
+		pppoat_debug("netem", "%s seed=%llu delay=%llu jitter=%llu "
+			     "usec dist=%s rate=%llu bit/s", name,
+			     (unsigned long long)ctx->nc_seed,
+			     (unsigned long long)ctx->nc_delay,
+			     (unsigned long long)ctx->nc_jitter, dist,
+			     (unsigned long long)ctx->nc_rate);
+		*userdata = ctx;
+	} else {
+		netem_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_netem_fini(void *userdata)
+{
+	struct pppoat_netem_ctx *ctx = userdata;
+
+	pppoat_debug("netem", "packets=%lu lost=%lu duplicated=%lu "
+		     "reordered=%lu overflows=%lu", ctx->nc_packets,
+		     ctx->nc_lost, ctx->nc_dups, ctx->nc_reordered,
+		     ctx->nc_overflows);
+	netem_ctx_fini(ctx);
+}
+
+static int module_netem_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_netem_ctx *ctx = userdata;
+	struct pppoat_inner     *in  = &ctx->nc_inner;
+	fd_set                   rfds;
+	fd_set                   wfds;
+	uint64_t                 now;
+	uint64_t                 timeout;
+	int                      rc;
+
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	rc = rc ?: pppoat_inner_start(in);
+
+	while (rc == 0) {
+		now = pppoat_util_time_us();
+		rc  = netem_flush(ctx, now);
+		if (rc != 0)
+			break;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(rd, &rfds);
+		FD_SET(in->in_rx[0], &rfds);
+		timeout = PPPOAT_TIME_NEVER;
+		if (ctx->nc_cur != NULL)
+			FD_SET(in->in_tx[1], &wfds);
+		else if (ctx->nc_heap_nr > 0)
+			timeout = ctx->nc_heap[0]->np_time -
+				  pppoat_min(now, ctx->nc_heap[0]->np_time);
+		rc = pppoat_util_select_timed(pppoat_max(rd,
+				pppoat_max(in->in_rx[0], in->in_tx[1])),
+				&rfds, &wfds, timeout);
+		if (rc <= 0) {
+			rc = rc < 0 ? rc : 0;
+			continue;
+		}
+		rc = 0;
+
+		if (FD_ISSET(in->in_rx[0], &rfds))
+			rc = netem_rx(ctx, wr);
+		if (rc == 0 && FD_ISSET(rd, &rfds))
+			rc = netem_tx(ctx, rd, pppoat_util_time_us());
+	}
+	pppoat_inner_stop(in);
+
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_netem = {
+	.m_name  = "netem",
+	.m_descr = "Network emulator in front of another transport",
+	.m_init  = &module_netem_init,
+	.m_fini  = &module_netem_fini,
+	.m_run   = &module_netem_run,
+};
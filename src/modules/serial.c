@@ -0,0 +1,305 @@
+/* serial.c
+ * PPP over Any Transport -- Serial line transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/serial.h"
+#include "cobs.h"
+#include "conf.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "util.h"
+
+/*
+ * Carries the interface stream over a tty: a serial port, a USB adapter
+ * or a pty. The line is put into raw mode, chunks of the stream are sent
+ * as COBS frames with CRC32C, see cobs.h. A frame damaged on the line
+ * fails the CRC and is dropped, the interface resynchronises on the next
+ * packet. The line has one stream, so there is one queue.
+ */
+
+#define SERIAL_BAUD_DEFAULT 115200
+/* Longest chunk of the stream in a frame */
+#define SERIAL_FRAME_MAX    2048
+#define SERIAL_RX_SIZE      4096
+
+struct serial_baud {
+	unsigned long sb_baud;
+	speed_t       sb_speed;
+};
+
+static const struct serial_baud serial_bauds[] = {
+	{ 9600,    B9600 },
+	{ 19200,   B19200 },
+	{ 38400,   B38400 },
+	{ 57600,   B57600 },
+	{ 115200,  B115200 },
+	{ 230400,  B230400 },
+	{ 460800,  B460800 },
+	{ 500000,  B500000 },
+	{ 576000,  B576000 },
+	{ 921600,  B921600 },
+	{ 1000000, B1000000 },
+	{ 1152000, B1152000 },
+	{ 1500000, B1500000 },
+	{ 2000000, B2000000 },
+	{ 2500000, B2500000 },
+	{ 3000000, B3000000 },
+	{ 3500000, B3500000 },
+	{ 4000000, B4000000 },
+};
+
+struct pppoat_serial_ctx {
+	int                 sc_fd;
+	char               *sc_dev;
+	unsigned long       sc_baud;
+	bool                sc_flow;
+	struct pppoat_cobs  sc_dec;
+	unsigned char      *sc_chunk;
+	unsigned char      *sc_rx;
+	/* Encoded frame, sc_out_len bytes from sc_out_off are unsent */
+	unsigned char      *sc_out;
+	size_t              sc_out_off;
+	size_t              sc_out_len;
+	/* Counters */
+	unsigned long       sc_tx_frames;
+	unsigned long       sc_tx_bytes;
+	unsigned long       sc_rx_bytes;
+};
+
+static int serial_tty_setup(struct pppoat_serial_ctx *ctx)
+{
+	struct termios tio;
+	size_t         i;
+	int            rc;
+
+	for (i = 0; i < ARRAY_SIZE(serial_bauds); ++i)
+		if (serial_bauds[i].sb_baud == ctx->sc_baud)
+			break;
+	if (i == ARRAY_SIZE(serial_bauds)) {
+		pppoat_error("serial", "Unsupported baud rate %lu",
+			     ctx->sc_baud);
+		return P_ERR(-EINVAL);
+	}
+
+	ctx->sc_fd = open(ctx->sc_dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (ctx->sc_fd < 0) {
+		pppoat_error("serial", "Can't open %s, errno=%d", ctx->sc_dev,
+			     errno);
+		return P_ERR(-errno);
+	}
+	rc = tcgetattr(ctx->sc_fd, &tio);
+	if (rc == 0) {
+		/* 8N1, no echo, no line discipline processing */
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+		if (ctx->sc_flow)
+			tio.c_cflag |= CRTSCTS;
+		tio.c_cc[VMIN]  = 1;
+		tio.c_cc[VTIME] = 0;
+		rc = cfsetispeed(&tio, serial_bauds[i].sb_speed);
+		rc = rc ?: cfsetospeed(&tio, serial_bauds[i].sb_speed);
+		rc = rc ?: tcsetattr(ctx->sc_fd, TCSANOW, &tio);
+	}
+	if (rc != 0) {
+		pppoat_error("serial", "Can't configure %s, errno=%d",
+			     ctx->sc_dev, errno);
+		return P_ERR(-errno);
+	}
+	/* Whatever was received before us is stale */
+	(void)tcflush(ctx->sc_fd, TCIOFLUSH);
+	return 0;
+}
+
+static void serial_ctx_fini(struct pppoat_serial_ctx *ctx)
+{
+	if (ctx->sc_fd >= 0)
+		(void)close(ctx->sc_fd);
+	pppoat_cobs_fini(&ctx->sc_dec);
+	pppoat_free(ctx->sc_out);
+	pppoat_free(ctx->sc_rx);
+	pppoat_free(ctx->sc_chunk);
+	pppoat_free(ctx->sc_dev);
+	pppoat_free(ctx);
+}
+
+static int module_serial_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_serial_ctx *ctx;
+	const char               *dev;
+	int                       rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->sc_fd   = -1;
+	ctx->sc_baud = pppoat_conf_get_ulong(conf, "serial.baud",
+					     SERIAL_BAUD_DEFAULT);
+	ctx->sc_flow = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+							       "serial.flow"));
+	dev = pppoat_conf_get(conf, "serial.dev");
+
+	rc = pppoat_cobs_init(&ctx->sc_dec, SERIAL_FRAME_MAX);
+	if (rc == 0 && dev == NULL) {
+		pppoat_error("serial", "Needs serial.dev");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0 && pppoat_conf_get_ulong(conf, "queue", 0) != 0) {
+		pppoat_error("serial", "A line carries one queue only");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0) {
+		ctx->sc_dev   = pppoat_strdup(dev);
+		ctx->sc_chunk = pppoat_alloc(SERIAL_FRAME_MAX);
+		ctx->sc_rx    = pppoat_alloc(SERIAL_RX_SIZE);
+		ctx->sc_out   = pppoat_alloc(PPPOAT_COBS_ENC_MAX(
+							SERIAL_FRAME_MAX));
+		if (ctx->sc_dev == NULL || ctx->sc_chunk == NULL ||
+		    ctx->sc_rx == NULL || ctx->sc_out == NULL)
+			rc = P_ERR(-ENOMEM);
+	}
+	rc = rc ?: serial_tty_setup(ctx);
+	if (rc == 0) {
+		pppoat_debug("serial", "%s at %lu baud%s", ctx->sc_dev,
+			     ctx->sc_baud, ctx->sc_flow ? ", RTS/CTS" : "");
+		*userdata = ctx;
+	} else {
+		serial_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_serial_fini(void *userdata)
+{
+	struct pppoat_serial_ctx *ctx = userdata;
+
+	pppoat_debug("serial", "tx frames=%lu bytes=%lu, rx frames=%lu "
+		     "bytes=%lu bad_crc=%lu too_long=%lu", ctx->sc_tx_frames,
+		     ctx->sc_tx_bytes, ctx->sc_dec.cb_frames, ctx->sc_rx_bytes,
+		     ctx->sc_dec.cb_bad_crc, ctx->sc_dec.cb_too_long);
+	serial_ctx_fini(ctx);
+}
+
+static int serial_deliver(void *userdata, unsigned char *frame, size_t len)
+{
+	int *wr = userdata;
+
+	return pppoat_util_write(*wr, frame, len);
+}
+
+static int serial_rx(struct pppoat_serial_ctx *ctx, int wr)
+{
+	ssize_t len;
+
+	len = read(ctx->sc_fd, ctx->sc_rx, SERIAL_RX_SIZE);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len <= 0) {
+		/* A pty returns EIO when the other end is closed */
+		pppoat_error("serial", "%s hung up", ctx->sc_dev);
+		return P_ERR(len == 0 ? -EPIPE : -errno);
+	}
+	ctx->sc_rx_bytes += len;
+	return pppoat_cobs_decode(&ctx->sc_dec, ctx->sc_rx, len,
+				  &serial_deliver, &wr);
+}
+
+static int serial_flush(struct pppoat_serial_ctx *ctx)
+{
+	ssize_t len;
+
+	len = write(ctx->sc_fd, ctx->sc_out + ctx->sc_out_off,
+		    ctx->sc_out_len);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	ctx->sc_out_off  += len;
+	ctx->sc_out_len  -= len;
+	ctx->sc_tx_bytes += len;
+	return 0;
+}
+
+/* Frames a chunk of the stream, the line takes it while we receive. */
+static int serial_tx(struct pppoat_serial_ctx *ctx, int rd)
+{
+	ssize_t len;
+
+	len = read(rd, ctx->sc_chunk, SERIAL_FRAME_MAX);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	ctx->sc_out_off = 0;
+	ctx->sc_out_len = pppoat_cobs_encode(ctx->sc_chunk, len, ctx->sc_out);
+	++ctx->sc_tx_frames;
+	return serial_flush(ctx);
+}
+
+static int module_serial_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_serial_ctx *ctx = userdata;
+	fd_set                    rfds;
+	fd_set                    wfds;
+	int                       rc;
+
+	/* Ends whatever the peer has half received, an empty frame is idle */
+	ctx->sc_out[0]  = 0;
+	ctx->sc_out_len = 1;
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	rc = rc ?: serial_flush(ctx);
+
+	while (rc == 0) {
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(ctx->sc_fd, &rfds);
+		if (ctx->sc_out_len > 0)
+			FD_SET(ctx->sc_fd, &wfds);
+		else
+			FD_SET(rd, &rfds);
+		rc = pppoat_util_select(pppoat_max(rd, ctx->sc_fd), &rfds,
+					&wfds);
+		if (rc < 0)
+			break;
+		rc = 0;
+
+		if (FD_ISSET(ctx->sc_fd, &rfds))
+			rc = serial_rx(ctx, wr);
+		if (rc == 0 && FD_ISSET(ctx->sc_fd, &wfds))
+			rc = serial_flush(ctx);
+		else if (rc == 0 && FD_ISSET(rd, &rfds))
+			rc = serial_tx(ctx, rd);
+	}
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_serial = {
+	.m_name  = "serial",
+	.m_descr = "PPP over a serial line (tty or pty)",
+	.m_init  = &module_serial_init,
+	.m_fini  = &module_serial_fini,
+	.m_run   = &module_serial_run,
+};
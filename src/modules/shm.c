@@ -0,0 +1,290 @@
+/* shm.c
+ * PPP over Any Transport -- Shared memory transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/shm.h"
+#include "conf.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "ring.h"
+#include "util.h"
+
+/*
+ * Both ends map the same POSIX shared memory object. It holds two rings,
+ * the server produces to ring 0 and the client to ring 1. The object is
+ * created by whichever end comes first and is never removed, so either
+ * end may restart and attach again. Packets are read from the interface
+ * right into the ring and written to the peer's interface from it.
+ */
+
+#define SHM_MAGIC          0x70707368 /* "ppsh" */
+#define SHM_HDR_SIZE       4096
+#define SHM_FRAME_MAX      65535
+#define SHM_RING_DEFAULT   (4UL << 20)
+#define SHM_RING_MIN       (256UL << 10)
+/* Sleeping ends check for stop this often */
+#define SHM_POLL_INTERVAL  100000
+
+struct shm_hdr {
+	uint32_t               sh_magic;
+	struct pppoat_ring_ctl sh_rings[2];
+};
+
+struct pppoat_shm_ctx {
+	pppoat_node_type_t  sc_type;
+	char                sc_path[64];
+	int                 sc_fd;
+	void               *sc_map;
+	size_t              sc_map_size;
+	struct pppoat_ring  sc_tx;
+	struct pppoat_ring  sc_rx;
+	pthread_t           sc_thread;
+	bool                sc_thread_started;
+	bool                sc_stop;
+	/* Wakes the TX thread up when the RX side stops */
+	int                 sc_stop_pipe[2];
+	int                 sc_rd;
+	/* Error which stopped the TX thread */
+	int                 sc_tx_rc;
+};
+
+static int shm_map(struct pppoat_shm_ctx *ctx, uint64_t ring_size)
+{
+	struct shm_hdr *hdr;
+	struct stat     st;
+	uint32_t        magic = 0;
+	int             rc;
+
+	ctx->sc_map_size = SHM_HDR_SIZE + 2 * ring_size;
+	ctx->sc_fd = shm_open(ctx->sc_path, O_RDWR | O_CREAT, 0600);
+	if (ctx->sc_fd < 0)
+		return P_ERR(-errno);
+
+	rc = fstat(ctx->sc_fd, &st) != 0 ? P_ERR(-errno) : 0;
+	/* Both ends may race here, they truncate to the same size */
+	if (rc == 0 && st.st_size == 0 &&
+	    (ftruncate(ctx->sc_fd, ctx->sc_map_size) != 0 ||
+	     fstat(ctx->sc_fd, &st) != 0))
+		rc = P_ERR(-errno);
+	if (rc == 0 && (size_t)st.st_size != ctx->sc_map_size) {
+		pppoat_error("shm", "%s has size %llu, shm.size differs "
+			     "between the ends", ctx->sc_path,
+			     (unsigned long long)st.st_size);
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0) {
+		ctx->sc_map = mmap(NULL, ctx->sc_map_size,
+				   PROT_READ | PROT_WRITE, MAP_SHARED,
+				   ctx->sc_fd, 0);
+		if (ctx->sc_map == MAP_FAILED) {
+			ctx->sc_map = NULL;
+			rc = P_ERR(-errno);
+		}
+	}
+	if (rc != 0)
+		return rc;
+
+	/* Zeroed rings are empty, the magic only guards against strangers */
+	hdr = ctx->sc_map;
+	if (!__atomic_compare_exchange_n(&hdr->sh_magic, &magic, SHM_MAGIC,
+					 false, __ATOMIC_SEQ_CST,
+					 __ATOMIC_SEQ_CST) &&
+	    magic != SHM_MAGIC) {
+		pppoat_error("shm", "%s isn't a pppoat region", ctx->sc_path);
+		return P_ERR(-EINVAL);
+	}
+
+	pppoat_ring_attach(ctx->sc_type == PPPOAT_NODE_MASTER ? &ctx->sc_tx :
+								&ctx->sc_rx,
+			   &hdr->sh_rings[0],
+			   (char *)ctx->sc_map + SHM_HDR_SIZE, ring_size);
+	pppoat_ring_attach(ctx->sc_type == PPPOAT_NODE_MASTER ? &ctx->sc_rx :
+								&ctx->sc_tx,
+			   &hdr->sh_rings[1],
+			   (char *)ctx->sc_map + SHM_HDR_SIZE + ring_size,
+			   ring_size);
+	return 0;
+}
+
+static void shm_ctx_fini(struct pppoat_shm_ctx *ctx)
+{
+	if (ctx->sc_map != NULL)
+		(void)munmap(ctx->sc_map, ctx->sc_map_size);
+	if (ctx->sc_fd >= 0)
+		(void)close(ctx->sc_fd);
+	if (ctx->sc_stop_pipe[0] >= 0) {
+		(void)close(ctx->sc_stop_pipe[0]);
+		(void)close(ctx->sc_stop_pipe[1]);
+	}
+	pppoat_free(ctx);
+}
+
+static int module_shm_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_shm_ctx *ctx;
+	const char            *name;
+	uint64_t               ring_size = SHM_RING_MIN;
+	unsigned long          size;
+	int                    rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->sc_fd   = -1;
+	ctx->sc_stop_pipe[0] = ctx->sc_stop_pipe[1] = -1;
+	ctx->sc_type = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+			"server")) ? PPPOAT_NODE_MASTER : PPPOAT_NODE_SLAVE;
+
+	/* Every queue of a multiqueue interface has its own region */
+	name = pppoat_conf_get(conf, "shm.name") ?: "pppoat";
+	snprintf(ctx->sc_path, sizeof(ctx->sc_path), "/pppoat-%s.%lu", name,
+		 pppoat_conf_get_ulong(conf, "queue", 0));
+	size = pppoat_conf_get_ulong(conf, "shm.size", SHM_RING_DEFAULT);
+	while (ring_size < size)
+		ring_size *= 2;
+
+	if (strchr(name, '/') != NULL) {
+		pppoat_error("shm", "shm.name can't contain '/'");
+		rc = P_ERR(-EINVAL);
+	} else {
+		rc = shm_map(ctx, ring_size);
+	}
+	if (rc == 0 && pipe(ctx->sc_stop_pipe) != 0) {
+		ctx->sc_stop_pipe[0] = ctx->sc_stop_pipe[1] = -1;
+		rc = P_ERR(-errno);
+	}
+	if (rc == 0) {
+		pppoat_debug("shm", "Attached to %s as %s, ring size %llu",
+			     ctx->sc_path, ctx->sc_type == PPPOAT_NODE_MASTER ?
+			     "server" : "client",
+			     (unsigned long long)ring_size);
+		*userdata = ctx;
+	} else {
+		shm_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_shm_fini(void *userdata)
+{
+	struct pppoat_shm_ctx *ctx = userdata;
+	ssize_t                rc;
+
+	if (ctx->sc_thread_started) {
+		rc = write(ctx->sc_stop_pipe[1], "", 1);
+		PPPOAT_ASSERT(rc == 1);
+		(void)pthread_join(ctx->sc_thread, NULL);
+	}
+	pppoat_debug("shm", "tx packets=%lu sleeps=%lu wakeups=%lu, "
+		     "rx packets=%lu sleeps=%lu wakeups=%lu",
+		     ctx->sc_tx.rg_packets, ctx->sc_tx.rg_sleeps,
+		     ctx->sc_tx.rg_wakeups, ctx->sc_rx.rg_packets,
+		     ctx->sc_rx.rg_sleeps, ctx->sc_rx.rg_wakeups);
+	shm_ctx_fini(ctx);
+}
+
+static bool shm_stopped(struct pppoat_shm_ctx *ctx)
+{
+	return __atomic_load_n(&ctx->sc_stop, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Reads packets from the interface into the TX ring. It waits for the
+ * interface together with the stop pipe, so the RX side can stop it.
+ */
+static void *shm_tx_thread(void *userdata)
+{
+	struct pppoat_shm_ctx *ctx  = userdata;
+	int                    stop = ctx->sc_stop_pipe[0];
+	unsigned char         *buf;
+	fd_set                 rfds;
+	ssize_t                len;
+	int                    rc   = 0;
+
+	while (rc == 0 && !shm_stopped(ctx)) {
+		buf = pppoat_ring_reserve(&ctx->sc_tx, SHM_FRAME_MAX,
+					  SHM_POLL_INTERVAL);
+		if (buf == NULL)
+			continue;
+		FD_ZERO(&rfds);
+		FD_SET(ctx->sc_rd, &rfds);
+		FD_SET(stop, &rfds);
+		rc = pppoat_util_select(pppoat_max(ctx->sc_rd, stop), &rfds,
+					NULL);
+		rc = rc < 0 ? P_ERR(-errno) : 0;
+		if (rc != 0 || FD_ISSET(stop, &rfds))
+			break;
+		len = read(ctx->sc_rd, buf, SHM_FRAME_MAX);
+		if (len > 0)
+			pppoat_ring_commit(&ctx->sc_tx, len);
+		else if (len == 0)
+			rc = -EPIPE;
+		else if (errno != EINTR && errno != EAGAIN)
+			rc = P_ERR(-errno);
+	}
+	ctx->sc_tx_rc = rc;
+	__atomic_store_n(&ctx->sc_stop, true, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static int module_shm_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_shm_ctx *ctx = userdata;
+	unsigned char         *buf;
+	size_t                 len;
+	int                    rc;
+
+	ctx->sc_rd = rd;
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	rc = rc ?: -pthread_create(&ctx->sc_thread, NULL, &shm_tx_thread,
+				   ctx);
+	ctx->sc_thread_started = rc == 0;
+
+	while (rc == 0 && !shm_stopped(ctx)) {
+		buf = pppoat_ring_peek(&ctx->sc_rx, &len, SHM_POLL_INTERVAL);
+		if (buf == NULL)
+			continue;
+		rc = pppoat_util_write(wr, buf, len);
+		pppoat_ring_release(&ctx->sc_rx);
+	}
+	__atomic_store_n(&ctx->sc_stop, true, __ATOMIC_RELEASE);
+
+	return rc ?: ctx->sc_tx_rc;
+}
+
+const struct pppoat_module pppoat_module_shm = {
+	.m_name  = "shm",
+	.m_descr = "PPP over shared memory (same host)",
+	.m_init  = &module_shm_init,
+	.m_fini  = &module_shm_fini,
+	.m_run   = &module_shm_run,
+};
@@ -0,0 +1,656 @@
+/* tcp.c
+ * PPP over Any Transport -- TCP transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/tcp.h"
+#include "conf.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "tls.h"
+#include "util.h"
+
+#define TCP_PORT_DEFAULT 0xc001
+
+/*
+ * The "tls" module is the same transport with the stream carried over TLS,
+ * see tls.h. Nothing but the handshake differs in the state machine.
+ */
+
+/*
+ * Every read from the interface becomes a frame with 16-bit length, like
+ * a datagram of the UDP transport. After a reconnection the stream
+ * restarts at a frame boundary.
+ */
+#define TCP_HDR_LEN   2
+#define TCP_FRAME_MAX 16384
+#define TCP_RX_SIZE   (2 * (TCP_HDR_LEN + 0xffff))
+
+/*
+ * Frames wait in a queue of TCP_SLOTS while the socket isn't writable and
+ * are sent with one sendmsg(). TCP_NOTSENT_LOWAT keeps the kernel's queue
+ * of unsent data short, so the backlog stays here where it's coalesced.
+ * With tcp.cork_depth frames queued the socket is corked to fill whole
+ * segments, it's uncorked when the queue drains. TCP_NODELAY is set, so
+ * a lone packet is never delayed.
+ */
+#define TCP_SLOTS                32
+#define TCP_NOTSENT_LOWAT_DEFAULT 16384
+#define TCP_CORK_DEPTH_DEFAULT   4
+
+/* Client retries with exponential backoff */
+#define TCP_RECONNECT_DEFAULT 1000
+#define TCP_RECONNECT_MAX     30000000
+
+/* Dead peers are detected within 10 + 3 * 5 seconds */
+#define TCP_KA_IDLE  10
+#define TCP_KA_INTVL 5
+#define TCP_KA_CNT   3
+
+typedef enum {
+	TCP_STATE_IDLE,
+	TCP_STATE_LISTEN,
+	TCP_STATE_CONNECTING,
+	TCP_STATE_HANDSHAKE,
+	TCP_STATE_CONNECTED,
+} tcp_state_t;
+
+struct tcp_slot {
+	unsigned char *ts_buf;
+	size_t         ts_len;
+};
+
+struct pppoat_tcp_ctx {
+	pppoat_node_type_t  tc_type;
+	struct addrinfo    *tc_ainfo;
+	int                 tc_lsock;
+	int                 tc_sock;
+	tcp_state_t         tc_state;
+	/* TLS transport runs the stream over TLS */
+	bool                tc_use_tls;
+	struct pppoat_tls   tc_tls;
+	uint64_t            tc_retry;
+	uint64_t            tc_backoff;
+	uint64_t            tc_reconnect;
+	unsigned long       tc_lowat;
+	unsigned int        tc_cork_depth;
+	bool                tc_corked;
+	struct tcp_slot     tc_slots[TCP_SLOTS];
+	unsigned int        tc_head;
+	unsigned int        tc_nr;
+	/* Bytes of the head frame which are already sent */
+	size_t              tc_head_off;
+	unsigned char      *tc_rx;
+	size_t              tc_rx_len;
+	int                 tc_wr;
+	/* Counters */
+	unsigned long       tc_connects;
+	unsigned long       tc_frames;
+	unsigned long       tc_sends;
+	unsigned long       tc_dropped;
+};
+
+static void tcp_ctx_fini(struct pppoat_tcp_ctx *ctx)
+{
+	unsigned int i;
+
+	if (ctx->tc_use_tls)
+		pppoat_tls_fini(&ctx->tc_tls);
+	if (ctx->tc_sock >= 0)
+		(void)close(ctx->tc_sock);
+	if (ctx->tc_lsock >= 0)
+		(void)close(ctx->tc_lsock);
+	if (ctx->tc_ainfo != NULL)
+		freeaddrinfo(ctx->tc_ainfo);
+	for (i = 0; i < TCP_SLOTS; ++i)
+		pppoat_free(ctx->tc_slots[i].ts_buf);
+	pppoat_free(ctx->tc_rx);
+	pppoat_free(ctx);
+}
+
+static int tcp_ainfo_get(struct pppoat_tcp_ctx *ctx,
+			 const char            *host,
+			 unsigned short         port)
+{
+	struct addrinfo hints;
+	char            service[6];
+	int             rc;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags    = host == NULL ? AI_PASSIVE : 0;
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_socktype = SOCK_STREAM;
+
+	snprintf(service, sizeof(service), "%u", port);
+	rc = getaddrinfo(host, service, &hints, &ctx->tc_ainfo);
+	if (rc != 0) {
+		pppoat_error("tcp", "getaddrinfo rc=%d: %s",
+			     rc, gai_strerror(rc));
+		ctx->tc_ainfo = NULL;
+		return P_ERR(-ENOPROTOOPT);
+	}
+	return 0;
+}
+
+static int tcp_setsockopt_int(int sock, int level, int name, int val)
+{
+	int rc;
+
+	rc = setsockopt(sock, level, name, &val, sizeof(val));
+	return rc != 0 ? P_ERR(-errno) : 0;
+}
+
+static int tcp_sock_setup(struct pppoat_tcp_ctx *ctx, int sock)
+{
+	int rc;
+
+	rc = pppoat_util_fd_nonblock_set(sock, true);
+	rc = rc ?: tcp_setsockopt_int(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+	rc = rc ?: tcp_setsockopt_int(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+	rc = rc ?: tcp_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPIDLE,
+				      TCP_KA_IDLE);
+	rc = rc ?: tcp_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+				      TCP_KA_INTVL);
+	rc = rc ?: tcp_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPCNT,
+				      TCP_KA_CNT);
+#ifdef TCP_NOTSENT_LOWAT
+	/* Linux 3.12+, older kernels work without it */
+	if (rc == 0 && ctx->tc_lowat != 0 &&
+	    tcp_setsockopt_int(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+			       ctx->tc_lowat) != 0)
+		pppoat_info("tcp", "TCP_NOTSENT_LOWAT isn't supported");
+#endif /* TCP_NOTSENT_LOWAT */
+	return rc;
+}
+
+static int tcp_listen(struct pppoat_tcp_ctx *ctx)
+{
+	struct addrinfo *ai = ctx->tc_ainfo;
+	int              rc;
+
+	ctx->tc_lsock = socket(ai->ai_family, ai->ai_socktype,
+			       ai->ai_protocol);
+	rc = ctx->tc_lsock < 0 ? P_ERR(-errno) : 0;
+	rc = rc ?: tcp_setsockopt_int(ctx->tc_lsock, SOL_SOCKET,
+				      SO_REUSEADDR, 1);
+	rc = rc ?: pppoat_util_fd_nonblock_set(ctx->tc_lsock, true);
+	if (rc == 0 &&
+	    (bind(ctx->tc_lsock, ai->ai_addr, ai->ai_addrlen) != 0 ||
+	     listen(ctx->tc_lsock, 1) != 0))
+		rc = P_ERR(-errno);
+	if (rc == 0)
+		ctx->tc_state = TCP_STATE_LISTEN;
+	return rc;
+}
+
+static void tcp_connected(struct pppoat_tcp_ctx *ctx)
+{
+	ctx->tc_state   = TCP_STATE_CONNECTED;
+	ctx->tc_backoff = ctx->tc_reconnect;
+	++ctx->tc_connects;
+	pppoat_info("tcp", "Connected");
+}
+
+static void tcp_disconnect(struct pppoat_tcp_ctx *ctx, int error);
+
+static void tcp_handshake(struct pppoat_tcp_ctx *ctx)
+{
+	int rc = pppoat_tls_handshake(&ctx->tc_tls);
+
+	if (rc == 0)
+		tcp_connected(ctx);
+	else if (rc != -EAGAIN)
+		tcp_disconnect(ctx, rc);
+}
+
+/* Socket is connected, TLS transport has to finish the handshake first. */
+static void tcp_established(struct pppoat_tcp_ctx *ctx)
+{
+	int rc;
+
+	if (!ctx->tc_use_tls) {
+		tcp_connected(ctx);
+		return;
+	}
+	rc = pppoat_tls_start(&ctx->tc_tls, ctx->tc_sock);
+	if (rc != 0) {
+		tcp_disconnect(ctx, rc);
+		return;
+	}
+	ctx->tc_state = TCP_STATE_HANDSHAKE;
+	tcp_handshake(ctx);
+}
+
+/* Drops the connection and everything queued for it. */
+static void tcp_disconnect(struct pppoat_tcp_ctx *ctx, int error)
+{
+	uint64_t now = pppoat_util_time_us();
+
+	if (ctx->tc_state == TCP_STATE_CONNECTED)
+		pppoat_info("tcp", "Disconnected, error=%d", error);
+	if (ctx->tc_use_tls)
+		pppoat_tls_stop(&ctx->tc_tls);
+	(void)close(ctx->tc_sock);
+	ctx->tc_sock      = -1;
+	ctx->tc_dropped  += ctx->tc_nr;
+	ctx->tc_nr        = 0;
+	ctx->tc_head_off  = 0;
+	ctx->tc_rx_len    = 0;
+	ctx->tc_corked    = false;
+	if (ctx->tc_type == PPPOAT_NODE_MASTER) {
+		ctx->tc_state = TCP_STATE_LISTEN;
+	} else {
+		ctx->tc_state   = TCP_STATE_IDLE;
+		ctx->tc_retry   = now + ctx->tc_backoff;
+		ctx->tc_backoff = pppoat_min(ctx->tc_backoff * 2,
+					     TCP_RECONNECT_MAX);
+	}
+}
+
+static int tcp_connect(struct pppoat_tcp_ctx *ctx)
+{
+	struct addrinfo *ai = ctx->tc_ainfo;
+	int              rc;
+
+	ctx->tc_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (ctx->tc_sock < 0)
+		return P_ERR(-errno);
+	rc = tcp_sock_setup(ctx, ctx->tc_sock);
+	if (rc == 0 &&
+	    connect(ctx->tc_sock, ai->ai_addr, ai->ai_addrlen) != 0)
+		rc = errno == EINPROGRESS ? 0 : -errno;
+	if (rc != 0) {
+		tcp_disconnect(ctx, rc);
+		return 0;
+	}
+	ctx->tc_state = TCP_STATE_CONNECTING;
+	return 0;
+}
+
+static void tcp_connect_finish(struct pppoat_tcp_ctx *ctx)
+{
+	socklen_t len = sizeof(int);
+	int       error;
+	int       rc;
+
+	rc = getsockopt(ctx->tc_sock, SOL_SOCKET, SO_ERROR, &error, &len);
+	error = rc != 0 ? errno : error;
+	if (error == 0)
+		tcp_established(ctx);
+	else
+		tcp_disconnect(ctx, -error);
+}
+
+/* A new client replaces the current one, the peer may have restarted. */
+static int tcp_accept(struct pppoat_tcp_ctx *ctx)
+{
+	int sock;
+	int rc;
+
+	sock = accept(ctx->tc_lsock, NULL, NULL);
+	if (sock < 0)
+		return errno == EAGAIN || errno == EINTR ||
+		       errno == ECONNABORTED ? 0 : P_ERR(-errno);
+	rc = tcp_sock_setup(ctx, sock);
+	if (rc != 0) {
+		(void)close(sock);
+		return 0;
+	}
+	if (ctx->tc_state == TCP_STATE_CONNECTED ||
+	    ctx->tc_state == TCP_STATE_HANDSHAKE)
+		tcp_disconnect(ctx, -ECONNRESET);
+	ctx->tc_sock = sock;
+	tcp_established(ctx);
+
+	return 0;
+}
+
+static void tcp_cork_set(struct pppoat_tcp_ctx *ctx, bool cork)
+{
+	if (ctx->tc_corked != cork &&
+	    tcp_setsockopt_int(ctx->tc_sock, IPPROTO_TCP, TCP_CORK,
+			       cork ? 1 : 0) == 0)
+		ctx->tc_corked = cork;
+}
+
+static ssize_t tcp_sendv(struct pppoat_tcp_ctx *ctx,
+			 struct iovec          *iov,
+			 int                    nr)
+{
+	struct msghdr msg;
+	ssize_t       len;
+
+	if (ctx->tc_use_tls)
+		return pppoat_tls_writev(&ctx->tc_tls, iov, nr);
+
+	/* writev() would raise SIGPIPE when the peer resets the connection */
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = nr;
+	len = sendmsg(ctx->tc_sock, &msg, MSG_NOSIGNAL);
+	return len < 0 ? -errno : len;
+}
+
+static ssize_t tcp_read(struct pppoat_tcp_ctx *ctx, void *buf, size_t len)
+{
+	ssize_t rc;
+
+	if (ctx->tc_use_tls)
+		return pppoat_tls_read(&ctx->tc_tls, buf, len);
+	rc = recv(ctx->tc_sock, buf, len, 0);
+	return rc < 0 ? -errno : rc;
+}
+
+/* Sends as much of the queue as the socket takes with one sendmsg(). */
+static void tcp_flush(struct pppoat_tcp_ctx *ctx)
+{
+	struct iovec     iov[TCP_SLOTS];
+	struct tcp_slot *slot;
+	unsigned int     i;
+	ssize_t          len;
+	size_t           left;
+
+	if (ctx->tc_nr >= ctx->tc_cork_depth)
+		tcp_cork_set(ctx, true);
+	for (i = 0; i < ctx->tc_nr; ++i) {
+		slot = &ctx->tc_slots[(ctx->tc_head + i) % TCP_SLOTS];
+		iov[i].iov_base = slot->ts_buf;
+		iov[i].iov_len  = slot->ts_len;
+	}
+	iov[0].iov_base  = (char *)iov[0].iov_base + ctx->tc_head_off;
+	iov[0].iov_len  -= ctx->tc_head_off;
+
+	len = tcp_sendv(ctx, iov, ctx->tc_nr);
+	if (len == -EAGAIN || len == -EINTR)
+		return;
+	if (len < 0) {
+		tcp_disconnect(ctx, len);
+		return;
+	}
+	++ctx->tc_sends;
+	left = (size_t)len + ctx->tc_head_off;
+	while (ctx->tc_nr > 0) {
+		slot = &ctx->tc_slots[ctx->tc_head];
+		if (left < slot->ts_len)
+			break;
+		left -= slot->ts_len;
+		ctx->tc_head = (ctx->tc_head + 1) % TCP_SLOTS;
+		--ctx->tc_nr;
+		++ctx->tc_frames;
+	}
+	ctx->tc_head_off = left;
+	/* Uncorking pushes out the last partial segment */
+	if (ctx->tc_nr == 0)
+		tcp_cork_set(ctx, false);
+}
+
+/* Queues a frame from the interface, drops it when there's no peer. */
+static int tcp_queue(struct pppoat_tcp_ctx *ctx, int rd)
+{
+	struct tcp_slot *slot;
+	ssize_t          len;
+
+	PPPOAT_ASSERT(ctx->tc_nr < TCP_SLOTS);
+	slot = &ctx->tc_slots[(ctx->tc_head + ctx->tc_nr) % TCP_SLOTS];
+	len  = read(rd, slot->ts_buf + TCP_HDR_LEN, TCP_FRAME_MAX);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (ctx->tc_state != TCP_STATE_CONNECTED) {
+		++ctx->tc_dropped;
+		return 0;
+	}
+	slot->ts_buf[0] = len >> 8;
+	slot->ts_buf[1] = len & 0xff;
+	slot->ts_len    = TCP_HDR_LEN + len;
+	++ctx->tc_nr;
+	/* Try to send right away, the socket is usually writable */
+	tcp_flush(ctx);
+
+	return 0;
+}
+
+/* Passes frames from the peer to the interface. */
+static int tcp_recv_once(struct pppoat_tcp_ctx *ctx)
+{
+	unsigned char *rx  = ctx->tc_rx;
+	size_t         off = 0;
+	size_t         flen;
+	ssize_t        len;
+	int            rc  = 0;
+
+	len = tcp_read(ctx, rx + ctx->tc_rx_len, TCP_RX_SIZE - ctx->tc_rx_len);
+	if (len == -EAGAIN || len == -EINTR)
+		return 0;
+	if (len <= 0) {
+		tcp_disconnect(ctx, len == 0 ? -ECONNRESET : len);
+		return 0;
+	}
+	ctx->tc_rx_len += len;
+
+	while (rc == 0 && ctx->tc_rx_len - off >= TCP_HDR_LEN) {
+		flen = (size_t)rx[off] << 8 | rx[off + 1];
+		if (flen == 0) {
+			tcp_disconnect(ctx, -EPROTO);
+			return 0;
+		}
+		if (ctx->tc_rx_len - off < TCP_HDR_LEN + flen)
+			break;
+		rc   = pppoat_util_write(ctx->tc_wr, rx + off + TCP_HDR_LEN,
+					 flen);
+		off += TCP_HDR_LEN + flen;
+	}
+	ctx->tc_rx_len -= off;
+	memmove(rx, rx + off, ctx->tc_rx_len);
+
+	return rc;
+}
+
+static int tcp_recv(struct pppoat_tcp_ctx *ctx)
+{
+	int rc;
+
+	/* OpenSSL may hold decrypted records which select() doesn't see */
+	do {
+		rc = tcp_recv_once(ctx);
+	} while (rc == 0 && ctx->tc_state == TCP_STATE_CONNECTED &&
+		 ctx->tc_use_tls && pppoat_tls_pending(&ctx->tc_tls));
+	return rc;
+}
+
+static int tcp_init(struct pppoat_conf *conf, void **userdata, bool tls)
+{
+	struct pppoat_tcp_ctx *ctx;
+	const char            *host;
+	unsigned long          port;
+	unsigned int           i;
+	int                    rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->tc_sock  = -1;
+	ctx->tc_lsock = -1;
+	ctx->tc_type  = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+			"server")) ? PPPOAT_NODE_MASTER : PPPOAT_NODE_SLAVE;
+	ctx->tc_reconnect = pppoat_conf_get_ulong(conf, "tcp.reconnect",
+				TCP_RECONNECT_DEFAULT) * 1000;
+	ctx->tc_reconnect = pppoat_max(ctx->tc_reconnect, 1000);
+	ctx->tc_backoff   = ctx->tc_reconnect;
+	ctx->tc_lowat     = pppoat_conf_get_ulong(conf, "tcp.notsent_lowat",
+				TCP_NOTSENT_LOWAT_DEFAULT);
+	ctx->tc_cork_depth = pppoat_conf_get_ulong(conf, "tcp.cork_depth",
+				TCP_CORK_DEPTH_DEFAULT);
+	ctx->tc_cork_depth = ctx->tc_cork_depth ?: TCP_SLOTS + 1;
+
+	/* Every queue of a multiqueue interface has its own connection */
+	port = pppoat_conf_get_ulong(conf, "tcp.port", TCP_PORT_DEFAULT) +
+	       pppoat_conf_get_ulong(conf, "queue", 0);
+	host = pppoat_conf_get(conf, "tcp.host");
+	rc = port == 0 || port > 0xffff ? P_ERR(-EINVAL) : 0;
+	if (rc == 0 && host == NULL && ctx->tc_type == PPPOAT_NODE_SLAVE) {
+		pppoat_error("tcp", "Client needs tcp.host");
+		rc = P_ERR(-EINVAL);
+	}
+
+	ctx->tc_rx = pppoat_alloc(TCP_RX_SIZE);
+	rc = rc ?: ctx->tc_rx == NULL ? P_ERR(-ENOMEM) : 0;
+	for (i = 0; rc == 0 && i < TCP_SLOTS; ++i) {
+		ctx->tc_slots[i].ts_buf = pppoat_alloc(TCP_HDR_LEN +
+						       TCP_FRAME_MAX);
+		rc = ctx->tc_slots[i].ts_buf == NULL ? P_ERR(-ENOMEM) : 0;
+	}
+	rc = rc ?: tcp_ainfo_get(ctx, host, port);
+	if (rc == 0 && tls) {
+		rc = pppoat_tls_init(&ctx->tc_tls, conf,
+				     ctx->tc_type == PPPOAT_NODE_MASTER, host);
+		ctx->tc_use_tls = rc == 0;
+	}
+	if (rc == 0 && ctx->tc_type == PPPOAT_NODE_MASTER)
+		rc = tcp_listen(ctx);
+	if (rc == 0) {
+		pppoat_debug("tcp", "%s %s:%lu notsent_lowat=%lu "
+			     "cork_depth=%u tls=%d", ctx->tc_type ==
+			     PPPOAT_NODE_MASTER ? "Listening on" :
+			     "Connecting to", host ?: "*", port,
+			     ctx->tc_lowat, ctx->tc_cork_depth, tls);
+		*userdata = ctx;
+	} else {
+		tcp_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static int module_tcp_init(struct pppoat_conf *conf, void **userdata)
+{
+	return tcp_init(conf, userdata, false);
+}
+
+static int module_tls_init(struct pppoat_conf *conf, void **userdata)
+{
+	return tcp_init(conf, userdata, true);
+}
+
+static void module_tcp_fini(void *userdata)
+{
+	struct pppoat_tcp_ctx *ctx = userdata;
+
+	pppoat_debug("tcp", "connects=%lu frames=%lu sends=%lu dropped=%lu",
+		     ctx->tc_connects, ctx->tc_frames, ctx->tc_sends,
+		     ctx->tc_dropped);
+	tcp_ctx_fini(ctx);
+}
+
+static int module_tcp_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_tcp_ctx *ctx = userdata;
+	fd_set                 rfds;
+	fd_set                 wfds;
+	uint64_t               now;
+	uint64_t               timeout;
+	int                    max;
+	int                    rc;
+
+	ctx->tc_wr = wr;
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+
+	while (rc == 0) {
+		now = pppoat_util_time_us();
+		if (ctx->tc_state == TCP_STATE_IDLE && now >= ctx->tc_retry)
+			rc = tcp_connect(ctx);
+		if (rc != 0)
+			break;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		/* A full queue holds the interface back */
+		if (ctx->tc_nr < TCP_SLOTS)
+			FD_SET(rd, &rfds);
+		if (ctx->tc_lsock >= 0)
+			FD_SET(ctx->tc_lsock, &rfds);
+		if (ctx->tc_state == TCP_STATE_CONNECTED)
+			FD_SET(ctx->tc_sock, &rfds);
+		if (ctx->tc_state == TCP_STATE_CONNECTING ||
+		    (ctx->tc_state == TCP_STATE_CONNECTED && ctx->tc_nr > 0))
+			FD_SET(ctx->tc_sock, &wfds);
+		if (ctx->tc_state == TCP_STATE_HANDSHAKE)
+			FD_SET(ctx->tc_sock, ctx->tc_tls.tl_want_write ?
+					     &wfds : &rfds);
+		max = pppoat_max(pppoat_max(rd, ctx->tc_lsock), ctx->tc_sock);
+		timeout = ctx->tc_state == TCP_STATE_IDLE ?
+			  ctx->tc_retry - pppoat_min(now, ctx->tc_retry) :
+			  PPPOAT_TIME_NEVER;
+		rc = pppoat_util_select_timed(max, &rfds, &wfds, timeout);
+		if (rc <= 0)
+			continue;
+		rc = 0;
+
+		if (ctx->tc_state == TCP_STATE_CONNECTING &&
+		    FD_ISSET(ctx->tc_sock, &wfds))
+			tcp_connect_finish(ctx);
+		else if (ctx->tc_state == TCP_STATE_HANDSHAKE &&
+			 (FD_ISSET(ctx->tc_sock, &rfds) ||
+			  FD_ISSET(ctx->tc_sock, &wfds)))
+			tcp_handshake(ctx);
+		else if (ctx->tc_state == TCP_STATE_CONNECTED &&
+			 FD_ISSET(ctx->tc_sock, &wfds))
+			tcp_flush(ctx);
+		if (ctx->tc_state == TCP_STATE_CONNECTED &&
+		    FD_ISSET(ctx->tc_sock, &rfds))
+			rc = tcp_recv(ctx);
+		if (rc == 0 && ctx->tc_lsock >= 0 &&
+		    FD_ISSET(ctx->tc_lsock, &rfds))
+			rc = tcp_accept(ctx);
+		if (rc == 0 && FD_ISSET(rd, &rfds))
+			rc = tcp_queue(ctx, rd);
+	}
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_tcp = {
+	.m_name  = "tcp",
+	.m_descr = "PPP over TCP",
+	.m_init  = &module_tcp_init,
+	.m_fini  = &module_tcp_fini,
+	.m_run   = &module_tcp_run,
+};
+
+const struct pppoat_module pppoat_module_tls = {
+	.m_name  = "tls",
+	.m_descr = "PPP over TLS (kernel TLS offload)",
+	.m_init  = &module_tls_init,
+	.m_fini  = &module_tcp_fini,
+	.m_run   = &module_tcp_run,
+};
@@ -0,0 +1,26 @@
+/* modules/tcp.h
+ * PPP over Any Transport -- TCP transport
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_TCP_H__
+#define __PPPOAT_TCP_H__
+
+extern const struct pppoat_module pppoat_module_tcp;
+extern const struct pppoat_module pppoat_module_tls;
+
+#endif /* __PPPOAT_TCP_H__ */
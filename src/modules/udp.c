@@ -19,20 +19,33 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif /* __linux__ */
 
 #include "trace.h"
 #include "conf.h"
+#include "hub.h"
+#include "if.h"
 #include "log.h"
 #include "memory.h"
+#include "pmtu.h"
 #include "pppoat.h"
+#include "probe.h"
+#include "reorder.h"
+#include "stats.h"
 #include "util.h"
 
 #define UDP_PORT_MASTER 0xc001
@@ -40,15 +53,207 @@
 #define UDP_HOST_MASTER "192.168.4.1"
 #define UDP_HOST_SLAVE  "192.168.4.10"
 
+/* Maximum UDP payload, so jumbo frames are never truncated */
+#define UDP_BUF_SIZE 65536
+/* Largest datagram which fits into an IPv4 packet */
+#define UDP_DGRAM_MAX 65507
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define UDP_HAVE_ZEROCOPY 1
+#endif
+
+/*
+ * Sends smaller than this are copied. Pinning pages and handling the
+ * completion notification costs more than memcpy(3) for small buffers.
+ */
+#define UDP_ZC_MIN_DEFAULT  10240
+#define UDP_ZC_BUFS_DEFAULT 32
+
+/*
+ * Low-latency mode: busy poll the device queue for SO_BUSY_POLL usec in
+ * the kernel and spin in select() for udp.spin usec before sleeping.
+ */
+#define UDP_BUSY_POLL_DEFAULT      50
+#define UDP_SPIN_DEFAULT           100
+#define UDP_STATS_INTERVAL_DEFAULT 10
+
+/*
+ * Bundling mode: every datagram carries one or more packets, each one is
+ * prefixed with its length encoded as LEB128 (1 byte below 128 bytes).
+ * A bundle is sent when the next packet doesn't fit into udp.bundle_size
+ * or udp.bundle_delay usec after the first packet was queued. Packets are
+ * collected only when reads are split into packets (TUN interface), other
+ * reads are arbitrary parts of a stream and go one per datagram.
+ */
+#define UDP_BUNDLE_HDR_MAX          3
+#define UDP_BUNDLE_SIZE_DEFAULT     1400
+#define UDP_BUNDLE_DELAY_DEFAULT    200
+
+/*
+ * Multipath mode: packets are striped over udp.path.N paths by weight.
+ * Every datagram starts with struct udp_hdr and the receiver restores
+ * order with a reorder buffer.
+ */
+#define UDP_PATHS_MAX                  8
+#define UDP_REORDER_WINDOW_DEFAULT     64
+#define UDP_REORDER_TIMEOUT_DEFAULT    10000
+
+/*
+ * Hub mode: the server serves many clients, see hub.h. Interface must
+ * carry IP packets, so the stream from it can be split into packets.
+ * In switch mode it carries Ethernet frames of a TAP interface.
+ */
+#define UDP_HUB_MAX_DEFAULT       4096
+#define UDP_HUB_TIMEOUT_DEFAULT   300
+#define UDP_SWITCH_MAX_DEFAULT    4096
+#define UDP_SWITCH_AGEING_DEFAULT 300
+
+/*
+ * Path MTU discovery: every path probes its underlay from a dedicated
+ * socket with DF set, data sockets keep default fragmentation policy.
+ * Discovered size, less the headers, becomes the interface MTU.
+ */
+#define UDP_PMTU_MIN_DEFAULT      1200
+#define UDP_PMTU_MAX_DEFAULT      1472
+#define UDP_PMTU_INTERVAL_DEFAULT 600
+#define UDP_PMTU_PROBE_TIMEOUT    1000000
+
+/*
+ * Path probing: pings every udp.probe_interval msec measure RTT and
+ * jitter, per-path sequence numbers of data give loss and reordering.
+ */
+#define UDP_PROBE_INTERVAL_DEFAULT 1000
+
+enum {
+	UDP_MSG_DATA      = 0,
+	/* uh_seq is probe id, the datagram is padded to the probed size */
+	UDP_MSG_PROBE     = 1,
+	UDP_MSG_PROBE_ACK = 2,
+	/* Payload is opaque send time, echoed in struct udp_pong */
+	UDP_MSG_PING      = 3,
+	UDP_MSG_PONG      = 4,
+};
+
+/*
+ * Header of multipath and PMTU discovery modes, multibyte fields are in
+ * network byte order.
+ */
+struct udp_hdr {
+	uint8_t  uh_type;
+	uint8_t  uh_path;
+	/* Per-path sequence number of data, gives loss of the path */
+	uint16_t uh_path_seq;
+	uint32_t uh_seq;
+};
+
+#define UDP_HDR_LEN sizeof(struct udp_hdr)
+
+/* Receive counters are for data which arrived with the ping's uh_path */
+struct udp_pong {
+	uint64_t upo_ts;
+	uint32_t upo_rx;
+	uint32_t upo_expected;
+};
+
+/* Socket bound to a local address, it is shared by paths using it */
+struct udp_sock {
+	int            us_fd;
+	char          *us_host;
+	unsigned short us_port;
+	unsigned long  us_rx;
+	/*
+	 * MSG_ZEROCOPY transmit path. A buffer from the pool stays pinned
+	 * until the kernel reports completion for its send. Kernel assigns
+	 * sequential ids to zerocopy sends on a socket, slot for an id is
+	 * id % uc_zc_nr.
+	 */
+	uint32_t       us_zc_next;
+	unsigned char *us_zc_bufs;
+	bool          *us_zc_busy;
+};
+
+struct udp_path {
+	struct udp_sock         *up_sock;
+	struct sockaddr_storage  up_addr;
+	socklen_t                up_addrlen;
+	unsigned int             up_weight;
+	/* Smooth weighted round-robin state */
+	long                     up_credit;
+	unsigned long            up_tx;
+	/* Path MTU discovery */
+	int                      up_probe_fd;
+	struct pppoat_pmtu       up_pmtu;
+	/* Path quality, unusable paths don't get data while others exist */
+	struct pppoat_probe      up_probe;
+	bool                     up_usable;
+};
+
 struct pppoat_udp_ctx {
-	pppoat_node_type_t  uc_type;
-	struct addrinfo    *uc_ainfo;
-	int                 uc_sock;
+	pppoat_node_type_t     uc_type;
+	struct udp_sock        uc_socks[UDP_PATHS_MAX];
+	unsigned int           uc_socks_nr;
+	struct udp_path        uc_paths[UDP_PATHS_MAX];
+	unsigned int           uc_paths_nr;
+	unsigned char         *uc_buf;
+	int                    uc_wr;
+	/* MSG_ZEROCOPY, buffer pools are per socket */
+	bool                   uc_zc;
+	size_t                 uc_zc_min;
+	uint32_t               uc_zc_nr;
+	unsigned long          uc_zc_copied;
+	/* Low-latency mode */
+	unsigned long          uc_spin_us;
+	/*
+	 * Delivery latency: time from the kernel receive timestamp until the
+	 * packet is written to the interface.
+	 */
+	bool                   uc_stats;
+	uint64_t               uc_stats_interval;
+	uint64_t               uc_stats_last;
+	struct pppoat_hist     uc_lat;
+	/* Small-packet bundling */
+	bool                   uc_bundle;
+	size_t                 uc_bundle_size;
+	unsigned long          uc_bundle_delay;
+	unsigned char         *uc_bundle_buf;
+	size_t                 uc_bundle_len;
+	uint64_t               uc_bundle_deadline;
+	unsigned long          uc_bundle_pkts;
+	unsigned long          uc_bundle_dgrams;
+	unsigned long          uc_bundle_bad;
+	/* Multipath */
+	bool                   uc_mp;
+	size_t                 uc_hdr_len;
+	uint32_t               uc_tx_seq;
+	unsigned long          uc_mp_bad;
+	struct pppoat_reorder  uc_reorder;
+	/* Path probing, uc_probe_rx is indexed by the peer's path index */
+	bool                   uc_probe;
+	uint64_t               uc_probe_rtt_slack;
+	uint64_t               uc_probe_report;
+	struct pppoat_probe_rx uc_probe_rx[UDP_PATHS_MAX];
+	/* Path MTU discovery, uc_pmtu_mtu is the interface MTU */
+	bool                   uc_pmtu;
+	unsigned int           uc_pmtu_mtu;
+	/* Hub mode */
+	bool                   uc_hub;
+	struct pppoat_hub      uc_hub_tbl;
+	unsigned char         *uc_hub_buf;
+	size_t                 uc_hub_len;
+	unsigned long          uc_hub_bad;
+	unsigned long          uc_hub_tx_err;
+	/* TUN interface, a datagram carries whole IP packets */
+	bool                   uc_split;
+	unsigned char         *uc_split_buf;
+	size_t                 uc_split_len;
+	unsigned long          uc_split_bad;
 };
 
 static int udp_ainfo_get(struct addrinfo **ainfo,
 			 const char       *host,
-			 unsigned short    port)
+			 unsigned short    port,
+			 int               family)
 {
 	struct addrinfo hints;
 	char            service[6];
@@ -59,7 +264,7 @@ static int udp_ainfo_get(struct addrinfo **ainfo,
 #ifdef AI_ADDRCONFIG
 	hints.ai_flags   |= AI_ADDRCONFIG;
 #endif /* AI_ADDRCONFIG */
-	hints.ai_family   = AF_UNSPEC;
+	hints.ai_family   = family;
 	hints.ai_protocol = IPPROTO_UDP;
 	hints.ai_socktype = SOCK_DGRAM;
 
@@ -79,12 +284,12 @@ static void udp_ainfo_put(struct addrinfo *ainfo)
 	freeaddrinfo(ainfo);
 }
 
-static int udp_sock_new(unsigned short port, int *sock)
+static int udp_sock_new(const char *host, unsigned short port, int *sock)
 {
 	struct addrinfo *ainfo;
 	int              rc;
 
-	rc = udp_ainfo_get(&ainfo, NULL, port);
+	rc = udp_ainfo_get(&ainfo, host, port, AF_UNSPEC);
 	if (rc == 0) {
 		*sock = socket(ainfo->ai_family, ainfo->ai_socktype,
 			       ainfo->ai_protocol);
@@ -93,8 +298,10 @@ static int udp_sock_new(unsigned short port, int *sock)
 	if (rc == 0) {
 		rc = bind(*sock, ainfo->ai_addr, ainfo->ai_addrlen);
 		rc = rc != 0 ? P_ERR(-errno) : 0;
-		if (rc != 0)
+		if (rc != 0) {
 			(void)close(*sock);
+			*sock = -1;
+		}
 	}
 	if (ainfo != NULL) {
 		udp_ainfo_put(ainfo);
@@ -102,22 +309,159 @@ static int udp_sock_new(unsigned short port, int *sock)
 	return rc;
 }
 
-static int module_udp_init(struct pppoat_conf *conf, void **userdata)
+static bool udp_str_eq(const char *s1, const char *s2)
 {
-	struct pppoat_udp_ctx *ctx;
-	pppoat_node_type_t     type;
-	unsigned short         sport;
-	unsigned short         dport;
-	const char            *dhost;
-	const char            *opt;
-	int                    rc;
+	return s1 == s2 || (s1 != NULL && s2 != NULL && strcmp(s1, s2) == 0);
+}
 
-	opt = pppoat_conf_get(conf, "server");
-	type = opt != NULL && pppoat_conf_obj_is_true(opt) ?
-	       PPPOAT_NODE_MASTER : PPPOAT_NODE_SLAVE;
+/* Finds socket bound to the local address or creates a new one. */
+static int udp_sock_get(struct pppoat_udp_ctx  *ctx,
+			const char             *host,
+			unsigned short          port,
+			struct udp_sock       **out)
+{
+	struct udp_sock *us;
+	unsigned int     i;
+	int              rc;
+
+	for (i = 0; i < ctx->uc_socks_nr; ++i) {
+		us = &ctx->uc_socks[i];
+		if (udp_str_eq(us->us_host, host) && us->us_port == port) {
+			*out = us;
+			return 0;
+		}
+	}
+	PPPOAT_ASSERT(ctx->uc_socks_nr < UDP_PATHS_MAX);
+	us = &ctx->uc_socks[ctx->uc_socks_nr];
+	memset(us, 0, sizeof(*us));
+	us->us_port = port;
+	us->us_host = host == NULL ? NULL : pppoat_strdup(host);
+	rc = host != NULL && us->us_host == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: udp_sock_new(host, port, &us->us_fd);
+	if (rc == 0) {
+		++ctx->uc_socks_nr;
+		*out = us;
+	} else {
+		pppoat_free(us->us_host);
+	}
+	return rc;
+}
+
+static void udp_sock_fini(struct udp_sock *us)
+{
+	(void)close(us->us_fd);
+	pppoat_free(us->us_host);
+	pppoat_free(us->us_zc_bufs);
+	pppoat_free(us->us_zc_busy);
+}
+
+static int udp_path_add(struct pppoat_udp_ctx *ctx,
+			const char            *host,
+			unsigned short         port,
+			const char            *lhost,
+			unsigned short         lport,
+			unsigned int           weight)
+{
+	struct sockaddr_storage  local;
+	struct udp_path         *path;
+	struct addrinfo         *ainfo;
+	socklen_t                len = sizeof(local);
+	int                      rc;
+
+	PPPOAT_ASSERT(ctx->uc_paths_nr < UDP_PATHS_MAX);
+	path = &ctx->uc_paths[ctx->uc_paths_nr];
+	memset(path, 0, sizeof(*path));
+	path->up_weight   = pppoat_max(weight, 1);
+	path->up_probe_fd = -1;
+	path->up_usable   = true;
+
+	rc = udp_sock_get(ctx, lhost, lport, &path->up_sock);
+	rc = rc ?: getsockname(path->up_sock->us_fd,
+			       (struct sockaddr *)&local, &len);
+	/* Remote address must be of the same family as the socket */
+	rc = rc ?: udp_ainfo_get(&ainfo, host, port, local.ss_family);
+	if (rc == 0) {
+		PPPOAT_ASSERT(ainfo->ai_addrlen <= sizeof(path->up_addr));
+		memcpy(&path->up_addr, ainfo->ai_addr, ainfo->ai_addrlen);
+		path->up_addrlen = ainfo->ai_addrlen;
+		udp_ainfo_put(ainfo);
+		pppoat_debug("udp", "Path %u: %s:%u -> %s:%u weight=%u",
+			     ctx->uc_paths_nr, lhost ?: "*", lport, host,
+			     port, path->up_weight);
+		++ctx->uc_paths_nr;
+	}
+	return rc;
+}
+
+/*
+ * Path format: udp.path.N=<remote>,<port>[,<local>[,<lport>[,<weight>]]]
+ * Empty fields take defaults. Ports are shifted by the queue index, so
+ * every queue of a multiqueue interface uses its own pair of sockets.
+ */
+static int udp_path_parse(struct pppoat_udp_ctx *ctx,
+			  const char            *spec,
+			  unsigned short         def_lport,
+			  unsigned int           queue)
+{
+	char          *str = pppoat_strdup(spec);
+	char          *cur = str;
+	char          *fields[5] = {};
+	unsigned long  val[5]    = { 0, 0, 0, def_lport, 1 };
+	bool           bad       = false;
+	char          *end;
+	unsigned int   i;
+	int            rc;
+
+	if (str == NULL)
+		return P_ERR(-ENOMEM);
+
+	for (i = 0; i < ARRAY_SIZE(fields) && cur != NULL; ++i) {
+		fields[i] = strsep(&cur, ",");
+		if (fields[i][0] == '\0')
+			fields[i] = NULL;
+	}
+	/* Port, local port and weight are numbers */
+	for (i = 1; i < ARRAY_SIZE(fields); i += i == 1 ? 2 : 1) {
+		if (fields[i] == NULL)
+			continue;
+		val[i] = strtoul(fields[i], &end, 0);
+		bad = bad || *end != '\0' || val[i] > 0xffff;
+	}
+	/* The remote port is required, an empty or zero one isn't shifted */
+	bad = bad || fields[0] == NULL || val[1] == 0 || cur != NULL;
+	if (!bad) {
+		val[1] += queue;
+		if (fields[3] != NULL && val[3] != 0)
+			val[3] += queue;
+	}
+	rc = bad || val[1] > 0xffff || val[3] > 0xffff ? P_ERR(-EINVAL) : 0;
+	if (rc != 0)
+		pppoat_error("udp", "Invalid path: %s", spec);
+	rc = rc ?: udp_path_add(ctx, fields[0], val[1], fields[2], val[3],
+				val[4]);
+	pppoat_free(str);
+
+	return rc;
+}
+
+static int udp_paths_init(struct pppoat_udp_ctx *ctx,
+			  struct pppoat_conf    *conf)
+{
+	unsigned short  sport;
+	unsigned short  dport;
+	const char     *dhost;
+	const char     *spec;
+	char            key[16];
+	unsigned int    queue;
+	unsigned int    i;
+	int             rc = 0;
+
+	queue = pppoat_conf_get_ulong(conf, "queue", 0);
+	if (queue > 0xff)
+		return P_ERR(-EINVAL);
 
 	/* XXX use hardcoded config for now */
-	if (type == PPPOAT_NODE_MASTER) {
+	if (ctx->uc_type == PPPOAT_NODE_MASTER) {
 		sport = UDP_PORT_MASTER;
 		dport = UDP_PORT_SLAVE;
 		dhost = UDP_HOST_SLAVE;
@@ -126,18 +470,649 @@ static int module_udp_init(struct pppoat_conf *conf, void **userdata)
 		dport = UDP_PORT_MASTER;
 		dhost = UDP_HOST_MASTER;
 	}
+	sport += queue;
+	dport += queue;
+
+	for (i = 0; rc == 0 && i < UDP_PATHS_MAX; ++i) {
+		snprintf(key, sizeof(key), "udp.path.%u", i);
+		spec = pppoat_conf_get(conf, key);
+		if (spec != NULL)
+			rc = udp_path_parse(ctx, spec, sport, queue);
+	}
+	if (rc == 0 && ctx->uc_paths_nr == 0)
+		rc = udp_path_add(ctx, dhost, dport, NULL, sport, 1);
+
+	return rc;
+}
+
+static uint32_t udp_pow2_roundup(uint32_t x)
+{
+	uint32_t r = 1;
+
+	while (r < x && r < (1U << 31))
+		r <<= 1;
+	return r;
+}
+
+static int udp_zc_init(struct pppoat_udp_ctx *ctx,
+		       struct pppoat_conf    *conf)
+{
+	struct udp_sock *us;
+	unsigned int     i;
+	int              one = 1;
+	int              rc  = 0;
+
+	ctx->uc_zc        = false;
+	ctx->uc_zc_nr     = 0;
+	ctx->uc_zc_copied = 0;
+
+	if (!pppoat_conf_obj_is_true(pppoat_conf_get(conf, "udp.zerocopy")))
+		return 0;
+
+#ifdef UDP_HAVE_ZEROCOPY
+	for (i = 0; rc == 0 && i < ctx->uc_socks_nr; ++i)
+		rc = setsockopt(ctx->uc_socks[i].us_fd, SOL_SOCKET,
+				SO_ZEROCOPY, &one, sizeof(one));
+	if (rc != 0) {
+		pppoat_info("udp", "SO_ZEROCOPY is not supported (errno=%d), "
+			    "using copying send", errno);
+		return 0;
+	}
+	ctx->uc_zc_min = pppoat_conf_get_ulong(conf, "udp.zerocopy_min",
+					       UDP_ZC_MIN_DEFAULT);
+	ctx->uc_zc_nr  = pppoat_conf_get_ulong(conf, "udp.zerocopy_bufs",
+					       UDP_ZC_BUFS_DEFAULT);
+	ctx->uc_zc_nr  = udp_pow2_roundup(pppoat_max(ctx->uc_zc_nr, 1));
+	for (i = 0; rc == 0 && i < ctx->uc_socks_nr; ++i) {
+		us = &ctx->uc_socks[i];
+		us->us_zc_bufs = pppoat_alloc((size_t)ctx->uc_zc_nr *
+					      UDP_BUF_SIZE);
+		us->us_zc_busy = pppoat_calloc(ctx->uc_zc_nr,
+					       sizeof(*us->us_zc_busy));
+		rc = us->us_zc_bufs == NULL || us->us_zc_busy == NULL ?
+		     P_ERR(-ENOMEM) : 0;
+	}
+	if (rc == 0) {
+		ctx->uc_zc = true;
+		pppoat_debug("udp", "MSG_ZEROCOPY enabled: bufs=%u min=%zu",
+			     ctx->uc_zc_nr, ctx->uc_zc_min);
+	}
+#else /* UDP_HAVE_ZEROCOPY */
+	(void)us;
+	(void)i;
+	(void)one;
+	pppoat_info("udp", "MSG_ZEROCOPY is not supported on this platform");
+#endif /* UDP_HAVE_ZEROCOPY */
+
+	return rc;
+}
+
+static void udp_zc_fini(struct pppoat_udp_ctx *ctx)
+{
+	if (ctx->uc_zc_copied > 0)
+		pppoat_debug("udp", "Kernel copied %lu zerocopy sends",
+			     ctx->uc_zc_copied);
+}
+
+static void udp_sock_buf_set(int sock, int opt, int opt_force,
+			     unsigned long size, const char *name)
+{
+	socklen_t optlen = sizeof(int);
+	int       val    = (int)size;
+	int       rc;
+
+	rc = setsockopt(sock, SOL_SOCKET, opt, &val, sizeof(val));
+	rc = rc ?: getsockopt(sock, SOL_SOCKET, opt, &val, &optlen);
+	/* Linux doubles the value and caps it by net.core.[rw]mem_max */
+	if (rc == 0 && (unsigned long)val < size) {
+		val = (int)size;
+		(void)setsockopt(sock, SOL_SOCKET, opt_force, &val,
+				 sizeof(val));
+		rc = getsockopt(sock, SOL_SOCKET, opt, &val, &optlen);
+	}
+	if (rc == 0)
+		pppoat_debug("udp", "%s=%d", name, val);
+	else
+		pppoat_info("udp", "Can't set %s (errno=%d)", name, errno);
+}
+
+static void udp_sock_opt_set(int sock, int level, int opt, int val,
+			     const char *name)
+{
+	int rc;
+
+	rc = setsockopt(sock, level, opt, &val, sizeof(val));
+	if (rc != 0)
+		pppoat_info("udp", "Can't set %s=%d (errno=%d)",
+			    name, val, errno);
+}
+
+static void udp_latency_init(struct pppoat_udp_ctx *ctx,
+			     struct pppoat_conf    *conf)
+{
+	unsigned long rcvbuf;
+	unsigned long sndbuf;
+	unsigned long busy_poll;
+	unsigned int  i;
+	bool          latency;
+	int           sock;
+
+	rcvbuf    = pppoat_conf_get_ulong(conf, "udp.rcvbuf", 0);
+	sndbuf    = pppoat_conf_get_ulong(conf, "udp.sndbuf", 0);
+	busy_poll = pppoat_conf_get_ulong(conf, "udp.busy_poll",
+					  UDP_BUSY_POLL_DEFAULT);
+	latency   = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+							    "udp.latency"));
+	ctx->uc_spin_us = latency ?
+		pppoat_conf_get_ulong(conf, "udp.spin", UDP_SPIN_DEFAULT) : 0;
+	ctx->uc_stats = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+							"udp.stats"));
+	ctx->uc_stats_interval = pppoat_conf_get_ulong(conf,
+						"udp.stats_interval",
+						UDP_STATS_INTERVAL_DEFAULT);
+	ctx->uc_stats_interval *= 1000000;
+	ctx->uc_stats_last = pppoat_util_time_us();
+	pppoat_hist_init(&ctx->uc_lat);
+
+	for (i = 0; i < ctx->uc_socks_nr; ++i) {
+		sock = ctx->uc_socks[i].us_fd;
+		if (rcvbuf != 0)
+			udp_sock_buf_set(sock, SO_RCVBUF, SO_RCVBUFFORCE,
+					 rcvbuf, "SO_RCVBUF");
+		if (sndbuf != 0)
+			udp_sock_buf_set(sock, SO_SNDBUF, SO_SNDBUFFORCE,
+					 sndbuf, "SO_SNDBUF");
+#ifdef SO_BUSY_POLL
+		if (latency)
+			udp_sock_opt_set(sock, SOL_SOCKET, SO_BUSY_POLL,
+					 (int)busy_poll, "SO_BUSY_POLL");
+#endif /* SO_BUSY_POLL */
+#ifdef SO_PREFER_BUSY_POLL
+		if (latency)
+			udp_sock_opt_set(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+					 1, "SO_PREFER_BUSY_POLL");
+#endif /* SO_PREFER_BUSY_POLL */
+#ifdef SO_TIMESTAMPNS
+		if (ctx->uc_stats)
+			udp_sock_opt_set(sock, SOL_SOCKET, SO_TIMESTAMPNS, 1,
+					 "SO_TIMESTAMPNS");
+#endif /* SO_TIMESTAMPNS */
+	}
+	(void)busy_poll;
+	if (latency)
+		pppoat_debug("udp", "Low-latency mode: spin=%lu usec",
+			     ctx->uc_spin_us);
+}
+
+static void udp_stats_print(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_hist *lat = &ctx->uc_lat;
+
+	if (lat->h_nr == 0)
+		return;
+
+	pppoat_info("udp", "Delivery latency (%s mode, %llu pkts): "
+		    "min=%llu p50=%llu p99=%llu max=%llu usec",
+		    ctx->uc_spin_us > 0 ? "low-latency" : "normal",
+		    (unsigned long long)lat->h_nr,
+		    (unsigned long long)lat->h_min,
+		    (unsigned long long)pppoat_hist_percentile(lat, 50),
+		    (unsigned long long)pppoat_hist_percentile(lat, 99),
+		    (unsigned long long)lat->h_max);
+}
+
+static int udp_bundle_init(struct pppoat_udp_ctx *ctx,
+			   struct pppoat_conf    *conf)
+{
+	ctx->uc_bundle        = pppoat_conf_obj_is_true(
+				pppoat_conf_get(conf, "udp.bundle"));
+	ctx->uc_bundle_buf    = NULL;
+	ctx->uc_bundle_len    = 0;
+	ctx->uc_bundle_pkts   = 0;
+	ctx->uc_bundle_dgrams = 0;
+	ctx->uc_bundle_bad    = 0;
+	if (!ctx->uc_bundle)
+		return 0;
+
+	ctx->uc_bundle_size  = pppoat_conf_get_ulong(conf, "udp.bundle_size",
+						     UDP_BUNDLE_SIZE_DEFAULT);
+	ctx->uc_bundle_size  = pppoat_max(ctx->uc_bundle_size,
+					  UDP_BUNDLE_HDR_MAX + 1);
+	ctx->uc_bundle_size  = pppoat_min(ctx->uc_bundle_size,
+					  UDP_BUF_SIZE - ctx->uc_hdr_len);
+	ctx->uc_bundle_delay = pppoat_conf_get_ulong(conf, "udp.bundle_delay",
+						     UDP_BUNDLE_DELAY_DEFAULT);
+	/* Multipath header is filled in front of the bundle */
+	ctx->uc_bundle_buf   = pppoat_alloc(ctx->uc_hdr_len +
+					    ctx->uc_bundle_size);
+	pppoat_debug("udp", "Bundling enabled: size=%zu delay=%lu usec",
+		     ctx->uc_bundle_size, ctx->uc_bundle_delay);
+
+	return ctx->uc_bundle_buf == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+static void udp_bundle_fini(struct pppoat_udp_ctx *ctx)
+{
+	if (ctx->uc_bundle_dgrams > 0)
+		pppoat_debug("udp", "Bundled %lu packets into %lu datagrams, "
+			     "%lu malformed datagrams received",
+			     ctx->uc_bundle_pkts, ctx->uc_bundle_dgrams,
+			     ctx->uc_bundle_bad);
+	pppoat_free(ctx->uc_bundle_buf);
+}
+
+static int udp_dgram_deliver(void *userdata, unsigned char *buf, size_t len);
+
+static int udp_mp_init(struct pppoat_udp_ctx *ctx,
+		       struct pppoat_conf    *conf)
+{
+	unsigned long window;
+	unsigned long timeout;
+	int           rc = 0;
+
+	ctx->uc_mp      = pppoat_conf_obj_is_true(
+			  pppoat_conf_get(conf, "udp.multipath"));
+	ctx->uc_hdr_len = ctx->uc_mp || ctx->uc_pmtu || ctx->uc_probe ?
+			  UDP_HDR_LEN : 0;
+	ctx->uc_tx_seq  = 0;
+	ctx->uc_mp_bad  = 0;
+
+	if (ctx->uc_mp) {
+		window  = pppoat_conf_get_ulong(conf, "udp.reorder_window",
+						UDP_REORDER_WINDOW_DEFAULT);
+		timeout = pppoat_conf_get_ulong(conf, "udp.reorder_timeout",
+						UDP_REORDER_TIMEOUT_DEFAULT);
+		rc = pppoat_reorder_init(&ctx->uc_reorder,
+					 pppoat_max(window, 1), timeout,
+					 &udp_dgram_deliver, ctx);
+		pppoat_debug("udp", "Multipath enabled: %u paths, reorder "
+			     "window=%lu timeout=%lu usec",
+			     ctx->uc_paths_nr, window, timeout);
+		if (rc != 0)
+			ctx->uc_mp = false;
+	} else if (ctx->uc_paths_nr > 1) {
+		pppoat_info("udp", "Only path 0 is used without "
+			    "udp.multipath");
+	}
+	return rc;
+}
+
+static void udp_mp_fini(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_reorder *ro = &ctx->uc_reorder;
+	unsigned int           i;
+
+	if (!ctx->uc_mp)
+		return;
+
+	for (i = 0; i < ctx->uc_paths_nr; ++i)
+		pppoat_debug("udp", "Path %u: tx=%lu", i,
+			     ctx->uc_paths[i].up_tx);
+	for (i = 0; i < ctx->uc_socks_nr; ++i)
+		pppoat_debug("udp", "Socket %u: rx=%lu", i,
+			     ctx->uc_socks[i].us_rx);
+	pppoat_debug("udp", "Reorder: reordered=%lu dropped=%lu lost=%lu "
+		     "malformed=%lu", ro->ro_reordered, ro->ro_dropped,
+		     ro->ro_lost, ctx->uc_mp_bad);
+	pppoat_reorder_fini(ro);
+}
 
-	ctx = pppoat_alloc(sizeof(*ctx));
+static int udp_hub_init(struct pppoat_udp_ctx *ctx,
+			struct pppoat_conf    *conf)
+{
+	unsigned long max;
+	unsigned long timeout;
+	unsigned long plen4;
+	unsigned long plen6;
+	int           rc;
+
+	if (!pppoat_conf_obj_is_true(pppoat_conf_get(conf, "udp.hub")))
+		return 0;
+
+	if (ctx->uc_type != PPPOAT_NODE_MASTER || ctx->uc_mp ||
+	    ctx->uc_bundle || ctx->uc_pmtu || ctx->uc_probe) {
+		pppoat_error("udp", "Hub mode requires server mode without "
+			     "multipath, bundling, PMTU discovery and "
+			     "probing");
+		return P_ERR(-EINVAL);
+	}
+	max     = pppoat_conf_get_ulong(conf, "udp.hub_max",
+					UDP_HUB_MAX_DEFAULT);
+	timeout = pppoat_conf_get_ulong(conf, "udp.hub_timeout",
+					UDP_HUB_TIMEOUT_DEFAULT);
+	plen4   = pppoat_conf_get_ulong(conf, "udp.hub_prefix4", 32);
+	plen6   = pppoat_conf_get_ulong(conf, "udp.hub_prefix6", 128);
+
+	ctx->uc_hub_len    = 0;
+	ctx->uc_hub_bad    = 0;
+	ctx->uc_hub_tx_err = 0;
+	ctx->uc_hub_buf    = pppoat_alloc(UDP_BUF_SIZE);
+	rc = ctx->uc_hub_buf == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: pppoat_hub_init(&ctx->uc_hub_tbl, max, timeout * 1000000,
+				   plen4, plen6);
+	if (rc == 0) {
+		ctx->uc_hub = true;
+		pppoat_debug("udp", "Hub mode: max=%lu timeout=%lu sec "
+			     "prefix4=/%lu prefix6=/%lu",
+			     max, timeout, plen4, plen6);
+	} else {
+		pppoat_free(ctx->uc_hub_buf);
+		return rc;
+	}
+
+	if (!pppoat_conf_obj_is_true(pppoat_conf_get(conf, "udp.switch")))
+		return 0;
+	max     = pppoat_conf_get_ulong(conf, "udp.switch_max",
+					UDP_SWITCH_MAX_DEFAULT);
+	timeout = pppoat_conf_get_ulong(conf, "udp.switch_ageing",
+					UDP_SWITCH_AGEING_DEFAULT);
+	rc = pppoat_hub_switch_init(&ctx->uc_hub_tbl, max, timeout * 1000000);
+	if (rc == 0) {
+		pppoat_debug("udp", "Switch mode: max=%lu ageing=%lu sec",
+			     max, timeout);
+	} else {
+		pppoat_hub_fini(&ctx->uc_hub_tbl);
+		pppoat_free(ctx->uc_hub_buf);
+		ctx->uc_hub = false;
+	}
+	return rc;
+}
+
+static void udp_hub_fini(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_hub *hub = &ctx->uc_hub_tbl;
+
+	if (!ctx->uc_hub)
+		return;
+
+	pppoat_debug("udp", "Hub: sessions=%zu routes=%lu expired=%lu "
+		     "rejected=%lu refused=%lu unrouted=%lu malformed=%lu "
+		     "tx_err=%lu", hub->hub_nr, hub->hub_routes4.lpm_prefixes +
+		     hub->hub_routes6.lpm_prefixes, hub->hub_expired,
+		     hub->hub_rejected, hub->hub_refused, hub->hub_unrouted,
+		     ctx->uc_hub_bad, ctx->uc_hub_tx_err);
+	if (hub->hub_switch)
+		pppoat_debug("udp", "Switch: macs=%zu learned=%lu moved=%lu "
+			     "aged=%lu full=%lu flooded=%lu",
+			     hub->hub_fdb.fdb_nr, hub->hub_fdb.fdb_learned,
+			     hub->hub_fdb.fdb_moved, hub->hub_fdb.fdb_aged,
+			     hub->hub_fdb.fdb_full, hub->hub_flooded);
+	pppoat_hub_fini(hub);
+	pppoat_free(ctx->uc_hub_buf);
+}
+
+/*
+ * A read from TUN interface may hold several packets, with offloads all
+ * segments of a GSO packet come at once. They are split by IP length, so
+ * datagrams don't need IP fragmentation. Only the transport attached to
+ * the interface does it, main() sets "if.packets" for it.
+ */
+static int udp_split_init(struct pppoat_udp_ctx *ctx,
+			  struct pppoat_conf    *conf)
+{
+	const char *packets = pppoat_conf_get(conf, "if.packets");
+
+	if (ctx->uc_hub || !pppoat_conf_obj_is_true(packets))
+		return 0;
+
+	ctx->uc_split_len = 0;
+	ctx->uc_split_bad = 0;
+	ctx->uc_split_buf = pppoat_alloc(UDP_BUF_SIZE);
+	if (ctx->uc_split_buf == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->uc_split = true;
+	return 0;
+}
+
+static void udp_split_fini(struct pppoat_udp_ctx *ctx)
+{
+	if (!ctx->uc_split)
+		return;
+
+	pppoat_debug("udp", "Split: malformed=%lu", ctx->uc_split_bad);
+	pppoat_free(ctx->uc_split_buf);
+}
+
+/* Paths which carry data */
+static unsigned int udp_paths_used(const struct pppoat_udp_ctx *ctx)
+{
+	return ctx->uc_mp ? ctx->uc_paths_nr : 1;
+}
+
+/* Creates socket with DF set which sends probes of the path. */
+static int udp_probe_sock_new(struct udp_path *path)
+{
+	struct sockaddr_storage local;
+	socklen_t               len = sizeof(local);
+	int                     fd;
+	int                     rc;
+	int                     val;
+
+	fd = socket(path->up_addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		return P_ERR(-errno);
+	/* Same local address as the path, but ephemeral port */
+	rc = getsockname(path->up_sock->us_fd, (struct sockaddr *)&local,
+			 &len);
+	if (rc == 0 && local.ss_family == AF_INET)
+		((struct sockaddr_in *)&local)->sin_port = 0;
+	if (rc == 0 && local.ss_family == AF_INET6)
+		((struct sockaddr_in6 *)&local)->sin6_port = 0;
+	rc = rc ?: bind(fd, (struct sockaddr *)&local, len);
+#if defined(IP_PMTUDISC_PROBE) && defined(IPV6_PMTUDISC_PROBE)
+	/* Set DF and ignore cached PMTU, so larger sizes can be probed */
+	if (rc == 0 && local.ss_family == AF_INET) {
+		val = IP_PMTUDISC_PROBE;
+		rc  = setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &val,
+				 sizeof(val));
+	} else if (rc == 0) {
+		val = IPV6_PMTUDISC_PROBE;
+		rc  = setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val,
+				 sizeof(val));
+	}
+#else
+	(void)val;
+	rc = rc ?: -1;
+	errno = ENOPROTOOPT;
+#endif
+	rc = rc ?: connect(fd, (struct sockaddr *)&path->up_addr,
+			   path->up_addrlen);
+	rc = rc == 0 ? 0 : P_ERR(-errno);
+	rc = rc ?: pppoat_util_fd_nonblock_set(fd, true);
+	if (rc == 0)
+		path->up_probe_fd = fd;
+	else
+		(void)close(fd);
+
+	return rc;
+}
+
+static int udp_pmtu_init(struct pppoat_udp_ctx *ctx,
+			 struct pppoat_conf    *conf)
+{
+	unsigned long min;
+	unsigned long max;
+	unsigned long interval;
+	uint64_t      now = pppoat_util_time_us();
+	unsigned int  i;
+	int           rc  = 0;
+
+	ctx->uc_pmtu_mtu = 0;
+	if (!ctx->uc_pmtu)
+		return 0;
+
+	min      = pppoat_conf_get_ulong(conf, "udp.pmtu_min",
+					 UDP_PMTU_MIN_DEFAULT);
+	max      = pppoat_conf_get_ulong(conf, "udp.pmtu_max",
+					 UDP_PMTU_MAX_DEFAULT);
+	interval = pppoat_conf_get_ulong(conf, "udp.pmtu_interval",
+					 UDP_PMTU_INTERVAL_DEFAULT);
+	max = pppoat_min(max, UDP_DGRAM_MAX);
+	min = pppoat_max(pppoat_min(min, max), UDP_HDR_LEN + 68);
+
+	for (i = 0; rc == 0 && i < udp_paths_used(ctx); ++i) {
+		rc = udp_probe_sock_new(&ctx->uc_paths[i]);
+		pppoat_pmtu_init(&ctx->uc_paths[i].up_pmtu, min, max,
+				 UDP_PMTU_PROBE_TIMEOUT, interval * 1000000,
+				 now);
+	}
+	if (rc == 0)
+		pppoat_debug("udp", "PMTU discovery: min=%lu max=%lu "
+			     "interval=%lu sec", min, max, interval);
+	return rc;
+}
+
+static void udp_pmtu_fini(struct pppoat_udp_ctx *ctx)
+{
+	struct udp_path *path;
+	unsigned int     i;
+
+	for (i = 0; i < ctx->uc_paths_nr; ++i) {
+		path = &ctx->uc_paths[i];
+		if (path->up_probe_fd < 0)
+			continue;
+		pppoat_debug("udp", "Path %u: PMTU %zu%s", i,
+			     path->up_pmtu.pm_mtu,
+			     path->up_pmtu.pm_done ? "" : " (searching)");
+		(void)close(path->up_probe_fd);
+	}
+}
+
+static void udp_probe_init(struct pppoat_udp_ctx *ctx,
+			   struct pppoat_conf    *conf)
+{
+	unsigned long interval;
+	uint64_t      now = pppoat_util_time_us();
+	unsigned int  i;
+
+	if (!ctx->uc_probe)
+		return;
+
+	interval = pppoat_conf_get_ulong(conf, "udp.probe_interval",
+					 UDP_PROBE_INTERVAL_DEFAULT);
+	interval = pppoat_max(interval, 1);
+	ctx->uc_probe_rtt_slack = pppoat_conf_get_ulong(conf,
+					"udp.probe_rtt_slack", 0) * 1000;
+	ctx->uc_probe_report = ctx->uc_stats_interval == 0 ?
+			       PPPOAT_TIME_NEVER :
+			       now + ctx->uc_stats_interval;
+	for (i = 0; i < ctx->uc_paths_nr; ++i)
+		pppoat_probe_init(&ctx->uc_paths[i].up_probe,
+				  interval * 1000, now);
+	for (i = 0; i < ARRAY_SIZE(ctx->uc_probe_rx); ++i)
+		pppoat_probe_rx_init(&ctx->uc_probe_rx[i]);
+	pppoat_debug("udp", "Path probing: interval=%lu msec "
+		     "rtt_slack=%llu msec", interval,
+		     (unsigned long long)ctx->uc_probe_rtt_slack / 1000);
+}
+
+static void udp_probe_report(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_probe_rx *prx;
+	struct pppoat_probe    *pr;
+	unsigned int            i;
+
+	for (i = 0; i < udp_paths_used(ctx); ++i) {
+		pr  = &ctx->uc_paths[i].up_probe;
+		prx = &ctx->uc_probe_rx[i];
+		pppoat_info("udp", "Path %u: %s rtt=%llu/%llu usec "
+			    "jitter=%llu usec loss=%u.%02u%% pings=%lu/%lu "
+			    "rx=%u reordered=%u", i,
+			    pr->pr_down ? "down" : "up",
+			    (unsigned long long)pr->pr_srtt,
+			    (unsigned long long)pr->pr_rtt_min,
+			    (unsigned long long)pr->pr_rttvar,
+			    pr->pr_loss_ppm / 10000,
+			    pr->pr_loss_ppm % 10000 / 100,
+			    pr->pr_pongs, pr->pr_pings,
+			    prx->prx_nr, prx->prx_reordered);
+	}
+}
+
+/*
+ * Marks paths which get data. Down paths are skipped, so are paths
+ * slower than the fastest one by more than udp.probe_rtt_slack, which
+ * keeps a slow link from holding back the reorder buffer. If no path
+ * qualifies, all are used.
+ */
+static void udp_probe_usable_update(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_probe *pr;
+	uint64_t             best = PPPOAT_TIME_NEVER;
+	unsigned int         usable = 0;
+	unsigned int         i;
+
+	for (i = 0; i < ctx->uc_paths_nr; ++i) {
+		pr = &ctx->uc_paths[i].up_probe;
+		if (!pr->pr_down && pr->pr_has_rtt)
+			best = pppoat_min(best, pr->pr_srtt);
+	}
+	for (i = 0; i < ctx->uc_paths_nr; ++i) {
+		pr = &ctx->uc_paths[i].up_probe;
+		ctx->uc_paths[i].up_usable = !pr->pr_down &&
+			(ctx->uc_probe_rtt_slack == 0 || !pr->pr_has_rtt ||
+			 best == PPPOAT_TIME_NEVER ||
+			 pr->pr_srtt <= best + ctx->uc_probe_rtt_slack);
+		usable += ctx->uc_paths[i].up_usable ? 1 : 0;
+	}
+	for (i = 0; usable == 0 && i < ctx->uc_paths_nr; ++i)
+		ctx->uc_paths[i].up_usable = true;
+}
+
+static void udp_probe_fini(struct pppoat_udp_ctx *ctx)
+{
+	if (ctx->uc_probe)
+		udp_probe_report(ctx);
+}
+
+static void udp_ctx_fini(struct pppoat_udp_ctx *ctx)
+{
+	unsigned int i;
+
+	udp_probe_fini(ctx);
+	udp_pmtu_fini(ctx);
+	udp_split_fini(ctx);
+	udp_hub_fini(ctx);
+	udp_mp_fini(ctx);
+	udp_bundle_fini(ctx);
+	udp_zc_fini(ctx);
+	for (i = 0; i < ctx->uc_socks_nr; ++i)
+		udp_sock_fini(&ctx->uc_socks[i]);
+	pppoat_free(ctx->uc_buf);
+	pppoat_free(ctx);
+}
+
+static int module_udp_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_udp_ctx *ctx;
+	const char            *opt;
+	int                    rc;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
 	rc  = ctx == NULL ? P_ERR(-ENOMEM) : 0;
 	if (rc == 0) {
-		ctx->uc_type = type;
-		rc = udp_ainfo_get(&ctx->uc_ainfo, dhost, dport);
-		rc = rc ?: udp_sock_new(sport, &ctx->uc_sock);
-		if (rc != 0) {
-			if (ctx->uc_ainfo != NULL)
-				udp_ainfo_put(ctx->uc_ainfo);
-			pppoat_free(ctx);
-		}
+		opt = pppoat_conf_get(conf, "server");
+		ctx->uc_type = opt != NULL && pppoat_conf_obj_is_true(opt) ?
+			       PPPOAT_NODE_MASTER : PPPOAT_NODE_SLAVE;
+		ctx->uc_pmtu  = pppoat_conf_obj_is_true(
+				pppoat_conf_get(conf, "udp.pmtu"));
+		ctx->uc_probe = pppoat_conf_obj_is_true(
+				pppoat_conf_get(conf, "udp.probe"));
+		ctx->uc_buf  = pppoat_alloc(UDP_BUF_SIZE);
+		rc = ctx->uc_buf == NULL ? P_ERR(-ENOMEM) : 0;
+		rc = rc ?: udp_paths_init(ctx, conf);
+		rc = rc ?: udp_zc_init(ctx, conf);
+		if (rc == 0)
+			udp_latency_init(ctx, conf);
+		rc = rc ?: udp_mp_init(ctx, conf);
+		rc = rc ?: udp_bundle_init(ctx, conf);
+		rc = rc ?: udp_hub_init(ctx, conf);
+		rc = rc ?: udp_split_init(ctx, conf);
+		rc = rc ?: udp_pmtu_init(ctx, conf);
+		if (rc == 0)
+			udp_probe_init(ctx, conf);
+		if (rc != 0)
+			udp_ctx_fini(ctx);
 	}
 	if (rc == 0) {
 		*userdata = ctx;
@@ -149,9 +1124,9 @@ static void module_udp_fini(void *userdata)
 {
 	struct pppoat_udp_ctx *ctx = userdata;
 
-	(void)close(ctx->uc_sock);
-	udp_ainfo_put(ctx->uc_ainfo);
-	pppoat_free(ctx);
+	if (ctx->uc_stats)
+		udp_stats_print(ctx);
+	udp_ctx_fini(ctx);
 }
 
 static bool udp_error_is_recoverable(int error)
@@ -161,26 +1136,27 @@ static bool udp_error_is_recoverable(int error)
 		error == -EWOULDBLOCK);
 }
 
-static int udp_buf_send(struct pppoat_udp_ctx *ctx,
-			unsigned char         *buf,
-			ssize_t                len)
+static int udp_buf_send(int                            sock,
+			const struct sockaddr_storage *addr,
+			socklen_t                      addrlen,
+			unsigned char                 *buf,
+			ssize_t                        len)
 {
-	struct addrinfo *ainfo = ctx->uc_ainfo;
-	ssize_t          len2  = 0;
-	fd_set           wfds;
-	int              rc    = 0;
+	ssize_t len2 = 0;
+	fd_set  wfds;
+	int     rc   = 0;
 
 	do {
-		len2 = sendto(ctx->uc_sock, buf, len, 0, ainfo->ai_addr,
-			      ainfo->ai_addrlen);
+		len2 = sendto(sock, buf, len, 0,
+			      (const struct sockaddr *)addr, addrlen);
 		if (len2 < 0 && errno == EINTR)
 			continue;
 		if (len2 < 0 && !udp_error_is_recoverable(-errno))
 			rc = P_ERR(-errno);
 		if (len2 < 0 && udp_error_is_recoverable(-errno)) {
 			FD_ZERO(&wfds);
-			FD_SET(ctx->uc_sock, &wfds);
-			rc = pppoat_util_select(ctx->uc_sock, NULL, &wfds);
+			FD_SET(sock, &wfds);
+			rc = pppoat_util_select(sock, NULL, &wfds);
 		}
 		if (len2 > 0) {
 			buf += len2;
@@ -191,44 +1167,970 @@ static int udp_buf_send(struct pppoat_udp_ctx *ctx,
 	return rc;
 }
 
+static int udp_path_send(struct udp_path *path,
+			 unsigned char   *buf,
+			 ssize_t          len)
+{
+	return udp_buf_send(path->up_sock->us_fd, &path->up_addr,
+			    path->up_addrlen, buf, len);
+}
+
+#ifdef UDP_HAVE_ZEROCOPY
+
+/* Returns free pool buffer for the next zerocopy send or NULL. */
+static unsigned char *udp_zc_buf_get(struct pppoat_udp_ctx *ctx,
+				     struct udp_sock       *us)
+{
+	uint32_t slot = us->us_zc_next & (ctx->uc_zc_nr - 1);
+
+	return us->us_zc_busy[slot] ? NULL :
+	       us->us_zc_bufs + (size_t)slot * UDP_BUF_SIZE;
+}
+
+static int udp_zc_send(struct pppoat_udp_ctx *ctx,
+		       struct udp_path       *path,
+		       unsigned char         *buf,
+		       ssize_t                len)
+{
+	struct udp_sock *us   = path->up_sock;
+	uint32_t         slot = us->us_zc_next & (ctx->uc_zc_nr - 1);
+	ssize_t          len2;
+
+	do {
+		len2 = sendto(us->us_fd, buf, len, MSG_ZEROCOPY,
+			      (struct sockaddr *)&path->up_addr,
+			      path->up_addrlen);
+	} while (len2 < 0 && errno == EINTR);
+
+	/*
+	 * ENOBUFS means the socket ran out of optmem for pinned pages.
+	 * Kernel doesn't consume an id on failure, so just copy instead.
+	 */
+	if (len2 < 0)
+		return udp_path_send(path, buf, len);
+
+	PPPOAT_ASSERT(len2 == len);
+	us->us_zc_busy[slot] = true;
+	++us->us_zc_next;
+
+	return 0;
+}
+
+/* Releases buffers of completed zerocopy sends from the error queue. */
+static int udp_zc_reap(struct pppoat_udp_ctx *ctx, struct udp_sock *us)
+{
+	struct sock_extended_err *serr;
+	struct cmsghdr           *cm;
+	struct msghdr             msg;
+	unsigned char             control[128];
+	uint32_t                  id;
+	ssize_t                   len;
+
+	while (true) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+		len = recvmsg(us->us_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		     cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			      cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			      cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 ||
+			    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				++ctx->uc_zc_copied;
+			/* Range [ee_info, ee_data] is inclusive and may wrap */
+			id = serr->ee_info;
+			do {
+				us->us_zc_busy[id & (ctx->uc_zc_nr - 1)] =
+					false;
+			} while (id++ != serr->ee_data);
+		}
+	}
+	return udp_error_is_recoverable(-errno) ? 0 : P_ERR(-errno);
+}
+
+#else /* UDP_HAVE_ZEROCOPY */
+
+static unsigned char *udp_zc_buf_get(struct pppoat_udp_ctx *ctx,
+				     struct udp_sock       *us)
+{
+	return NULL;
+}
+
+static int udp_zc_send(struct pppoat_udp_ctx *ctx,
+		       struct udp_path       *path,
+		       unsigned char         *buf,
+		       ssize_t                len)
+{
+	return udp_path_send(path, buf, len);
+}
+
+static int udp_zc_reap(struct pppoat_udp_ctx *ctx, struct udp_sock *us)
+{
+	return 0;
+}
+
+#endif /* UDP_HAVE_ZEROCOPY */
+
+/*
+ * Picks path for the next datagram with smooth weighted round-robin, so
+ * paths are interleaved in proportion to their weights. Credits aren't
+ * charged until udp_path_take(), the choice stays the same till then.
+ */
+static struct udp_path *udp_path_peek(struct pppoat_udp_ctx *ctx)
+{
+	struct udp_path *best = NULL;
+	struct udp_path *path;
+	unsigned int     i;
+
+	if (!ctx->uc_mp || ctx->uc_paths_nr == 1)
+		return &ctx->uc_paths[0];
+
+	for (i = 0; i < ctx->uc_paths_nr; ++i) {
+		path = &ctx->uc_paths[i];
+		if (path->up_usable &&
+		    (best == NULL || path->up_credit + path->up_weight >
+				     best->up_credit + best->up_weight))
+			best = path;
+	}
+	return best;
+}
+
+/* Charges credits for a datagram sent to path, NULL picks the path. */
+static struct udp_path *udp_path_take(struct pppoat_udp_ctx *ctx,
+				      struct udp_path       *path)
+{
+	struct udp_path *p;
+	long             total = 0;
+	unsigned int     i;
+
+	path = path ?: udp_path_peek(ctx);
+	if (!ctx->uc_mp || ctx->uc_paths_nr == 1)
+		return path;
+
+	for (i = 0; i < ctx->uc_paths_nr; ++i) {
+		p = &ctx->uc_paths[i];
+		if (!p->up_usable)
+			continue;
+		p->up_credit += p->up_weight;
+		total += p->up_weight;
+	}
+	path->up_credit -= total;
+
+	return path;
+}
+
+static struct udp_path *udp_path_next(struct pppoat_udp_ctx *ctx)
+{
+	return udp_path_take(ctx, NULL);
+}
+
+/*
+ * Sends a datagram. First uc_hdr_len bytes of dgram are reserved for the
+ * multipath header.
+ */
+static int udp_dgram_send(struct pppoat_udp_ctx *ctx,
+			  struct udp_path       *path,
+			  unsigned char         *dgram,
+			  size_t                 len,
+			  bool                   zc)
+{
+	struct udp_hdr hdr;
+
+	if (ctx->uc_hdr_len > 0) {
+		hdr.uh_type     = UDP_MSG_DATA;
+		hdr.uh_path     = (uint8_t)(path - ctx->uc_paths);
+		hdr.uh_path_seq = htons(path->up_probe.pr_tx_seq++);
+		hdr.uh_seq      = htonl(ctx->uc_tx_seq++);
+		memcpy(dgram, &hdr, sizeof(hdr));
+	}
+	++path->up_tx;
+
+	return zc && len >= ctx->uc_zc_min ?
+	       udp_zc_send(ctx, path, dgram, len) :
+	       udp_path_send(path, dgram, len);
+}
+
+static size_t udp_bundle_hdr_len(size_t len)
+{
+	return len < 0x80 ? 1 : len < 0x4000 ? 2 : 3;
+}
+
+static void udp_bundle_hdr_put(unsigned char *hdr, size_t len)
+{
+	while (len >= 0x80) {
+		*hdr++ = (unsigned char)(len & 0x7f) | 0x80;
+		len >>= 7;
+	}
+	*hdr = (unsigned char)len;
+}
+
+/* Returns length of the header or 0 if it is malformed. */
+static size_t udp_bundle_hdr_get(const unsigned char *hdr,
+				 size_t               avail,
+				 size_t              *len)
+{
+	size_t i;
+
+	*len = 0;
+	for (i = 0; i < avail && i < UDP_BUNDLE_HDR_MAX; ++i) {
+		*len |= (size_t)(hdr[i] & 0x7f) << (7 * i);
+		if ((hdr[i] & 0x80) == 0)
+			return *len <= avail - i - 1 ? i + 1 : 0;
+	}
+	return 0;
+}
+
+static int udp_bundle_flush(struct pppoat_udp_ctx *ctx)
+{
+	int rc = 0;
+
+	if (ctx->uc_bundle_len > 0) {
+		rc = udp_dgram_send(ctx, udp_path_next(ctx),
+				    ctx->uc_bundle_buf,
+				    ctx->uc_hdr_len + ctx->uc_bundle_len,
+				    false);
+		ctx->uc_bundle_len = 0;
+		++ctx->uc_bundle_dgrams;
+	}
+	return rc;
+}
+
+/*
+ * Sends a packet read from the interface. The packet is located at
+ * buf + uc_hdr_len + UDP_BUNDLE_HDR_MAX in bundling mode and at
+ * buf + uc_hdr_len otherwise. So headers are filled in place and a packet
+ * which doesn't go to a bundle is sent without copying. Path is peeked in
+ * advance when buf is a zerocopy buffer of its socket, it's charged only
+ * when the packet is sent to it.
+ */
+static int udp_pkt_send(struct pppoat_udp_ctx *ctx,
+			struct udp_path       *path,
+			unsigned char         *buf,
+			size_t                 len,
+			bool                   zc)
+{
+	unsigned char *bundle;
+	size_t         hlen;
+	int            rc;
+
+	if (!ctx->uc_bundle) {
+		return udp_dgram_send(ctx, udp_path_take(ctx, path), buf,
+				      ctx->uc_hdr_len + len, zc);
+	}
+
+	bundle = ctx->uc_bundle_buf + ctx->uc_hdr_len;
+	buf   += ctx->uc_hdr_len + UDP_BUNDLE_HDR_MAX;
+	hlen   = udp_bundle_hdr_len(len);
+	++ctx->uc_bundle_pkts;
+
+	rc = ctx->uc_bundle_len + hlen + len > ctx->uc_bundle_size ?
+	     udp_bundle_flush(ctx) : 0;
+	if (rc == 0 && (!ctx->uc_split ||
+			hlen + len > ctx->uc_bundle_size / 2)) {
+		/* Large packets and parts of a stream go alone */
+		udp_bundle_hdr_put(buf - hlen, len);
+		++ctx->uc_bundle_dgrams;
+		rc = udp_dgram_send(ctx, udp_path_take(ctx, path),
+				    buf - hlen - ctx->uc_hdr_len,
+				    ctx->uc_hdr_len + hlen + len, zc);
+	} else if (rc == 0) {
+		if (ctx->uc_bundle_len == 0)
+			ctx->uc_bundle_deadline = pppoat_util_time_us() +
+						  ctx->uc_bundle_delay;
+		udp_bundle_hdr_put(bundle + ctx->uc_bundle_len, len);
+		ctx->uc_bundle_len += hlen;
+		memcpy(bundle + ctx->uc_bundle_len, buf, len);
+		ctx->uc_bundle_len += len;
+		if (ctx->uc_bundle_len + 1 >= ctx->uc_bundle_size ||
+		    ctx->uc_bundle_delay == 0)
+			rc = udp_bundle_flush(ctx);
+	}
+	return rc;
+}
+
+/*
+ * Sends whole IP packets of a read from TUN interface at buf + off, one per
+ * datagram. The incomplete packet at the end is kept for the next read.
+ * Packets after the first one are moved to uc_buf, otherwise datagram
+ * headers would overwrite the previous packet, which may be in flight
+ * with zerocopy.
+ */
+static int udp_split_send(struct pppoat_udp_ctx *ctx,
+			  struct udp_path       *path,
+			  unsigned char         *buf,
+			  size_t                 off,
+			  size_t                 len,
+			  bool                   zc)
+{
+	unsigned char *pkt = buf + off;
+	ssize_t        plen;
+	int            rc  = 0;
+
+	while (rc == 0 && len > 0) {
+		plen = pppoat_hub_pkt_len(pkt, len);
+		if (plen < 0 || (size_t)plen > UDP_DGRAM_MAX - off) {
+			/* Packet boundary is lost, drop everything */
+			++ctx->uc_split_bad;
+			len = 0;
+			break;
+		}
+		if (plen == 0 || (size_t)plen > len)
+			break;
+		if (pkt == buf + off) {
+			rc = udp_pkt_send(ctx, path, buf, plen, zc);
+		} else {
+			memmove(ctx->uc_buf + off, pkt, plen);
+			rc = udp_pkt_send(ctx, NULL, ctx->uc_buf, plen, false);
+		}
+		pkt += plen;
+		len -= plen;
+	}
+	memcpy(ctx->uc_split_buf, pkt, len);
+	ctx->uc_split_len = len;
+
+	return rc;
+}
+
+/* Writes packets of a received datagram payload to the interface. */
+static int udp_dgram_deliver(void *userdata, unsigned char *buf, size_t len)
+{
+	struct pppoat_udp_ctx *ctx = userdata;
+	size_t                 plen;
+	size_t                 hlen;
+	int                    rc = 0;
+
+	if (!ctx->uc_bundle)
+		return pppoat_util_write(ctx->uc_wr, buf, len);
+
+	while (rc == 0 && len > 0) {
+		hlen = udp_bundle_hdr_get(buf, len, &plen);
+		if (hlen == 0) {
+			++ctx->uc_bundle_bad;
+			break;
+		}
+		if (plen > 0)
+			rc = pppoat_util_write(ctx->uc_wr, buf + hlen, plen);
+		buf += hlen + plen;
+		len -= hlen + plen;
+	}
+	return rc;
+}
+
+static void udp_ping_send(struct pppoat_udp_ctx *ctx,
+			  struct udp_path       *path,
+			  uint64_t               now)
+{
+	unsigned char  buf[UDP_HDR_LEN + sizeof(now)];
+	struct udp_hdr hdr;
+
+	hdr.uh_type     = UDP_MSG_PING;
+	hdr.uh_path     = (uint8_t)(path - ctx->uc_paths);
+	hdr.uh_path_seq = 0;
+	hdr.uh_seq      = 0;
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + UDP_HDR_LEN, &now, sizeof(now));
+	/* Failure means the path is down, probing will tell */
+	(void)sendto(path->up_sock->us_fd, buf, sizeof(buf), 0,
+		     (struct sockaddr *)&path->up_addr, path->up_addrlen);
+}
+
+static int udp_ping_reply(struct pppoat_udp_ctx         *ctx,
+			  struct udp_sock               *us,
+			  const struct sockaddr_storage *from,
+			  socklen_t                      fromlen,
+			  unsigned char                 *buf,
+			  size_t                         len)
+{
+	struct pppoat_probe_rx *prx;
+	struct udp_pong         pong;
+	struct udp_hdr          hdr;
+	unsigned char           reply[UDP_HDR_LEN + sizeof(pong)];
+
+	if (len < UDP_HDR_LEN + sizeof(pong.upo_ts)) {
+		++ctx->uc_mp_bad;
+		return 0;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	memset(&pong, 0, sizeof(pong));
+	memcpy(&pong.upo_ts, buf + UDP_HDR_LEN, sizeof(pong.upo_ts));
+	if (ctx->uc_probe && hdr.uh_path < UDP_PATHS_MAX) {
+		prx = &ctx->uc_probe_rx[hdr.uh_path];
+		pong.upo_rx       = htonl(prx->prx_nr);
+		pong.upo_expected = htonl(prx->prx_expected);
+	}
+	hdr.uh_type = UDP_MSG_PONG;
+	memcpy(reply, &hdr, sizeof(hdr));
+	memcpy(reply + UDP_HDR_LEN, &pong, sizeof(pong));
+
+	return udp_buf_send(us->us_fd, from, fromlen, reply, sizeof(reply));
+}
+
+static void udp_pong_process(struct pppoat_udp_ctx *ctx,
+			     unsigned char         *buf,
+			     size_t                 len)
+{
+	struct udp_pong pong;
+	struct udp_hdr  hdr;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (!ctx->uc_probe || hdr.uh_path >= ctx->uc_paths_nr ||
+	    len < UDP_HDR_LEN + sizeof(pong)) {
+		++ctx->uc_mp_bad;
+		return;
+	}
+	memcpy(&pong, buf + UDP_HDR_LEN, sizeof(pong));
+	pppoat_probe_pong(&ctx->uc_paths[hdr.uh_path].up_probe, pong.upo_ts,
+			  ntohl(pong.upo_rx), ntohl(pong.upo_expected),
+			  pppoat_util_time_us());
+	udp_probe_usable_update(ctx);
+}
+
+static int udp_dgram_recv(struct pppoat_udp_ctx         *ctx,
+			  struct udp_sock               *us,
+			  const struct sockaddr_storage *from,
+			  socklen_t                      fromlen,
+			  unsigned char                 *buf,
+			  size_t                         len)
+{
+	struct udp_hdr hdr;
+
+	if (ctx->uc_hdr_len == 0)
+		return udp_dgram_deliver(ctx, buf, len);
+
+	if (len < UDP_HDR_LEN) {
+		++ctx->uc_mp_bad;
+		return 0;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	switch (hdr.uh_type) {
+	case UDP_MSG_DATA:
+		if (ctx->uc_probe && hdr.uh_path < UDP_PATHS_MAX)
+			pppoat_probe_rx(&ctx->uc_probe_rx[hdr.uh_path],
+					ntohs(hdr.uh_path_seq));
+		if (!ctx->uc_mp)
+			return udp_dgram_deliver(ctx, buf + UDP_HDR_LEN,
+						 len - UDP_HDR_LEN);
+		return pppoat_reorder_put(&ctx->uc_reorder, ntohl(hdr.uh_seq),
+					  buf + UDP_HDR_LEN,
+					  len - UDP_HDR_LEN,
+					  pppoat_util_time_us());
+	case UDP_MSG_PROBE:
+		/* Reply to the probe socket of the peer */
+		hdr.uh_type = UDP_MSG_PROBE_ACK;
+		return udp_buf_send(us->us_fd, from, fromlen,
+				    (unsigned char *)&hdr, sizeof(hdr));
+	case UDP_MSG_PING:
+		return udp_ping_reply(ctx, us, from, fromlen, buf, len);
+	case UDP_MSG_PONG:
+		udp_pong_process(ctx, buf, len);
+		return 0;
+	default:
+		++ctx->uc_mp_bad;
+		return 0;
+	}
+}
+
+/*
+ * Passes the smallest path MTU to the interface. Smaller values are
+ * applied at once, larger ones when the search completes on all paths.
+ */
+static void udp_pmtu_publish(struct pppoat_udp_ctx *ctx)
+{
+	struct pppoat_pmtu *pm;
+	size_t              mtu  = UDP_DGRAM_MAX;
+	bool                done = true;
+	unsigned int        i;
+	int                 rc;
+
+	for (i = 0; i < udp_paths_used(ctx); ++i) {
+		pm   = &ctx->uc_paths[i].up_pmtu;
+		mtu  = pppoat_min(mtu, pm->pm_mtu);
+		done = done && pm->pm_done;
+	}
+	mtu -= ctx->uc_hdr_len + (ctx->uc_bundle ? UDP_BUNDLE_HDR_MAX : 0);
+	if (mtu == ctx->uc_pmtu_mtu ||
+	    (!done && (ctx->uc_pmtu_mtu == 0 || mtu > ctx->uc_pmtu_mtu)))
+		return;
+
+	rc = pppoat_if_mtu_set(mtu);
+	pppoat_debug("udp", "Path MTU allows %zu byte packets (rc=%d)",
+		     mtu, rc);
+	ctx->uc_pmtu_mtu = mtu;
+}
+
+static void udp_pmtu_probe(struct pppoat_udp_ctx *ctx,
+			   struct udp_path       *path,
+			   uint64_t               now)
+{
+	struct udp_hdr hdr;
+	size_t         size;
+
+	size = pppoat_pmtu_probe(&path->up_pmtu, now);
+	if (size == 0)
+		return;
+
+	hdr.uh_type     = UDP_MSG_PROBE;
+	hdr.uh_path     = (uint8_t)(path - ctx->uc_paths);
+	hdr.uh_path_seq = 0;
+	hdr.uh_seq      = htonl(path->up_pmtu.pm_id);
+	memset(ctx->uc_buf, 0, size);
+	memcpy(ctx->uc_buf, &hdr, sizeof(hdr));
+	/* EMSGSIZE or a lost probe mean the same, the size doesn't fit */
+	(void)send(path->up_probe_fd, ctx->uc_buf, size, 0);
+}
+
+/* Handles probe acknowledgements. */
+static void udp_pmtu_process(struct pppoat_udp_ctx *ctx,
+			     struct udp_path       *path)
+{
+	struct udp_hdr hdr;
+	ssize_t        len;
+
+	while ((len = recv(path->up_probe_fd, &hdr, sizeof(hdr), 0)) >= 0) {
+		if (len == sizeof(hdr) && hdr.uh_type == UDP_MSG_PROBE_ACK)
+			pppoat_pmtu_ack(&path->up_pmtu, ntohl(hdr.uh_seq),
+					pppoat_util_time_us());
+	}
+	udp_pmtu_publish(ctx);
+}
+
+/* Earliest time when a timer expires or PPPOAT_TIME_NEVER */
+static uint64_t udp_deadline(struct pppoat_udp_ctx *ctx)
+{
+	uint64_t     deadline = PPPOAT_TIME_NEVER;
+	unsigned int i;
+
+	if (ctx->uc_bundle_len > 0)
+		deadline = ctx->uc_bundle_deadline;
+	if (ctx->uc_mp)
+		deadline = pppoat_min(deadline,
+				pppoat_reorder_deadline(&ctx->uc_reorder));
+	if (ctx->uc_hub)
+		deadline = pppoat_min(deadline,
+				pppoat_hub_deadline(&ctx->uc_hub_tbl));
+	for (i = 0; ctx->uc_pmtu && i < udp_paths_used(ctx); ++i)
+		deadline = pppoat_min(deadline,
+			pppoat_pmtu_deadline(&ctx->uc_paths[i].up_pmtu));
+	for (i = 0; ctx->uc_probe && i < udp_paths_used(ctx); ++i)
+		deadline = pppoat_min(deadline,
+			pppoat_probe_deadline(&ctx->uc_paths[i].up_probe));
+	if (ctx->uc_probe)
+		deadline = pppoat_min(deadline, ctx->uc_probe_report);
+	return deadline;
+}
+
+static int udp_timers_run(struct pppoat_udp_ctx *ctx)
+{
+	uint64_t     now = pppoat_util_time_us();
+	unsigned int i;
+	int          rc  = 0;
+
+	if (ctx->uc_bundle_len > 0 && now >= ctx->uc_bundle_deadline)
+		rc = udp_bundle_flush(ctx);
+	if (rc == 0 && ctx->uc_mp)
+		rc = pppoat_reorder_expire(&ctx->uc_reorder, now);
+	if (ctx->uc_hub)
+		pppoat_hub_expire(&ctx->uc_hub_tbl, now);
+	for (i = 0; ctx->uc_pmtu && i < udp_paths_used(ctx); ++i)
+		udp_pmtu_probe(ctx, &ctx->uc_paths[i], now);
+	if (ctx->uc_pmtu)
+		udp_pmtu_publish(ctx);
+	for (i = 0; ctx->uc_probe && i < udp_paths_used(ctx); ++i)
+		if (pppoat_probe_ping_due(&ctx->uc_paths[i].up_probe, now)) {
+			udp_ping_send(ctx, &ctx->uc_paths[i], now);
+			udp_probe_usable_update(ctx);
+		}
+	if (ctx->uc_probe && now >= ctx->uc_probe_report) {
+		udp_probe_report(ctx);
+		ctx->uc_probe_report = now + ctx->uc_stats_interval;
+	}
+	return rc;
+}
+
+static int udp_fds_set(struct pppoat_udp_ctx *ctx, int rd, fd_set *rfds)
+{
+	unsigned int i;
+	int          max = rd;
+
+	FD_ZERO(rfds);
+	FD_SET(rd, rfds);
+	for (i = 0; i < ctx->uc_socks_nr; ++i) {
+		FD_SET(ctx->uc_socks[i].us_fd, rfds);
+		max = pppoat_max(max, ctx->uc_socks[i].us_fd);
+	}
+	for (i = 0; ctx->uc_pmtu && i < udp_paths_used(ctx); ++i) {
+		FD_SET(ctx->uc_paths[i].up_probe_fd, rfds);
+		max = pppoat_max(max, ctx->uc_paths[i].up_probe_fd);
+	}
+	return max;
+}
+
+/*
+ * Waits for the descriptors to become readable. In low-latency mode polls
+ * without sleeping for uc_spin_us before falling back to blocking wait, so
+ * a packet arriving soon after the previous one doesn't pay for a wakeup.
+ * Returns 0 when the nearest timer expires.
+ */
+static int udp_wait(struct pppoat_udp_ctx *ctx, int rd, fd_set *rfds)
+{
+	uint64_t deadline = udp_deadline(ctx);
+	uint64_t now      = pppoat_util_time_us();
+	uint64_t spin_end;
+	int      max;
+	int      rc;
+
+	if (ctx->uc_spin_us > 0) {
+		spin_end = pppoat_min(now + ctx->uc_spin_us, deadline);
+		do {
+			max = udp_fds_set(ctx, rd, rfds);
+			rc  = pppoat_util_select_timed(max, rfds, NULL, 0);
+			if (rc != 0)
+				return rc;
+			now = pppoat_util_time_us();
+		} while (now < spin_end);
+	}
+	max = udp_fds_set(ctx, rd, rfds);
+
+	return deadline == PPPOAT_TIME_NEVER ?
+	       pppoat_util_select(max, rfds, NULL) :
+	       pppoat_util_select_timed(max, rfds, NULL,
+					deadline > now ? deadline - now : 0);
+}
+
+/*
+ * recvfrom(2) which also returns kernel receive timestamp if enabled.
+ * On input *fromlen is size of from.
+ */
+static ssize_t udp_recv(struct pppoat_udp_ctx   *ctx,
+			struct udp_sock         *us,
+			unsigned char           *buf,
+			size_t                   size,
+			struct sockaddr_storage *from,
+			socklen_t               *fromlen,
+			struct timespec         *ts)
+{
+	struct cmsghdr *cm;
+	struct msghdr   msg;
+	struct iovec    iov;
+	unsigned char   control[CMSG_SPACE(sizeof(*ts))];
+	ssize_t         len;
+
+	ts->tv_sec  = 0;
+	ts->tv_nsec = 0;
+	if (!ctx->uc_stats)
+		return recvfrom(us->us_fd, buf, size, 0,
+				(struct sockaddr *)from, fromlen);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base       = buf;
+	iov.iov_len        = size;
+	msg.msg_name       = from;
+	msg.msg_namelen    = *fromlen;
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control;
+	msg.msg_controllen = sizeof(control);
+	len = recvmsg(us->us_fd, &msg, 0);
+	*fromlen = msg.msg_namelen;
+#ifdef SCM_TIMESTAMPNS
+	for (cm = len < 0 ? NULL : CMSG_FIRSTHDR(&msg); cm != NULL;
+	     cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET &&
+		    cm->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(ts, CMSG_DATA(cm), sizeof(*ts));
+	}
+#else /* SCM_TIMESTAMPNS */
+	(void)cm;
+#endif /* SCM_TIMESTAMPNS */
+	return len;
+}
+
+static void udp_stats_update(struct pppoat_udp_ctx *ctx,
+			     const struct timespec *ts)
+{
+	struct timespec now;
+	int64_t         usec;
+	uint64_t        mono;
+
+	if (ts->tv_sec == 0 && ts->tv_nsec == 0)
+		return;
+
+	/* Kernel timestamps use CLOCK_REALTIME */
+	(void)clock_gettime(CLOCK_REALTIME, &now);
+	usec = (int64_t)(now.tv_sec - ts->tv_sec) * 1000000 +
+	       (now.tv_nsec - ts->tv_nsec) / 1000;
+	pppoat_hist_add(&ctx->uc_lat, usec < 0 ? 0 : (uint64_t)usec);
+
+	mono = pppoat_util_time_us();
+	if (ctx->uc_stats_interval > 0 &&
+	    mono - ctx->uc_stats_last >= ctx->uc_stats_interval) {
+		udp_stats_print(ctx);
+		pppoat_hist_init(&ctx->uc_lat);
+		ctx->uc_stats_last = mono;
+	}
+}
+
+static void udp_hub_send(struct pppoat_udp_ctx  *ctx,
+			 struct pppoat_hub_sess *sess,
+			 unsigned char          *buf,
+			 size_t                  len)
+{
+	int rc;
+
+	++sess->hs_tx;
+	/* A failing client must not stop the hub */
+	rc = udp_buf_send(ctx->uc_socks[0].us_fd, &sess->hs_addr,
+			  sess->hs_addrlen, buf, len);
+	if (rc != 0)
+		++ctx->uc_hub_tx_err;
+}
+
+/* Forwards a frame from a client or from the interface (from is NULL). */
+static int udp_switch_fwd(struct pppoat_udp_ctx  *ctx,
+			  struct pppoat_hub_sess *from,
+			  unsigned char          *frame,
+			  size_t                  len,
+			  uint64_t                now)
+{
+	struct pppoat_hub      *hub = &ctx->uc_hub_tbl;
+	struct pppoat_hub_sess *sess;
+
+	switch (pppoat_hub_switch(hub, from, frame, len, now, &sess)) {
+	case PPPOAT_HUB_FWD_IF:
+		return pppoat_util_write(ctx->uc_wr, frame, len);
+	case PPPOAT_HUB_FWD_SESS:
+		udp_hub_send(ctx, sess, frame, len);
+		return 0;
+	case PPPOAT_HUB_FWD_FLOOD:
+		for (sess = pppoat_hub_sess_next(hub, NULL); sess != NULL;
+		     sess = pppoat_hub_sess_next(hub, sess))
+			if (sess != from)
+				udp_hub_send(ctx, sess, frame, len);
+		return from == NULL ? 0 :
+		       pppoat_util_write(ctx->uc_wr, frame, len);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Passes frames of a datagram from a client to their destinations. The
+ * datagram is dropped unless it splits into frames exactly, nothing is
+ * learned from frames with unknown boundaries.
+ */
+static int udp_switch_recv(struct pppoat_udp_ctx         *ctx,
+			   const struct sockaddr_storage *from,
+			   socklen_t                      fromlen,
+			   unsigned char                 *buf,
+			   size_t                         len)
+{
+	struct pppoat_hub_sess *sess;
+	uint64_t                now = pppoat_util_time_us();
+	ssize_t                 flen;
+	size_t                  off;
+	int                     rc  = 0;
+
+	for (off = 0; off < len; off += flen) {
+		flen = pppoat_hub_frame_len(buf + off, len - off);
+		if (flen <= 0 || (size_t)flen > len - off) {
+			++ctx->uc_hub_bad;
+			return 0;
+		}
+	}
+	sess = pppoat_hub_sess_get(&ctx->uc_hub_tbl,
+				   (const struct sockaddr *)from, fromlen, now);
+	if (sess == NULL)
+		return 0;
+
+	++sess->hs_rx;
+	for (off = 0; rc == 0 && off < len; off += flen) {
+		flen = pppoat_hub_frame_len(buf + off, len - off);
+		rc = udp_switch_fwd(ctx, sess, buf + off, flen, now);
+	}
+	return rc;
+}
+
+/* Passes packet from a client to the interface. */
+static int udp_hub_recv(struct pppoat_udp_ctx         *ctx,
+			const struct sockaddr_storage *from,
+			socklen_t                      fromlen,
+			unsigned char                 *buf,
+			size_t                         len)
+{
+	struct pppoat_hub_sess *sess;
+	int                     rc;
+
+	if (ctx->uc_hub_tbl.hub_switch)
+		return udp_switch_recv(ctx, from, fromlen, buf, len);
+	/* Don't let garbage create sessions */
+	if (pppoat_hub_pkt_len(buf, len) != (ssize_t)len) {
+		++ctx->uc_hub_bad;
+		return 0;
+	}
+	sess = pppoat_hub_sess_get(&ctx->uc_hub_tbl,
+				   (const struct sockaddr *)from, fromlen,
+				   pppoat_util_time_us());
+	if (sess == NULL)
+		return 0;
+
+	++sess->hs_rx;
+	rc = pppoat_hub_learn(&ctx->uc_hub_tbl, sess, buf, len);
+	if (rc == -EACCES)
+		return 0;
+
+	return rc ?: pppoat_util_write(ctx->uc_wr, buf, len);
+}
+
+/*
+ * Routes packets from the interface to clients. A read may end in the
+ * middle of a packet, the tail is kept in uc_hub_buf for the next read.
+ */
+static int udp_hub_read(struct pppoat_udp_ctx *ctx, int rd)
+{
+	struct pppoat_hub      *hub = &ctx->uc_hub_tbl;
+	struct pppoat_hub_sess *sess;
+	unsigned char          *buf = ctx->uc_hub_buf;
+	uint64_t                now = pppoat_util_time_us();
+	ssize_t                 plen;
+	ssize_t                 len;
+	size_t                  off = 0;
+	int                     rc  = 0;
+
+	len = read(rd, buf + ctx->uc_hub_len, UDP_BUF_SIZE - ctx->uc_hub_len);
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	if (len < 0)
+		return udp_error_is_recoverable(-errno) ? 0 : P_ERR(-errno);
+	ctx->uc_hub_len += len;
+
+	while (rc == 0 && off < ctx->uc_hub_len) {
+		plen = hub->hub_switch ?
+		       pppoat_hub_frame_len(buf + off, ctx->uc_hub_len - off) :
+		       pppoat_hub_pkt_len(buf + off, ctx->uc_hub_len - off);
+		if (plen < 0 || plen > UDP_DGRAM_MAX) {
+			/* Packet boundary is lost, drop everything */
+			++ctx->uc_hub_bad;
+			off = ctx->uc_hub_len;
+			break;
+		}
+		if (plen == 0 || (size_t)plen > ctx->uc_hub_len - off)
+			break;
+		if (hub->hub_switch) {
+			rc = udp_switch_fwd(ctx, NULL, buf + off, plen, now);
+		} else {
+			sess = pppoat_hub_route(hub, buf + off, plen);
+			if (sess != NULL)
+				udp_hub_send(ctx, sess, buf + off, plen);
+		}
+		off += plen;
+	}
+	ctx->uc_hub_len -= off;
+	memmove(buf, buf + off, ctx->uc_hub_len);
+
+	return rc;
+}
+
+static int udp_sock_process(struct pppoat_udp_ctx *ctx, struct udp_sock *us)
+{
+	struct sockaddr_storage  from;
+	socklen_t                fromlen = sizeof(from);
+	unsigned char           *buf     = ctx->uc_buf;
+	struct timespec          ts;
+	ssize_t                  len;
+	int                      rc      = 0;
+
+	if (ctx->uc_zc)
+		rc = udp_zc_reap(ctx, us);
+	if (rc == 0) {
+		len = udp_recv(ctx, us, buf, UDP_BUF_SIZE, &from, &fromlen,
+			       &ts);
+		if (len < 0 && !udp_error_is_recoverable(-errno))
+			rc = P_ERR(-errno);
+		if (len > 0) {
+			++us->us_rx;
+			rc = ctx->uc_hub ?
+			     udp_hub_recv(ctx, &from, fromlen, buf, (size_t)len) :
+			     udp_dgram_recv(ctx, us, &from, fromlen, buf,
+					    (size_t)len);
+		}
+		if (len > 0 && rc == 0 && ctx->uc_stats)
+			udp_stats_update(ctx, &ts);
+	}
+	return rc;
+}
+
 static int module_udp_run(int rd, int wr, int ctrl, void *userdata)
 {
 	struct pppoat_udp_ctx *ctx = userdata;
-	unsigned char          buf[4096]; /* XXX allocate during init */
+	struct udp_path       *path;
+	unsigned char         *buf;
+	unsigned char         *zc_buf;
 	ssize_t                len;
 	fd_set                 rfds;
-	int                    sock = ctx->uc_sock;
-	int                    max;
+	size_t                 off;
+	size_t                 tail;
+	unsigned int           i;
 	int                    rc = 0;
 
-	rc = pppoat_util_fd_nonblock_set(rd,   true)
-	  ?: pppoat_util_fd_nonblock_set(sock, true);
+	off = ctx->uc_hdr_len + (ctx->uc_bundle ? UDP_BUNDLE_HDR_MAX : 0);
+	ctx->uc_wr = wr;
+
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	for (i = 0; rc == 0 && i < ctx->uc_socks_nr; ++i)
+		rc = pppoat_util_fd_nonblock_set(ctx->uc_socks[i].us_fd, true);
 
 	while (rc == 0) {
-		FD_ZERO(&rfds);
-		FD_SET(rd,   &rfds);
-		FD_SET(sock, &rfds);
-		max = pppoat_max(rd, sock);
-		rc  = pppoat_util_select(max, &rfds, NULL);
-		rc  = rc > 0 ? 0 : rc;
-
-		if (FD_ISSET(rd, &rfds)) {
-			len = read(rd, buf, sizeof(buf));
+		rc = udp_wait(ctx, rd, &rfds);
+		rc = rc > 0 ? 0 : rc;
+
+		if (rc == 0 && ctx->uc_hub && FD_ISSET(rd, &rfds)) {
+			rc = udp_hub_read(ctx, rd);
+		} else if (rc == 0 && FD_ISSET(rd, &rfds)) {
+			/*
+			 * Read straight into a pool buffer when zerocopy is
+			 * possible, so large packets are never copied.
+			 */
+			path   = ctx->uc_zc ? udp_path_peek(ctx) : NULL;
+			zc_buf = path == NULL ? NULL :
+				 udp_zc_buf_get(ctx, path->up_sock);
+			buf    = zc_buf ?: ctx->uc_buf;
+			tail   = ctx->uc_split ? ctx->uc_split_len : 0;
+			if (tail > 0)
+				memcpy(buf + off, ctx->uc_split_buf, tail);
+			len = read(rd, buf + off + tail,
+				   UDP_DGRAM_MAX - off - tail);
 			if (len == 0)
 				rc = P_ERR(-EPIPE);
 			if (len < 0 && !udp_error_is_recoverable(-errno))
 				rc = P_ERR(-errno);
-			if (len > 0)
-				rc = udp_buf_send(ctx, buf, len);
-		}
-		if (rc == 0 && FD_ISSET(sock, &rfds)) {
-			/* XXX use recvfrom() */
-			len = recv(sock, buf, sizeof(buf), 0);
-			if (len < 0 && !udp_error_is_recoverable(-errno))
-				rc = P_ERR(-errno);
-			if (len > 0)
-				rc = pppoat_util_write(wr, buf, (size_t)len);
+			if (len > 0 && ctx->uc_split)
+				rc = udp_split_send(ctx, path, buf, off,
+						    tail + (size_t)len,
+						    zc_buf != NULL);
+			else if (len > 0)
+				rc = udp_pkt_send(ctx, path, buf, (size_t)len,
+						  zc_buf != NULL);
 		}
+		for (i = 0; rc == 0 && i < ctx->uc_socks_nr; ++i)
+			if (FD_ISSET(ctx->uc_socks[i].us_fd, &rfds))
+				rc = udp_sock_process(ctx, &ctx->uc_socks[i]);
+		for (i = 0; rc == 0 && ctx->uc_pmtu &&
+			    i < udp_paths_used(ctx); ++i)
+			if (FD_ISSET(ctx->uc_paths[i].up_probe_fd, &rfds))
+				udp_pmtu_process(ctx, &ctx->uc_paths[i]);
+		rc = rc ?: udp_timers_run(ctx);
 	}
 	return rc;
 }
@@ -0,0 +1,1229 @@
+/* ws.c
+ * PPP over Any Transport -- WebSocket/HTTP transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/ws.h"
+#include "base64.h"
+#include "conf.h"
+#include "http.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "util.h"
+#include "websocket.h"
+
+/*
+ * Every read from the interface becomes a binary WebSocket frame. The
+ * client upgrades one HTTP/1.1 connection to WebSocket. Where a proxy
+ * refuses the upgrade, the client falls back to two plain HTTP requests
+ * per direction: a POST with a chunked body carries frames up and a GET
+ * answered with a chunked body carries them down. Both are ended after
+ * ws.poll bytes (the response also after WS_POLL_TIME) and reissued on
+ * the same connection, so proxies which buffer whole messages still
+ * forward the stream. The server accepts either way.
+ *
+ * Request heads are built once per session. A frame is read from the
+ * interface right after room for its headers in the output buffer, the
+ * headers are written in front of it and the client masks the payload
+ * in place.
+ */
+
+#define WS_PORT_DEFAULT 80
+#define WS_PATH_DEFAULT "/pppoat"
+
+#define WS_FRAME_MAX 16384
+/* Chunk header, WebSocket header with 16-bit length and mask */
+#define WS_FRAME_HDR (PPPOAT_HTTP_CHUNK_HDR_LEN + 4 + 4)
+/* Headers and the CRLF which ends the chunk */
+#define WS_FRAME_OVERHEAD (WS_FRAME_HDR + 2)
+#define WS_OUT_SIZE (256 << 10)
+#define WS_IN_SIZE  (64 << 10)
+
+/* Server: WebSocket or both polling requests plus connections to classify */
+#define WS_CONNS 6
+
+#define WS_POLL_DEFAULT (1 << 20)
+/* A response ends at least this often, proxies time out idle ones */
+#define WS_POLL_TIME    20000000
+
+/* Client retries with exponential backoff */
+#define WS_RECONNECT_DEFAULT 1000
+#define WS_RECONNECT_MAX     30000000
+
+/* Dead peers are detected within 10 + 3 * 5 seconds */
+#define WS_KA_IDLE  10
+#define WS_KA_INTVL 5
+#define WS_KA_CNT   3
+
+typedef enum {
+	WS_MODE_AUTO,
+	WS_MODE_WS,
+	WS_MODE_HTTP,
+} ws_mode_t;
+
+typedef enum {
+	/* Server: the request isn't received yet */
+	WS_ROLE_NONE,
+	WS_ROLE_WS,
+	/* POST requests, client to server */
+	WS_ROLE_UP,
+	/* Responses to GET requests, server to client */
+	WS_ROLE_DOWN,
+} ws_role_t;
+
+typedef enum {
+	WS_CONN_CLOSED,
+	WS_CONN_CONNECTING,
+	/* Waiting for a request or response head */
+	WS_CONN_HEAD,
+	/* Frames flow */
+	WS_CONN_OPEN,
+} ws_conn_state_t;
+
+struct pppoat_ws_ctx;
+
+struct ws_conn {
+	struct pppoat_ws_ctx       *wn_ctx;
+	int                         wn_sock;
+	ws_conn_state_t             wn_state;
+	ws_role_t                   wn_role;
+	/* Close when the output is sent, after an error response */
+	bool                        wn_closing;
+	unsigned char              *wn_out;
+	size_t                      wn_out_off;
+	size_t                      wn_out_len;
+	unsigned char              *wn_in;
+	size_t                      wn_in_len;
+	struct pppoat_ws_parser     wn_parser;
+	struct pppoat_http_chunked  wn_chunked;
+	/* Bytes of the current body */
+	uint64_t                    wn_body;
+	/* Start of the current response */
+	uint64_t                    wn_start;
+	char                        wn_key[PPPOAT_WS_KEY_LEN + 1];
+};
+
+struct pppoat_ws_ctx {
+	pppoat_node_type_t  wc_type;
+	struct addrinfo    *wc_ainfo;
+	int                 wc_lsock;
+	struct ws_conn      wc_conns[WS_CONNS];
+	ws_mode_t           wc_mode;
+	/* Auto mode found the upgrade refused */
+	bool                wc_http;
+	/* Reconnect without delay, to fall back */
+	bool                wc_retry_now;
+	/* Polling session, ties the requests of a client together */
+	uint64_t            wc_sid;
+	uint64_t            wc_poll;
+	char               *wc_path;
+	/* Request target, absolute when it goes to a proxy */
+	char               *wc_target;
+	char               *wc_host;
+	char               *wc_req_ws;
+	char               *wc_req_post;
+	char               *wc_req_get;
+	size_t              wc_req_ws_len;
+	size_t              wc_req_post_len;
+	size_t              wc_req_get_len;
+	bool                wc_session;
+	/* The session has carried data since it was started */
+	bool                wc_connected;
+	uint64_t            wc_retry;
+	uint64_t            wc_backoff;
+	uint64_t            wc_reconnect;
+	/* Mask keys */
+	uint64_t            wc_rand;
+	int                 wc_wr;
+	/* Error of the interface pipe, stops the module */
+	int                 wc_fatal;
+	/* Counters */
+	unsigned long       wc_connects;
+	unsigned long       wc_fallbacks;
+	unsigned long       wc_frames;
+	unsigned long       wc_polls;
+	unsigned long       wc_dropped;
+};
+
+static const char ws_resp_down[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Cache-Control: no-store\r\n"
+	"Transfer-Encoding: chunked\r\n\r\n";
+static const char ws_resp_post[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Length: 0\r\n\r\n";
+static const char ws_resp_bad[] =
+	"HTTP/1.1 400 Bad Request\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n\r\n";
+static const char ws_resp_notfound[] =
+	"HTTP/1.1 404 Not Found\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n\r\n";
+static const char ws_chunk_last[] = "0\r\n\r\n";
+
+/* xorshift64*, seeded from getrandom() */
+static uint64_t ws_rand(struct pppoat_ws_ctx *ctx)
+{
+	ctx->wc_rand ^= ctx->wc_rand >> 12;
+	ctx->wc_rand ^= ctx->wc_rand << 25;
+	ctx->wc_rand ^= ctx->wc_rand >> 27;
+	return ctx->wc_rand * 0x2545f4914f6cdd1dULL;
+}
+
+static int ws_setsockopt_int(int sock, int level, int name, int val)
+{
+	int rc;
+
+	rc = setsockopt(sock, level, name, &val, sizeof(val));
+	return rc != 0 ? P_ERR(-errno) : 0;
+}
+
+static int ws_sock_setup(int sock)
+{
+	int rc;
+
+	rc = pppoat_util_fd_nonblock_set(sock, true);
+	rc = rc ?: ws_setsockopt_int(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+	rc = rc ?: ws_setsockopt_int(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+	rc = rc ?: ws_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPIDLE,
+				     WS_KA_IDLE);
+	rc = rc ?: ws_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+				     WS_KA_INTVL);
+	rc = rc ?: ws_setsockopt_int(sock, IPPROTO_TCP, TCP_KEEPCNT,
+				     WS_KA_CNT);
+	return rc;
+}
+
+static bool ws_conn_is_open(const struct ws_conn *conn)
+{
+	return conn->wn_state != WS_CONN_CLOSED;
+}
+
+static void ws_conn_close(struct ws_conn *conn)
+{
+	if (!ws_conn_is_open(conn))
+		return;
+	(void)close(conn->wn_sock);
+	conn->wn_sock    = -1;
+	conn->wn_state   = WS_CONN_CLOSED;
+	conn->wn_role    = WS_ROLE_NONE;
+	conn->wn_closing = false;
+	conn->wn_ctx->wc_dropped += conn->wn_out_len > 0;
+	conn->wn_out_off = 0;
+	conn->wn_out_len = 0;
+	conn->wn_in_len  = 0;
+}
+
+static struct ws_conn *ws_conn_find(struct pppoat_ws_ctx *ctx,
+				    ws_role_t             role)
+{
+	int i;
+
+	for (i = 0; i < WS_CONNS; ++i) {
+		if (ws_conn_is_open(&ctx->wc_conns[i]) &&
+		    ctx->wc_conns[i].wn_role == role)
+			return &ctx->wc_conns[i];
+	}
+	return NULL;
+}
+
+/* Room for len more bytes of output, pending output moves to the front. */
+static unsigned char *ws_out_room(struct ws_conn *conn, size_t len)
+{
+	if (conn->wn_out_off + conn->wn_out_len + len > WS_OUT_SIZE &&
+	    conn->wn_out_off > 0) {
+		memmove(conn->wn_out, conn->wn_out + conn->wn_out_off,
+			conn->wn_out_len);
+		conn->wn_out_off = 0;
+	}
+	if (conn->wn_out_off + conn->wn_out_len + len > WS_OUT_SIZE)
+		return NULL;
+	return conn->wn_out + conn->wn_out_off + conn->wn_out_len;
+}
+
+static int ws_out_append(struct ws_conn *conn, const void *buf, size_t len)
+{
+	unsigned char *p = ws_out_room(conn, len);
+
+	if (p == NULL)
+		return P_ERR(-ENOBUFS);
+	memcpy(p, buf, len);
+	conn->wn_out_len += len;
+	return 0;
+}
+
+static void ws_session_end(struct pppoat_ws_ctx *ctx, int error);
+
+/* Client drops the whole session, server only the connection. */
+static void ws_conn_fail(struct ws_conn *conn, int error)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+
+	if (ctx->wc_type == PPPOAT_NODE_SLAVE) {
+		ws_session_end(ctx, error);
+		return;
+	}
+	if (conn->wn_role != WS_ROLE_NONE)
+		pppoat_info("ws", "Connection closed, error=%d", error);
+	ws_conn_close(conn);
+}
+
+static void ws_conn_flush(struct ws_conn *conn)
+{
+	ssize_t len;
+
+	len = send(conn->wn_sock, conn->wn_out + conn->wn_out_off,
+		   conn->wn_out_len, MSG_NOSIGNAL);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len < 0) {
+		ws_conn_fail(conn, -errno);
+		return;
+	}
+	conn->wn_out_off += len;
+	conn->wn_out_len -= len;
+	if (conn->wn_out_len == 0)
+		conn->wn_out_off = 0;
+	if (conn->wn_out_len == 0 && conn->wn_closing)
+		ws_conn_close(conn);
+}
+
+static int ws_head_build(char **head, size_t *len, const char *fmt, ...)
+{
+	va_list ap;
+	int     rc;
+
+	free(*head);
+	va_start(ap, fmt);
+	rc = vasprintf(head, fmt, ap);
+	va_end(ap);
+	if (rc < 0) {
+		*head = NULL;
+		return P_ERR(-ENOMEM);
+	}
+	*len = rc;
+	return 0;
+}
+
+/* Builds the heads of the client's requests for a new session. */
+static int ws_heads_build(struct pppoat_ws_ctx *ctx)
+{
+	unsigned long long sid = ctx->wc_sid;
+	int                rc;
+
+	/* The key line and the empty line follow */
+	rc = ws_head_build(&ctx->wc_req_ws, &ctx->wc_req_ws_len,
+			   "GET %s HTTP/1.1\r\n"
+			   "Host: %s\r\n"
+			   "Upgrade: websocket\r\n"
+			   "Connection: Upgrade\r\n"
+			   "Sec-WebSocket-Version: 13\r\n",
+			   ctx->wc_target, ctx->wc_host);
+	rc = rc ?: ws_head_build(&ctx->wc_req_post, &ctx->wc_req_post_len,
+				 "POST %s?sid=%016llx HTTP/1.1\r\n"
+				 "Host: %s\r\n"
+				 "Content-Type: application/octet-stream\r\n"
+				 "Transfer-Encoding: chunked\r\n\r\n",
+				 ctx->wc_target, sid, ctx->wc_host);
+	rc = rc ?: ws_head_build(&ctx->wc_req_get, &ctx->wc_req_get_len,
+				 "GET %s?sid=%016llx HTTP/1.1\r\n"
+				 "Host: %s\r\n"
+				 "Cache-Control: no-store\r\n\r\n",
+				 ctx->wc_target, sid, ctx->wc_host);
+	return rc;
+}
+
+static int ws_conn_connect(struct pppoat_ws_ctx *ctx, ws_role_t role)
+{
+	struct addrinfo *ai   = ctx->wc_ainfo;
+	struct ws_conn  *conn = ws_conn_find(ctx, WS_ROLE_NONE);
+	int              i;
+	int              rc;
+
+	for (i = 0; conn == NULL && i < WS_CONNS; ++i)
+		if (!ws_conn_is_open(&ctx->wc_conns[i]))
+			conn = &ctx->wc_conns[i];
+	PPPOAT_ASSERT(conn != NULL && !ws_conn_is_open(conn));
+
+	conn->wn_sock = socket(ai->ai_family, ai->ai_socktype,
+			       ai->ai_protocol);
+	if (conn->wn_sock < 0)
+		return -errno;
+	conn->wn_state = WS_CONN_CONNECTING;
+	conn->wn_role  = role;
+	rc = ws_sock_setup(conn->wn_sock);
+	if (rc == 0 && connect(conn->wn_sock, ai->ai_addr, ai->ai_addrlen) != 0)
+		rc = errno == EINPROGRESS ? 0 : -errno;
+	return rc;
+}
+
+/* Client opens a WebSocket connection or the pair of polling ones. */
+static int ws_session_start(struct pppoat_ws_ctx *ctx)
+{
+	bool http = ctx->wc_mode == WS_MODE_HTTP || ctx->wc_http;
+	int  rc;
+
+	ctx->wc_sid = ws_rand(ctx);
+	rc = ws_heads_build(ctx);
+	if (rc != 0)
+		return rc;
+	ctx->wc_session   = true;
+	ctx->wc_connected = false;
+	rc = ws_conn_connect(ctx, http ? WS_ROLE_UP : WS_ROLE_WS);
+	if (rc == 0 && http)
+		rc = ws_conn_connect(ctx, WS_ROLE_DOWN);
+	if (rc != 0)
+		ws_session_end(ctx, rc);
+	return 0;
+}
+
+static void ws_session_end(struct pppoat_ws_ctx *ctx, int error)
+{
+	uint64_t now = pppoat_util_time_us();
+	int      i;
+
+	if (!ctx->wc_session)
+		return;
+	for (i = 0; i < WS_CONNS; ++i)
+		ws_conn_close(&ctx->wc_conns[i]);
+	ctx->wc_session = false;
+	pppoat_info("ws", "Disconnected, error=%d", error);
+	/* A refused upgrade is retried as polling right away */
+	if (ctx->wc_retry_now) {
+		ctx->wc_retry_now = false;
+		ctx->wc_retry     = now;
+		return;
+	}
+	ctx->wc_retry   = now + ctx->wc_backoff;
+	ctx->wc_backoff = pppoat_min(ctx->wc_backoff * 2, WS_RECONNECT_MAX);
+}
+
+static void ws_connected(struct pppoat_ws_ctx *ctx, const char *how)
+{
+	ctx->wc_backoff   = ctx->wc_reconnect;
+	ctx->wc_connected = true;
+	++ctx->wc_connects;
+	pppoat_info("ws", "Connected (%s)", how);
+}
+
+/* Client sends the request once the connection is established. */
+static void ws_conn_request(struct ws_conn *conn)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+	unsigned char         key[16];
+	char                  line[64];
+	int                   rc  = 0;
+
+	switch (conn->wn_role) {
+	case WS_ROLE_WS:
+		if (getrandom(key, sizeof(key), 0) != sizeof(key))
+			rc = P_ERR(-errno);
+		pppoat_base64_enc(key, sizeof(key), conn->wn_key,
+				  PPPOAT_WS_KEY_LEN);
+		conn->wn_key[PPPOAT_WS_KEY_LEN] = '\0';
+		snprintf(line, sizeof(line), "Sec-WebSocket-Key: %s\r\n\r\n",
+			 conn->wn_key);
+		rc = rc ?: ws_out_append(conn, ctx->wc_req_ws,
+					 ctx->wc_req_ws_len);
+		rc = rc ?: ws_out_append(conn, line, strlen(line));
+		conn->wn_state = WS_CONN_HEAD;
+		break;
+	case WS_ROLE_UP:
+		/* The body starts right away, responses come later */
+		rc = ws_out_append(conn, ctx->wc_req_post,
+				   ctx->wc_req_post_len);
+		conn->wn_state = WS_CONN_OPEN;
+		conn->wn_body  = 0;
+		break;
+	case WS_ROLE_DOWN:
+		rc = ws_out_append(conn, ctx->wc_req_get, ctx->wc_req_get_len);
+		conn->wn_state = WS_CONN_HEAD;
+		break;
+	default:
+		PPPOAT_ASSERT(0);
+	}
+	if (rc != 0)
+		ws_conn_fail(conn, rc);
+	else
+		ws_conn_flush(conn);
+}
+
+static void ws_connect_finish(struct ws_conn *conn)
+{
+	socklen_t len = sizeof(int);
+	int       error;
+	int       rc;
+
+	rc = getsockopt(conn->wn_sock, SOL_SOCKET, SO_ERROR, &error, &len);
+	error = rc != 0 ? errno : error;
+	if (error == 0)
+		ws_conn_request(conn);
+	else
+		ws_conn_fail(conn, -error);
+}
+
+static int ws_accept(struct pppoat_ws_ctx *ctx)
+{
+	struct ws_conn *conn = NULL;
+	int             sock;
+	int             i;
+
+	sock = accept(ctx->wc_lsock, NULL, NULL);
+	if (sock < 0)
+		return errno == EAGAIN || errno == EINTR ||
+		       errno == ECONNABORTED ? 0 : P_ERR(-errno);
+	for (i = 0; conn == NULL && i < WS_CONNS; ++i)
+		if (!ws_conn_is_open(&ctx->wc_conns[i]))
+			conn = &ctx->wc_conns[i];
+	if (conn == NULL || ws_sock_setup(sock) != 0) {
+		(void)close(sock);
+		return 0;
+	}
+	conn->wn_sock  = sock;
+	conn->wn_state = WS_CONN_HEAD;
+	conn->wn_role  = WS_ROLE_NONE;
+	return 0;
+}
+
+/* Passes payload to the interface and answers control frames. */
+static int ws_deliver(void          *userdata,
+		      unsigned int   opcode,
+		      unsigned char *data,
+		      size_t         len)
+{
+	struct ws_conn        *conn = userdata;
+	struct pppoat_ws_ctx  *ctx  = conn->wn_ctx;
+	unsigned char          frame[PPPOAT_WS_HDR_MAX + PPPOAT_WS_CTL_MAX];
+	unsigned char          mask[4];
+	uint64_t               r;
+	size_t                 hlen;
+	int                    rc   = 0;
+
+	switch (opcode) {
+	case PPPOAT_WS_BINARY:
+		rc = pppoat_util_write(ctx->wc_wr, data, len);
+		ctx->wc_fatal = rc;
+		break;
+	case PPPOAT_WS_PING:
+		if (conn->wn_role != WS_ROLE_WS)
+			break;
+		r = ws_rand(ctx);
+		memcpy(mask, &r, sizeof(mask));
+		memcpy(frame + PPPOAT_WS_HDR_MAX, data, len);
+		hlen = pppoat_ws_hdr(frame + PPPOAT_WS_HDR_MAX, PPPOAT_WS_PONG,
+				     len, ctx->wc_type == PPPOAT_NODE_SLAVE ?
+					  mask : NULL);
+		if (ctx->wc_type == PPPOAT_NODE_SLAVE)
+			pppoat_ws_mask(frame + PPPOAT_WS_HDR_MAX, len, mask, 0);
+		/* A pong which doesn't fit is lost, the peer pings again */
+		(void)ws_out_append(conn, frame + PPPOAT_WS_HDR_MAX - hlen,
+				    hlen + len);
+		break;
+	case PPPOAT_WS_CLOSE:
+		rc = -ECONNRESET;
+		break;
+	}
+	return rc;
+}
+
+static int ws_chunk_deliver(void *userdata, unsigned char *data, size_t len)
+{
+	struct ws_conn *conn = userdata;
+
+	return pppoat_ws_parse(&conn->wn_parser, data, len, &ws_deliver,
+			       conn);
+}
+
+static uint64_t ws_query_sid(const char *target)
+{
+	const char *sid = strstr(target, "?sid=");
+
+	return sid == NULL ? 0 : strtoull(sid + 5, NULL, 16);
+}
+
+/* A request of a new polling session replaces the old connections. */
+static void ws_session_claim(struct pppoat_ws_ctx *ctx,
+			     struct ws_conn       *conn,
+			     uint64_t              sid)
+{
+	struct ws_conn *other;
+	int             i;
+
+	for (i = 0; i < WS_CONNS; ++i) {
+		other = &ctx->wc_conns[i];
+		if (other == conn || !ws_conn_is_open(other) ||
+		    other->wn_role == WS_ROLE_NONE)
+			continue;
+		if (conn->wn_role == WS_ROLE_WS || sid != ctx->wc_sid ||
+		    other->wn_role == WS_ROLE_WS ||
+		    other->wn_role == conn->wn_role)
+			ws_conn_close(other);
+	}
+	if (conn->wn_role != WS_ROLE_WS && sid != ctx->wc_sid) {
+		ctx->wc_sid = sid;
+		ws_connected(ctx, "HTTP polling");
+	}
+	if (conn->wn_role == WS_ROLE_WS)
+		ws_connected(ctx, "WebSocket");
+}
+
+/* Server: dispatches a request head by its kind. */
+static int ws_request(struct ws_conn *conn, const char *head, size_t len)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+	char                  method[8];
+	char                  target[256];
+	char                  accept[PPPOAT_WS_ACCEPT_LEN + 1];
+	char                  val[128];
+	char                  resp[256];
+	const char           *path;
+	bool                  upgrade;
+	size_t                plen;
+	int                   rc;
+
+	if (sscanf(head, "%7s %255s HTTP/1.", method, target) != 2) {
+		conn->wn_closing = true;
+		return ws_out_append(conn, ws_resp_bad, strlen(ws_resp_bad));
+	}
+	/* A proxy may pass the absolute form on */
+	path = target;
+	if (strncmp(path, "http://", 7) == 0)
+		path = strchr(path + 7, '/') ?: "/";
+	plen = strcspn(path, "?");
+	if (plen != strlen(ctx->wc_path) ||
+	    strncmp(path, ctx->wc_path, plen) != 0) {
+		conn->wn_closing = true;
+		return ws_out_append(conn, ws_resp_notfound,
+				     strlen(ws_resp_notfound));
+	}
+
+	upgrade = pppoat_http_header(head, len, "Upgrade", val, sizeof(val)) &&
+		  pppoat_http_has_token(val, "websocket");
+	if (strcmp(method, "GET") == 0 && upgrade &&
+	    pppoat_http_header(head, len, "Sec-WebSocket-Key", val,
+			       sizeof(val))) {
+		pppoat_ws_accept(val, strlen(val), accept);
+		snprintf(resp, sizeof(resp),
+			 "HTTP/1.1 101 Switching Protocols\r\n"
+			 "Upgrade: websocket\r\n"
+			 "Connection: Upgrade\r\n"
+			 "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+		conn->wn_role = WS_ROLE_WS;
+		rc = ws_out_append(conn, resp, strlen(resp));
+	} else if (strcmp(method, "POST") == 0 &&
+		   pppoat_http_header(head, len, "Transfer-Encoding", val,
+				      sizeof(val)) &&
+		   pppoat_http_has_token(val, "chunked")) {
+		conn->wn_role = WS_ROLE_UP;
+		pppoat_http_chunked_init(&conn->wn_chunked);
+		rc = 0;
+	} else if (strcmp(method, "GET") == 0) {
+		conn->wn_role  = WS_ROLE_DOWN;
+		conn->wn_start = pppoat_util_time_us();
+		conn->wn_body  = 0;
+		rc = ws_out_append(conn, ws_resp_down, strlen(ws_resp_down));
+		++ctx->wc_polls;
+	} else {
+		conn->wn_closing = true;
+		return ws_out_append(conn, ws_resp_bad, strlen(ws_resp_bad));
+	}
+	if (rc == 0) {
+		conn->wn_state = WS_CONN_OPEN;
+		pppoat_ws_parser_init(&conn->wn_parser, true);
+		ws_session_claim(ctx, conn, ws_query_sid(target));
+	}
+	return rc;
+}
+
+/* Client: checks a response head. */
+static int ws_response(struct ws_conn *conn, const char *head, size_t len)
+{
+	struct pppoat_ws_ctx *ctx    = conn->wn_ctx;
+	int                   status = pppoat_http_status(head, len);
+	char                  accept[PPPOAT_WS_ACCEPT_LEN + 1];
+	char                  val[128];
+
+	switch (conn->wn_role) {
+	case WS_ROLE_WS:
+		pppoat_ws_accept(conn->wn_key, strlen(conn->wn_key), accept);
+		if (status == 101 &&
+		    pppoat_http_header(head, len, "Sec-WebSocket-Accept", val,
+				       sizeof(val)) &&
+		    strcmp(val, accept) == 0) {
+			conn->wn_state = WS_CONN_OPEN;
+			pppoat_ws_parser_init(&conn->wn_parser, false);
+			ws_connected(ctx, "WebSocket");
+			return 0;
+		}
+		if (ctx->wc_mode != WS_MODE_AUTO || status < 0)
+			return P_ERR(-EPROTO);
+		pppoat_info("ws", "Upgrade refused with %d, falling back to "
+			    "HTTP polling", status);
+		ctx->wc_http      = true;
+		ctx->wc_retry_now = true;
+		++ctx->wc_fallbacks;
+		return -ECONNREFUSED;
+	case WS_ROLE_DOWN:
+		if (status != 200 ||
+		    !pppoat_http_header(head, len, "Transfer-Encoding", val,
+					sizeof(val)) ||
+		    !pppoat_http_has_token(val, "chunked"))
+			return P_ERR(-EPROTO);
+		conn->wn_state = WS_CONN_OPEN;
+		pppoat_http_chunked_init(&conn->wn_chunked);
+		pppoat_ws_parser_init(&conn->wn_parser, false);
+		if (!ctx->wc_connected)
+			ws_connected(ctx, "HTTP polling");
+		++ctx->wc_polls;
+		return 0;
+	case WS_ROLE_UP:
+		/* Answers to finished POST requests */
+		return status >= 200 && status < 300 ? 0 : P_ERR(-EPROTO);
+	default:
+		PPPOAT_ASSERT(0);
+	}
+	return P_ERR(-EPROTO);
+}
+
+/* A chunked body has ended, the next request or response follows. */
+static int ws_body_end(struct ws_conn *conn)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+
+	conn->wn_state = WS_CONN_HEAD;
+	if (ctx->wc_type == PPPOAT_NODE_MASTER)
+		return ws_out_append(conn, ws_resp_post, strlen(ws_resp_post));
+	return ws_out_append(conn, ctx->wc_req_get, ctx->wc_req_get_len);
+}
+
+static bool ws_conn_chunked_rx(struct ws_conn *conn)
+{
+	return conn->wn_role == (conn->wn_ctx->wc_type == PPPOAT_NODE_MASTER ?
+				 WS_ROLE_UP : WS_ROLE_DOWN);
+}
+
+/* Consumes received data: heads, frames or chunked bodies of frames. */
+static int ws_conn_process(struct ws_conn *conn)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+	unsigned char        *in  = conn->wn_in;
+	size_t                off = 0;
+	size_t                len;
+	bool                  head;
+	int                   rc  = 0;
+
+	while (rc == 0 && ws_conn_is_open(conn) && !conn->wn_closing &&
+	       off < conn->wn_in_len) {
+		/* Client's POST connection only receives heads */
+		head = conn->wn_state == WS_CONN_HEAD ||
+		       (conn->wn_role == WS_ROLE_UP &&
+			ctx->wc_type == PPPOAT_NODE_SLAVE);
+		if (head) {
+			len = pppoat_http_head_len((char *)in + off,
+						   conn->wn_in_len - off);
+			if (len == 0 &&
+			    conn->wn_in_len - off >= PPPOAT_HTTP_HEAD_MAX)
+				rc = P_ERR(-EPROTO);
+			if (len == 0)
+				break;
+			/* The empty line ends the string for sscanf() */
+			in[off + len - 1] = '\0';
+			rc = ctx->wc_type == PPPOAT_NODE_MASTER ?
+			     ws_request(conn, (char *)in + off, len) :
+			     ws_response(conn, (char *)in + off, len);
+			off += len;
+		} else if (conn->wn_role == WS_ROLE_WS) {
+			rc = pppoat_ws_parse(&conn->wn_parser, in + off,
+					     conn->wn_in_len - off,
+					     &ws_deliver, conn);
+			off = conn->wn_in_len;
+		} else if (ws_conn_chunked_rx(conn)) {
+			rc = pppoat_http_chunked_decode(&conn->wn_chunked,
+					in + off, conn->wn_in_len - off, &len,
+					&ws_chunk_deliver, conn);
+			off += len;
+			if (rc == 0 && conn->wn_chunked.hc_done)
+				rc = ws_body_end(conn);
+		} else {
+			/* Nothing is expected from the peer */
+			rc = P_ERR(-EPROTO);
+		}
+	}
+	if (ws_conn_is_open(conn)) {
+		conn->wn_in_len -= off;
+		memmove(in, in + off, conn->wn_in_len);
+	}
+	return rc;
+}
+
+static void ws_conn_recv(struct ws_conn *conn)
+{
+	ssize_t len;
+	int     rc;
+
+	len = recv(conn->wn_sock, conn->wn_in + conn->wn_in_len,
+		   WS_IN_SIZE - conn->wn_in_len, 0);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0) {
+		ws_conn_fail(conn, len == 0 ? -ECONNRESET : -errno);
+		return;
+	}
+	conn->wn_in_len += len;
+	rc = ws_conn_process(conn);
+	if (rc != 0 && ws_conn_is_open(conn))
+		ws_conn_fail(conn, rc);
+	else if (ws_conn_is_open(conn) && conn->wn_out_len > 0)
+		ws_conn_flush(conn);
+}
+
+/* The connection which carries frames to the peer, if it takes them. */
+static struct ws_conn *ws_tx_conn(struct pppoat_ws_ctx *ctx)
+{
+	return ws_conn_find(ctx, WS_ROLE_WS) ?:
+	       ws_conn_find(ctx, ctx->wc_type == PPPOAT_NODE_MASTER ?
+				 WS_ROLE_DOWN : WS_ROLE_UP);
+}
+
+static bool ws_tx_ready(struct ws_conn *conn)
+{
+	return conn->wn_state == WS_CONN_OPEN &&
+	       ws_out_room(conn, WS_FRAME_MAX + WS_FRAME_OVERHEAD +
+			   strlen(ws_chunk_last) +
+			   conn->wn_ctx->wc_req_post_len) != NULL;
+}
+
+/* Ends a body which is long or old enough, proxies pass it on then. */
+static int ws_poll_end(struct ws_conn *conn)
+{
+	struct pppoat_ws_ctx *ctx = conn->wn_ctx;
+	int                   rc;
+
+	rc = ws_out_append(conn, ws_chunk_last, strlen(ws_chunk_last));
+	conn->wn_body = 0;
+	if (ctx->wc_type == PPPOAT_NODE_MASTER) {
+		conn->wn_state = WS_CONN_HEAD;
+		return rc;
+	}
+	/* The next POST is pipelined, its frames follow right away */
+	return rc ?: ws_out_append(conn, ctx->wc_req_post,
+				   ctx->wc_req_post_len);
+}
+
+/* Reads a packet from the interface into a frame in the output buffer. */
+static int ws_tx(struct pppoat_ws_ctx *ctx, int rd)
+{
+	struct ws_conn *conn = ws_tx_conn(ctx);
+	unsigned char   frame[WS_FRAME_MAX];
+	unsigned char  *start = NULL;
+	unsigned char  *data  = NULL;
+	unsigned char   mask[4];
+	bool            client;
+	bool            chunked;
+	uint64_t        r;
+	size_t          hlen;
+	size_t          flen;
+	ssize_t         len;
+	int             rc = 0;
+
+	if (conn == NULL) {
+		len = read(rd, frame, sizeof(frame));
+		if (len > 0)
+			++ctx->wc_dropped;
+	} else {
+		start = ws_out_room(conn, WS_FRAME_MAX + WS_FRAME_OVERHEAD);
+		PPPOAT_ASSERT(start != NULL);
+		data  = start + WS_FRAME_HDR;
+		len   = read(rd, data, WS_FRAME_MAX);
+	}
+	if (len == 0)
+		return P_ERR(-EPIPE);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : P_ERR(-errno);
+	if (conn == NULL)
+		return 0;
+
+	client  = ctx->wc_type == PPPOAT_NODE_SLAVE;
+	chunked = conn->wn_role != WS_ROLE_WS;
+	if (client) {
+		r = ws_rand(ctx);
+		memcpy(mask, &r, sizeof(mask));
+		pppoat_ws_mask(data, len, mask, 0);
+	}
+	hlen = pppoat_ws_hdr(data, PPPOAT_WS_BINARY, len,
+			     client ? mask : NULL);
+	flen = hlen + len;
+	if (chunked) {
+		pppoat_http_chunk_hdr((char *)data - hlen -
+				      PPPOAT_HTTP_CHUNK_HDR_LEN, flen);
+		memcpy(data + len, "\r\n", 2);
+		hlen += PPPOAT_HTTP_CHUNK_HDR_LEN;
+		flen += PPPOAT_HTTP_CHUNK_HDR_LEN + 2;
+	}
+	/* Short frames have a shorter header, close the gap */
+	if (hlen < WS_FRAME_HDR)
+		memmove(start, data - hlen, flen);
+	conn->wn_out_len += flen;
+	conn->wn_body    += flen;
+	++ctx->wc_frames;
+
+	if (chunked && conn->wn_body >= ctx->wc_poll)
+		rc = ws_poll_end(conn);
+	if (rc == 0)
+		ws_conn_flush(conn);
+	else
+		ws_conn_fail(conn, rc);
+	return 0;
+}
+
+/* Server ends responses which are open for too long. */
+static uint64_t ws_poll_check(struct pppoat_ws_ctx *ctx, uint64_t now)
+{
+	struct ws_conn *conn = ws_conn_find(ctx, WS_ROLE_DOWN);
+	uint64_t        deadline;
+	int             rc;
+
+	if (ctx->wc_type != PPPOAT_NODE_MASTER || conn == NULL ||
+	    conn->wn_state != WS_CONN_OPEN)
+		return PPPOAT_TIME_NEVER;
+	deadline = conn->wn_start + WS_POLL_TIME;
+	if (now < deadline)
+		return deadline - now;
+	rc = ws_poll_end(conn);
+	if (rc == 0)
+		ws_conn_flush(conn);
+	else
+		ws_conn_fail(conn, rc);
+	return PPPOAT_TIME_NEVER;
+}
+
+static int ws_listen(struct pppoat_ws_ctx *ctx)
+{
+	struct addrinfo *ai = ctx->wc_ainfo;
+	int              rc;
+
+	ctx->wc_lsock = socket(ai->ai_family, ai->ai_socktype,
+			       ai->ai_protocol);
+	rc = ctx->wc_lsock < 0 ? P_ERR(-errno) : 0;
+	rc = rc ?: ws_setsockopt_int(ctx->wc_lsock, SOL_SOCKET, SO_REUSEADDR,
+				     1);
+	rc = rc ?: pppoat_util_fd_nonblock_set(ctx->wc_lsock, true);
+	if (rc == 0 &&
+	    (bind(ctx->wc_lsock, ai->ai_addr, ai->ai_addrlen) != 0 ||
+	     listen(ctx->wc_lsock, WS_CONNS) != 0))
+		rc = P_ERR(-errno);
+	return rc;
+}
+
+/* Splits "host[:port]", port is left untouched if missing. */
+static int ws_host_parse(const char *str, char **host, unsigned long *port)
+{
+	const char *colon = strrchr(str, ':');
+	char       *end;
+
+	*host = pppoat_strdup(str);
+	if (*host == NULL)
+		return P_ERR(-ENOMEM);
+	if (colon == NULL || strchr(str, ']') > colon)
+		return 0;
+	(*host)[colon - str] = '\0';
+	*port = strtoul(colon + 1, &end, 10);
+	return *end != '\0' || *port == 0 || *port > 0xffff ? P_ERR(-EINVAL) :
+							      0;
+}
+
+static int ws_ainfo_get(struct pppoat_ws_ctx *ctx,
+			const char           *host,
+			unsigned long         port)
+{
+	struct addrinfo hints;
+	char            service[6];
+	int             rc;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags    = host == NULL ? AI_PASSIVE : 0;
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_socktype = SOCK_STREAM;
+
+	snprintf(service, sizeof(service), "%lu", port);
+	rc = getaddrinfo(host, service, &hints, &ctx->wc_ainfo);
+	if (rc != 0) {
+		pppoat_error("ws", "getaddrinfo rc=%d: %s", rc,
+			     gai_strerror(rc));
+		ctx->wc_ainfo = NULL;
+		return P_ERR(-ENOPROTOOPT);
+	}
+	return 0;
+}
+
+/* Client's Host header, request target and the address to connect to. */
+static int ws_client_setup(struct pppoat_ws_ctx *ctx,
+			   struct pppoat_conf   *conf,
+			   const char           *host,
+			   unsigned long         port)
+{
+	const char    *proxy = pppoat_conf_get(conf, "ws.proxy");
+	char          *phost = NULL;
+	unsigned long  pport = 8080;
+	int            rc;
+
+	rc = asprintf(&ctx->wc_host, "%s:%lu", host, port);
+	if (rc < 0) {
+		ctx->wc_host = NULL;
+		return P_ERR(-ENOMEM);
+	}
+	rc = proxy == NULL ? asprintf(&ctx->wc_target, "%s", ctx->wc_path) :
+	     asprintf(&ctx->wc_target, "http://%s%s", ctx->wc_host,
+		      ctx->wc_path);
+	if (rc < 0) {
+		ctx->wc_target = NULL;
+		return P_ERR(-ENOMEM);
+	}
+	if (proxy == NULL)
+		return ws_ainfo_get(ctx, host, port);
+
+	rc = ws_host_parse(proxy, &phost, &pport);
+	rc = rc ?: ws_ainfo_get(ctx, phost, pport);
+	pppoat_free(phost);
+	return rc;
+}
+
+static void ws_ctx_fini(struct pppoat_ws_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < WS_CONNS; ++i) {
+		ws_conn_close(&ctx->wc_conns[i]);
+		pppoat_free(ctx->wc_conns[i].wn_out);
+		pppoat_free(ctx->wc_conns[i].wn_in);
+	}
+	if (ctx->wc_lsock >= 0)
+		(void)close(ctx->wc_lsock);
+	if (ctx->wc_ainfo != NULL)
+		freeaddrinfo(ctx->wc_ainfo);
+	/* Strings from asprintf() come from malloc() */
+	free(ctx->wc_req_ws);
+	free(ctx->wc_req_post);
+	free(ctx->wc_req_get);
+	free(ctx->wc_target);
+	free(ctx->wc_host);
+	pppoat_free(ctx->wc_path);
+	pppoat_free(ctx);
+}
+
+static int module_ws_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_ws_ctx *ctx;
+	const char           *host;
+	const char           *mode;
+	unsigned long         port;
+	int                   i;
+	int                   rc = 0;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->wc_lsock = -1;
+	ctx->wc_type  = pppoat_conf_obj_is_true(pppoat_conf_get(conf,
+			"server")) ? PPPOAT_NODE_MASTER : PPPOAT_NODE_SLAVE;
+	ctx->wc_reconnect = pppoat_conf_get_ulong(conf, "ws.reconnect",
+				WS_RECONNECT_DEFAULT) * 1000;
+	ctx->wc_reconnect = pppoat_max(ctx->wc_reconnect, 1000);
+	ctx->wc_backoff   = ctx->wc_reconnect;
+	ctx->wc_poll      = pppoat_max(pppoat_conf_get_ulong(conf, "ws.poll",
+				WS_POLL_DEFAULT), WS_FRAME_MAX);
+	ctx->wc_path      = pppoat_strdup(pppoat_conf_get(conf, "ws.path") ?:
+					  WS_PATH_DEFAULT);
+	for (i = 0; i < WS_CONNS; ++i) {
+		ctx->wc_conns[i].wn_ctx  = ctx;
+		ctx->wc_conns[i].wn_sock = -1;
+		ctx->wc_conns[i].wn_out  = pppoat_alloc(WS_OUT_SIZE);
+		ctx->wc_conns[i].wn_in   = pppoat_alloc(WS_IN_SIZE);
+		if (ctx->wc_conns[i].wn_out == NULL ||
+		    ctx->wc_conns[i].wn_in == NULL)
+			rc = P_ERR(-ENOMEM);
+	}
+	if (rc == 0 && (ctx->wc_path == NULL ||
+			getrandom(&ctx->wc_rand, sizeof(ctx->wc_rand), 0) !=
+			sizeof(ctx->wc_rand)))
+		rc = P_ERR(-ENOMEM);
+	ctx->wc_rand |= 1;
+
+	mode = pppoat_conf_get(conf, "ws.mode") ?: "auto";
+	if (strcmp(mode, "ws") == 0)
+		ctx->wc_mode = WS_MODE_WS;
+	else if (strcmp(mode, "http") == 0)
+		ctx->wc_mode = WS_MODE_HTTP;
+	else if (strcmp(mode, "auto") != 0)
+		rc = rc ?: P_ERR(-EINVAL);
+	if (rc == 0 && ctx->wc_path[0] != '/') {
+		pppoat_error("ws", "ws.path must start with '/'");
+		rc = P_ERR(-EINVAL);
+	}
+
+	/* Every queue of a multiqueue interface has its own connection */
+	port = pppoat_conf_get_ulong(conf, "ws.port", WS_PORT_DEFAULT) +
+	       pppoat_conf_get_ulong(conf, "queue", 0);
+	host = pppoat_conf_get(conf, "ws.host");
+	rc = rc ?: port == 0 || port > 0xffff ? P_ERR(-EINVAL) : 0;
+	if (rc == 0 && host == NULL && ctx->wc_type == PPPOAT_NODE_SLAVE) {
+		pppoat_error("ws", "Client needs ws.host");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0 && ctx->wc_type == PPPOAT_NODE_MASTER) {
+		rc = ws_ainfo_get(ctx, host, port);
+		rc = rc ?: ws_listen(ctx);
+	} else if (rc == 0) {
+		rc = ws_client_setup(ctx, conf, host, port);
+	}
+	if (rc == 0) {
+		pppoat_debug("ws", "%s %s:%lu%s mode=%s", ctx->wc_type ==
+			     PPPOAT_NODE_MASTER ? "Listening on" :
+			     "Connecting to", host ?: "*", port, ctx->wc_path,
+			     mode);
+		*userdata = ctx;
+	} else {
+		ws_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_ws_fini(void *userdata)
+{
+	struct pppoat_ws_ctx *ctx = userdata;
+
+	pppoat_debug("ws", "connects=%lu fallbacks=%lu frames=%lu polls=%lu "
+		     "dropped=%lu", ctx->wc_connects, ctx->wc_fallbacks,
+		     ctx->wc_frames, ctx->wc_polls, ctx->wc_dropped);
+	ws_ctx_fini(ctx);
+}
+
+static int module_ws_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_ws_ctx *ctx = userdata;
+	struct ws_conn       *conn;
+	struct ws_conn       *tx;
+	fd_set                rfds;
+	fd_set                wfds;
+	uint64_t              now;
+	uint64_t              timeout;
+	int                   max;
+	int                   i;
+	int                   rc;
+
+	ctx->wc_wr = wr;
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+
+	while (rc == 0 && ctx->wc_fatal == 0) {
+		now = pppoat_util_time_us();
+		if (ctx->wc_type == PPPOAT_NODE_SLAVE && !ctx->wc_session &&
+		    now >= ctx->wc_retry)
+			rc = ws_session_start(ctx);
+		if (rc != 0)
+			break;
+		timeout = ws_poll_check(ctx, now);
+		if (ctx->wc_type == PPPOAT_NODE_SLAVE && !ctx->wc_session)
+			timeout = ctx->wc_retry - pppoat_min(now,
+							     ctx->wc_retry);
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		max = rd;
+		/*
+		 * Interface waits while the connection to the peer is busy,
+		 * with no connection at all its packets are dropped.
+		 */
+		tx = ws_tx_conn(ctx);
+		if (tx == NULL ? !ctx->wc_session : ws_tx_ready(tx))
+			FD_SET(rd, &rfds);
+		if (ctx->wc_lsock >= 0) {
+			FD_SET(ctx->wc_lsock, &rfds);
+			max = pppoat_max(max, ctx->wc_lsock);
+		}
+		for (i = 0; i < WS_CONNS; ++i) {
+			conn = &ctx->wc_conns[i];
+			if (!ws_conn_is_open(conn))
+				continue;
+			if (conn->wn_state == WS_CONN_CONNECTING ||
+			    conn->wn_out_len > 0)
+				FD_SET(conn->wn_sock, &wfds);
+			if (conn->wn_state != WS_CONN_CONNECTING)
+				FD_SET(conn->wn_sock, &rfds);
+			max = pppoat_max(max, conn->wn_sock);
+		}
+		rc = pppoat_util_select_timed(max, &rfds, &wfds, timeout);
+		if (rc <= 0)
+			continue;
+		rc = 0;
+
+		for (i = 0; i < WS_CONNS; ++i) {
+			conn = &ctx->wc_conns[i];
+			if (!ws_conn_is_open(conn))
+				continue;
+			if (conn->wn_state == WS_CONN_CONNECTING &&
+			    FD_ISSET(conn->wn_sock, &wfds))
+				ws_connect_finish(conn);
+			else if (FD_ISSET(conn->wn_sock, &wfds))
+				ws_conn_flush(conn);
+			if (ws_conn_is_open(conn) &&
+			    conn->wn_state != WS_CONN_CONNECTING &&
+			    FD_ISSET(conn->wn_sock, &rfds))
+				ws_conn_recv(conn);
+			if (ctx->wc_fatal != 0)
+				break;
+		}
+		if (ctx->wc_fatal == 0 && ctx->wc_lsock >= 0 &&
+		    FD_ISSET(ctx->wc_lsock, &rfds))
+			rc = ws_accept(ctx);
+		/* Connections may have changed, the interface waits then */
+		tx = ws_tx_conn(ctx);
+		if (rc == 0 && ctx->wc_fatal == 0 && FD_ISSET(rd, &rfds) &&
+		    (tx == NULL ? !ctx->wc_session : ws_tx_ready(tx)))
+			rc = ws_tx(ctx, rd);
+	}
+	return rc ?: ctx->wc_fatal;
+}
+
+const struct pppoat_module pppoat_module_ws = {
+	.m_name  = "ws",
+	.m_descr = "PPP over WebSocket or HTTP polling",
+	.m_init  = &module_ws_init,
+	.m_fini  = &module_ws_fini,
+	.m_run   = &module_ws_run,
+};
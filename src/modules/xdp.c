@@ -0,0 +1,716 @@
+/* xdp.c
+ * PPP over Any Transport -- AF_XDP transport module
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "modules/xdp.h"
+#include "conf.h"
+#include "ether.h"
+#include "if.h"
+#include "log.h"
+#include "memory.h"
+#include "pppoat.h"
+#include "util.h"
+
+/*
+ * Frames are the same as of the eth module: a chunk of the interface
+ * stream after [16-bit length][queue][0] under EtherType xdp.type, so an
+ * xdp end talks to an eth end.
+ *
+ * A small XDP program redirects frames of our EtherType to an AF_XDP
+ * socket of the receiving device queue, everything else goes on to the
+ * stack. The socket shares a UMEM with the kernel: the first half of the
+ * frames is posted to the fill ring for RX, the other half is the TX pool
+ * which returns via the completion ring. Packets from the interface are
+ * read straight into UMEM frames and received chunks are written from
+ * them, nothing is copied in user space.
+ *
+ * The program runs in driver mode where the device supports it and in
+ * generic (skb) mode otherwise, the socket tries zero-copy first. Queue Q
+ * of the tunnel binds device queue xdp.queue_id + Q, frames are steered
+ * to it by the device (e.g. with ethtool flow rules); with one device
+ * queue there must be one tunnel queue.
+ */
+
+#define XDP_FRAME_SIZE     4096
+/* RX data follows the headroom the kernel reserves in every frame */
+#define XDP_FRAME_DATA     (XDP_FRAME_SIZE - XDP_PACKET_HEADROOM)
+#define XDP_FRAMES_DEFAULT 4096
+#define XDP_FRAMES_MIN     64
+/* Device queues the program may redirect to */
+#define XDP_QUEUES_MAX     64
+/* Frames from the interface sent with one kick */
+#define XDP_TX_BATCH       32
+/* Exhausted TX pool is polled for completions after this many usec */
+#define XDP_TX_RETRY       1000
+
+struct xdp_ring {
+	uint32_t *xr_producer;
+	uint32_t *xr_consumer;
+	uint32_t *xr_flags;
+	void     *xr_desc;
+	uint32_t  xr_size;
+	/* Local copy of the index this side moves */
+	uint32_t  xr_cached;
+	void     *xr_map;
+	size_t    xr_map_size;
+};
+
+/*
+ * The program and the socket map belong to the device, queues of one
+ * process share them. Module init and fini run in the main thread.
+ */
+struct xdp_prog {
+	unsigned int xp_ref;
+	int          xp_ifindex;
+	int          xp_map;
+	int          xp_prog;
+	int          xp_link;
+	bool         xp_drv;
+};
+
+static struct xdp_prog xdp_prog = {
+	.xp_map  = -1,
+	.xp_prog = -1,
+	.xp_link = -1,
+};
+
+struct pppoat_xdp_ctx {
+	int              xc_sock;
+	int              xc_ifindex;
+	char             xc_dev[IFNAMSIZ];
+	uint16_t         xc_type;
+	unsigned int     xc_queue;
+	unsigned int     xc_dev_queue;
+	unsigned int     xc_mtu;
+	unsigned char    xc_mac[ETH_ALEN];
+	unsigned char    xc_peer[ETH_ALEN];
+	bool             xc_peer_fixed;
+	bool             xc_prog_ref;
+	bool             xc_zerocopy;
+	unsigned char   *xc_umem;
+	size_t           xc_umem_size;
+	struct xdp_ring  xc_fill;
+	struct xdp_ring  xc_comp;
+	struct xdp_ring  xc_rx;
+	struct xdp_ring  xc_tx;
+	/* Free TX frames, addresses in UMEM */
+	uint64_t        *xc_tx_free;
+	unsigned int     xc_tx_free_nr;
+	/* Counters */
+	unsigned long    xc_rx_frames;
+	unsigned long    xc_tx_frames;
+	unsigned long    xc_tx_kicks;
+	unsigned long    xc_bad;
+};
+
+static int xdp_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Redirects frames of our EtherType to xsks[rx_queue_index], passes the
+ * rest. bpf_redirect_map() passes too when the queue has no socket.
+ */
+static int xdp_prog_load(int map, uint16_t type)
+{
+	struct bpf_insn insns[] = {
+		/* r2 = data, r3 = data_end */
+		{ BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1,
+		  offsetof(struct xdp_md, data), 0 },
+		{ BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1,
+		  offsetof(struct xdp_md, data_end), 0 },
+		{ BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0 },
+		{ BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0,
+		  ETH_HLEN + PPPOAT_ETHER_HDR_LEN },
+		{ BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0 },
+		/* EtherType is big endian, the load is host order */
+		{ BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 12, 0 },
+		{ BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6, htons(type) },
+		{ BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1,
+		  offsetof(struct xdp_md, rx_queue_index), 0 },
+		{ BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+		  map },
+		{ 0, 0, 0, 0, 0 },
+		{ BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+		{ BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+		/* pass: */
+		{ BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS },
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+	};
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type            = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns                = (uintptr_t)insns;
+	attr.insn_cnt             = ARRAY_SIZE(insns);
+	attr.license              = (uintptr_t)"GPL";
+
+	return xdp_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int xdp_prog_attach(struct xdp_prog *xp, int ifindex, bool drv)
+{
+	union bpf_attr attr;
+
+	/* The link detaches the program when the last fd is closed */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd        = xp->xp_prog;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type    = BPF_XDP;
+	attr.link_create.flags          = drv ? XDP_FLAGS_DRV_MODE :
+						XDP_FLAGS_SKB_MODE;
+	xp->xp_link = xdp_bpf(BPF_LINK_CREATE, &attr);
+	xp->xp_drv  = drv;
+
+	return xp->xp_link < 0 ? -errno : 0;
+}
+
+static void xdp_prog_put(struct xdp_prog *xp)
+{
+	PPPOAT_ASSERT(xp->xp_ref > 0);
+
+	if (--xp->xp_ref > 0)
+		return;
+	if (xp->xp_link >= 0)
+		(void)close(xp->xp_link);
+	if (xp->xp_prog >= 0)
+		(void)close(xp->xp_prog);
+	if (xp->xp_map >= 0)
+		(void)close(xp->xp_map);
+	xp->xp_link = xp->xp_prog = xp->xp_map = -1;
+}
+
+static int xdp_prog_get(struct xdp_prog *xp,
+			int              ifindex,
+			uint16_t         type,
+			const char      *mode)
+{
+	union bpf_attr attr;
+	int            rc;
+
+	if (xp->xp_ref > 0) {
+		if (xp->xp_ifindex != ifindex) {
+			pppoat_error("xdp", "All queues must use one device");
+			return P_ERR(-EINVAL);
+		}
+		++xp->xp_ref;
+		return 0;
+	}
+	xp->xp_ref     = 1;
+	xp->xp_ifindex = ifindex;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size    = sizeof(uint32_t);
+	attr.value_size  = sizeof(uint32_t);
+	attr.max_entries = XDP_QUEUES_MAX;
+	xp->xp_map = xdp_bpf(BPF_MAP_CREATE, &attr);
+	rc = xp->xp_map < 0 ? P_ERR(-errno) : 0;
+	if (rc == 0) {
+		xp->xp_prog = xdp_prog_load(xp->xp_map, type);
+		rc = xp->xp_prog < 0 ? P_ERR(-errno) : 0;
+	}
+	if (rc != 0)
+		pppoat_error("xdp", "Can't load XDP program, errno=%d", -rc);
+
+	if (rc == 0 && strcmp(mode, "skb") != 0) {
+		rc = xdp_prog_attach(xp, ifindex, true);
+		/* Generic mode works with any device */
+		if (rc != 0 && strcmp(mode, "auto") == 0) {
+			pppoat_debug("xdp", "No driver mode, errno=%d", -rc);
+			rc = 1;
+		}
+	}
+	if (rc == 1 || (rc == 0 && strcmp(mode, "skb") == 0))
+		rc = xdp_prog_attach(xp, ifindex, false);
+	if (rc != 0 && xp->xp_prog >= 0)
+		pppoat_error("xdp", "Can't attach XDP program in %s mode, "
+			     "errno=%d", mode, -rc);
+
+	if (rc != 0)
+		xdp_prog_put(xp);
+	return rc;
+}
+
+static int xdp_ring_map(struct pppoat_xdp_ctx        *ctx,
+			struct xdp_ring              *ring,
+			const struct xdp_ring_offset *off,
+			size_t                        desc_size,
+			uint32_t                      size,
+			off_t                         pgoff)
+{
+	unsigned char *map;
+
+	ring->xr_map_size = off->desc + size * desc_size;
+	map = mmap(NULL, ring->xr_map_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ctx->xc_sock, pgoff);
+	if (map == MAP_FAILED)
+		return P_ERR(-errno);
+	ring->xr_map      = map;
+	ring->xr_producer = (uint32_t *)(map + off->producer);
+	ring->xr_consumer = (uint32_t *)(map + off->consumer);
+	ring->xr_flags    = (uint32_t *)(map + off->flags);
+	ring->xr_desc     = map + off->desc;
+	ring->xr_size     = size;
+	return 0;
+}
+
+static void xdp_ring_unmap(struct xdp_ring *ring)
+{
+	if (ring->xr_map != NULL)
+		(void)munmap(ring->xr_map, ring->xr_map_size);
+}
+
+static int xdp_umem_setup(struct pppoat_xdp_ctx *ctx, uint32_t frames)
+{
+	struct xdp_umem_reg     reg;
+	struct xdp_mmap_offsets off;
+	socklen_t               optlen = sizeof(off);
+	uint32_t                half   = frames / 2;
+	uint64_t               *fill;
+	uint32_t                i;
+	int                     rc;
+
+	ctx->xc_umem_size = (size_t)frames * XDP_FRAME_SIZE;
+	ctx->xc_umem = mmap(NULL, ctx->xc_umem_size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (ctx->xc_umem == MAP_FAILED) {
+		ctx->xc_umem = NULL;
+		return P_ERR(-errno);
+	}
+	ctx->xc_tx_free = pppoat_alloc(half * sizeof(*ctx->xc_tx_free));
+	if (ctx->xc_tx_free == NULL)
+		return P_ERR(-ENOMEM);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr       = (uintptr_t)ctx->xc_umem;
+	reg.len        = ctx->xc_umem_size;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	rc = setsockopt(ctx->xc_sock, SOL_XDP, XDP_UMEM_REG, &reg,
+			sizeof(reg));
+	rc = rc ?: setsockopt(ctx->xc_sock, SOL_XDP, XDP_UMEM_FILL_RING,
+			      &half, sizeof(half));
+	rc = rc ?: setsockopt(ctx->xc_sock, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+			      &half, sizeof(half));
+	rc = rc ?: setsockopt(ctx->xc_sock, SOL_XDP, XDP_RX_RING, &half,
+			      sizeof(half));
+	rc = rc ?: setsockopt(ctx->xc_sock, SOL_XDP, XDP_TX_RING, &half,
+			      sizeof(half));
+	rc = rc ?: getsockopt(ctx->xc_sock, SOL_XDP, XDP_MMAP_OFFSETS, &off,
+			      &optlen);
+	if (rc != 0) {
+		pppoat_error("xdp", "Can't set up UMEM, errno=%d", errno);
+		return P_ERR(-errno);
+	}
+
+	rc = xdp_ring_map(ctx, &ctx->xc_fill, &off.fr, sizeof(uint64_t),
+			  half, XDP_UMEM_PGOFF_FILL_RING);
+	rc = rc ?: xdp_ring_map(ctx, &ctx->xc_comp, &off.cr, sizeof(uint64_t),
+				half, XDP_UMEM_PGOFF_COMPLETION_RING);
+	rc = rc ?: xdp_ring_map(ctx, &ctx->xc_rx, &off.rx,
+				sizeof(struct xdp_desc), half,
+				XDP_PGOFF_RX_RING);
+	rc = rc ?: xdp_ring_map(ctx, &ctx->xc_tx, &off.tx,
+				sizeof(struct xdp_desc), half,
+				XDP_PGOFF_TX_RING);
+	if (rc != 0)
+		return rc;
+
+	/* RX frames go to the kernel before bind, TX frames stay with us */
+	fill = ctx->xc_fill.xr_desc;
+	for (i = 0; i < half; ++i) {
+		fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+		ctx->xc_tx_free[i] = (uint64_t)(half + i) * XDP_FRAME_SIZE;
+	}
+	ctx->xc_tx_free_nr    = half;
+	ctx->xc_fill.xr_cached = half;
+	__atomic_store_n(ctx->xc_fill.xr_producer, half, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static int xdp_sock_bind(struct pppoat_xdp_ctx *ctx)
+{
+	struct sockaddr_xdp addr;
+	int                 rc = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sxdp_family   = AF_XDP;
+	addr.sxdp_ifindex  = ctx->xc_ifindex;
+	addr.sxdp_queue_id = ctx->xc_dev_queue;
+	if (xdp_prog.xp_drv) {
+		addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+		rc = bind(ctx->xc_sock, (struct sockaddr *)&addr,
+			  sizeof(addr));
+		ctx->xc_zerocopy = rc == 0;
+	}
+	if (rc != 0) {
+		addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+		rc = bind(ctx->xc_sock, (struct sockaddr *)&addr,
+			  sizeof(addr));
+	}
+	if (rc != 0) {
+		pppoat_error("xdp", "Can't bind to %s queue %u, errno=%d",
+			     ctx->xc_dev, ctx->xc_dev_queue, errno);
+		return P_ERR(-errno);
+	}
+	return 0;
+}
+
+static int xdp_map_update(struct pppoat_xdp_ctx *ctx)
+{
+	union bpf_attr attr;
+	uint32_t       key = ctx->xc_dev_queue;
+	uint32_t       val = ctx->xc_sock;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xdp_prog.xp_map;
+	attr.key    = (uintptr_t)&key;
+	attr.value  = (uintptr_t)&val;
+	attr.flags  = BPF_ANY;
+
+	return xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0 ? P_ERR(-errno) : 0;
+}
+
+static int xdp_sock_setup(struct pppoat_xdp_ctx *ctx,
+			  struct pppoat_conf    *conf)
+{
+	const char   *mode;
+	unsigned long frames;
+	uint32_t      n = XDP_FRAMES_MIN;
+	int           rc;
+
+	mode   = pppoat_conf_get(conf, "xdp.mode") ?: "auto";
+	frames = pppoat_conf_get_ulong(conf, "xdp.frames",
+				       XDP_FRAMES_DEFAULT);
+	/* Ring sizes are powers of 2 */
+	while (n < frames && n < (1U << 20))
+		n *= 2;
+	if (strcmp(mode, "auto") != 0 && strcmp(mode, "drv") != 0 &&
+	    strcmp(mode, "skb") != 0) {
+		pppoat_error("xdp", "xdp.mode is auto, drv or skb");
+		return P_ERR(-EINVAL);
+	}
+	if (ctx->xc_dev_queue >= XDP_QUEUES_MAX) {
+		pppoat_error("xdp", "Device queue %u is out of range",
+			     ctx->xc_dev_queue);
+		return P_ERR(-EINVAL);
+	}
+
+	ctx->xc_sock = socket(AF_XDP, SOCK_RAW, 0);
+	if (ctx->xc_sock < 0) {
+		pppoat_error("xdp", "Can't create AF_XDP socket, errno=%d",
+			     errno);
+		return P_ERR(-errno);
+	}
+	rc = pppoat_ether_dev_query(ctx->xc_dev, &ctx->xc_ifindex, ctx->xc_mac,
+				    &ctx->xc_mtu);
+	rc = rc ?: xdp_prog_get(&xdp_prog, ctx->xc_ifindex, ctx->xc_type,
+				mode);
+	ctx->xc_prog_ref = rc == 0;
+	rc = rc ?: xdp_umem_setup(ctx, n);
+	rc = rc ?: xdp_sock_bind(ctx);
+	rc = rc ?: xdp_map_update(ctx);
+
+	return rc;
+}
+
+static void xdp_ctx_fini(struct pppoat_xdp_ctx *ctx)
+{
+	xdp_ring_unmap(&ctx->xc_tx);
+	xdp_ring_unmap(&ctx->xc_rx);
+	xdp_ring_unmap(&ctx->xc_comp);
+	xdp_ring_unmap(&ctx->xc_fill);
+	if (ctx->xc_sock >= 0)
+		(void)close(ctx->xc_sock);
+	if (ctx->xc_umem != NULL)
+		(void)munmap(ctx->xc_umem, ctx->xc_umem_size);
+	if (ctx->xc_prog_ref)
+		xdp_prog_put(&xdp_prog);
+	pppoat_free(ctx->xc_tx_free);
+	pppoat_free(ctx);
+}
+
+static int module_xdp_init(struct pppoat_conf *conf, void **userdata)
+{
+	struct pppoat_xdp_ctx *ctx;
+	const char            *dev;
+	const char            *peer;
+	int                    rc = 0;
+
+	ctx = pppoat_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return P_ERR(-ENOMEM);
+	ctx->xc_sock      = -1;
+	ctx->xc_type      = pppoat_conf_get_ulong(conf, "xdp.type",
+						  PPPOAT_ETHER_TYPE_DEFAULT);
+	ctx->xc_queue     = pppoat_conf_get_ulong(conf, "queue", 0);
+	ctx->xc_dev_queue = pppoat_conf_get_ulong(conf, "xdp.queue_id", 0) +
+			    ctx->xc_queue;
+	memset(ctx->xc_peer, 0xff, ETH_ALEN);
+
+	dev  = pppoat_conf_get(conf, "xdp.dev");
+	peer = pppoat_conf_get(conf, "xdp.peer");
+	if (dev == NULL || strlen(dev) >= IFNAMSIZ) {
+		pppoat_error("xdp", "Needs xdp.dev");
+		rc = P_ERR(-EINVAL);
+	}
+	if (rc == 0 && peer != NULL) {
+		rc = pppoat_ether_mac_parse(peer, ctx->xc_peer);
+		ctx->xc_peer_fixed = true;
+	}
+	if (rc == 0) {
+		strcpy(ctx->xc_dev, dev);
+		rc = xdp_sock_setup(ctx, conf);
+	}
+	if (rc == 0) {
+		pppoat_debug("xdp", "%s queue %u type 0x%04x mtu %u, %s mode, "
+			     "%s, %u frames", ctx->xc_dev, ctx->xc_dev_queue,
+			     ctx->xc_type, ctx->xc_mtu,
+			     xdp_prog.xp_drv ? "driver" : "generic",
+			     ctx->xc_zerocopy ? "zero-copy" : "copy",
+			     2 * ctx->xc_rx.xr_size);
+		*userdata = ctx;
+	} else {
+		xdp_ctx_fini(ctx);
+	}
+	return rc;
+}
+
+static void module_xdp_fini(void *userdata)
+{
+	struct pppoat_xdp_ctx *ctx = userdata;
+
+	pppoat_debug("xdp", "rx frames=%lu, tx frames=%lu kicks=%lu, bad=%lu",
+		     ctx->xc_rx_frames, ctx->xc_tx_frames, ctx->xc_tx_kicks,
+		     ctx->xc_bad);
+	xdp_ctx_fini(ctx);
+}
+
+static bool xdp_ring_needs_wakeup(struct xdp_ring *ring)
+{
+	return (__atomic_load_n(ring->xr_flags, __ATOMIC_RELAXED) &
+		XDP_RING_NEED_WAKEUP) != 0;
+}
+
+static int xdp_rx_frame(struct pppoat_xdp_ctx *ctx,
+			const struct xdp_desc *desc,
+			int                    wr)
+{
+	unsigned char *frame = ctx->xc_umem + desc->addr;
+	unsigned int   queue;
+	ssize_t        len;
+
+	len = pppoat_ether_hdr_get(frame, desc->len, &queue);
+	if (len < 0 || queue != ctx->xc_queue) {
+		++ctx->xc_bad;
+		return 0;
+	}
+	if (!ctx->xc_peer_fixed)
+		memcpy(ctx->xc_peer, frame + ETH_ALEN, ETH_ALEN);
+	++ctx->xc_rx_frames;
+	return pppoat_util_write(wr, frame + ETH_HLEN + PPPOAT_ETHER_HDR_LEN,
+				 len);
+}
+
+/*
+ * Passes received frames to the interface and returns them to the fill
+ * ring. Fill ring has room for all RX frames, so it never overflows.
+ */
+static int xdp_rx(struct pppoat_xdp_ctx *ctx, int wr)
+{
+	struct xdp_ring *rx   = &ctx->xc_rx;
+	struct xdp_ring *fill = &ctx->xc_fill;
+	struct xdp_desc *desc = rx->xr_desc;
+	uint64_t        *addr = fill->xr_desc;
+	uint32_t         mask = rx->xr_size - 1;
+	uint32_t         prod;
+	uint32_t         cons;
+	int              rc   = 0;
+
+	prod = __atomic_load_n(rx->xr_producer, __ATOMIC_ACQUIRE);
+	for (cons = rx->xr_cached; rc == 0 && cons != prod; ++cons) {
+		rc = xdp_rx_frame(ctx, &desc[cons & mask], wr);
+		/* Aligned UMEM: the frame is found from any address in it */
+		addr[fill->xr_cached++ & mask] =
+			desc[cons & mask].addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+	}
+	rx->xr_cached = cons;
+	__atomic_store_n(rx->xr_consumer, cons, __ATOMIC_RELEASE);
+	__atomic_store_n(fill->xr_producer, fill->xr_cached, __ATOMIC_RELEASE);
+	if (xdp_ring_needs_wakeup(fill))
+		(void)recvfrom(ctx->xc_sock, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+	return rc;
+}
+
+/* Longest chunk which fits the device MTU and a receiver's frame. */
+static size_t xdp_payload_max(struct pppoat_xdp_ctx *ctx)
+{
+	return pppoat_min(XDP_FRAME_DATA - ETH_HLEN, ctx->xc_mtu) -
+	       PPPOAT_ETHER_HDR_LEN;
+}
+
+/* Takes back TX frames the kernel has sent. */
+static void xdp_tx_complete(struct pppoat_xdp_ctx *ctx)
+{
+	struct xdp_ring *comp = &ctx->xc_comp;
+	uint64_t        *addr = comp->xr_desc;
+	uint32_t         prod;
+
+	prod = __atomic_load_n(comp->xr_producer, __ATOMIC_ACQUIRE);
+	for (; comp->xr_cached != prod; ++comp->xr_cached) {
+		ctx->xc_tx_free[ctx->xc_tx_free_nr++] =
+			addr[comp->xr_cached & (comp->xr_size - 1)];
+	}
+	__atomic_store_n(comp->xr_consumer, comp->xr_cached,
+			 __ATOMIC_RELEASE);
+}
+
+static void xdp_tx_kick(struct pppoat_xdp_ctx *ctx)
+{
+	ssize_t rc;
+
+	if (ctx->xc_zerocopy && !xdp_ring_needs_wakeup(&ctx->xc_tx))
+		return;
+	/* Copy mode transmits from the syscall, so it always needs one */
+	rc = sendto(ctx->xc_sock, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	if (rc < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+	    errno != ENETDOWN)
+		pppoat_debug("xdp", "sendto errno=%d", errno);
+	++ctx->xc_tx_kicks;
+}
+
+/*
+ * Reads packets from the interface into free TX frames while the pipe
+ * has any, then kicks the kernel once for the batch. TX ring has room
+ * for all TX frames.
+ */
+static int xdp_tx(struct pppoat_xdp_ctx *ctx, int rd)
+{
+	struct xdp_ring *tx   = &ctx->xc_tx;
+	struct xdp_desc *desc = tx->xr_desc;
+	unsigned char   *frame;
+	unsigned int     nr   = 0;
+	uint64_t         addr;
+	size_t           max;
+	ssize_t          len;
+	int              rc   = 0;
+
+	/* The pipe is a stream, a longer packet continues in the next frame */
+	max = xdp_payload_max(ctx);
+	while (rc == 0 && nr < XDP_TX_BATCH && ctx->xc_tx_free_nr > 0) {
+		addr  = ctx->xc_tx_free[ctx->xc_tx_free_nr - 1];
+		frame = ctx->xc_umem + addr;
+		len   = read(rd, frame + ETH_HLEN + PPPOAT_ETHER_HDR_LEN, max);
+		if (len == 0)
+			rc = P_ERR(-EPIPE);
+		else if (len < 0)
+			rc = errno == EAGAIN || errno == EINTR ? 1 :
+			     P_ERR(-errno);
+		if (rc != 0)
+			break;
+
+		pppoat_ether_hdr_put(frame, ctx->xc_peer, ctx->xc_mac,
+				     ctx->xc_type, ctx->xc_queue, len);
+
+		desc[tx->xr_cached & (tx->xr_size - 1)] = (struct xdp_desc){
+			.addr = addr,
+			.len  = ETH_HLEN + PPPOAT_ETHER_HDR_LEN + len,
+		};
+		++tx->xr_cached;
+		--ctx->xc_tx_free_nr;
+		++nr;
+	}
+	if (nr > 0) {
+		__atomic_store_n(tx->xr_producer, tx->xr_cached,
+				 __ATOMIC_RELEASE);
+		ctx->xc_tx_frames += nr;
+		xdp_tx_kick(ctx);
+	}
+	return rc == 1 ? 0 : rc;
+}
+
+static int module_xdp_run(int rd, int wr, int ctrl, void *userdata)
+{
+	struct pppoat_xdp_ctx *ctx = userdata;
+	fd_set                 rfds;
+	uint64_t               timeout;
+	bool                   tx_full;
+	int                    rc;
+
+	rc = pppoat_util_fd_nonblock_set(rd, true);
+	/* Packets which fit a frame are never split */
+	if (rc == 0 && ctx->xc_queue == 0)
+		(void)pppoat_if_mtu_set(xdp_payload_max(ctx));
+
+	while (rc == 0) {
+		/*
+		 * Interface waits while the TX pool is empty, completions
+		 * don't wake the socket up, so they are polled.
+		 */
+		xdp_tx_complete(ctx);
+		tx_full = ctx->xc_tx_free_nr == 0;
+		if (tx_full)
+			xdp_tx_kick(ctx);
+		timeout = tx_full ? XDP_TX_RETRY : PPPOAT_TIME_NEVER;
+		FD_ZERO(&rfds);
+		FD_SET(ctx->xc_sock, &rfds);
+		if (!tx_full)
+			FD_SET(rd, &rfds);
+		rc = pppoat_util_select_timed(pppoat_max(rd, ctx->xc_sock),
+					      &rfds, NULL, timeout);
+		if (rc <= 0)
+			continue;
+		rc = 0;
+
+		if (FD_ISSET(ctx->xc_sock, &rfds))
+			rc = xdp_rx(ctx, wr);
+		if (rc == 0 && !tx_full && FD_ISSET(rd, &rfds))
+			rc = xdp_tx(ctx, rd);
+	}
+	return rc;
+}
+
+const struct pppoat_module pppoat_module_xdp = {
+	.m_name  = "xdp",
+	.m_descr = "PPP over raw Ethernet (AF_XDP)",
+	.m_init  = &module_xdp_init,
+	.m_fini  = &module_xdp_fini,
+	.m_run   = &module_xdp_run,
+};
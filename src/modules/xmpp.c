@@ -18,9 +18,12 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <strophe.h>
+#include <sys/select.h>
 #include <unistd.h>
 
 #include "trace.h"
@@ -32,25 +35,52 @@
 #include "pppoat.h"
 #include "util.h"
 
-#define PPPOAT_XMPP_TIMEOUT  1
 #define PPPOAT_XMPP_BUF_SIZE 4096
+/* Msec libstrophe waits while connecting, before the socket is known */
+#define PPPOAT_XMPP_CONNECT_TIMEOUT 100
+/* Stanzas queued in libstrophe before the pipe isn't read any more */
+#define PPPOAT_XMPP_QUEUE_MAX 64
+/*
+ * libstrophe reads 4096 bytes a time, a TLS record of 16KiB may stay
+ * buffered in OpenSSL after the socket is drained.
+ */
+#define PPPOAT_XMPP_TLS_READS 4
 
 #define XMPP_NS_XEP_0091 "jabber:x:delay"
 #define XMPP_NS_XEP_0203 "urn:xmpp:delay"
+/* Marks a body which carries several packets, see pppoat_xmpp_drain() */
+#define XMPP_NS_PPPOAT_BATCH "urn:pppoat:batch"
+
+/* Batches flush at this many bytes, packets or usec after the first one */
+#define PPPOAT_XMPP_BATCH_SIZE    16384
+#define PPPOAT_XMPP_BATCH_PACKETS 32
+#define PPPOAT_XMPP_BATCH_DELAY   1000
+/* Every packet of a batch is prefixed with 16-bit length */
+#define PPPOAT_XMPP_BATCH_HDR     2
 
 struct pppoat_xmpp_ctx {
-	pppoat_node_type_t  xc_type;
-	xmpp_log_t          xc_log;
-	xmpp_ctx_t         *xc_ctx;
-	xmpp_conn_t        *xc_conn;
-	const char         *xc_jid;
-	const char         *xc_passwd;
-	char               *xc_to;
-	bool                xc_connected;
-	bool                xc_stop;
-	bool                xc_to_trusted;
-	int                 xc_rd;
-	int                 xc_wr;
+	pppoat_node_type_t      xc_type;
+	xmpp_log_t              xc_log;
+	xmpp_ctx_t             *xc_ctx;
+	xmpp_conn_t            *xc_conn;
+	const char             *xc_jid;
+	const char             *xc_passwd;
+	char                   *xc_to;
+	bool                    xc_connected;
+	bool                    xc_stop;
+	bool                    xc_to_trusted;
+	int                     xc_rd;
+	int                     xc_wr;
+	/* libstrophe's socket, known from the sockopt callback */
+	int                     xc_fd;
+	struct pppoat_xmpp_ctx *xc_next;
+	unsigned char          *xc_batch;
+	size_t                  xc_batch_len;
+	unsigned long           xc_batch_nr;
+	uint64_t                xc_batch_deadline;
+	size_t                  xc_batch_size;
+	unsigned long           xc_batch_packets;
+	unsigned long           xc_batch_delay;
 };
 
 static void pppoat_xmpp_log(void                  *userdata,
@@ -93,13 +123,22 @@ static void pppoat_xmpp_parse_args(struct pppoat_conf      *conf,
 	PPPOAT_ASSERT(ctx->xc_jid != NULL);
 	PPPOAT_ASSERT(ctx->xc_passwd != NULL);
 	PPPOAT_ASSERT(ctx->xc_type == PPPOAT_NODE_MASTER || ctx->xc_to != NULL);
+
+	ctx->xc_batch_size    = pppoat_conf_get_ulong(conf, "xmpp.batch_size",
+						      PPPOAT_XMPP_BATCH_SIZE);
+	ctx->xc_batch_packets = pppoat_conf_get_ulong(conf,
+			"xmpp.batch_packets", PPPOAT_XMPP_BATCH_PACKETS);
+	ctx->xc_batch_delay   = pppoat_conf_get_ulong(conf, "xmpp.batch_delay",
+						      PPPOAT_XMPP_BATCH_DELAY);
 }
 
 static int pppoat_xmpp_send_buf(struct pppoat_xmpp_ctx *ctx,
 				const unsigned char    *buf,
-				size_t                  len)
+				size_t                  len,
+				bool                    batch)
 {
 	xmpp_stanza_t *message;
+	xmpp_stanza_t *mark;
 	char          *b64;
 	int            rc;
 
@@ -112,6 +151,15 @@ static int pppoat_xmpp_send_buf(struct pppoat_xmpp_ctx *ctx,
 	PPPOAT_ASSERT(message != NULL);
 	rc = xmpp_message_set_body(message, b64);
 	PPPOAT_ASSERT(rc == XMPP_EOK);
+	if (batch) {
+		mark = xmpp_stanza_new(ctx->xc_ctx);
+		PPPOAT_ASSERT(mark != NULL);
+		rc = xmpp_stanza_set_name(mark, "batch");
+		rc = rc ?: xmpp_stanza_set_ns(mark, XMPP_NS_PPPOAT_BATCH);
+		rc = rc ?: xmpp_stanza_add_child(message, mark);
+		PPPOAT_ASSERT(rc == XMPP_EOK);
+		xmpp_stanza_release(mark);
+	}
 	xmpp_send(ctx->xc_conn, message);
 	xmpp_stanza_release(message);
 	pppoat_free(b64);
@@ -140,6 +188,14 @@ static int module_xmpp_init(struct pppoat_conf *conf, void **userdata)
 		ctx->xc_connected  = false;
 		ctx->xc_stop       = false;
 		ctx->xc_to_trusted = false;
+		ctx->xc_fd         = -1;
+		ctx->xc_batch_len  = 0;
+		ctx->xc_batch_nr   = 0;
+		/* Room for one more read past the flush size */
+		ctx->xc_batch = pppoat_alloc(ctx->xc_batch_size +
+					     PPPOAT_XMPP_BATCH_HDR +
+					     PPPOAT_XMPP_BUF_SIZE);
+		PPPOAT_ASSERT(ctx->xc_batch != NULL);
 
 		resource = ctx->xc_to == NULL ? NULL :
 			   xmpp_jid_resource(ctx->xc_ctx, ctx->xc_to);
@@ -159,12 +215,37 @@ static void module_xmpp_fini(void *userdata)
 	struct pppoat_xmpp_ctx *ctx = userdata;
 
 	pppoat_free(ctx->xc_to);
+	pppoat_free(ctx->xc_batch);
 	xmpp_conn_release(ctx->xc_conn);
 	xmpp_ctx_free(ctx->xc_ctx);
 	pppoat_free(ctx);
 	xmpp_shutdown();
 }
 
+/* Writes packets of a batch to the interface one by one. */
+static int pppoat_xmpp_unbatch(struct pppoat_xmpp_ctx *ctx,
+			       const unsigned char    *raw,
+			       size_t                  raw_len)
+{
+	size_t off;
+	size_t len;
+	int    rc = 0;
+
+	for (off = 0; off < raw_len && rc == 0; off += len) {
+		len = PPPOAT_XMPP_BATCH_HDR;
+		if (raw_len - off >= len)
+			len += raw[off] << 8 | raw[off + 1];
+		if (raw_len - off < len) {
+			pppoat_debug("xmpp", "Truncated batch");
+			break;
+		}
+		rc = pppoat_util_write(ctx->xc_wr,
+				       raw + off + PPPOAT_XMPP_BATCH_HDR,
+				       len - PPPOAT_XMPP_BATCH_HDR);
+	}
+	return rc;
+}
+
 static int message_handler(xmpp_conn_t * const   conn,
 			   xmpp_stanza_t * const stanza,
 			   void * const          userdata)
@@ -175,9 +256,8 @@ static int message_handler(xmpp_conn_t * const   conn,
 	const char             *from;
 	char                   *b64;
 	char                   *bare;
-	ssize_t                 written;
 	size_t                  raw_len;
-	int                     rc;
+	int                     rc  = 0;
 
 	/* Ignore delayed messages */
 	delay = xmpp_stanza_get_child_by_ns(stanza, XMPP_NS_XEP_0091);
@@ -226,12 +306,22 @@ static int message_handler(xmpp_conn_t * const   conn,
 	rc = pppoat_base64_dec_new(b64, strlen(b64), &raw, &raw_len);
 	PPPOAT_ASSERT(rc == 0);
 
-	written = write(ctx->xc_wr, raw, raw_len);
-	PPPOAT_ASSERT_INFO(written == raw_len, "written=%zi", written);
+	if (xmpp_stanza_get_child_by_ns(stanza, XMPP_NS_PPPOAT_BATCH) != NULL) {
+		rc = pppoat_xmpp_unbatch(ctx, raw, raw_len);
+	} else {
+		rc = pppoat_util_write(ctx->xc_wr, raw, raw_len);
+	}
 
 	pppoat_free(raw);
 	xmpp_free(ctx->xc_ctx, b64);
 
+	if (rc != 0) {
+		/* The interface is gone, stop the run loop */
+		pppoat_error("xmpp", "Can't write to interface, rc=%d", rc);
+		ctx->xc_stop = true;
+		xmpp_disconnect(conn);
+		return 0;
+	}
 	return 1;
 }
 
@@ -257,15 +347,108 @@ static void conn_handler(xmpp_conn_t * const         conn,
 		pppoat_debug("xmpp", "Disconnected with error=%d, "
 				     "stream_error=%d", error, stream_error);
 		ctx->xc_stop = true;
+		ctx->xc_fd   = -1;
 	}
 }
 
+/*
+ * libstrophe passes no userdata to the sockopt callback, so running
+ * contexts are found by their connection. Every queue of a multiqueue
+ * interface runs its own context.
+ */
+static struct pppoat_xmpp_ctx *xmpp_running;
+static pthread_mutex_t         xmpp_running_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void xmpp_running_add(struct pppoat_xmpp_ctx *ctx)
+{
+	pthread_mutex_lock(&xmpp_running_lock);
+	ctx->xc_next = xmpp_running;
+	xmpp_running = ctx;
+	pthread_mutex_unlock(&xmpp_running_lock);
+}
+
+static void xmpp_running_del(struct pppoat_xmpp_ctx *ctx)
+{
+	struct pppoat_xmpp_ctx **pos;
+
+	pthread_mutex_lock(&xmpp_running_lock);
+	for (pos = &xmpp_running; *pos != ctx; pos = &(*pos)->xc_next)
+		PPPOAT_ASSERT(*pos != NULL);
+	*pos = ctx->xc_next;
+	pthread_mutex_unlock(&xmpp_running_lock);
+}
+
+static int sockopt_handler(xmpp_conn_t *conn, void *sock)
+{
+	struct pppoat_xmpp_ctx *ctx;
+
+	pthread_mutex_lock(&xmpp_running_lock);
+	for (ctx = xmpp_running; ctx != NULL; ctx = ctx->xc_next)
+		if (ctx->xc_conn == conn)
+			break;
+	pthread_mutex_unlock(&xmpp_running_lock);
+	PPPOAT_ASSERT(ctx != NULL);
+	ctx->xc_fd = *(int *)sock;
+	return xmpp_sockopt_cb_keepalive(conn, sock);
+}
+
+static int pppoat_xmpp_flush(struct pppoat_xmpp_ctx *ctx)
+{
+	int rc = 0;
+
+	if (ctx->xc_batch_nr > 0)
+		rc = pppoat_xmpp_send_buf(ctx, ctx->xc_batch,
+					  ctx->xc_batch_len, true);
+	ctx->xc_batch_len = 0;
+	ctx->xc_batch_nr  = 0;
+	return rc;
+}
+
+/*
+ * Reads everything the interface has while libstrophe's queue is short.
+ * Packets are packed into a batch, each after its 16-bit length, and the
+ * batch is sent as one stanza when it reaches xmpp.batch_size bytes or
+ * xmpp.batch_packets packets. The rest goes when the connection is idle
+ * or xmpp.batch_delay passes, see module_xmpp_run().
+ */
+static int pppoat_xmpp_drain(struct pppoat_xmpp_ctx *ctx)
+{
+	unsigned char *rec;
+	ssize_t        len;
+	int            rc = 0;
+
+	while (rc == 0 &&
+	       xmpp_conn_send_queue_len(ctx->xc_conn) < PPPOAT_XMPP_QUEUE_MAX) {
+		rec = ctx->xc_batch + ctx->xc_batch_len;
+		len = read(ctx->xc_rd, rec + PPPOAT_XMPP_BATCH_HDR,
+			   PPPOAT_XMPP_BUF_SIZE);
+		if (len < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 :
+							       P_ERR(-errno);
+		if (len == 0)
+			return P_ERR(-EPIPE);
+		rec[0] = (unsigned char)(len >> 8);
+		rec[1] = (unsigned char)len;
+		if (ctx->xc_batch_nr++ == 0)
+			ctx->xc_batch_deadline = pppoat_util_time_us() +
+						 ctx->xc_batch_delay;
+		ctx->xc_batch_len += PPPOAT_XMPP_BATCH_HDR + len;
+		if (ctx->xc_batch_len >= ctx->xc_batch_size ||
+		    ctx->xc_batch_nr >= ctx->xc_batch_packets)
+			rc = pppoat_xmpp_flush(ctx);
+	}
+	return rc;
+}
+
 static int module_xmpp_run(int rd, int wr, int ctrl, void *userdata)
 {
 	struct pppoat_xmpp_ctx *ctx  = userdata;
 	xmpp_conn_t            *conn = ctx->xc_conn;
-	unsigned char          *buf;
-	ssize_t                 len;
+	fd_set                  rfds;
+	fd_set                  wfds;
+	uint64_t                now;
+	uint64_t                timeout;
+	int                     reads;
 	int                     rc;
 
 	ctx->xc_rd = rd;
@@ -273,26 +456,52 @@ static int module_xmpp_run(int rd, int wr, int ctrl, void *userdata)
 
 	rc = pppoat_util_fd_nonblock_set(rd, true);
 	PPPOAT_ASSERT(rc == 0);
-	buf = pppoat_alloc(PPPOAT_XMPP_BUF_SIZE);
-	PPPOAT_ASSERT(buf != NULL);
 
 	xmpp_conn_set_jid(conn, ctx->xc_jid);
 	xmpp_conn_set_pass(conn, ctx->xc_passwd);
+	xmpp_running_add(ctx);
+	xmpp_conn_set_sockopt_callback(conn, &sockopt_handler);
 	xmpp_connect_client(conn, NULL, 0, &conn_handler, userdata);
 
-	while (!ctx->xc_stop) {
-		xmpp_run_once(ctx->xc_ctx, PPPOAT_XMPP_TIMEOUT);
-
-		if (!ctx->xc_connected)
+	while (!ctx->xc_stop && rc == 0) {
+		if (!ctx->xc_connected || ctx->xc_fd < 0) {
+			xmpp_run_once(ctx->xc_ctx, PPPOAT_XMPP_CONNECT_TIMEOUT);
 			continue;
-
-		len = read(rd, buf, PPPOAT_XMPP_BUF_SIZE);
-		if (len > 0) {
-			rc = pppoat_xmpp_send_buf(ctx, buf, (size_t)len);
-			PPPOAT_ASSERT(rc == 0);
 		}
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(ctx->xc_fd, &rfds);
+		if (xmpp_conn_send_queue_len(conn) < PPPOAT_XMPP_QUEUE_MAX)
+			FD_SET(rd, &rfds);
+		if (xmpp_conn_send_queue_len(conn) > 0)
+			FD_SET(ctx->xc_fd, &wfds);
+		now     = pppoat_util_time_us();
+		timeout = ctx->xc_batch_nr == 0 ? PPPOAT_TIME_NEVER :
+			  ctx->xc_batch_deadline -
+			  pppoat_min(now, ctx->xc_batch_deadline);
+		rc = pppoat_util_select_timed(pppoat_max(rd, ctx->xc_fd),
+					      &rfds, &wfds, timeout);
+		if (rc < 0)
+			break;
+		rc = 0;
+
+		if (FD_ISSET(rd, &rfds))
+			rc = pppoat_xmpp_drain(ctx);
+		/* A batch waits only while earlier stanzas are being sent */
+		if (rc == 0 && ctx->xc_batch_nr > 0 &&
+		    (xmpp_conn_send_queue_len(conn) == 0 ||
+		     pppoat_util_time_us() >= ctx->xc_batch_deadline))
+			rc = pppoat_xmpp_flush(ctx);
+		/* Writes the queue out and handles what came in */
+		reads = FD_ISSET(ctx->xc_fd, &rfds) &&
+			xmpp_conn_is_secured(conn) ? PPPOAT_XMPP_TLS_READS : 1;
+		while (reads-- > 0 && !ctx->xc_stop)
+			xmpp_run_once(ctx->xc_ctx, 0);
 	}
-	return 0;
+	xmpp_running_del(ctx);
+
+	return rc;
 }
 
 const struct pppoat_module pppoat_module_xmpp = {
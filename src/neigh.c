@@ -0,0 +1,282 @@
+/* neigh.c
+ * PPP over Any Transport -- ARP/ND proxy
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>	/* AF_INET */
+
+#include "trace.h"
+#include "neigh.h"
+#include "memory.h"
+#include "util.h"
+
+enum {
+	NEIGH_ETH_HLEN  = 14,
+	/* Ethernet header and ARP packet for IPv4 */
+	NEIGH_ARP_LEN   = NEIGH_ETH_HLEN + 28,
+	/* Ethernet, IPv6 and ICMPv6 headers with the target address */
+	NEIGH_ND_LEN    = NEIGH_ETH_HLEN + 40 + 24,
+	/* Neighbour advertisement with target link-layer address option */
+	NEIGH_NA_LEN    = NEIGH_ND_LEN + 8,
+	NEIGH_ARP_REQUEST = 1,
+	NEIGH_ARP_REPLY   = 2,
+	NEIGH_ND_NS       = 135,
+	NEIGH_ND_NA       = 136,
+	NEIGH_ND_OPT_SLLA = 1,
+	NEIGH_ND_OPT_TLLA = 2,
+};
+
+static const unsigned char neigh_arp_hdr[] = {
+	/* Ethernet, IPv4, address lengths */
+	0x00, 0x01, 0x08, 0x00, 6, 4,
+};
+
+static uint16_t neigh_get16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static bool neigh_is_arp(const unsigned char *f, size_t len)
+{
+	return len >= NEIGH_ARP_LEN && neigh_get16(f + 12) == 0x0806 &&
+	       memcmp(f + 14, neigh_arp_hdr, sizeof(neigh_arp_hdr)) == 0;
+}
+
+/* Returns ICMPv6 type of a neighbour discovery message or 0. */
+static unsigned int neigh_nd_type(const unsigned char *f, size_t len)
+{
+	/* Hop limit 255 proves the message wasn't forwarded */
+	if (len < NEIGH_ND_LEN || neigh_get16(f + 12) != 0x86dd ||
+	    f[20] != IPPROTO_ICMPV6 || f[21] != 255 || f[55] != 0)
+		return 0;
+	return f[54];
+}
+
+bool pppoat_neigh_is_nd(const unsigned char *frame, size_t len)
+{
+	unsigned int type = neigh_nd_type(frame, len);
+
+	/* Router and neighbour solicitations/advertisements, redirect */
+	return neigh_is_arp(frame, len) || (type >= 133 && type <= 137);
+}
+
+/* Link-layer address option of a neighbour discovery message. */
+static const unsigned char *neigh_nd_lladdr(const unsigned char *f,
+					    size_t               len,
+					    unsigned int         type)
+{
+	size_t off = NEIGH_ND_LEN;
+	size_t olen;
+
+	while (off + 8 <= len) {
+		olen = (size_t)f[off + 1] * 8;
+		if (olen == 0 || off + olen > len)
+			break;
+		if (f[off] == type && olen == 8)
+			return f + off + 2;
+		off += olen;
+	}
+	return NULL;
+}
+
+static struct pppoat_neigh_entry *neigh_find(struct pppoat_neigh *nb,
+					     int                  family,
+					     const unsigned char *addr)
+{
+	size_t alen = family == AF_INET ? 4 : 16;
+	size_t i;
+
+	for (i = 0; i < nb->nb_nr; ++i)
+		if (nb->nb_entries[i].ne_family == family &&
+		    memcmp(nb->nb_entries[i].ne_addr, addr, alen) == 0)
+			return &nb->nb_entries[i];
+	return NULL;
+}
+
+static void neigh_update(struct pppoat_neigh *nb,
+			 int                  family,
+			 const unsigned char *addr,
+			 const unsigned char *mac,
+			 uint64_t             now)
+{
+	struct pppoat_neigh_entry *ne = neigh_find(nb, family, addr);
+	size_t                     i;
+
+	/* Group addresses are never bindings */
+	if (mac[0] & 0x01)
+		return;
+	if (ne == NULL && nb->nb_nr < nb->nb_max) {
+		ne = &nb->nb_entries[nb->nb_nr++];
+	} else if (ne == NULL) {
+		/* Replace the least recently confirmed entry */
+		ne = &nb->nb_entries[0];
+		for (i = 1; i < nb->nb_nr; ++i)
+			if (nb->nb_entries[i].ne_seen < ne->ne_seen)
+				ne = &nb->nb_entries[i];
+	}
+	if (ne->ne_family != family || memcmp(ne->ne_mac, mac, 6) != 0)
+		++nb->nb_learned;
+	ne->ne_family = family;
+	memcpy(ne->ne_addr, addr, family == AF_INET ? 4 : 16);
+	memcpy(ne->ne_mac, mac, 6);
+	ne->ne_seen = now;
+}
+
+int pppoat_neigh_init(struct pppoat_neigh *nb, size_t max, uint64_t timeout)
+{
+	int rc;
+
+	memset(nb, 0, sizeof(*nb));
+	nb->nb_entries = pppoat_calloc(max, sizeof(*nb->nb_entries));
+	nb->nb_max     = max;
+	nb->nb_timeout = timeout;
+	rc = nb->nb_entries == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: -pthread_mutex_init(&nb->nb_lock, NULL);
+
+	return rc;
+}
+
+void pppoat_neigh_fini(struct pppoat_neigh *nb)
+{
+	pthread_mutex_destroy(&nb->nb_lock);
+	pppoat_free(nb->nb_entries);
+}
+
+void pppoat_neigh_learn(struct pppoat_neigh *nb,
+			const unsigned char *frame,
+			size_t               len,
+			uint64_t             now)
+{
+	static const unsigned char zero[16];
+	const unsigned char       *mac;
+	unsigned int               type;
+
+	pthread_mutex_lock(&nb->nb_lock);
+	type = neigh_nd_type(frame, len);
+	if (neigh_is_arp(frame, len)) {
+		/* Sender address of ARP probes is 0.0.0.0 */
+		if (memcmp(frame + 28, zero, 4) != 0)
+			neigh_update(nb, AF_INET, frame + 28, frame + 22, now);
+	} else if (type == NEIGH_ND_NS &&
+		   memcmp(frame + 22, zero, 16) != 0) {
+		mac = neigh_nd_lladdr(frame, len, NEIGH_ND_OPT_SLLA);
+		neigh_update(nb, AF_INET6, frame + 22, mac ?: frame + 6, now);
+	} else if (type == NEIGH_ND_NA) {
+		mac = neigh_nd_lladdr(frame, len, NEIGH_ND_OPT_TLLA);
+		neigh_update(nb, AF_INET6, frame + 62, mac ?: frame + 6, now);
+	}
+	pthread_mutex_unlock(&nb->nb_lock);
+}
+
+static uint16_t neigh_csum(const unsigned char *p, size_t len, uint32_t sum)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += neigh_get16(p + i);
+	if (len % 2 != 0)
+		sum += (uint32_t)p[len - 1] << 8;
+	while (sum >> 16 != 0)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static size_t neigh_arp_reply(const struct pppoat_neigh_entry *ne,
+			      const unsigned char             *req,
+			      unsigned char                   *r)
+{
+	memcpy(r, req + 6, 6);
+	memcpy(r + 6, ne->ne_mac, 6);
+	memcpy(r + 12, req + 12, 2 + sizeof(neigh_arp_hdr));
+	r[20] = 0;
+	r[21] = NEIGH_ARP_REPLY;
+	memcpy(r + 22, ne->ne_mac, 6);
+	memcpy(r + 28, req + 38, 4);
+	memcpy(r + 32, req + 22, 10);
+
+	return NEIGH_ARP_LEN;
+}
+
+static size_t neigh_na(const struct pppoat_neigh_entry *ne,
+		       const unsigned char             *ns,
+		       unsigned char                   *r)
+{
+	unsigned char *icmp = r + 54;
+	uint16_t       csum;
+
+	memset(r, 0, NEIGH_NA_LEN);
+	memcpy(r, ns + 6, 6);
+	memcpy(r + 6, ne->ne_mac, 6);
+	r[12] = 0x86;
+	r[13] = 0xdd;
+	r[14] = 0x60;
+	r[19] = NEIGH_NA_LEN - 54;
+	r[20] = IPPROTO_ICMPV6;
+	r[21] = 255;
+	memcpy(r + 22, ne->ne_addr, 16);
+	memcpy(r + 38, ns + 22, 16);
+	icmp[0] = NEIGH_ND_NA;
+	/* Solicited and override flags */
+	icmp[4] = 0x60;
+	memcpy(icmp + 8, ne->ne_addr, 16);
+	icmp[24] = NEIGH_ND_OPT_TLLA;
+	icmp[25] = 1;
+	memcpy(icmp + 26, ne->ne_mac, 6);
+
+	csum = neigh_csum(r + 22, 32, IPPROTO_ICMPV6 + NEIGH_NA_LEN - 54);
+	csum = neigh_csum(icmp, NEIGH_NA_LEN - 54, (uint16_t)~csum);
+	icmp[2] = csum >> 8;
+	icmp[3] = csum & 0xff;
+
+	return NEIGH_NA_LEN;
+}
+
+size_t pppoat_neigh_proxy(struct pppoat_neigh *nb,
+			  const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *reply,
+			  size_t               size,
+			  uint64_t             now)
+{
+	static const unsigned char  zero[16];
+	struct pppoat_neigh_entry  *ne = NULL;
+	size_t                      rlen = 0;
+
+	pthread_mutex_lock(&nb->nb_lock);
+	if (neigh_is_arp(frame, len) && size >= NEIGH_ARP_LEN &&
+	    frame[21] == NEIGH_ARP_REQUEST &&
+	    memcmp(frame + 28, frame + 38, 4) != 0) {
+		ne = neigh_find(nb, AF_INET, frame + 38);
+		if (ne != NULL && now - ne->ne_seen <= nb->nb_timeout)
+			rlen = neigh_arp_reply(ne, frame, reply);
+	} else if (neigh_nd_type(frame, len) == NEIGH_ND_NS &&
+		   size >= NEIGH_NA_LEN &&
+		   /* Duplicate address detection is left to the owner */
+		   memcmp(frame + 22, zero, 16) != 0) {
+		ne = neigh_find(nb, AF_INET6, frame + 62);
+		if (ne != NULL && now - ne->ne_seen <= nb->nb_timeout)
+			rlen = neigh_na(ne, frame, reply);
+	}
+	if (rlen > 0)
+		++nb->nb_answered;
+	pthread_mutex_unlock(&nb->nb_lock);
+
+	return rlen;
+}
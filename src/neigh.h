@@ -0,0 +1,80 @@
+/* neigh.h
+ * PPP over Any Transport -- ARP/ND proxy
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_NEIGH_H__
+#define __PPPOAT_NEIGH_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cache of IP to MAC bindings of the remote side. The bindings are
+ * learnt from ARP and neighbour discovery frames which come from the
+ * transport. Local ARP requests and neighbour solicitations for cached
+ * addresses are answered without crossing the link.
+ *
+ * Frames are Ethernet frames without VLAN tags.
+ */
+
+struct pppoat_neigh_entry {
+	int           ne_family;
+	unsigned char ne_addr[16];
+	unsigned char ne_mac[6];
+	uint64_t      ne_seen;
+};
+
+struct pppoat_neigh {
+	pthread_mutex_t            nb_lock;
+	struct pppoat_neigh_entry *nb_entries;
+	size_t                     nb_max;
+	size_t                     nb_nr;
+	/* Entries not confirmed for nb_timeout usec aren't used */
+	uint64_t                   nb_timeout;
+	/* Statistics */
+	unsigned long              nb_learned;
+	unsigned long              nb_answered;
+};
+
+int pppoat_neigh_init(struct pppoat_neigh *nb, size_t max, uint64_t timeout);
+void pppoat_neigh_fini(struct pppoat_neigh *nb);
+
+/* Learns bindings from a frame which came from the remote side. */
+void pppoat_neigh_learn(struct pppoat_neigh *nb,
+			const unsigned char *frame,
+			size_t               len,
+			uint64_t             now);
+
+/*
+ * Builds the answer to an ARP request or neighbour solicitation for a
+ * cached address. Returns length of the answer or 0 if the frame must
+ * be forwarded.
+ */
+size_t pppoat_neigh_proxy(struct pppoat_neigh *nb,
+			  const unsigned char *frame,
+			  size_t               len,
+			  unsigned char       *reply,
+			  size_t               size,
+			  uint64_t             now);
+
+/* True for ARP frames and neighbour solicitations/advertisements. */
+bool pppoat_neigh_is_nd(const unsigned char *frame, size_t len);
+
+#endif /* __PPPOAT_NEIGH_H__ */
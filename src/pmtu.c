@@ -0,0 +1,108 @@
+/* pmtu.c
+ * PPP over Any Transport -- Path MTU discovery
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+#include "pmtu.h"
+#include "util.h"
+
+enum {
+	/* Lost probes before the size is considered too large */
+	PMTU_TRIES_MAX = 3,
+};
+
+void pppoat_pmtu_init(struct pppoat_pmtu *pm,
+		      size_t              min,
+		      size_t              max,
+		      uint64_t            timeout,
+		      uint64_t            interval,
+		      uint64_t            now)
+{
+	PPPOAT_ASSERT(min <= max);
+
+	pm->pm_min      = min;
+	pm->pm_max      = max;
+	pm->pm_mtu      = min;
+	pm->pm_hi       = max + 1;
+	pm->pm_probe    = 0;
+	pm->pm_id       = 0;
+	pm->pm_tries    = 0;
+	pm->pm_done     = false;
+	pm->pm_confirm  = false;
+	pm->pm_timeout  = timeout;
+	pm->pm_interval = interval;
+	pm->pm_deadline = now;
+}
+
+static void pmtu_fail(struct pppoat_pmtu *pm)
+{
+	pm->pm_hi = pm->pm_probe;
+	if (pm->pm_probe <= pm->pm_mtu) {
+		/* Black hole, the path doesn't pass acknowledged size */
+		pm->pm_mtu = pm->pm_min;
+		pm->pm_hi  = pppoat_max(pm->pm_hi, pm->pm_min + 1);
+	}
+	pm->pm_probe = 0;
+	pm->pm_tries = 0;
+}
+
+size_t pppoat_pmtu_probe(struct pppoat_pmtu *pm, uint64_t now)
+{
+	if (now < pm->pm_deadline)
+		return 0;
+
+	if (pm->pm_probe != 0 && ++pm->pm_tries >= PMTU_TRIES_MAX)
+		pmtu_fail(pm);
+
+	if (pm->pm_probe == 0 && pm->pm_done) {
+		/* Periodic search */
+		pm->pm_done    = false;
+		pm->pm_confirm = pm->pm_mtu > pm->pm_min;
+		pm->pm_hi      = pm->pm_max + 1;
+	}
+	if (pm->pm_probe == 0 && pm->pm_confirm) {
+		pm->pm_probe   = pm->pm_mtu;
+		pm->pm_confirm = false;
+	} else if (pm->pm_probe == 0 && pm->pm_hi - pm->pm_mtu > 1) {
+		pm->pm_probe = pm->pm_mtu + (pm->pm_hi - pm->pm_mtu) / 2;
+	} else if (pm->pm_probe == 0) {
+		pm->pm_done     = true;
+		pm->pm_deadline = now + pm->pm_interval;
+		return 0;
+	}
+	++pm->pm_id;
+	pm->pm_deadline = now + pm->pm_timeout;
+
+	return pm->pm_probe;
+}
+
+void pppoat_pmtu_ack(struct pppoat_pmtu *pm, uint32_t id, uint64_t now)
+{
+	if (pm->pm_probe == 0 || id != pm->pm_id)
+		return;
+
+	pm->pm_mtu      = pppoat_max(pm->pm_mtu, pm->pm_probe);
+	pm->pm_probe    = 0;
+	pm->pm_tries    = 0;
+	pm->pm_deadline = now;
+}
+
+uint64_t pppoat_pmtu_deadline(const struct pppoat_pmtu *pm)
+{
+	return pm->pm_deadline;
+}
@@ -0,0 +1,71 @@
+/* pmtu.h
+ * PPP over Any Transport -- Path MTU discovery
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_PMTU_H__
+#define __PPPOAT_PMTU_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Packetization layer path MTU discovery (RFC 8899). Probes of growing
+ * size are sent with DF set and acknowledged by the peer, binary search
+ * finds the largest size which gets through. The search is repeated
+ * every pm_interval usec, it starts with confirming the current size, so
+ * a path which shrank (black hole) falls back to the base size.
+ *
+ * Sizes are transport payload sizes.
+ */
+
+struct pppoat_pmtu {
+	size_t   pm_min;
+	size_t   pm_max;
+	/* Largest acknowledged size */
+	size_t   pm_mtu;
+	/* Smallest size known not to get through */
+	size_t   pm_hi;
+	/* Size in flight or 0 */
+	size_t   pm_probe;
+	uint32_t pm_id;
+	unsigned pm_tries;
+	bool     pm_done;
+	bool     pm_confirm;
+	uint64_t pm_timeout;
+	uint64_t pm_interval;
+	uint64_t pm_deadline;
+};
+
+void pppoat_pmtu_init(struct pppoat_pmtu *pm,
+		      size_t              min,
+		      size_t              max,
+		      uint64_t            timeout,
+		      uint64_t            interval,
+		      uint64_t            now);
+
+/*
+ * Must be called at pppoat_pmtu_deadline(). Returns size of the probe to
+ * send with id pm_id or 0.
+ */
+size_t pppoat_pmtu_probe(struct pppoat_pmtu *pm, uint64_t now);
+/* Peer acknowledged probe with the id. */
+void pppoat_pmtu_ack(struct pppoat_pmtu *pm, uint32_t id, uint64_t now);
+uint64_t pppoat_pmtu_deadline(const struct pppoat_pmtu *pm);
+
+#endif /* __PPPOAT_PMTU_H__ */
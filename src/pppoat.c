@@ -19,6 +19,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -30,25 +31,66 @@
 #include "util.h"
 
 #include "if_pppd.h"
+#include "if_pppk.h"
 #include "if_stdio.h"
 #include "if_tun.h"
+#include "modules/bond.h"
+#include "modules/netem.h"
+#include "modules/eth.h"
+#include "modules/serial.h"
+#include "modules/shm.h"
+#include "modules/tcp.h"
 #include "modules/udp.h"
+#include "modules/ws.h"
+#include "modules/xdp.h"
 #include "modules/xmpp.h"
 
 static const struct pppoat_module *module_tbl[] =
 {
 	&pppoat_module_udp,
+	&pppoat_module_tcp,
+	&pppoat_module_tls,
+	&pppoat_module_shm,
+	&pppoat_module_eth,
+	&pppoat_module_xdp,
+	&pppoat_module_serial,
+	&pppoat_module_ws,
+	&pppoat_module_bond,
+	&pppoat_module_netem,
 	&pppoat_module_xmpp,
 };
 
 static const struct pppoat_if_module *if_module_tbl[] =
 {
 	&pppoat_if_module_pppd,
+	&pppoat_if_module_pppk,
 	&pppoat_if_module_tun,
 	&pppoat_if_module_tap,
 	&pppoat_if_module_stdio,
 };
 
+#define PPPOAT_QUEUES_MAX 16
+
+/* Transport instance serving a queue of the interface */
+struct pppoat_queue {
+	const struct pppoat_module *q_module;
+	void                       *q_data;
+	int                         q_rd[2];
+	int                         q_wr[2];
+	pthread_t                   q_thread;
+};
+
+/* Interface which is running */
+static const struct pppoat_if_module *if_module;
+static void                          *if_module_data;
+
+int pppoat_if_mtu_set(unsigned int mtu)
+{
+	if (if_module == NULL || if_module->im_mtu_set == NULL)
+		return -ENOSYS;
+	return if_module->im_mtu_set(if_module_data, mtu);
+}
+
 /* TODO Construct help message from the conf array. */
 static void help_print(FILE *f, char *name)
 {
@@ -67,7 +109,7 @@ static void help_print(FILE *f, char *name)
 		   "  --src=<ip> (-s)      Source IP for the tunnel\n");
 }
 
-static const struct pppoat_module *module_find(const char *name)
+const struct pppoat_module *pppoat_module_find(const char *name)
 {
 	int i;
 
@@ -102,17 +144,31 @@ static void module_list_print(FILE *f)
 					  module_tbl[i]->m_descr);
 }
 
+static void *queue_thread(void *userdata)
+{
+	struct pppoat_queue *q = userdata;
+	int                  rc;
+
+	rc = q->q_module->m_run(q->q_rd[0], q->q_wr[1], 0 /* XXX */,
+				q->q_data);
+	pppoat_debug("main", "Queue transport finished rc=%d", rc);
+
+	return NULL;
+}
+
 int main(int argc, char **argv)
 {
 	const struct pppoat_module    *m;
 	const struct pppoat_if_module *im;
 	struct pppoat_conf             conf;
+	struct pppoat_queue            queues[PPPOAT_QUEUES_MAX];
+	struct pppoat_queue           *q;
 	const char                    *if_name;
-	void                          *m_data;
 	void                          *im_data;
 	bool                           present;
-	int                            rd[2];
-	int                            wr[2];
+	char                           queue[12];
+	unsigned int                   queues_nr;
+	unsigned int                   i;
 	int                            rc;
 
 	pppoat_log_init(PPPOAT_DEBUG);
@@ -137,37 +193,73 @@ int main(int argc, char **argv)
 	if_name = pppoat_conf_get(&conf, "if");
 	im = if_name == NULL ? if_module_tbl[0] : if_module_find(if_name);
 	PPPOAT_ASSERT(im != NULL);
-	m = module_find(pppoat_conf_get(&conf, "module"));
+	m = pppoat_module_find(pppoat_conf_get(&conf, "module"));
 	PPPOAT_ASSERT(m != NULL);
 
 	/* init modules */
 	rc = im->im_init(&conf, &im_data);
 	PPPOAT_ASSERT_INFO(rc == 0, "rc=%d", rc);
-	rc = m->m_init(&conf, &m_data);
-	PPPOAT_ASSERT_INFO(rc == 0, "rc=%d", rc);
+	queues_nr = im->im_queues != NULL ? im->im_queues(im_data) : 1;
+	PPPOAT_ASSERT(queues_nr > 0 && queues_nr <= PPPOAT_QUEUES_MAX);
 
-	/* create pipes for communication with pppd */
-	rc = pipe(rd);
-	PPPOAT_ASSERT(rc == 0);
-	rc = pipe(wr);
+	/*
+	 * Every read from the tun pipe carries whole IP packets, the transport
+	 * attached to it may split them. Inner transports clear this key.
+	 */
+	rc = pppoat_conf_update(&conf, "if.packets",
+				im == &pppoat_if_module_tun ? "1" : "0");
 	PPPOAT_ASSERT(rc == 0);
 
-	/* exec pppd */
-	rc = im->im_run(wr[0], rd[1], im_data);
-	PPPOAT_ASSERT_INFO(rc == 0, "rc=%d", rc);
-	close(rd[1]);
-	close(wr[0]);
+	/*
+	 * Every queue of the interface gets its own transport instance. The
+	 * transport finds out its queue index from the "queue" key.
+	 */
+	for (i = 0; i < queues_nr; ++i) {
+		q = &queues[i];
+		q->q_module = m;
+		snprintf(queue, sizeof(queue), "%u", i);
+		rc = pppoat_conf_update(&conf, "queue", queue);
+		PPPOAT_ASSERT(rc == 0);
+		rc = m->m_init(&conf, &q->q_data);
+		PPPOAT_ASSERT_INFO(rc == 0, "rc=%d", rc);
+
+		/* create pipes for communication with pppd */
+		rc = pipe(q->q_rd);
+		PPPOAT_ASSERT(rc == 0);
+		rc = pipe(q->q_wr);
+		PPPOAT_ASSERT(rc == 0);
+
+		/* exec pppd */
+		rc = im->im_run(q->q_wr[0], q->q_rd[1], im_data);
+		PPPOAT_ASSERT_INFO(rc == 0, "rc=%d", rc);
+		close(q->q_rd[1]);
+		close(q->q_wr[0]);
+	}
+	if_module      = im;
+	if_module_data = im_data;
+
+	for (i = 1; i < queues_nr; ++i) {
+		rc = pthread_create(&queues[i].q_thread, NULL, &queue_thread,
+				    &queues[i]);
+		PPPOAT_ASSERT(rc == 0);
+	}
 
 	/* run appropriate module's function */
-	rc = m->m_run(rd[0], wr[1], 0 /* XXX */, m_data);
+	q = &queues[0];
+	rc = m->m_run(q->q_rd[0], q->q_wr[1], 0 /* XXX */, q->q_data);
 	pppoat_error("main", "rc=%d", rc);
 
 	/* finalisation */
+	if_module = NULL;
 	im->im_stop(im_data);
+	for (i = 1; i < queues_nr; ++i)
+		(void)pthread_join(queues[i].q_thread, NULL);
 	im->im_fini(im_data);
-	m->m_fini(m_data);
-	close(rd[0]);
-	close(wr[1]);
+	for (i = 0; i < queues_nr; ++i) {
+		m->m_fini(queues[i].q_data);
+		close(queues[i].q_rd[0]);
+		close(queues[i].q_wr[1]);
+	}
 
 quit:
 	pppoat_conf_fini(&conf);
@@ -43,4 +43,7 @@ struct pppoat_module {
 	int       (*m_run)(int rd, int wr, int ctrl, void *userdata);
 };
 
+/* Transport module by name, NULL if there is no such module. */
+const struct pppoat_module *pppoat_module_find(const char *name);
+
 #endif /* __PPPOAT_PPPOAT_H__ */
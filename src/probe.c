@@ -0,0 +1,116 @@
+/* probe.c
+ * PPP over Any Transport -- In-band path probing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>	/* memset */
+
+#include "trace.h"
+#include "probe.h"
+#include "util.h"
+
+void pppoat_probe_init(struct pppoat_probe *pr, uint64_t interval,
+		       uint64_t now)
+{
+	memset(pr, 0, sizeof(*pr));
+	pr->pr_interval  = interval;
+	pr->pr_next      = now;
+	pr->pr_last_pong = now;
+}
+
+bool pppoat_probe_ping_due(struct pppoat_probe *pr, uint64_t now)
+{
+	if (now < pr->pr_next)
+		return false;
+
+	pr->pr_down = now - pr->pr_last_pong >
+		      PPPOAT_PROBE_DOWN_PINGS * pr->pr_interval;
+	pr->pr_next = now + pr->pr_interval;
+	++pr->pr_pings;
+
+	return true;
+}
+
+void pppoat_probe_pong(struct pppoat_probe *pr,
+		       uint64_t             ts,
+		       uint32_t             rx_nr,
+		       uint32_t             rx_expected,
+		       uint64_t             now)
+{
+	uint64_t rtt;
+	uint64_t err;
+	uint32_t d_rx;
+	uint32_t d_exp;
+	uint32_t loss;
+
+	if (ts > now)
+		return;
+
+	rtt = now - ts;
+	if (!pr->pr_has_rtt) {
+		pr->pr_srtt    = rtt;
+		pr->pr_rttvar  = rtt / 2;
+		pr->pr_rtt_min = rtt;
+		pr->pr_has_rtt = true;
+	} else {
+		err = rtt > pr->pr_srtt ? rtt - pr->pr_srtt : pr->pr_srtt - rtt;
+		pr->pr_rttvar  = (3 * pr->pr_rttvar + err) / 4;
+		pr->pr_srtt    = (7 * pr->pr_srtt + rtt) / 8;
+		pr->pr_rtt_min = pppoat_min(pr->pr_rtt_min, rtt);
+	}
+
+	/* Counters wrap, differences are still correct */
+	d_exp = rx_expected - pr->pr_rep_expected;
+	d_rx  = rx_nr - pr->pr_rep_rx;
+	if (pr->pr_pongs > 0 && d_exp > 0 && d_exp < (1U << 31)) {
+		loss = d_rx >= d_exp ? 0 :
+		       (uint32_t)((uint64_t)(d_exp - d_rx) * 1000000 / d_exp);
+		pr->pr_loss_ppm = (3 * pr->pr_loss_ppm + loss) / 4;
+	}
+	pr->pr_rep_rx       = rx_nr;
+	pr->pr_rep_expected = rx_expected;
+	pr->pr_last_pong    = now;
+	pr->pr_down         = false;
+	++pr->pr_pongs;
+}
+
+uint64_t pppoat_probe_deadline(const struct pppoat_probe *pr)
+{
+	return pr->pr_next;
+}
+
+void pppoat_probe_rx_init(struct pppoat_probe_rx *prx)
+{
+	memset(prx, 0, sizeof(*prx));
+}
+
+void pppoat_probe_rx(struct pppoat_probe_rx *prx, uint16_t seq)
+{
+	int16_t delta = (int16_t)(seq - prx->prx_max);
+
+	if (!prx->prx_init) {
+		prx->prx_init     = true;
+		prx->prx_max      = seq;
+		prx->prx_expected = 1;
+	} else if (delta > 0) {
+		prx->prx_max       = seq;
+		prx->prx_expected += (uint16_t)delta;
+	} else {
+		++prx->prx_reordered;
+	}
+	++prx->prx_nr;
+}
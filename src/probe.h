@@ -0,0 +1,80 @@
+/* probe.h
+ * PPP over Any Transport -- In-band path probing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_PROBE_H__
+#define __PPPOAT_PROBE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Path quality estimation. Sender sends timestamped pings every
+ * pr_interval usec, the peer echoes them together with its receive
+ * counters for the path. RTT and its variation (jitter) are smoothed as
+ * in RFC 6298, loss is derived from per-path sequence numbers of data.
+ * A path without replies for PPPOAT_PROBE_DOWN_PINGS intervals is down.
+ */
+
+#define PPPOAT_PROBE_DOWN_PINGS 3
+
+/* Sender side of a path */
+struct pppoat_probe {
+	uint64_t      pr_interval;
+	uint64_t      pr_next;
+	uint64_t      pr_last_pong;
+	uint16_t      pr_tx_seq;
+	bool          pr_down;
+	bool          pr_has_rtt;
+	uint64_t      pr_srtt;
+	uint64_t      pr_rttvar;
+	uint64_t      pr_rtt_min;
+	/* Counters from the previous report of the peer */
+	uint32_t      pr_rep_rx;
+	uint32_t      pr_rep_expected;
+	/* Smoothed loss in parts per million */
+	uint32_t      pr_loss_ppm;
+	unsigned long pr_pings;
+	unsigned long pr_pongs;
+};
+
+/* Receiver side, counts data packets the peer sent over a path */
+struct pppoat_probe_rx {
+	bool     prx_init;
+	uint16_t prx_max;
+	uint32_t prx_nr;
+	uint32_t prx_expected;
+	uint32_t prx_reordered;
+};
+
+void pppoat_probe_init(struct pppoat_probe *pr, uint64_t interval,
+		       uint64_t now);
+/* Returns true when a ping must be sent, updates state of the path. */
+bool pppoat_probe_ping_due(struct pppoat_probe *pr, uint64_t now);
+/* Handles reply to the ping sent at ts with the peer's counters. */
+void pppoat_probe_pong(struct pppoat_probe *pr,
+		       uint64_t             ts,
+		       uint32_t             rx_nr,
+		       uint32_t             rx_expected,
+		       uint64_t             now);
+uint64_t pppoat_probe_deadline(const struct pppoat_probe *pr);
+
+void pppoat_probe_rx_init(struct pppoat_probe_rx *prx);
+void pppoat_probe_rx(struct pppoat_probe_rx *prx, uint16_t seq);
+
+#endif /* __PPPOAT_PROBE_H__ */
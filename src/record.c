@@ -0,0 +1,131 @@
+/* record.c
+ * PPP over Any Transport -- Checked records of PPP frames
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "crc32c.h"
+#include "memory.h"
+#include "record.h"
+#include "util.h"
+
+static uint32_t record_crc_get(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
+	       (uint32_t)buf[2] << 8 | buf[3];
+}
+
+int pppoat_record_init(struct pppoat_record *re, size_t mru)
+{
+	memset(re, 0, sizeof(*re));
+	re->re_mru  = pppoat_min(mru, 0xffff);
+	re->re_size = 2 * PPPOAT_RECORD_LEN(re->re_mru);
+	re->re_buf  = pppoat_alloc(re->re_size);
+
+	return re->re_buf == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+void pppoat_record_fini(struct pppoat_record *re)
+{
+	pppoat_free(re->re_buf);
+}
+
+size_t pppoat_record_seal(unsigned char *rec, size_t len)
+{
+	unsigned char *tail = rec + PPPOAT_RECORD_HDR + len;
+	uint32_t       crc;
+
+	PPPOAT_ASSERT(len <= 0xffff);
+	rec[0] = PPPOAT_RECORD_MAGIC >> 8;
+	rec[1] = PPPOAT_RECORD_MAGIC & 0xff;
+	rec[2] = len >> 8;
+	rec[3] = len & 0xff;
+	crc = pppoat_crc32c(0, rec, PPPOAT_RECORD_HDR + len);
+	tail[0] = crc >> 24;
+	tail[1] = crc >> 16;
+	tail[2] = crc >> 8;
+	tail[3] = crc;
+
+	return PPPOAT_RECORD_LEN(len);
+}
+
+/* Returns length of the valid record at buf, 0 if incomplete, -1 if bad. */
+static ssize_t record_check(const struct pppoat_record *re,
+			    const unsigned char        *buf,
+			    size_t                      len)
+{
+	size_t flen;
+
+	if (len < PPPOAT_RECORD_HDR)
+		return 0;
+	flen = (size_t)buf[2] << 8 | buf[3];
+	if ((buf[0] << 8 | buf[1]) != PPPOAT_RECORD_MAGIC || flen == 0 ||
+	    flen > re->re_mru)
+		return -1;
+	if (len < PPPOAT_RECORD_LEN(flen))
+		return 0;
+	if (record_crc_get(buf + PPPOAT_RECORD_HDR + flen) !=
+	    pppoat_crc32c(0, buf, PPPOAT_RECORD_HDR + flen))
+		return -1;
+	return PPPOAT_RECORD_LEN(flen);
+}
+
+int pppoat_record_read(struct pppoat_record    *re,
+		       int                      fd,
+		       pppoat_record_deliver_t  deliver,
+		       void                    *userdata)
+{
+	unsigned char *buf = re->re_buf;
+	size_t         off = 0;
+	ssize_t        rlen;
+	ssize_t        len;
+	int            rc  = 0;
+
+	len = read(fd, buf + re->re_len, re->re_size - re->re_len);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : P_ERR(-errno);
+	if (len == 0)
+		return -EPIPE;
+	re->re_len += len;
+
+	while (rc == 0 && off < re->re_len) {
+		rlen = record_check(re, buf + off, re->re_len - off);
+		if (rlen == 0)
+			break;
+		if (rlen < 0) {
+			/* Look for the next record byte by byte */
+			re->re_bad += re->re_lost ? 0 : 1;
+			re->re_lost = true;
+			++off;
+			continue;
+		}
+		re->re_lost = false;
+		++re->re_frames;
+		rc   = deliver(userdata, buf + off + PPPOAT_RECORD_HDR,
+			       rlen - PPPOAT_RECORD_LEN(0));
+		off += rlen;
+	}
+	re->re_len -= off;
+	memmove(buf, buf + off, re->re_len);
+
+	return rc;
+}
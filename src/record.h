@@ -0,0 +1,74 @@
+/* record.h
+ * PPP over Any Transport -- Checked records of PPP frames
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_RECORD_H__
+#define __PPPOAT_RECORD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Carries PPP frames over the transport stream when HDLC framing is
+ * stripped: 16-bit magic, 16-bit length, the frame and CRC32C of all
+ * that. A transport may lose or reorder data, then the stream resyncs on
+ * the next record with valid magic and CRC. A damaged frame never reaches
+ * the interface, where it would get a fresh FCS and pass as valid.
+ */
+
+#define PPPOAT_RECORD_MAGIC 0x7e50
+#define PPPOAT_RECORD_HDR   4
+#define PPPOAT_RECORD_CRC   4
+#define PPPOAT_RECORD_LEN(len) \
+	(PPPOAT_RECORD_HDR + (len) + PPPOAT_RECORD_CRC)
+
+typedef int (*pppoat_record_deliver_t)(void          *userdata,
+				       unsigned char *frame,
+				       size_t         len);
+
+struct pppoat_record {
+	unsigned char *re_buf;
+	size_t         re_len;
+	size_t         re_size;
+	size_t         re_mru;
+	/* Bytes are skipped until the next valid record */
+	bool           re_lost;
+	/* Counters */
+	unsigned long  re_frames;
+	unsigned long  re_bad;
+};
+
+int pppoat_record_init(struct pppoat_record *re, size_t mru);
+void pppoat_record_fini(struct pppoat_record *re);
+
+/*
+ * Reads a chunk of the stream from fd, records may span chunks. Frames
+ * of valid records are passed to deliver. Returns -EPIPE on EOF.
+ */
+int pppoat_record_read(struct pppoat_record    *re,
+		       int                      fd,
+		       pppoat_record_deliver_t  deliver,
+		       void                    *userdata);
+/*
+ * Builds a record around len bytes of frame at rec + PPPOAT_RECORD_HDR,
+ * rec must hold PPPOAT_RECORD_LEN(len) bytes. Returns length of the
+ * record.
+ */
+size_t pppoat_record_seal(unsigned char *rec, size_t len);
+
+#endif /* __PPPOAT_RECORD_H__ */
@@ -0,0 +1,208 @@
+/* reorder.c
+ * PPP over Any Transport -- Reorder buffer
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>	/* memcpy */
+
+#include "trace.h"
+#include "memory.h"
+#include "reorder.h"
+#include "util.h"
+
+/* Distance from the expected sequence number, negative for late packets */
+static int32_t reorder_dist(const struct pppoat_reorder *ro, uint32_t seq)
+{
+	return (int32_t)(seq - ro->ro_next);
+}
+
+static struct pppoat_reorder_slot *reorder_slot(struct pppoat_reorder *ro,
+						uint32_t               seq)
+{
+	/* ro_size is a power of two, so slots follow seq across its wrap */
+	return &ro->ro_slots[seq & (ro->ro_size - 1)];
+}
+
+static void reorder_deadline_update(struct pppoat_reorder *ro)
+{
+	uint64_t oldest = PPPOAT_TIME_NEVER;
+	uint32_t i;
+
+	for (i = 0; ro->ro_nr > 0 && i < ro->ro_size; ++i)
+		if (ro->ro_slots[i].rs_buf != NULL)
+			oldest = pppoat_min(oldest, ro->ro_slots[i].rs_time);
+	ro->ro_deadline = oldest == PPPOAT_TIME_NEVER ?
+			  PPPOAT_TIME_NEVER : oldest + ro->ro_timeout;
+}
+
+/* Moves the window by one packet, delivers the head slot if present. */
+static int reorder_advance(struct pppoat_reorder *ro)
+{
+	struct pppoat_reorder_slot *slot = reorder_slot(ro, ro->ro_next);
+	int                         rc   = 0;
+
+	if (slot->rs_buf != NULL) {
+		rc = ro->ro_deliver(ro->ro_userdata, slot->rs_buf,
+				    slot->rs_len);
+		pppoat_free(slot->rs_buf);
+		slot->rs_buf = NULL;
+		--ro->ro_nr;
+	} else {
+		++ro->ro_lost;
+	}
+	++ro->ro_next;
+
+	return rc;
+}
+
+static int reorder_drain(struct pppoat_reorder *ro)
+{
+	int rc = 0;
+
+	while (rc == 0 && reorder_slot(ro, ro->ro_next)->rs_buf != NULL)
+		rc = reorder_advance(ro);
+	return rc;
+}
+
+/* Delivers everything buffered in order and forgets the gaps. */
+static int reorder_flush(struct pppoat_reorder *ro)
+{
+	int rc = 0;
+
+	while (rc == 0 && ro->ro_nr > 0)
+		rc = reorder_advance(ro);
+	return rc;
+}
+
+int pppoat_reorder_init(struct pppoat_reorder    *ro,
+			uint32_t                  size,
+			uint64_t                  timeout,
+			pppoat_reorder_deliver_t  deliver,
+			void                     *userdata)
+{
+	uint32_t slots = 1;
+
+	PPPOAT_ASSERT(size > 0);
+	while (slots < pppoat_min(size, PPPOAT_REORDER_SIZE_MAX))
+		slots *= 2;
+
+	ro->ro_slots     = pppoat_calloc(slots, sizeof(*ro->ro_slots));
+	ro->ro_size      = slots;
+	ro->ro_next      = 0;
+	ro->ro_nr        = 0;
+	ro->ro_synced    = false;
+	ro->ro_timeout   = timeout;
+	ro->ro_deadline  = PPPOAT_TIME_NEVER;
+	ro->ro_deliver   = deliver;
+	ro->ro_userdata  = userdata;
+	ro->ro_reordered = 0;
+	ro->ro_dropped   = 0;
+	ro->ro_lost      = 0;
+
+	return ro->ro_slots == NULL ? P_ERR(-ENOMEM) : 0;
+}
+
+void pppoat_reorder_fini(struct pppoat_reorder *ro)
+{
+	uint32_t i;
+
+	for (i = 0; i < ro->ro_size; ++i)
+		pppoat_free(ro->ro_slots[i].rs_buf);
+	pppoat_free(ro->ro_slots);
+}
+
+int pppoat_reorder_put(struct pppoat_reorder *ro,
+		       uint32_t               seq,
+		       unsigned char         *buf,
+		       size_t                 len,
+		       uint64_t               now)
+{
+	struct pppoat_reorder_slot *slot;
+	int32_t                     dist;
+	int                         rc = 0;
+
+	if (!ro->ro_synced) {
+		ro->ro_next   = seq;
+		ro->ro_synced = true;
+	}
+	dist = reorder_dist(ro, seq);
+
+	/* Far behind the window: the peer has restarted its counter */
+	if (dist < -2 * (int32_t)ro->ro_size) {
+		rc = reorder_flush(ro);
+		ro->ro_next = seq;
+		dist = 0;
+	}
+	if (rc != 0 || dist < 0) {
+		++ro->ro_dropped;
+		return rc;
+	}
+	/* Packet is beyond the window, push the window forward */
+	if (dist >= (int32_t)ro->ro_size) {
+		if (dist >= 2 * (int32_t)ro->ro_size) {
+			rc = reorder_flush(ro);
+			ro->ro_lost += seq - ro->ro_size + 1 - ro->ro_next;
+			ro->ro_next  = seq - ro->ro_size + 1;
+		}
+		while (rc == 0 && reorder_dist(ro, seq) >= (int32_t)ro->ro_size)
+			rc = reorder_advance(ro);
+		/* Packets held at the new head are in order now */
+		rc = rc ?: reorder_drain(ro);
+		dist = reorder_dist(ro, seq);
+	}
+	if (rc == 0 && dist == 0) {
+		rc = ro->ro_deliver(ro->ro_userdata, buf, len);
+		++ro->ro_next;
+		rc = rc ?: reorder_drain(ro);
+	} else if (rc == 0) {
+		slot = reorder_slot(ro, seq);
+		if (slot->rs_buf != NULL) {
+			++ro->ro_dropped;
+			return 0;
+		}
+		slot->rs_buf = pppoat_alloc(len);
+		if (slot->rs_buf == NULL)
+			return P_ERR(-ENOMEM);
+		memcpy(slot->rs_buf, buf, len);
+		slot->rs_len  = len;
+		slot->rs_time = now;
+		++ro->ro_nr;
+		++ro->ro_reordered;
+	}
+	reorder_deadline_update(ro);
+
+	return rc;
+}
+
+int pppoat_reorder_expire(struct pppoat_reorder *ro, uint64_t now)
+{
+	int rc = 0;
+
+	while (rc == 0 && ro->ro_nr > 0 && now >= ro->ro_deadline) {
+		/* Skip the gap up to the first held packet */
+		while (rc == 0 && reorder_slot(ro, ro->ro_next)->rs_buf == NULL)
+			rc = reorder_advance(ro);
+		rc = rc ?: reorder_drain(ro);
+		reorder_deadline_update(ro);
+	}
+	return rc;
+}
+
+uint64_t pppoat_reorder_deadline(const struct pppoat_reorder *ro)
+{
+	return ro->ro_nr > 0 ? ro->ro_deadline : PPPOAT_TIME_NEVER;
+}
@@ -0,0 +1,83 @@
+/* reorder.h
+ * PPP over Any Transport -- Reorder buffer
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_REORDER_H__
+#define __PPPOAT_REORDER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Restores order of sequenced packets received over several paths.
+ *
+ * A packet ahead of the expected sequence number is held for at most
+ * ro_timeout usec, then the gap is considered lost. Window of ro_size
+ * packets bounds memory: a packet beyond the window pushes the window
+ * forward. Late packets and duplicates are dropped. The window is
+ * rounded up to a power of two.
+ */
+
+#define PPPOAT_REORDER_SIZE_MAX (1U << 16)
+
+typedef int (*pppoat_reorder_deliver_t)(void          *userdata,
+					unsigned char *buf,
+					size_t         len);
+
+struct pppoat_reorder_slot {
+	unsigned char *rs_buf;
+	size_t         rs_len;
+	uint64_t       rs_time;
+};
+
+struct pppoat_reorder {
+	struct pppoat_reorder_slot *ro_slots;
+	uint32_t                    ro_size;
+	uint32_t                    ro_next;
+	uint32_t                    ro_nr;
+	bool                        ro_synced;
+	uint64_t                    ro_timeout;
+	uint64_t                    ro_deadline;
+	pppoat_reorder_deliver_t    ro_deliver;
+	void                       *ro_userdata;
+	/* Counters */
+	unsigned long               ro_reordered;
+	unsigned long               ro_dropped;
+	unsigned long               ro_lost;
+};
+
+int pppoat_reorder_init(struct pppoat_reorder    *ro,
+			uint32_t                  size,
+			uint64_t                  timeout,
+			pppoat_reorder_deliver_t  deliver,
+			void                     *userdata);
+void pppoat_reorder_fini(struct pppoat_reorder *ro);
+
+/* Passes the packet and all packets which follow it in order to deliver. */
+int pppoat_reorder_put(struct pppoat_reorder *ro,
+		       uint32_t               seq,
+		       unsigned char         *buf,
+		       size_t                 len,
+		       uint64_t               now);
+/* Gives up on gaps which are older than the timeout. */
+int pppoat_reorder_expire(struct pppoat_reorder *ro, uint64_t now);
+/* Time when pppoat_reorder_expire() must be called or PPPOAT_TIME_NEVER. */
+uint64_t pppoat_reorder_deadline(const struct pppoat_reorder *ro);
+
+#endif /* __PPPOAT_REORDER_H__ */
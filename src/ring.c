@@ -0,0 +1,190 @@
+/* ring.c
+ * PPP over Any Transport -- Lock-free SPSC packet ring
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "ring.h"
+#include "util.h"
+
+#define RING_HDR_LEN   4
+#define RING_ALIGN     8
+#define RING_SKIP      0xffffffffU
+#define RING_REC(len)  (((len) + RING_HDR_LEN + RING_ALIGN - 1) & \
+			~(uint64_t)(RING_ALIGN - 1))
+
+/* Rings are shared between processes, so futexes aren't private */
+static void ring_futex_wait(uint32_t *addr, uint32_t val, uint64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec  = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	(void)syscall(SYS_futex, addr, FUTEX_WAIT, val,
+		      usec == PPPOAT_TIME_NEVER ? NULL : &ts, NULL, 0);
+}
+
+static void ring_wake(struct pppoat_ring *ring, uint32_t *flag)
+{
+	/* Pairs with the fence in ring_wait(), one side sees the other */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(flag, __ATOMIC_RELAXED) != 0 &&
+	    __atomic_exchange_n(flag, 0, __ATOMIC_RELAXED) != 0) {
+		(void)syscall(SYS_futex, flag, FUTEX_WAKE, 1, NULL, NULL, 0);
+		++ring->rg_wakeups;
+	}
+}
+
+/* Sleeps while *watch stays equal to seen. Returns false on timeout. */
+static bool ring_wait(struct pppoat_ring *ring,
+		      uint32_t           *flag,
+		      const uint64_t     *watch,
+		      uint64_t            seen,
+		      uint64_t            deadline)
+{
+	uint64_t now = pppoat_util_time_us();
+
+	if (now >= deadline)
+		return false;
+	__atomic_store_n(flag, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(watch, __ATOMIC_ACQUIRE) == seen) {
+		ring_futex_wait(flag, 1, deadline == PPPOAT_TIME_NEVER ?
+					 PPPOAT_TIME_NEVER : deadline - now);
+		++ring->rg_sleeps;
+	}
+	__atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+	return true;
+}
+
+static uint64_t ring_deadline(uint64_t timeout)
+{
+	return timeout == PPPOAT_TIME_NEVER ? PPPOAT_TIME_NEVER :
+					      pppoat_util_time_us() + timeout;
+}
+
+static uint32_t *ring_hdr(struct pppoat_ring *ring, uint64_t off)
+{
+	return (uint32_t *)(ring->rg_data + (off & (ring->rg_size - 1)));
+}
+
+void pppoat_ring_attach(struct pppoat_ring     *ring,
+			struct pppoat_ring_ctl *ctl,
+			void                   *data,
+			uint64_t                size)
+{
+	PPPOAT_ASSERT((size & (size - 1)) == 0);
+
+	ring->rg_ctl     = ctl;
+	ring->rg_data    = data;
+	ring->rg_size    = size;
+	ring->rg_skip    = 0;
+	ring->rg_packets = 0;
+	ring->rg_sleeps  = 0;
+	ring->rg_wakeups = 0;
+}
+
+unsigned char *pppoat_ring_reserve(struct pppoat_ring *ring,
+				   size_t              max,
+				   uint64_t            timeout)
+{
+	struct pppoat_ring_ctl *ctl  = ring->rg_ctl;
+	uint64_t                head = ctl->rc_head;
+	uint64_t                need = RING_REC(max);
+	uint64_t                left;
+	uint64_t                skip;
+	uint64_t                tail;
+	uint64_t                deadline = 0;
+
+	PPPOAT_ASSERT(need <= ring->rg_size / 2);
+
+	left = ring->rg_size - (head & (ring->rg_size - 1));
+	skip = left < need ? left : 0;
+	while (true) {
+		tail = __atomic_load_n(&ctl->rc_tail, __ATOMIC_ACQUIRE);
+		if (ring->rg_size - (head - tail) >= skip + need)
+			break;
+		deadline = deadline ?: ring_deadline(timeout);
+		if (!ring_wait(ring, &ctl->rc_prod_sleeps, &ctl->rc_tail,
+			       tail, deadline))
+			return NULL;
+	}
+	if (skip != 0)
+		*ring_hdr(ring, head) = RING_SKIP;
+	ring->rg_skip = skip;
+
+	return (unsigned char *)ring_hdr(ring, head + skip) + RING_HDR_LEN;
+}
+
+void pppoat_ring_commit(struct pppoat_ring *ring, size_t len)
+{
+	struct pppoat_ring_ctl *ctl  = ring->rg_ctl;
+	uint64_t                head = ctl->rc_head + ring->rg_skip;
+
+	*ring_hdr(ring, head) = len;
+	__atomic_store_n(&ctl->rc_head, head + RING_REC(len),
+			 __ATOMIC_RELEASE);
+	++ring->rg_packets;
+	ring_wake(ring, &ctl->rc_cons_sleeps);
+}
+
+unsigned char *pppoat_ring_peek(struct pppoat_ring *ring,
+				size_t             *len,
+				uint64_t            timeout)
+{
+	struct pppoat_ring_ctl *ctl  = ring->rg_ctl;
+	uint64_t                tail = ctl->rc_tail;
+	uint64_t                head;
+	uint64_t                deadline = 0;
+	uint32_t                hdr;
+
+	while (true) {
+		head = __atomic_load_n(&ctl->rc_head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			deadline = deadline ?: ring_deadline(timeout);
+			if (!ring_wait(ring, &ctl->rc_cons_sleeps,
+				       &ctl->rc_head, head, deadline))
+				return NULL;
+			continue;
+		}
+		hdr = *ring_hdr(ring, tail);
+		if (hdr != RING_SKIP)
+			break;
+		tail += ring->rg_size - (tail & (ring->rg_size - 1));
+		__atomic_store_n(&ctl->rc_tail, tail, __ATOMIC_RELEASE);
+		ring_wake(ring, &ctl->rc_prod_sleeps);
+	}
+	*len = hdr;
+	return (unsigned char *)ring_hdr(ring, tail) + RING_HDR_LEN;
+}
+
+void pppoat_ring_release(struct pppoat_ring *ring)
+{
+	struct pppoat_ring_ctl *ctl  = ring->rg_ctl;
+	uint64_t                tail = ctl->rc_tail;
+
+	__atomic_store_n(&ctl->rc_tail, tail + RING_REC(*ring_hdr(ring, tail)),
+			 __ATOMIC_RELEASE);
+	++ring->rg_packets;
+	ring_wake(ring, &ctl->rc_prod_sleeps);
+}
@@ -0,0 +1,87 @@
+/* ring.h
+ * PPP over Any Transport -- Lock-free SPSC packet ring
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_RING_H__
+#define __PPPOAT_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single-producer single-consumer ring of variable-length packets. The
+ * control block and data may live in memory shared by two processes.
+ * Head and tail are free-running byte counters, every packet is a 32-bit
+ * length followed by data and padded to 8 bytes. A packet never wraps:
+ * the rest of the lap is skipped with a marker instead.
+ *
+ * A side which finds the ring empty (consumer) or full (producer) sleeps
+ * on a futex. The other side issues FUTEX_WAKE only when it sees the
+ * sleeping flag, i.e. when the ring goes from empty to non-empty or from
+ * full to having room, so a busy ring never enters the kernel.
+ */
+
+#define PPPOAT_RING_CACHELINE 64
+
+struct pppoat_ring_ctl {
+	/* Written by the producer */
+	uint64_t rc_head __attribute__((aligned(PPPOAT_RING_CACHELINE)));
+	uint32_t rc_prod_sleeps;
+	/* Written by the consumer */
+	uint64_t rc_tail __attribute__((aligned(PPPOAT_RING_CACHELINE)));
+	uint32_t rc_cons_sleeps;
+};
+
+struct pppoat_ring {
+	struct pppoat_ring_ctl *rg_ctl;
+	unsigned char          *rg_data;
+	uint64_t                rg_size;
+	/* Bytes to skip at the end of the lap on commit */
+	uint64_t                rg_skip;
+	/* Counters */
+	unsigned long           rg_packets;
+	unsigned long           rg_sleeps;
+	unsigned long           rg_wakeups;
+};
+
+/* Size must be a power of 2, zeroed control block is an empty ring. */
+void pppoat_ring_attach(struct pppoat_ring     *ring,
+			struct pppoat_ring_ctl *ctl,
+			void                   *data,
+			uint64_t                size);
+
+/*
+ * Producer: returns room for a packet of up to max bytes, waits up to
+ * timeout usec for the consumer to free it. Returns NULL on timeout.
+ */
+unsigned char *pppoat_ring_reserve(struct pppoat_ring *ring,
+				   size_t              max,
+				   uint64_t            timeout);
+/* Publishes the reserved packet of len bytes. */
+void pppoat_ring_commit(struct pppoat_ring *ring, size_t len);
+
+/*
+ * Consumer: returns the oldest packet, waits up to timeout usec for one.
+ * Returns NULL on timeout. The packet stays in the ring till release.
+ */
+unsigned char *pppoat_ring_peek(struct pppoat_ring *ring,
+				size_t             *len,
+				uint64_t            timeout);
+void pppoat_ring_release(struct pppoat_ring *ring);
+
+#endif /* __PPPOAT_RING_H__ */
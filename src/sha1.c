@@ -0,0 +1,124 @@
+/* sha1.c
+ * PPP over Any Transport -- SHA-1
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "trace.h"
+#include "sha1.h"
+
+static uint32_t sha1_rol(uint32_t v, unsigned int n)
+{
+	return v << n | v >> (32 - n);
+}
+
+static void sha1_block(struct pppoat_sha1 *sha, const unsigned char *p)
+{
+	uint32_t w[80];
+	uint32_t a = sha->sh_h[0];
+	uint32_t b = sha->sh_h[1];
+	uint32_t c = sha->sh_h[2];
+	uint32_t d = sha->sh_h[3];
+	uint32_t e = sha->sh_h[4];
+	uint32_t f;
+	uint32_t k;
+	uint32_t t;
+	int      i;
+
+	for (i = 0; i < 16; ++i)
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+		       (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (; i < 80; ++i)
+		w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	for (i = 0; i < 80; ++i) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		t = sha1_rol(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = sha1_rol(b, 30);
+		b = a;
+		a = t;
+	}
+	sha->sh_h[0] += a;
+	sha->sh_h[1] += b;
+	sha->sh_h[2] += c;
+	sha->sh_h[3] += d;
+	sha->sh_h[4] += e;
+}
+
+void pppoat_sha1_init(struct pppoat_sha1 *sha)
+{
+	sha->sh_h[0] = 0x67452301;
+	sha->sh_h[1] = 0xefcdab89;
+	sha->sh_h[2] = 0x98badcfe;
+	sha->sh_h[3] = 0x10325476;
+	sha->sh_h[4] = 0xc3d2e1f0;
+	sha->sh_len  = 0;
+}
+
+void pppoat_sha1_update(struct pppoat_sha1 *sha, const void *buf, size_t len)
+{
+	const unsigned char *p   = buf;
+	size_t               off = sha->sh_len % 64;
+	size_t               n;
+
+	sha->sh_len += len;
+	while (len > 0) {
+		n = 64 - off < len ? 64 - off : len;
+		memcpy(sha->sh_block + off, p, n);
+		off += n;
+		p   += n;
+		len -= n;
+		if (off == 64) {
+			sha1_block(sha, sha->sh_block);
+			off = 0;
+		}
+	}
+}
+
+void pppoat_sha1_final(struct pppoat_sha1 *sha,
+		       unsigned char       digest[PPPOAT_SHA1_LEN])
+{
+	static const unsigned char pad = 0x80;
+	static const unsigned char zero;
+	uint64_t                   bits = sha->sh_len * 8;
+	unsigned char              len[8];
+	int                        i;
+
+	for (i = 0; i < 8; ++i)
+		len[i] = bits >> (56 - 8 * i);
+	pppoat_sha1_update(sha, &pad, 1);
+	while (sha->sh_len % 64 != 56)
+		pppoat_sha1_update(sha, &zero, 1);
+	pppoat_sha1_update(sha, len, sizeof(len));
+	for (i = 0; i < PPPOAT_SHA1_LEN; ++i)
+		digest[i] = sha->sh_h[i / 4] >> (24 - 8 * (i % 4));
+}
@@ -0,0 +1,44 @@
+/* sha1.h
+ * PPP over Any Transport -- SHA-1
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_SHA1_H__
+#define __PPPOAT_SHA1_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SHA-1 (RFC 3174). WebSocket handshake needs it, it isn't used where
+ * collision resistance matters.
+ */
+
+#define PPPOAT_SHA1_LEN 20
+
+struct pppoat_sha1 {
+	uint32_t      sh_h[5];
+	uint64_t      sh_len;
+	unsigned char sh_block[64];
+};
+
+void pppoat_sha1_init(struct pppoat_sha1 *sha);
+void pppoat_sha1_update(struct pppoat_sha1 *sha, const void *buf, size_t len);
+void pppoat_sha1_final(struct pppoat_sha1 *sha,
+		       unsigned char       digest[PPPOAT_SHA1_LEN]);
+
+#endif /* __PPPOAT_SHA1_H__ */
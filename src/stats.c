@@ -0,0 +1,90 @@
+/* stats.c
+ * PPP over Any Transport -- Statistics
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>	/* memset */
+
+#include "trace.h"
+#include "stats.h"
+
+#define HIST_SUB_NR (1U << PPPOAT_HIST_SUB_BITS)
+
+static unsigned int hist_idx(uint64_t val)
+{
+	unsigned int shift;
+
+	if (val < HIST_SUB_NR)
+		return (unsigned int)val;
+
+	shift = 63 - __builtin_clzll(val) - PPPOAT_HIST_SUB_BITS;
+	return ((shift + 1) << PPPOAT_HIST_SUB_BITS) +
+	       (unsigned int)((val >> shift) & (HIST_SUB_NR - 1));
+}
+
+/* Lowest value which falls into the bucket */
+static uint64_t hist_val(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < HIST_SUB_NR)
+		return idx;
+
+	shift = (idx >> PPPOAT_HIST_SUB_BITS) - 1;
+	return (uint64_t)(HIST_SUB_NR + (idx & (HIST_SUB_NR - 1))) << shift;
+}
+
+void pppoat_hist_init(struct pppoat_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->h_min = UINT64_MAX;
+}
+
+void pppoat_hist_add(struct pppoat_hist *hist, uint64_t val)
+{
+	++hist->h_buckets[hist_idx(val)];
+	++hist->h_nr;
+	hist->h_min = val < hist->h_min ? val : hist->h_min;
+	hist->h_max = val > hist->h_max ? val : hist->h_max;
+}
+
+uint64_t pppoat_hist_percentile(const struct pppoat_hist *hist,
+				unsigned int              pct)
+{
+	uint64_t     rank;
+	uint64_t     sum = 0;
+	unsigned int i;
+
+	PPPOAT_ASSERT(pct <= 100);
+
+	if (hist->h_nr == 0)
+		return 0;
+
+	rank = (hist->h_nr * pct + 99) / 100;
+	rank = rank == 0 ? 1 : rank;
+	if (rank == hist->h_nr)
+		return hist->h_max;
+	for (i = 0; i < PPPOAT_HIST_BUCKETS; ++i) {
+		sum += hist->h_buckets[i];
+		if (sum >= rank)
+			break;
+	}
+	/* Clamp to the observed range, it is exact at both ends */
+	if (i >= PPPOAT_HIST_BUCKETS || hist_val(i) > hist->h_max)
+		return hist->h_max;
+	return hist_val(i) < hist->h_min ? hist->h_min : hist_val(i);
+}
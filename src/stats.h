@@ -0,0 +1,46 @@
+/* stats.h
+ * PPP over Any Transport -- Statistics
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_STATS_H__
+#define __PPPOAT_STATS_H__
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram. Values below 2^PPPOAT_HIST_SUB_BITS are exact,
+ * every power of two above is split into 2^PPPOAT_HIST_SUB_BITS buckets.
+ * So a percentile is reported with relative error below 1/16.
+ */
+#define PPPOAT_HIST_SUB_BITS 4
+#define PPPOAT_HIST_BUCKETS  ((64 - PPPOAT_HIST_SUB_BITS + 1) << \
+			      PPPOAT_HIST_SUB_BITS)
+
+struct pppoat_hist {
+	uint64_t h_nr;
+	uint64_t h_min;
+	uint64_t h_max;
+	uint64_t h_buckets[PPPOAT_HIST_BUCKETS];
+};
+
+void pppoat_hist_init(struct pppoat_hist *hist);
+void pppoat_hist_add(struct pppoat_hist *hist, uint64_t val);
+uint64_t pppoat_hist_percentile(const struct pppoat_hist *hist,
+				unsigned int              pct);
+
+#endif /* __PPPOAT_STATS_H__ */
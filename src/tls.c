@@ -0,0 +1,313 @@
+/* tls.c
+ * PPP over Any Transport -- TLS layer with kernel offload
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "trace.h"
+#include "tls.h"
+#include "log.h"
+#include "memory.h"
+#include "util.h"
+
+#ifdef HAVE_TLS
+
+static void tls_errors_log(const char *what)
+{
+	unsigned long err;
+	char          buf[256];
+
+	err = ERR_get_error();
+	if (err == 0) {
+		pppoat_error("tls", "%s failed", what);
+		return;
+	}
+	while (err != 0) {
+		ERR_error_string_n(err, buf, sizeof(buf));
+		pppoat_error("tls", "%s: %s", what, buf);
+		err = ERR_get_error();
+	}
+}
+
+static bool tls_opt_is_true(struct pppoat_conf *conf, const char *key)
+{
+	const char *opt = pppoat_conf_get(conf, key);
+
+	return opt == NULL || pppoat_conf_obj_is_true(opt);
+}
+
+static int tls_ctx_setup(struct pppoat_tls *tls, struct pppoat_conf *conf)
+{
+	const char *cert = pppoat_conf_get(conf, "tls.cert");
+	const char *key  = pppoat_conf_get(conf, "tls.key");
+	const char *ca   = pppoat_conf_get(conf, "tls.ca");
+	SSL_CTX    *ctx  = tls->tl_ctx;
+	bool        verify;
+	int         ok;
+
+	if (tls->tl_server && cert == NULL) {
+		pppoat_error("tls", "Server needs tls.cert");
+		return P_ERR(-EINVAL);
+	}
+	ok = SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	if (ok == 1 && cert != NULL)
+		ok = SSL_CTX_use_certificate_chain_file(ctx, cert) == 1 &&
+		     SSL_CTX_use_PrivateKey_file(ctx, key ?: cert,
+						 SSL_FILETYPE_PEM) == 1 &&
+		     SSL_CTX_check_private_key(ctx) == 1;
+
+	/*
+	 * Client always checks the server unless tls.verify=0. Server asks
+	 * for a client certificate only when it's given tls.ca.
+	 */
+	verify = tls->tl_server ? ca != NULL :
+				  tls_opt_is_true(conf, "tls.verify");
+	if (ok == 1 && verify) {
+		ok = ca != NULL ?
+		     SSL_CTX_load_verify_locations(ctx, ca, NULL) :
+		     SSL_CTX_set_default_verify_paths(ctx);
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER |
+				   SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+	}
+	if (ok != 1) {
+		tls_errors_log("Configuration");
+		return P_ERR(-EINVAL);
+	}
+
+	/*
+	 * Session tickets are post-handshake records which the offloaded
+	 * receive path would have to pass to OpenSSL, nothing resumes them.
+	 */
+	if (tls->tl_server)
+		(void)SSL_CTX_set_num_tickets(ctx, 0);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	/* Frames carry their length, a truncated stream is just a reset */
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif /* SSL_OP_IGNORE_UNEXPECTED_EOF */
+#ifdef SSL_OP_ENABLE_KTLS
+	if (tls_opt_is_true(conf, "tls.ktls"))
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif /* SSL_OP_ENABLE_KTLS */
+	return 0;
+}
+
+int pppoat_tls_init(struct pppoat_tls  *tls,
+		    struct pppoat_conf *conf,
+		    bool                server,
+		    const char         *name)
+{
+	int rc;
+
+	memset(tls, 0, sizeof(*tls));
+	tls->tl_sock   = -1;
+	tls->tl_server = server;
+	tls->tl_ctx    = SSL_CTX_new(server ? TLS_server_method() :
+					      TLS_client_method());
+	rc = tls->tl_ctx == NULL ? P_ERR(-ENOMEM) : 0;
+	rc = rc ?: tls_ctx_setup(tls, conf);
+	/* OpenSSL writes to the socket with write() which raises SIGPIPE */
+	if (rc == 0)
+		(void)signal(SIGPIPE, SIG_IGN);
+
+	name = pppoat_conf_get(conf, "tls.name") ?: name;
+	if (rc == 0 && name != NULL) {
+		tls->tl_name = pppoat_strdup(name);
+		rc = tls->tl_name == NULL ? P_ERR(-ENOMEM) : 0;
+	}
+	if (rc == 0) {
+		tls->tl_wbuf = pppoat_alloc(PPPOAT_TLS_RECORD_MAX);
+		rc = tls->tl_wbuf == NULL ? P_ERR(-ENOMEM) : 0;
+	}
+	if (rc != 0)
+		pppoat_tls_fini(tls);
+	return rc;
+}
+
+void pppoat_tls_fini(struct pppoat_tls *tls)
+{
+	pppoat_tls_stop(tls);
+	SSL_CTX_free(tls->tl_ctx);
+	pppoat_free(tls->tl_name);
+	pppoat_free(tls->tl_wbuf);
+}
+
+static bool tls_name_is_ip(const char *name)
+{
+	unsigned char addr[sizeof(struct in6_addr)];
+
+	return inet_pton(AF_INET, name, addr) == 1 ||
+	       inet_pton(AF_INET6, name, addr) == 1;
+}
+
+int pppoat_tls_start(struct pppoat_tls *tls, int sock)
+{
+	SSL *ssl;
+
+	PPPOAT_ASSERT(tls->tl_ssl == NULL);
+
+	ssl = SSL_new(tls->tl_ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, sock) != 1) {
+		tls_errors_log("Session");
+		SSL_free(ssl);
+		return -ENOMEM;
+	}
+	if (!tls->tl_server && tls->tl_name != NULL &&
+	    tls_name_is_ip(tls->tl_name)) {
+		/* No SNI for addresses, the certificate has an IP SAN */
+		(void)X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl),
+						    tls->tl_name);
+	} else if (!tls->tl_server && tls->tl_name != NULL) {
+		(void)SSL_set_tlsext_host_name(ssl, tls->tl_name);
+		(void)SSL_set1_host(ssl, tls->tl_name);
+	}
+	if (tls->tl_server)
+		SSL_set_accept_state(ssl);
+	else
+		SSL_set_connect_state(ssl);
+
+	tls->tl_ssl        = ssl;
+	tls->tl_sock       = sock;
+	tls->tl_ktls_tx    = false;
+	tls->tl_ktls_rx    = false;
+	tls->tl_want_write = false;
+	tls->tl_wpend      = 0;
+
+	return 0;
+}
+
+void pppoat_tls_stop(struct pppoat_tls *tls)
+{
+	SSL_free(tls->tl_ssl);
+	tls->tl_ssl  = NULL;
+	tls->tl_sock = -1;
+	ERR_clear_error();
+}
+
+/* Converts result of an SSL call to -EAGAIN or an error. */
+static int tls_result(struct pppoat_tls *tls, int ret, const char *what)
+{
+	int err = SSL_get_error(tls->tl_ssl, ret);
+
+	switch (err) {
+	case SSL_ERROR_WANT_READ:
+		tls->tl_want_write = false;
+		return -EAGAIN;
+	case SSL_ERROR_WANT_WRITE:
+		tls->tl_want_write = true;
+		return -EAGAIN;
+	case SSL_ERROR_ZERO_RETURN:
+		return -ECONNRESET;
+	case SSL_ERROR_SYSCALL:
+		/* Peer closed the socket without close_notify */
+		ERR_clear_error();
+		return errno != 0 ? -errno : -ECONNRESET;
+	default:
+		tls_errors_log(what);
+		return -EPROTO;
+	}
+}
+
+int pppoat_tls_handshake(struct pppoat_tls *tls)
+{
+	int ret;
+
+	errno = 0;
+	ret = SSL_do_handshake(tls->tl_ssl);
+	if (ret != 1)
+		return tls_result(tls, ret, "Handshake");
+
+	tls->tl_want_write = false;
+#ifdef SSL_OP_ENABLE_KTLS
+	tls->tl_ktls_tx = BIO_get_ktls_send(SSL_get_wbio(tls->tl_ssl));
+	tls->tl_ktls_rx = BIO_get_ktls_recv(SSL_get_rbio(tls->tl_ssl));
+#endif /* SSL_OP_ENABLE_KTLS */
+	pppoat_info("tls", "%s %s, kernel TLS tx=%d rx=%d",
+		    SSL_get_version(tls->tl_ssl),
+		    SSL_get_cipher_name(tls->tl_ssl),
+		    tls->tl_ktls_tx, tls->tl_ktls_rx);
+	return 0;
+}
+
+ssize_t pppoat_tls_writev(struct pppoat_tls  *tls,
+			  const struct iovec *iov,
+			  int                 nr)
+{
+	struct msghdr msg;
+	ssize_t       len;
+	size_t        pend = tls->tl_wpend;
+	size_t        n;
+	int           ret;
+	int           i;
+
+	if (tls->tl_ktls_tx) {
+		/* The kernel builds records, corking makes them full-sized */
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = (struct iovec *)iov;
+		msg.msg_iovlen = nr;
+		len = sendmsg(tls->tl_sock, &msg, MSG_NOSIGNAL);
+		return len < 0 ? -errno : len;
+	}
+
+	/* Small frames are gathered into one record */
+	for (i = 0; pend == 0 && i < nr &&
+		    tls->tl_wpend < PPPOAT_TLS_RECORD_MAX; ++i) {
+		n = pppoat_min(iov[i].iov_len,
+			       PPPOAT_TLS_RECORD_MAX - tls->tl_wpend);
+		memcpy(tls->tl_wbuf + tls->tl_wpend, iov[i].iov_base, n);
+		tls->tl_wpend += n;
+	}
+	errno = 0;
+	ret = SSL_write(tls->tl_ssl, tls->tl_wbuf, tls->tl_wpend);
+	if (ret <= 0)
+		return tls_result(tls, ret, "Write");
+	PPPOAT_ASSERT((size_t)ret == tls->tl_wpend);
+	tls->tl_wpend = 0;
+
+	return ret;
+}
+
+ssize_t pppoat_tls_read(struct pppoat_tls *tls, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	/* Records OpenSSL read before the offload must be drained first */
+	if (tls->tl_ktls_rx && !SSL_has_pending(tls->tl_ssl)) {
+		ret = recv(tls->tl_sock, buf, len, 0);
+		/* EIO is a control record, close_notify or an alert */
+		return ret < 0 && errno == EIO ? -ECONNRESET :
+		       ret < 0 ? -errno : ret;
+	}
+	errno = 0;
+	ret = SSL_read(tls->tl_ssl, buf, pppoat_min(len, (size_t)INT_MAX));
+	return ret > 0 ? ret : tls_result(tls, ret, "Read");
+}
+
+bool pppoat_tls_pending(struct pppoat_tls *tls)
+{
+	return tls->tl_ssl != NULL && SSL_pending(tls->tl_ssl) > 0;
+}
+
+#endif /* HAVE_TLS */
@@ -0,0 +1,146 @@
+/* tls.h
+ * PPP over Any Transport -- TLS layer with kernel offload
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_TLS_H__
+#define __PPPOAT_TLS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "conf.h"
+
+/*
+ * The handshake runs in OpenSSL over a non-blocking socket. Afterwards
+ * OpenSSL moves record encryption to the kernel (TCP_ULP "tls") when the
+ * kernel supports the negotiated cipher. A direction that is offloaded
+ * bypasses OpenSSL: plain writev() and recv() on the socket carry the
+ * records, so TLS costs about as much as plain TCP.
+ */
+
+#ifdef HAVE_TLS
+
+#include <openssl/ssl.h>
+
+/* Largest TLS record payload */
+#define PPPOAT_TLS_RECORD_MAX 16384
+
+struct pppoat_tls {
+	SSL_CTX       *tl_ctx;
+	SSL           *tl_ssl;
+	int            tl_sock;
+	bool           tl_server;
+	/* Name to check in the server certificate and to send as SNI */
+	char          *tl_name;
+	bool           tl_ktls_tx;
+	bool           tl_ktls_rx;
+	/* Last call needs the socket writable rather than readable */
+	bool           tl_want_write;
+	/* Records built in user space when TX isn't offloaded */
+	unsigned char *tl_wbuf;
+	/* A write which must be retried with the same data */
+	size_t         tl_wpend;
+};
+
+/*
+ * Reads tls.* options. Server needs tls.cert and tls.key, the client
+ * verifies the server against tls.ca or the system store for name.
+ */
+int pppoat_tls_init(struct pppoat_tls  *tls,
+		    struct pppoat_conf *conf,
+		    bool                server,
+		    const char         *name);
+void pppoat_tls_fini(struct pppoat_tls *tls);
+
+/* Starts a session on a connected non-blocking socket. */
+int pppoat_tls_start(struct pppoat_tls *tls, int sock);
+/* Ends the session, the socket is closed by the caller. */
+void pppoat_tls_stop(struct pppoat_tls *tls);
+
+/*
+ * Makes progress with the handshake. Returns 0 when it's finished and
+ * -EAGAIN when the socket must become ready, see tl_want_write.
+ */
+int pppoat_tls_handshake(struct pppoat_tls *tls);
+
+/*
+ * Sends leading bytes of iov as application data. Returns number of
+ * bytes sent or negative error, -EAGAIN when the socket is busy. After
+ * -EAGAIN the next call must pass the same leading data.
+ */
+ssize_t pppoat_tls_writev(struct pppoat_tls  *tls,
+			  const struct iovec *iov,
+			  int                 nr);
+/* Returns number of bytes read, 0 on close or negative error. */
+ssize_t pppoat_tls_read(struct pppoat_tls *tls, void *buf, size_t len);
+/* Decrypted data is buffered which select() doesn't report. */
+bool pppoat_tls_pending(struct pppoat_tls *tls);
+
+#else /* HAVE_TLS */
+
+#include <errno.h>
+
+#include "log.h"
+
+/* Built with --disable-tls, the TLS transport refuses to start */
+
+struct pppoat_tls {
+	bool tl_want_write;
+};
+
+static inline int pppoat_tls_init(struct pppoat_tls  *tls,
+				  struct pppoat_conf *conf,
+				  bool                server,
+				  const char         *name)
+{
+	pppoat_error("tls", "pppoat is built without TLS support");
+	return -ENOTSUP;
+}
+
+static inline void pppoat_tls_fini(struct pppoat_tls *tls) {}
+static inline int pppoat_tls_start(struct pppoat_tls *tls, int sock)
+{
+	return -ENOTSUP;
+}
+static inline void pppoat_tls_stop(struct pppoat_tls *tls) {}
+static inline int pppoat_tls_handshake(struct pppoat_tls *tls)
+{
+	return -ENOTSUP;
+}
+static inline ssize_t pppoat_tls_writev(struct pppoat_tls  *tls,
+					const struct iovec *iov,
+					int                 nr)
+{
+	return -ENOTSUP;
+}
+static inline ssize_t pppoat_tls_read(struct pppoat_tls *tls,
+				      void              *buf,
+				      size_t             len)
+{
+	return -ENOTSUP;
+}
+static inline bool pppoat_tls_pending(struct pppoat_tls *tls)
+{
+	return false;
+}
+
+#endif /* HAVE_TLS */
+
+#endif /* __PPPOAT_TLS_H__ */
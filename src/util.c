@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "trace.h"
 #include "util.h"
@@ -71,6 +72,17 @@ int pppoat_util_select(int maxfd, fd_set *rfds, fd_set *wfds)
 	return rc;
 }
 
+uint64_t pppoat_util_time_us(void)
+{
+	struct timespec ts;
+	int             rc;
+
+	rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+	PPPOAT_ASSERT(rc == 0);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
 static bool util_error_is_recoverable(int error)
 {
 	return error == -EWOULDBLOCK ||
@@ -78,7 +90,7 @@ static bool util_error_is_recoverable(int error)
 	       error == -EINTR;
 }
 
-int pppoat_util_write(int fd, void *buf, size_t len)
+int pppoat_util_write(int fd, const void *buf, size_t len)
 {
 	ssize_t nlen = (ssize_t)len;
 	ssize_t wlen;
@@ -97,7 +109,7 @@ int pppoat_util_write(int fd, void *buf, size_t len)
 			rc = pppoat_util_select(fd, NULL, &wfds);
 		}
 		if (wlen > 0) {
-			buf   = (char *)buf + wlen;
+			buf   = (const char *)buf + wlen;
 			nlen -= wlen;
 		}
 	} while (rc == 0 && nlen > 0);
@@ -105,6 +117,23 @@ int pppoat_util_write(int fd, void *buf, size_t len)
 	return rc;
 }
 
+int pppoat_util_write_frame(int fd, const void *buf, size_t len)
+{
+	ssize_t wlen;
+
+	wlen = write(fd, buf, len);
+	if (wlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return -EAGAIN;
+	if (wlen < 0 && errno == EINTR)
+		wlen = 0;
+	if (wlen < 0)
+		return P_ERR(-errno);
+	/* Frames larger than PIPE_BUF may be written partially */
+	return (size_t)wlen < len ?
+	       pppoat_util_write(fd, (const char *)buf + wlen, len - wlen) :
+	       0;
+}
+
 int pppoat_util_write_fd(int dst, int src)
 {
 	unsigned char buf[4096]; /* FIXME: avoid buffer on stack */
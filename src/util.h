@@ -22,6 +22,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <limits.h>
 #include <sys/select.h>
 
@@ -33,6 +34,7 @@
 
 /* FIXME: rewrite this, the arguments are evaluated twice */
 #define pppoat_max(x, y) ((x) > (y) ? (x) : (y))
+#define pppoat_min(x, y) ((x) < (y) ? (x) : (y))
 
 int pppoat_util_fd_nonblock_set(int fd, bool set);
 
@@ -42,7 +44,15 @@ int pppoat_util_select_timed(int            maxfd,
 			     fd_set        *wfds,
 			     unsigned long  usec);
 
-int pppoat_util_write(int fd, void *buf, size_t len);
+/* Monotonic time in microseconds */
+uint64_t pppoat_util_time_us(void);
+
+int pppoat_util_write(int fd, const void *buf, size_t len);
 int pppoat_util_write_fd(int dst, int src);
+/*
+ * Writes a frame to a non-blocking pipe. Returns -EAGAIN and writes
+ * nothing if the pipe is full, so the caller can drop the frame.
+ */
+int pppoat_util_write_frame(int fd, const void *buf, size_t len);
 
 #endif /* __PPPOAT_UTIL_H__ */
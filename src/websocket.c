@@ -0,0 +1,227 @@
+/* websocket.c
+ * PPP over Any Transport -- WebSocket framing (RFC 6455)
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "trace.h"
+#include "websocket.h"
+#include "base64.h"
+#include "sha1.h"
+#include "util.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum {
+	WS_FIN    = 0x80,
+	WS_RSV    = 0x70,
+	WS_OPCODE = 0x0f,
+	WS_MASKED = 0x80,
+	WS_LEN    = 0x7f,
+	WS_LEN16  = 126,
+	WS_LEN64  = 127,
+};
+
+/* Vector extension, the compiler picks SSE2, AVX or NEON registers */
+typedef unsigned char ws_vec_t __attribute__((vector_size(16)));
+
+void pppoat_ws_accept(const char *key,
+		      size_t      key_len,
+		      char        accept[PPPOAT_WS_ACCEPT_LEN + 1])
+{
+	struct pppoat_sha1 sha;
+	unsigned char      digest[PPPOAT_SHA1_LEN];
+
+	pppoat_sha1_init(&sha);
+	pppoat_sha1_update(&sha, key, key_len);
+	pppoat_sha1_update(&sha, WS_GUID, strlen(WS_GUID));
+	pppoat_sha1_final(&sha, digest);
+	pppoat_base64_enc(digest, sizeof(digest), accept, PPPOAT_WS_ACCEPT_LEN);
+	accept[PPPOAT_WS_ACCEPT_LEN] = '\0';
+}
+
+size_t pppoat_ws_hdr(unsigned char       *hdr_end,
+		     unsigned int         opcode,
+		     size_t               len,
+		     const unsigned char *mask)
+{
+	unsigned char *p    = hdr_end;
+	unsigned char  mbit = mask == NULL ? 0 : WS_MASKED;
+	int            i;
+
+	if (mask != NULL) {
+		p -= 4;
+		memcpy(p, mask, 4);
+	}
+	if (len < WS_LEN16) {
+		*--p = mbit | len;
+	} else if (len <= 0xffff) {
+		*--p = len & 0xff;
+		*--p = len >> 8;
+		*--p = mbit | WS_LEN16;
+	} else {
+		for (i = 0; i < 8; ++i, len >>= 8)
+			*--p = len & 0xff;
+		*--p = mbit | WS_LEN64;
+	}
+	*--p = WS_FIN | opcode;
+
+	return (size_t)(hdr_end - p);
+}
+
+void pppoat_ws_mask(unsigned char       *buf,
+		    size_t               len,
+		    const unsigned char *key,
+		    uint64_t             off)
+{
+	unsigned char k[sizeof(ws_vec_t)];
+	ws_vec_t      kv;
+	ws_vec_t      v;
+	size_t        i;
+
+	/* The key repeats every 4 bytes, so a vector of it stays in phase */
+	for (i = 0; i < sizeof(k); ++i)
+		k[i] = key[(off + i) & 3];
+	memcpy(&kv, k, sizeof(kv));
+	for (; len >= 4 * sizeof(v); buf += 4 * sizeof(v),
+				     len -= 4 * sizeof(v)) {
+		for (i = 0; i < 4; ++i) {
+			memcpy(&v, buf + i * sizeof(v), sizeof(v));
+			v ^= kv;
+			memcpy(buf + i * sizeof(v), &v, sizeof(v));
+		}
+	}
+	for (; len >= sizeof(v); buf += sizeof(v), len -= sizeof(v)) {
+		memcpy(&v, buf, sizeof(v));
+		v ^= kv;
+		memcpy(buf, &v, sizeof(v));
+	}
+	for (i = 0; i < len; ++i)
+		buf[i] ^= k[i];
+}
+
+void pppoat_ws_parser_init(struct pppoat_ws_parser *wp, bool server)
+{
+	memset(wp, 0, sizeof(*wp));
+	wp->wp_server   = server;
+	wp->wp_hdr_need = 2;
+}
+
+/* Validates a complete header and starts the payload. */
+static int ws_hdr_done(struct pppoat_ws_parser *wp)
+{
+	unsigned char *h      = wp->wp_hdr;
+	unsigned int   opcode = h[0] & WS_OPCODE;
+	unsigned int   len7   = h[1] & WS_LEN;
+	unsigned int   off    = 2;
+	uint64_t       len    = len7;
+	int            i;
+
+	if (len7 == WS_LEN16) {
+		len  = (uint64_t)h[2] << 8 | h[3];
+		off += 2;
+	} else if (len7 == WS_LEN64) {
+		for (len = 0, i = 0; i < 8; ++i)
+			len = len << 8 | h[2 + i];
+		off += 8;
+	}
+	wp->wp_masked = (h[1] & WS_MASKED) != 0;
+	if (wp->wp_masked)
+		memcpy(wp->wp_mask, h + off, 4);
+
+	if ((h[0] & WS_RSV) != 0 || wp->wp_masked != wp->wp_server ||
+	    len >> 63 != 0)
+		return P_ERR(-EPROTO);
+	switch (opcode) {
+	case PPPOAT_WS_CONT:
+	case PPPOAT_WS_BINARY:
+		opcode = PPPOAT_WS_BINARY;
+		break;
+	case PPPOAT_WS_CLOSE:
+	case PPPOAT_WS_PING:
+	case PPPOAT_WS_PONG:
+		if ((h[0] & WS_FIN) == 0 || len > PPPOAT_WS_CTL_MAX)
+			return P_ERR(-EPROTO);
+		break;
+	default:
+		return P_ERR(-EPROTO);
+	}
+	wp->wp_opcode  = opcode;
+	wp->wp_left    = len;
+	wp->wp_off     = 0;
+	wp->wp_payload = true;
+	return 0;
+}
+
+static unsigned int ws_hdr_need(const unsigned char *h)
+{
+	unsigned int len7 = h[1] & WS_LEN;
+
+	return 2 + (len7 == WS_LEN16 ? 2 : len7 == WS_LEN64 ? 8 : 0) +
+	       ((h[1] & WS_MASKED) != 0 ? 4 : 0);
+}
+
+int pppoat_ws_parse(struct pppoat_ws_parser *wp,
+		    unsigned char           *buf,
+		    size_t                   len,
+		    pppoat_ws_deliver_t      deliver,
+		    void                    *userdata)
+{
+	bool   ctl;
+	size_t n;
+	int    rc = 0;
+
+	while (rc == 0 && (len > 0 || (wp->wp_payload && wp->wp_left == 0))) {
+		if (!wp->wp_payload) {
+			n = pppoat_min((size_t)(wp->wp_hdr_need -
+						wp->wp_hdr_len), len);
+			memcpy(wp->wp_hdr + wp->wp_hdr_len, buf, n);
+			wp->wp_hdr_len += n;
+			buf += n;
+			len -= n;
+			if (wp->wp_hdr_len == 2)
+				wp->wp_hdr_need = ws_hdr_need(wp->wp_hdr);
+			if (wp->wp_hdr_len == wp->wp_hdr_need)
+				rc = ws_hdr_done(wp);
+			continue;
+		}
+		ctl = wp->wp_opcode != PPPOAT_WS_BINARY;
+		n   = pppoat_min(wp->wp_left, (uint64_t)len);
+		if (wp->wp_masked)
+			pppoat_ws_mask(buf, n, wp->wp_mask, wp->wp_off);
+		if (ctl)
+			memcpy(wp->wp_ctl + wp->wp_off, buf, n);
+		else if (n > 0)
+			rc = deliver(userdata, wp->wp_opcode, buf, n);
+		wp->wp_off  += n;
+		wp->wp_left -= n;
+		buf += n;
+		len -= n;
+		if (wp->wp_left > 0)
+			continue;
+		/* Frame is complete, control frames go out whole */
+		wp->wp_payload  = false;
+		wp->wp_hdr_len  = 0;
+		wp->wp_hdr_need = 2;
+		if (rc == 0 && ctl)
+			rc = deliver(userdata, wp->wp_opcode, wp->wp_ctl,
+				     wp->wp_off);
+	}
+	return rc;
+}
@@ -0,0 +1,104 @@
+/* websocket.h
+ * PPP over Any Transport -- WebSocket framing (RFC 6455)
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_WEBSOCKET_H__
+#define __PPPOAT_WEBSOCKET_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frames are built in place: the caller reserves PPPOAT_WS_HDR_MAX bytes
+ * in front of the payload. The parser is incremental, it takes the stream
+ * in chunks of any size and passes payload on as soon as it arrives, so a
+ * large frame is never buffered. Payload is unmasked in place.
+ */
+
+#define PPPOAT_WS_HDR_MAX    14
+#define PPPOAT_WS_CTL_MAX    125
+/* Base64 of the 16-byte key and of the SHA-1 digest */
+#define PPPOAT_WS_KEY_LEN    24
+#define PPPOAT_WS_ACCEPT_LEN 28
+
+enum {
+	PPPOAT_WS_CONT   = 0x0,
+	PPPOAT_WS_TEXT   = 0x1,
+	PPPOAT_WS_BINARY = 0x2,
+	PPPOAT_WS_CLOSE  = 0x8,
+	PPPOAT_WS_PING   = 0x9,
+	PPPOAT_WS_PONG   = 0xa,
+};
+
+/*
+ * Data frames are passed in pieces with opcode PPPOAT_WS_BINARY, control
+ * frames are passed whole with their opcode.
+ */
+typedef int (*pppoat_ws_deliver_t)(void          *userdata,
+				   unsigned int   opcode,
+				   unsigned char *data,
+				   size_t         len);
+
+struct pppoat_ws_parser {
+	/* Server side expects masked frames, client side unmasked */
+	bool          wp_server;
+	unsigned char wp_hdr[PPPOAT_WS_HDR_MAX];
+	unsigned int  wp_hdr_len;
+	unsigned int  wp_hdr_need;
+	bool          wp_payload;
+	unsigned int  wp_opcode;
+	uint64_t      wp_left;
+	unsigned char wp_mask[4];
+	bool          wp_masked;
+	/* Payload bytes of the frame seen, position in the mask */
+	uint64_t      wp_off;
+	unsigned char wp_ctl[PPPOAT_WS_CTL_MAX];
+};
+
+/* Writes Sec-WebSocket-Accept for the key, NUL terminated. */
+void pppoat_ws_accept(const char *key,
+		      size_t      key_len,
+		      char        accept[PPPOAT_WS_ACCEPT_LEN + 1]);
+
+/*
+ * Writes a final frame header for len bytes of payload to the end of hdr,
+ * i.e. right before the payload, and returns its length. Client frames
+ * need a mask, the payload is masked separately.
+ */
+size_t pppoat_ws_hdr(unsigned char       *hdr_end,
+		     unsigned int         opcode,
+		     size_t               len,
+		     const unsigned char *mask);
+
+/* XORs buf with the key starting at position off of the payload. */
+void pppoat_ws_mask(unsigned char       *buf,
+		    size_t               len,
+		    const unsigned char *key,
+		    uint64_t             off);
+
+void pppoat_ws_parser_init(struct pppoat_ws_parser *wp, bool server);
+
+/* Returns -EPROTO on a malformed frame or the error of deliver. */
+int pppoat_ws_parse(struct pppoat_ws_parser *wp,
+		    unsigned char           *buf,
+		    size_t                   len,
+		    pppoat_ws_deliver_t      deliver,
+		    void                    *userdata);
+
+#endif /* __PPPOAT_WEBSOCKET_H__ */
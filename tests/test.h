@@ -0,0 +1,41 @@
+/* test.h
+ * PPP over Any Transport -- Unit test helpers
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PPPOAT_TEST_H__
+#define __PPPOAT_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Every test is a program run by "make check". A failed check prints its
+ * location and exits with non-zero status, so the test is reported as
+ * failed by the harness.
+ */
+
+#define PPPOAT_TEST(expr)                                               \
+	do {                                                            \
+		if (!(expr)) {                                          \
+			fprintf(stderr, "%s:%d: %s: check `%s' failed\n",\
+				__FILE__, __LINE__, __func__, # expr);  \
+			exit(1);                                        \
+		}                                                       \
+	} while (0)
+
+#endif /* __PPPOAT_TEST_H__ */
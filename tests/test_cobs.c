@@ -0,0 +1,149 @@
+/* test_cobs.c
+ * PPP over Any Transport -- Unit tests of COBS framing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "cobs.h"
+
+#define TEST_MRU 1500
+
+struct test_frames {
+	unsigned char buf[TEST_MRU];
+	size_t        len;
+	unsigned int  nr;
+};
+
+static int test_deliver(void *userdata, unsigned char *frame, size_t len)
+{
+	struct test_frames *tf = userdata;
+
+	PPPOAT_TEST(len <= sizeof(tf->buf));
+	memcpy(tf->buf, frame, len);
+	tf->len = len;
+	++tf->nr;
+	return 0;
+}
+
+/* Encodes the frame, decodes it in chunks of step bytes. */
+static void test_cobs_roundtrip(const unsigned char *frame,
+				size_t               len,
+				size_t               step)
+{
+	struct pppoat_cobs cb;
+	struct test_frames tf = {};
+	unsigned char      enc[PPPOAT_COBS_ENC_MAX(TEST_MRU)];
+	size_t             enc_len;
+	size_t             off;
+	int                rc;
+
+	enc_len = pppoat_cobs_encode(frame, len, enc);
+	PPPOAT_TEST(enc_len <= PPPOAT_COBS_ENC_MAX(len));
+	PPPOAT_TEST(enc[enc_len - 1] == 0);
+	PPPOAT_TEST(memchr(enc, 0, enc_len - 1) == NULL);
+
+	rc = pppoat_cobs_init(&cb, TEST_MRU);
+	PPPOAT_TEST(rc == 0);
+	for (off = 0; off < enc_len; off += step) {
+		rc = pppoat_cobs_decode(&cb, enc + off,
+					enc_len - off < step ? enc_len - off :
+							       step,
+					&test_deliver, &tf);
+		PPPOAT_TEST(rc == 0);
+	}
+	PPPOAT_TEST(tf.nr == 1);
+	PPPOAT_TEST(tf.len == len && memcmp(tf.buf, frame, len) == 0);
+	pppoat_cobs_fini(&cb);
+}
+
+static void test_cobs_frames(void)
+{
+	/* Sizes around the 254-byte block limit */
+	static const size_t sizes[] = { 1, 2, 253, 254, 255, 508, 1500 };
+	unsigned char       frame[TEST_MRU];
+	size_t              i;
+	size_t              j;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		memset(frame, 0, sizes[i]);
+		test_cobs_roundtrip(frame, sizes[i], 1);
+		memset(frame, 0x5a, sizes[i]);
+		test_cobs_roundtrip(frame, sizes[i], 7);
+		for (j = 0; j < sizes[i]; ++j)
+			frame[j] = j % 3 == 0 ? 0 : j;
+		test_cobs_roundtrip(frame, sizes[i], sizes[i]);
+	}
+}
+
+static void test_cobs_damage(void)
+{
+	struct pppoat_cobs cb;
+	struct test_frames tf = {};
+	unsigned char      frame[100];
+	unsigned char      enc[3 * PPPOAT_COBS_ENC_MAX(sizeof(frame))];
+	size_t             len;
+	size_t             bad;
+	int                rc;
+
+	memset(frame, 0x42, sizeof(frame));
+	len  = pppoat_cobs_encode(frame, sizeof(frame), enc);
+	bad  = len;
+	len += pppoat_cobs_encode(frame, sizeof(frame), enc + len);
+	len += pppoat_cobs_encode(frame, sizeof(frame), enc + len);
+	enc[bad + 10] ^= 0x01;
+
+	rc = pppoat_cobs_init(&cb, TEST_MRU);
+	PPPOAT_TEST(rc == 0);
+	rc = pppoat_cobs_decode(&cb, enc, len, &test_deliver, &tf);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(tf.nr == 2);
+	PPPOAT_TEST(cb.cb_bad_crc == 1);
+	pppoat_cobs_fini(&cb);
+}
+
+static void test_cobs_too_long(void)
+{
+	struct pppoat_cobs cb;
+	struct test_frames tf = {};
+	unsigned char      frame[300];
+	unsigned char      enc[2 * PPPOAT_COBS_ENC_MAX(sizeof(frame))];
+	size_t             len;
+	int                rc;
+
+	memset(frame, 0x01, sizeof(frame));
+	len  = pppoat_cobs_encode(frame, sizeof(frame), enc);
+	len += pppoat_cobs_encode(frame, 50, enc + len);
+
+	rc = pppoat_cobs_init(&cb, 100);
+	PPPOAT_TEST(rc == 0);
+	rc = pppoat_cobs_decode(&cb, enc, len, &test_deliver, &tf);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(tf.nr == 1 && tf.len == 50);
+	PPPOAT_TEST(cb.cb_too_long == 1);
+	pppoat_cobs_fini(&cb);
+}
+
+int main(int argc, char **argv)
+{
+	test_cobs_frames();
+	test_cobs_damage();
+	test_cobs_too_long();
+
+	return 0;
+}
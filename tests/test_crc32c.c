@@ -0,0 +1,61 @@
+/* test_crc32c.c
+ * PPP over Any Transport -- Unit tests of CRC32C
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "crc32c.h"
+
+static void test_crc32c_vector(void)
+{
+	static const char check[] = "123456789";
+
+	/* Check value of the CRC-32C catalogue entry */
+	PPPOAT_TEST(pppoat_crc32c(0, check, 9) == 0xe3069283);
+	PPPOAT_TEST(pppoat_crc32c(0, check, 0) == 0);
+}
+
+static void test_crc32c_chunks(void)
+{
+	unsigned char buf[1031];
+	uint32_t      whole;
+	uint32_t      crc;
+	size_t        off;
+	size_t        i;
+
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 7 + 3;
+	whole = pppoat_crc32c(0, buf, sizeof(buf));
+	/* Odd chunks cover the unaligned head and tail of the hw loop */
+	for (off = 0, crc = 0; off < sizeof(buf); off += 13)
+		crc = pppoat_crc32c(crc, buf + off,
+				    sizeof(buf) - off < 13 ? sizeof(buf) - off :
+							     13);
+	PPPOAT_TEST(crc == whole);
+	buf[500] ^= 0x10;
+	PPPOAT_TEST(pppoat_crc32c(0, buf, sizeof(buf)) != whole);
+}
+
+int main(int argc, char **argv)
+{
+	test_crc32c_vector();
+	test_crc32c_chunks();
+
+	return 0;
+}
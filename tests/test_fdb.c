@@ -0,0 +1,123 @@
+/* test_fdb.c
+ * PPP over Any Transport -- Unit tests of forwarding database
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "fdb.h"
+
+#define TEST_MAX 1000
+
+static void test_fdb_mac(unsigned char *mac, unsigned int i)
+{
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	mac[2] = i >> 24;
+	mac[3] = i >> 16;
+	mac[4] = i >> 8;
+	mac[5] = i;
+}
+
+static void test_fdb_basic(void)
+{
+	static const unsigned char bcast[6] = { 0xff, 0xff, 0xff,
+						0xff, 0xff, 0xff };
+	static const unsigned char zero[6];
+	struct pppoat_fdb          fdb;
+	unsigned char              mac[6];
+	void                      *port;
+	int                        p[2];
+
+	PPPOAT_TEST(pppoat_fdb_init(&fdb, 16, 100) == 0);
+	test_fdb_mac(mac, 1);
+	PPPOAT_TEST(!pppoat_fdb_lookup(&fdb, mac, 0, &port));
+	pppoat_fdb_learn(&fdb, mac, &p[0], 0);
+	PPPOAT_TEST(pppoat_fdb_lookup(&fdb, mac, 10, &port));
+	PPPOAT_TEST(port == &p[0]);
+
+	/* The station moves to another port */
+	pppoat_fdb_learn(&fdb, mac, &p[1], 50);
+	PPPOAT_TEST(pppoat_fdb_lookup(&fdb, mac, 60, &port));
+	PPPOAT_TEST(port == &p[1]);
+	PPPOAT_TEST(fdb.fdb_moved == 1);
+	PPPOAT_TEST(fdb.fdb_learned == 1);
+
+	/* The entry ages out */
+	PPPOAT_TEST(!pppoat_fdb_lookup(&fdb, mac, 150, &port));
+	pppoat_fdb_expire(&fdb, 150);
+	PPPOAT_TEST(fdb.fdb_nr == 0);
+	PPPOAT_TEST(fdb.fdb_aged == 1);
+
+	pppoat_fdb_learn(&fdb, bcast, &p[0], 200);
+	pppoat_fdb_learn(&fdb, zero, &p[0], 200);
+	PPPOAT_TEST(fdb.fdb_nr == 0);
+	PPPOAT_TEST(!pppoat_fdb_lookup(&fdb, bcast, 200, &port));
+
+	pppoat_fdb_fini(&fdb);
+}
+
+/* Fills the table and removes every other port to stress deletion. */
+static void test_fdb_full(void)
+{
+	struct pppoat_fdb fdb;
+	unsigned char     mac[6];
+	unsigned int      i;
+	void             *port;
+	int               p[2];
+
+	PPPOAT_TEST(pppoat_fdb_init(&fdb, TEST_MAX, 0) == 0);
+	for (i = 0; i < TEST_MAX; ++i) {
+		test_fdb_mac(mac, i * 2654435761U);
+		pppoat_fdb_learn(&fdb, mac, &p[i % 2], i);
+	}
+	PPPOAT_TEST(fdb.fdb_nr == TEST_MAX);
+	test_fdb_mac(mac, 0xdeadbeef);
+	pppoat_fdb_learn(&fdb, mac, &p[0], 0);
+	PPPOAT_TEST(fdb.fdb_full == 1);
+	PPPOAT_TEST(!pppoat_fdb_lookup(&fdb, mac, 0, &port));
+
+	/* Ageing of 0 keeps the entries forever */
+	pppoat_fdb_expire(&fdb, UINT64_MAX);
+	PPPOAT_TEST(fdb.fdb_nr == TEST_MAX);
+
+	pppoat_fdb_port_del(&fdb, &p[0]);
+	PPPOAT_TEST(fdb.fdb_nr == TEST_MAX / 2);
+	for (i = 0; i < TEST_MAX; ++i) {
+		test_fdb_mac(mac, i * 2654435761U);
+		if (i % 2 == 0) {
+			PPPOAT_TEST(!pppoat_fdb_lookup(&fdb, mac, 0, &port));
+		} else {
+			PPPOAT_TEST(pppoat_fdb_lookup(&fdb, mac, 0, &port));
+			PPPOAT_TEST(port == &p[1]);
+		}
+	}
+	pppoat_fdb_port_del(&fdb, &p[1]);
+	PPPOAT_TEST(fdb.fdb_nr == 0);
+
+	pppoat_fdb_fini(&fdb);
+}
+
+int main(int argc, char **argv)
+{
+	test_fdb_basic();
+	test_fdb_full();
+
+	return 0;
+}
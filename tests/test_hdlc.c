@@ -0,0 +1,168 @@
+/* test_hdlc.c
+ * PPP over Any Transport -- Unit tests of HDLC-like framing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "hdlc.h"
+
+#define TEST_MRU 1500
+
+struct test_frames {
+	unsigned char buf[TEST_MRU];
+	size_t        len;
+	unsigned int  nr;
+};
+
+static int test_deliver(void *userdata, unsigned char *frame, size_t len)
+{
+	struct test_frames *tf = userdata;
+
+	PPPOAT_TEST(len <= sizeof(tf->buf));
+	memcpy(tf->buf, frame, len);
+	tf->len = len;
+	++tf->nr;
+	return 0;
+}
+
+static void test_hdlc_vector(void)
+{
+	static const unsigned char check[] = "123456789";
+	static const unsigned char enc_ok[] = {
+		0x7e, '1', '2', '3', '4', '5', '6', '7', '8', '9',
+		/* FCS-16 of the check string is 0x906e */
+		0x6e, 0x90, 0x7e,
+	};
+	unsigned char              enc[PPPOAT_HDLC_ENC_MAX(9)];
+	size_t                     len;
+
+	len = pppoat_hdlc_encode(check, 9, enc);
+	PPPOAT_TEST(len == sizeof(enc_ok));
+	PPPOAT_TEST(memcmp(enc, enc_ok, len) == 0);
+}
+
+/* Encodes the frame, decodes it in chunks of step bytes. */
+static void test_hdlc_roundtrip(const unsigned char *frame,
+				size_t               len,
+				size_t               step)
+{
+	struct pppoat_hdlc hd;
+	struct test_frames tf = {};
+	unsigned char      enc[PPPOAT_HDLC_ENC_MAX(TEST_MRU)];
+	size_t             enc_len;
+	size_t             off;
+	size_t             i;
+	int                rc;
+
+	enc_len = pppoat_hdlc_encode(frame, len, enc);
+	PPPOAT_TEST(enc_len <= PPPOAT_HDLC_ENC_MAX(len));
+	PPPOAT_TEST(enc[0] == 0x7e && enc[enc_len - 1] == 0x7e);
+	for (i = 1; i < enc_len - 1; ++i)
+		PPPOAT_TEST(enc[i] != 0x7e && enc[i] >= 0x20);
+
+	rc = pppoat_hdlc_init(&hd, TEST_MRU);
+	PPPOAT_TEST(rc == 0);
+	for (off = 0; off < enc_len; off += step) {
+		rc = pppoat_hdlc_decode(&hd, enc + off,
+					enc_len - off < step ? enc_len - off :
+							       step,
+					&test_deliver, &tf);
+		PPPOAT_TEST(rc == 0);
+	}
+	PPPOAT_TEST(tf.nr == 1);
+	PPPOAT_TEST(tf.len == len && memcmp(tf.buf, frame, len) == 0);
+	pppoat_hdlc_fini(&hd);
+}
+
+static void test_hdlc_frames(void)
+{
+	static const size_t sizes[] = { 2, 3, 64, 1500 };
+	unsigned char       frame[TEST_MRU];
+	size_t              i;
+	size_t              j;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		/* Flags and escapes inside the frame */
+		memset(frame, 0x7e, sizes[i]);
+		test_hdlc_roundtrip(frame, sizes[i], 1);
+		memset(frame, 0x7d, sizes[i]);
+		test_hdlc_roundtrip(frame, sizes[i], 5);
+		for (j = 0; j < sizes[i]; ++j)
+			frame[j] = j;
+		test_hdlc_roundtrip(frame, sizes[i], sizes[i]);
+	}
+}
+
+static void test_hdlc_damage(void)
+{
+	struct pppoat_hdlc hd;
+	struct test_frames tf = {};
+	unsigned char      frame[100];
+	unsigned char      enc[3 * PPPOAT_HDLC_ENC_MAX(sizeof(frame))];
+	size_t             len;
+	size_t             bad;
+	int                rc;
+
+	memset(frame, 0x42, sizeof(frame));
+	len  = pppoat_hdlc_encode(frame, sizeof(frame), enc);
+	bad  = len;
+	len += pppoat_hdlc_encode(frame, sizeof(frame), enc + len);
+	len += pppoat_hdlc_encode(frame, sizeof(frame), enc + len);
+	enc[bad + 10] ^= 0x01;
+
+	rc = pppoat_hdlc_init(&hd, TEST_MRU);
+	PPPOAT_TEST(rc == 0);
+	rc = pppoat_hdlc_decode(&hd, enc, len, &test_deliver, &tf);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(tf.nr == 2);
+	PPPOAT_TEST(hd.hd_bad_fcs == 1);
+	pppoat_hdlc_fini(&hd);
+}
+
+static void test_hdlc_too_long(void)
+{
+	struct pppoat_hdlc hd;
+	struct test_frames tf = {};
+	unsigned char      frame[300];
+	unsigned char      enc[2 * PPPOAT_HDLC_ENC_MAX(sizeof(frame))];
+	size_t             len;
+	int                rc;
+
+	memset(frame, 0x01, sizeof(frame));
+	len  = pppoat_hdlc_encode(frame, sizeof(frame), enc);
+	len += pppoat_hdlc_encode(frame, 50, enc + len);
+
+	rc = pppoat_hdlc_init(&hd, 100);
+	PPPOAT_TEST(rc == 0);
+	rc = pppoat_hdlc_decode(&hd, enc, len, &test_deliver, &tf);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(tf.nr == 1 && tf.len == 50);
+	PPPOAT_TEST(hd.hd_too_long == 1);
+	pppoat_hdlc_fini(&hd);
+}
+
+int main(int argc, char **argv)
+{
+	test_hdlc_vector();
+	test_hdlc_frames();
+	test_hdlc_damage();
+	test_hdlc_too_long();
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/* test_lpm.c
+ * PPP over Any Transport -- Unit tests of longest prefix match
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "lpm.h"
+
+static void test_lpm_key(uint8_t *key, uint8_t a, uint8_t b, uint8_t c,
+			 uint8_t d)
+{
+	memset(key, 0, 16);
+	key[0] = a;
+	key[1] = b;
+	key[2] = c;
+	key[3] = d;
+}
+
+static void test_lpm_longest(void)
+{
+	struct pppoat_lpm lpm;
+	uint8_t           key[16];
+	int               v[4];
+	int               rc;
+
+	pppoat_lpm_init(&lpm);
+	test_lpm_key(key, 10, 0, 0, 0);
+	rc = pppoat_lpm_insert(&lpm, key, 8, &v[0]);
+	test_lpm_key(key, 10, 1, 0, 0);
+	rc = rc ?: pppoat_lpm_insert(&lpm, key, 16, &v[1]);
+	test_lpm_key(key, 10, 1, 2, 0);
+	rc = rc ?: pppoat_lpm_insert(&lpm, key, 24, &v[2]);
+	test_lpm_key(key, 0, 0, 0, 0);
+	rc = rc ?: pppoat_lpm_insert(&lpm, key, 0, &v[3]);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(lpm.lpm_prefixes == 4);
+
+	test_lpm_key(key, 10, 1, 2, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[2]);
+	test_lpm_key(key, 10, 1, 3, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[1]);
+	test_lpm_key(key, 10, 2, 2, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[0]);
+	test_lpm_key(key, 192, 168, 0, 1);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[3]);
+	/* A key shorter than the prefix doesn't match it */
+	test_lpm_key(key, 10, 1, 2, 0);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 20) == &v[1]);
+
+	/* Replacing a value doesn't add a prefix */
+	test_lpm_key(key, 10, 1, 0, 0);
+	PPPOAT_TEST(pppoat_lpm_insert(&lpm, key, 16, &v[3]) == 0);
+	PPPOAT_TEST(lpm.lpm_prefixes == 4);
+	test_lpm_key(key, 10, 1, 3, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[3]);
+
+	/* Removing the middle prefix falls back to the shorter one */
+	test_lpm_key(key, 10, 1, 0, 0);
+	PPPOAT_TEST(pppoat_lpm_delete(&lpm, key, 16) == &v[3]);
+	PPPOAT_TEST(pppoat_lpm_delete(&lpm, key, 16) == NULL);
+	test_lpm_key(key, 10, 1, 3, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[0]);
+	test_lpm_key(key, 10, 1, 2, 3);
+	PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 32) == &v[2]);
+	PPPOAT_TEST(lpm.lpm_prefixes == 3);
+
+	pppoat_lpm_fini(&lpm);
+}
+
+/* Many host routes of IPv6 length, removed in a different order. */
+static void test_lpm_many(void)
+{
+	struct pppoat_lpm lpm;
+	uint8_t           key[16];
+	unsigned int      i;
+	unsigned int      j;
+	int               v[256];
+
+	pppoat_lpm_init(&lpm);
+	memset(key, 0, sizeof(key));
+	for (i = 0; i < 256; ++i) {
+		key[15] = i * 37;
+		key[7]  = i & 0x0f;
+		PPPOAT_TEST(pppoat_lpm_insert(&lpm, key, 128, &v[i]) == 0);
+	}
+	PPPOAT_TEST(lpm.lpm_prefixes == 256);
+	for (i = 0; i < 256; ++i) {
+		key[15] = i * 37;
+		key[7]  = i & 0x0f;
+		PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 128) == &v[i]);
+	}
+	for (i = 0; i < 256; i += 2) {
+		key[15] = i * 37;
+		key[7]  = i & 0x0f;
+		PPPOAT_TEST(pppoat_lpm_delete(&lpm, key, 128) == &v[i]);
+	}
+	for (i = 0; i < 256; ++i) {
+		key[15] = i * 37;
+		key[7]  = i & 0x0f;
+		PPPOAT_TEST(pppoat_lpm_lookup(&lpm, key, 128) ==
+			    (i % 2 == 0 ? NULL : &v[i]));
+	}
+	for (j = 1; j < 256; j += 2) {
+		key[15] = j * 37;
+		key[7]  = j & 0x0f;
+		PPPOAT_TEST(pppoat_lpm_delete(&lpm, key, 128) == &v[j]);
+	}
+	PPPOAT_TEST(lpm.lpm_prefixes == 0);
+	PPPOAT_TEST(lpm.lpm_nodes == 0);
+
+	pppoat_lpm_fini(&lpm);
+}
+
+int main(int argc, char **argv)
+{
+	test_lpm_longest();
+	test_lpm_many();
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* test_netem.c
+ * PPP over Any Transport -- Unit tests of network emulator
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The distributions and the queue are internals of the module */
+#include "modules/netem.c"
+
+#include "test.h"
+
+#define TEST_SAMPLES 200000
+#define TEST_DELAY   10000
+#define TEST_JITTER  2000
+
+/* The module is tested alone, there is no inner module to look up. */
+const struct pppoat_module *pppoat_module_find(const char *name)
+{
+	return NULL;
+}
+
+static void test_netem_ctx_init(struct pppoat_netem_ctx *ctx,
+				netem_dist_t             dist)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->nc_rand   = 0x9e3779b97f4a7c15ULL;
+	ctx->nc_delay  = TEST_DELAY;
+	ctx->nc_jitter = TEST_JITTER;
+	ctx->nc_dist   = dist;
+}
+
+/* Returns mean of the samples and checks they are within [min, max]. */
+static double test_netem_mean(struct pppoat_netem_ctx *ctx,
+			      uint64_t                 min,
+			      uint64_t                 max,
+			      double                  *var)
+{
+	double   sum = 0;
+	double   sq  = 0;
+	double   mean;
+	uint64_t x;
+	int      i;
+
+	for (i = 0; i < TEST_SAMPLES; ++i) {
+		x = netem_delay(ctx);
+		PPPOAT_TEST(x >= min && x <= max);
+		sum += x;
+		sq  += (double)x * x;
+	}
+	mean = sum / TEST_SAMPLES;
+	*var = sq / TEST_SAMPLES - mean * mean;
+	return mean;
+}
+
+static void test_netem_dist(void)
+{
+	struct pppoat_netem_ctx ctx;
+	double                  mean;
+	double                  var;
+	double                  std;
+
+	test_netem_ctx_init(&ctx, NETEM_DIST_UNIFORM);
+	mean = test_netem_mean(&ctx, TEST_DELAY - TEST_JITTER,
+			       TEST_DELAY + TEST_JITTER, &var);
+	PPPOAT_TEST(fabs(mean - TEST_DELAY) < 50);
+	/* Variance of the uniform distribution is jitter^2 / 3 */
+	PPPOAT_TEST(fabs(var * 3 / TEST_JITTER / TEST_JITTER - 1) < 0.05);
+
+	test_netem_ctx_init(&ctx, NETEM_DIST_NORMAL);
+	mean = test_netem_mean(&ctx, 0, UINT64_MAX, &var);
+	std  = sqrt(var);
+	PPPOAT_TEST(fabs(mean - TEST_DELAY) < 50);
+	PPPOAT_TEST(fabs(std / TEST_JITTER - 1) < 0.05);
+
+	/* Pareto never goes below delay - jitter / alpha */
+	test_netem_ctx_init(&ctx, NETEM_DIST_PARETO);
+	mean = test_netem_mean(&ctx, TEST_DELAY - TEST_JITTER /
+				     NETEM_PARETO_ALPHA - 1,
+			       UINT64_MAX, &var);
+	PPPOAT_TEST(fabs(mean - TEST_DELAY) < 100);
+
+	/* No jitter means a constant delay */
+	test_netem_ctx_init(&ctx, NETEM_DIST_NORMAL);
+	ctx.nc_jitter = 0;
+	mean = test_netem_mean(&ctx, TEST_DELAY, TEST_DELAY, &var);
+}
+
+static void test_netem_loss(void)
+{
+	struct pppoat_netem_ctx ctx;
+	unsigned long           lost = 0;
+	int                     i;
+
+	test_netem_ctx_init(&ctx, NETEM_DIST_UNIFORM);
+	ctx.nc_loss = 0.1;
+	for (i = 0; i < TEST_SAMPLES; ++i)
+		lost += netem_lost(&ctx);
+	PPPOAT_TEST(fabs((double)lost / TEST_SAMPLES - 0.1) < 0.005);
+
+	/* Gilbert-Elliott: bad state for p / (p + r) of the time */
+	test_netem_ctx_init(&ctx, NETEM_DIST_UNIFORM);
+	ctx.nc_loss_p   = 0.01;
+	ctx.nc_loss_r   = 0.1;
+	ctx.nc_loss_bad = 1;
+	for (lost = 0, i = 0; i < TEST_SAMPLES; ++i)
+		lost += netem_lost(&ctx);
+	PPPOAT_TEST(fabs((double)lost / TEST_SAMPLES - 0.01 / 0.11) < 0.01);
+}
+
+/* Packets leave in order of time, packets of equal time keep order. */
+static void test_netem_queue(void)
+{
+	struct pppoat_netem_ctx  ctx;
+	struct netem_pkt        *pkt;
+	uint64_t                 time;
+	uint64_t                 seq;
+	unsigned char            buf;
+	int                      i;
+
+	test_netem_ctx_init(&ctx, NETEM_DIST_UNIFORM);
+	ctx.nc_limit = 1000;
+	ctx.nc_heap  = pppoat_alloc(ctx.nc_limit * sizeof(*ctx.nc_heap));
+	PPPOAT_TEST(ctx.nc_heap != NULL);
+	for (i = 0; i < 1001; ++i) {
+		buf = i;
+		netem_enqueue(&ctx, &buf, 1, netem_rand(&ctx) % 100);
+	}
+	PPPOAT_TEST(ctx.nc_heap_nr == 1000);
+	PPPOAT_TEST(ctx.nc_overflows == 1);
+	for (time = 0, seq = 0, i = 0; i < 1000; ++i) {
+		pkt = netem_heap_pop(&ctx);
+		PPPOAT_TEST(pkt->np_time > time ||
+			    (pkt->np_time == time && pkt->np_seq >= seq));
+		PPPOAT_TEST(pkt->np_len == 1 &&
+			    pkt->np_data[0] == (unsigned char)pkt->np_seq);
+		time = pkt->np_time;
+		seq  = pkt->np_seq;
+		pppoat_free(pkt);
+	}
+	PPPOAT_TEST(ctx.nc_heap_nr == 0);
+	pppoat_free(ctx.nc_heap);
+}
+
+int main(int argc, char **argv)
+{
+	test_netem_dist();
+	test_netem_loss();
+	test_netem_queue();
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+/* test_record.c
+ * PPP over Any Transport -- Unit tests of checked records
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "record.h"
+
+#define TEST_MRU 1500
+
+struct test_frames {
+	unsigned char buf[4096];
+	size_t        len;
+	unsigned int  nr;
+};
+
+static int test_deliver(void *userdata, unsigned char *frame, size_t len)
+{
+	struct test_frames *tf = userdata;
+
+	PPPOAT_TEST(tf->len + len <= sizeof(tf->buf));
+	memcpy(tf->buf + tf->len, frame, len);
+	tf->len += len;
+	++tf->nr;
+	return 0;
+}
+
+static size_t test_record_make(unsigned char *rec, unsigned char fill,
+			       size_t len)
+{
+	memset(rec + PPPOAT_RECORD_HDR, fill, len);
+	return pppoat_record_seal(rec, len);
+}
+
+/* Writes buf to the pipe in chunks of step bytes and reads them. */
+static void test_record_feed(struct pppoat_record *re,
+			     struct test_frames   *tf,
+			     const unsigned char  *buf,
+			     size_t                len,
+			     size_t                step)
+{
+	int    fds[2];
+	size_t off;
+	size_t n;
+	int    rc;
+
+	rc = pipe(fds);
+	PPPOAT_TEST(rc == 0);
+	for (off = 0; off < len; off += n) {
+		n = len - off < step ? len - off : step;
+		PPPOAT_TEST(write(fds[1], buf + off, n) == (ssize_t)n);
+		rc = pppoat_record_read(re, fds[0], &test_deliver, tf);
+		PPPOAT_TEST(rc == 0);
+	}
+	close(fds[1]);
+	rc = pppoat_record_read(re, fds[0], &test_deliver, tf);
+	PPPOAT_TEST(rc == -EPIPE);
+	close(fds[0]);
+}
+
+static void test_record_stream(void)
+{
+	struct pppoat_record re;
+	struct test_frames   tf = {};
+	unsigned char        buf[3 * PPPOAT_RECORD_LEN(300)];
+	size_t               len;
+	size_t               step;
+	int                  rc;
+
+	len  = test_record_make(buf, 0x11, 100);
+	len += test_record_make(buf + len, 0x7e, 300);
+	len += test_record_make(buf + len, 0x00, 1);
+	for (step = 1; step <= len; step += 97) {
+		memset(&tf, 0, sizeof(tf));
+		rc = pppoat_record_init(&re, TEST_MRU);
+		PPPOAT_TEST(rc == 0);
+		test_record_feed(&re, &tf, buf, len, step);
+		PPPOAT_TEST(tf.nr == 3);
+		PPPOAT_TEST(tf.len == 401);
+		PPPOAT_TEST(tf.buf[0] == 0x11 && tf.buf[100] == 0x7e &&
+			    tf.buf[400] == 0x00);
+		PPPOAT_TEST(re.re_bad == 0);
+		pppoat_record_fini(&re);
+	}
+}
+
+static void test_record_resync(void)
+{
+	struct pppoat_record re;
+	struct test_frames   tf = {};
+	unsigned char        buf[4 * PPPOAT_RECORD_LEN(200)];
+	size_t               len;
+	size_t               bad;
+	int                  rc;
+
+	/* Garbage, a damaged record, then a good one */
+	memset(buf, 0x7e, 7);
+	len  = 7;
+	bad  = len;
+	len += test_record_make(buf + len, 0x22, 200);
+	buf[bad + PPPOAT_RECORD_HDR + 50] ^= 0x01;
+	len += test_record_make(buf + len, 0x33, 200);
+
+	rc = pppoat_record_init(&re, TEST_MRU);
+	PPPOAT_TEST(rc == 0);
+	test_record_feed(&re, &tf, buf, len, len);
+	PPPOAT_TEST(tf.nr == 1);
+	PPPOAT_TEST(tf.len == 200 && tf.buf[0] == 0x33);
+	PPPOAT_TEST(re.re_bad > 0);
+	pppoat_record_fini(&re);
+}
+
+static void test_record_mru(void)
+{
+	struct pppoat_record re;
+	struct test_frames   tf = {};
+	unsigned char        buf[PPPOAT_RECORD_LEN(200)];
+	size_t               len;
+	int                  rc;
+
+	len = test_record_make(buf, 0x44, 200);
+	rc  = pppoat_record_init(&re, 100);
+	PPPOAT_TEST(rc == 0);
+	test_record_feed(&re, &tf, buf, len, len);
+	PPPOAT_TEST(tf.nr == 0);
+	pppoat_record_fini(&re);
+}
+
+int main(int argc, char **argv)
+{
+	test_record_stream();
+	test_record_resync();
+	test_record_mru();
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+/* test_reorder.c
+ * PPP over Any Transport -- Unit tests of bonding reorder window
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "reorder.h"
+#include "util.h"
+
+#define TEST_OUT_MAX 1024
+
+/* Payload of every packet is its sequence number. */
+struct test_out {
+	uint32_t     seq[TEST_OUT_MAX];
+	unsigned int nr;
+};
+
+static int test_deliver(void *userdata, unsigned char *buf, size_t len)
+{
+	struct test_out *out = userdata;
+
+	PPPOAT_TEST(len == sizeof(uint32_t));
+	PPPOAT_TEST(out->nr < TEST_OUT_MAX);
+	memcpy(&out->seq[out->nr++], buf, len);
+	return 0;
+}
+
+static int test_put(struct pppoat_reorder *ro, uint32_t seq, uint64_t now)
+{
+	return pppoat_reorder_put(ro, seq, (unsigned char *)&seq, sizeof(seq),
+				  now);
+}
+
+/* Checks that out holds the sequence numbers first..first + nr - 1. */
+static void test_out_check(struct test_out *out, uint32_t first,
+			   unsigned int nr)
+{
+	unsigned int i;
+
+	PPPOAT_TEST(out->nr == nr);
+	for (i = 0; i < nr; ++i)
+		PPPOAT_TEST(out->seq[i] == (uint32_t)(first + i));
+}
+
+static void test_reorder_inorder(void)
+{
+	struct pppoat_reorder ro;
+	struct test_out       out = { .nr = 0 };
+	unsigned int          i;
+	int                   rc = 0;
+
+	PPPOAT_TEST(pppoat_reorder_init(&ro, 16, 1000, &test_deliver,
+					&out) == 0);
+	for (i = 0; i < 100; ++i)
+		rc = rc ?: test_put(&ro, 500 + i, i);
+	PPPOAT_TEST(rc == 0);
+	test_out_check(&out, 500, 100);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == PPPOAT_TIME_NEVER);
+	PPPOAT_TEST(ro.ro_reordered == 0 && ro.ro_lost == 0);
+	pppoat_reorder_fini(&ro);
+}
+
+static void test_reorder_swap(void)
+{
+	struct pppoat_reorder ro;
+	struct test_out       out = { .nr = 0 };
+	int                   rc;
+
+	PPPOAT_TEST(pppoat_reorder_init(&ro, 16, 1000, &test_deliver,
+					&out) == 0);
+	rc = test_put(&ro, 0, 0);
+	rc = rc ?: test_put(&ro, 2, 0);
+	rc = rc ?: test_put(&ro, 3, 0);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(out.nr == 1);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == 1000);
+	/* Duplicate of a held packet */
+	PPPOAT_TEST(test_put(&ro, 3, 0) == 0);
+	PPPOAT_TEST(ro.ro_dropped == 1);
+	PPPOAT_TEST(test_put(&ro, 1, 10) == 0);
+	test_out_check(&out, 0, 4);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == PPPOAT_TIME_NEVER);
+	/* Late packet */
+	PPPOAT_TEST(test_put(&ro, 2, 20) == 0);
+	PPPOAT_TEST(ro.ro_dropped == 2);
+	PPPOAT_TEST(out.nr == 4);
+	PPPOAT_TEST(ro.ro_reordered == 2 && ro.ro_lost == 0);
+	pppoat_reorder_fini(&ro);
+}
+
+static void test_reorder_expire(void)
+{
+	struct pppoat_reorder ro;
+	struct test_out       out = { .nr = 0 };
+	int                   rc;
+
+	PPPOAT_TEST(pppoat_reorder_init(&ro, 16, 1000, &test_deliver,
+					&out) == 0);
+	rc = test_put(&ro, 0, 0);
+	rc = rc ?: test_put(&ro, 3, 100);
+	rc = rc ?: test_put(&ro, 4, 200);
+	rc = rc ?: test_put(&ro, 6, 300);
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == 1100);
+	PPPOAT_TEST(pppoat_reorder_expire(&ro, 1099) == 0);
+	PPPOAT_TEST(out.nr == 1);
+	/* Gap 1-2 is lost, 3 and 4 follow, 6 is still waiting for 5 */
+	PPPOAT_TEST(pppoat_reorder_expire(&ro, 1100) == 0);
+	PPPOAT_TEST(out.nr == 3);
+	PPPOAT_TEST(out.seq[1] == 3 && out.seq[2] == 4);
+	PPPOAT_TEST(ro.ro_lost == 2);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == 1300);
+	PPPOAT_TEST(pppoat_reorder_expire(&ro, 1300) == 0);
+	PPPOAT_TEST(out.nr == 4 && out.seq[3] == 6);
+	PPPOAT_TEST(ro.ro_lost == 3);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == PPPOAT_TIME_NEVER);
+	pppoat_reorder_fini(&ro);
+}
+
+/*
+ * The window isn't a power of two and sequence numbers wrap around 2^32
+ * while packets are held in it.
+ */
+static void test_reorder_wrap(void)
+{
+	struct pppoat_reorder ro;
+	struct test_out       out = { .nr = 0 };
+	uint32_t              first = 0xffffffff - 150;
+	uint32_t              i;
+	int                   rc = 0;
+
+	PPPOAT_TEST(pppoat_reorder_init(&ro, 100, 1000, &test_deliver,
+					&out) == 0);
+	rc = test_put(&ro, first, 0);
+	/* Odd packets first, then even ones, in blocks of 64 */
+	for (i = 0; rc == 0 && i < 300; i += 64) {
+		uint32_t j;
+
+		for (j = i + 1; rc == 0 && j < i + 64 && j < 300; j += 2)
+			rc = test_put(&ro, first + j, 0);
+		for (j = i + 2; rc == 0 && j < i + 64 && j < 300; j += 2)
+			rc = test_put(&ro, first + j, 0);
+		if (rc == 0 && i + 64 < 300)
+			rc = test_put(&ro, first + i + 64, 0);
+	}
+	PPPOAT_TEST(rc == 0);
+	test_out_check(&out, first, 300);
+	PPPOAT_TEST(ro.ro_lost == 0 && ro.ro_dropped == 0);
+	PPPOAT_TEST(pppoat_reorder_deadline(&ro) == PPPOAT_TIME_NEVER);
+	pppoat_reorder_fini(&ro);
+}
+
+/* A packet far ahead pushes the window and skips what it leaves behind. */
+static void test_reorder_jump(void)
+{
+	struct pppoat_reorder ro;
+	struct test_out       out = { .nr = 0 };
+	int                   rc;
+
+	PPPOAT_TEST(pppoat_reorder_init(&ro, 8, 1000, &test_deliver,
+					&out) == 0);
+	rc = test_put(&ro, 0, 0);
+	rc = rc ?: test_put(&ro, 2, 0);
+	rc = rc ?: test_put(&ro, 9, 0);
+	PPPOAT_TEST(rc == 0);
+	/* 1 is lost, 2 is delivered, the window now starts at 3 */
+	PPPOAT_TEST(out.nr == 2 && out.seq[1] == 2);
+	PPPOAT_TEST(ro.ro_lost == 1);
+	PPPOAT_TEST(test_put(&ro, 1000, 0) == 0);
+	PPPOAT_TEST(out.nr == 3 && out.seq[2] == 9);
+	PPPOAT_TEST(ro.ro_next == 1000 - 8 + 1);
+	pppoat_reorder_fini(&ro);
+}
+
+int main(int argc, char **argv)
+{
+	test_reorder_inorder();
+	test_reorder_swap();
+	test_reorder_expire();
+	test_reorder_wrap();
+	test_reorder_jump();
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+/* test_websocket.c
+ * PPP over Any Transport -- Unit tests of WebSocket framing
+ *
+ * Copyright (C) 2012-2015 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "test.h"
+#include "websocket.h"
+
+#define TEST_LEN_MAX 70000
+
+struct test_stream {
+	unsigned char data[2 * TEST_LEN_MAX];
+	size_t        len;
+	unsigned char ctl[PPPOAT_WS_CTL_MAX];
+	size_t        ctl_len;
+	unsigned int  ctl_opcode;
+};
+
+static unsigned char test_frame[PPPOAT_WS_HDR_MAX + TEST_LEN_MAX];
+static unsigned char test_payload[TEST_LEN_MAX];
+
+static int test_deliver(void          *userdata,
+			unsigned int   opcode,
+			unsigned char *data,
+			size_t         len)
+{
+	struct test_stream *ts = userdata;
+
+	if (opcode == PPPOAT_WS_BINARY) {
+		PPPOAT_TEST(ts->len + len <= sizeof(ts->data));
+		memcpy(ts->data + ts->len, data, len);
+		ts->len += len;
+	} else {
+		PPPOAT_TEST(len <= sizeof(ts->ctl));
+		memcpy(ts->ctl, data, len);
+		ts->ctl_len    = len;
+		ts->ctl_opcode = opcode;
+	}
+	return 0;
+}
+
+static void test_ws_accept(void)
+{
+	static const char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+	char              accept[PPPOAT_WS_ACCEPT_LEN + 1];
+
+	/* Example of RFC 6455 section 1.3 */
+	pppoat_ws_accept(key, strlen(key), accept);
+	PPPOAT_TEST(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+}
+
+static void test_ws_mask(void)
+{
+	static const unsigned char key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+	unsigned char              buf[301];
+	size_t                     off;
+	size_t                     len;
+	size_t                     i;
+
+	/* Every offset and length covers vector and byte loops in phase */
+	for (off = 0; off < 8; ++off) {
+		for (len = 0; len < sizeof(buf) - off; len += 7) {
+			for (i = 0; i < sizeof(buf); ++i)
+				buf[i] = i;
+			pppoat_ws_mask(buf + off, len, key, off + 5);
+			for (i = 0; i < sizeof(buf); ++i) {
+				unsigned char b = i;
+
+				if (i >= off && i < off + len)
+					b ^= key[(i + 5) & 3];
+				PPPOAT_TEST(buf[i] == b);
+			}
+		}
+	}
+}
+
+/* Builds a final frame in test_frame, returns offset of its header. */
+static size_t test_ws_build(unsigned int         opcode,
+			    const unsigned char *payload,
+			    size_t               len,
+			    const unsigned char *mask,
+			    size_t              *flen)
+{
+	unsigned char *data = test_frame + PPPOAT_WS_HDR_MAX;
+	size_t         hlen;
+
+	memcpy(data, payload, len);
+	if (mask != NULL)
+		pppoat_ws_mask(data, len, mask, 0);
+	hlen  = pppoat_ws_hdr(data, opcode, len, mask);
+	*flen = hlen + len;
+	return PPPOAT_WS_HDR_MAX - hlen;
+}
+
+static void test_ws_roundtrip(size_t len, size_t step, bool server)
+{
+	static const unsigned char  mask[4] = { 0x01, 0x80, 0xfe, 0x55 };
+	static struct test_stream   ts;
+	struct pppoat_ws_parser     wp;
+	const unsigned char        *key = server ? mask : NULL;
+	unsigned char               ping[5] = "hello";
+	size_t                      start;
+	size_t                      flen;
+	size_t                      off;
+	size_t                      n;
+	size_t                      i;
+	int                         rc = 0;
+
+	for (i = 0; i < len; ++i)
+		test_payload[i] = i * 13 + (i >> 8);
+	memset(&ts, 0, sizeof(ts));
+	pppoat_ws_parser_init(&wp, server);
+
+	/* A ping between two data frames comes out whole */
+	start = test_ws_build(PPPOAT_WS_BINARY, test_payload, len, key, &flen);
+	for (off = 0; rc == 0 && off < flen; off += n) {
+		n  = flen - off < step ? flen - off : step;
+		rc = pppoat_ws_parse(&wp, test_frame + start + off, n,
+				     &test_deliver, &ts);
+	}
+	start = test_ws_build(PPPOAT_WS_PING, ping, sizeof(ping), key, &flen);
+	rc = rc ?: pppoat_ws_parse(&wp, test_frame + start, flen,
+				   &test_deliver, &ts);
+	start = test_ws_build(PPPOAT_WS_BINARY, test_payload, len, key, &flen);
+	for (off = 0; rc == 0 && off < flen; off += n) {
+		n  = flen - off < step ? flen - off : step;
+		rc = pppoat_ws_parse(&wp, test_frame + start + off, n,
+				     &test_deliver, &ts);
+	}
+	PPPOAT_TEST(rc == 0);
+	PPPOAT_TEST(ts.len == 2 * len);
+	PPPOAT_TEST(memcmp(ts.data, test_payload, len) == 0);
+	PPPOAT_TEST(memcmp(ts.data + len, test_payload, len) == 0);
+	PPPOAT_TEST(ts.ctl_opcode == PPPOAT_WS_PING);
+	PPPOAT_TEST(ts.ctl_len == sizeof(ping));
+	PPPOAT_TEST(memcmp(ts.ctl, "hello", sizeof(ping)) == 0);
+}
+
+static void test_ws_bad(void)
+{
+	static const unsigned char mask[4] = { 1, 2, 3, 4 };
+	static struct test_stream  ts;
+	struct pppoat_ws_parser    wp;
+	unsigned char              data[4] = { 0 };
+	unsigned char              ping[PPPOAT_WS_CTL_MAX + 1] = { 0 };
+	size_t                     start;
+	size_t                     flen;
+
+	/* Client frames must be masked, server frames must not */
+	pppoat_ws_parser_init(&wp, true);
+	start = test_ws_build(PPPOAT_WS_BINARY, data, sizeof(data), NULL,
+			      &flen);
+	PPPOAT_TEST(pppoat_ws_parse(&wp, test_frame + start, flen,
+				    &test_deliver, &ts) == -EPROTO);
+	pppoat_ws_parser_init(&wp, false);
+	start = test_ws_build(PPPOAT_WS_BINARY, data, sizeof(data), mask,
+			      &flen);
+	PPPOAT_TEST(pppoat_ws_parse(&wp, test_frame + start, flen,
+				    &test_deliver, &ts) == -EPROTO);
+	/* Text frames and oversized control frames */
+	pppoat_ws_parser_init(&wp, false);
+	start = test_ws_build(PPPOAT_WS_TEXT, data, sizeof(data), NULL, &flen);
+	PPPOAT_TEST(pppoat_ws_parse(&wp, test_frame + start, flen,
+				    &test_deliver, &ts) == -EPROTO);
+	pppoat_ws_parser_init(&wp, false);
+	start = test_ws_build(PPPOAT_WS_PING, ping, sizeof(ping), NULL, &flen);
+	PPPOAT_TEST(pppoat_ws_parse(&wp, test_frame + start, flen,
+				    &test_deliver, &ts) == -EPROTO);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t lens[] = { 0, 1, 125, 126, 1500, 65535, 65536 };
+	static const size_t steps[] = { 1, 3, 14, 4096, TEST_LEN_MAX * 2 };
+	size_t              i;
+	size_t              j;
+
+	test_ws_accept();
+	test_ws_mask();
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+		for (j = 0; j < sizeof(steps) / sizeof(steps[0]); ++j) {
+			test_ws_roundtrip(lens[i], steps[j], true);
+			test_ws_roundtrip(lens[i], steps[j], false);
+		}
+	}
+	test_ws_bad();
+
+	return 0;
+}